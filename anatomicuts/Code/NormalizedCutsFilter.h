@@ -109,6 +109,17 @@ class NormalizedCutsFilter :
 		{
 			return m_numberOfFibersForEigenDecomposition;
 		}
+		// When > 0, the affinity matrix of the fibers used for the eigen
+		// decomposition only holds each fiber's k nearest neighbors (by
+		// endpoints and midpoint) instead of all pairs of fibers.
+		void SetNumberOfNeighbors(int k)
+		{
+			this->m_numberOfNeighbors = k;
+		}
+		int GetNumberOfNeighbors()
+		{
+			return m_numberOfNeighbors;
+		}
 
 		std::vector<std::string> GetLabels()
 		{ return this->labels;}
@@ -147,11 +158,12 @@ class NormalizedCutsFilter :
 
 		std::vector<std::pair<int,int>> SelectCentroids(typename SampleType::Pointer samples, const typename MembershipFunctionType::Pointer);
 		std::vector<std::pair<int,int>> SelectCentroidsParallel(typename SampleType::Pointer samples, const typename MembershipFunctionType::Pointer);
+		std::vector<std::pair<int,int>> NearestNeighborPairs(typename SampleType::Pointer samples, const std::vector<int>& selected);
 		MeshPointerType input;
 		std::vector<std::string> labels;
 		ListOfOutputMeshTypePointer m_Output;
 		int numberOfClusters;
-		NormalizedCutsFilter() {}
+		NormalizedCutsFilter() : m_numberOfNeighbors(0) {}
 		~NormalizedCutsFilter() {}
 
 		//    virtual void GenerateData (void);
@@ -162,6 +174,7 @@ class NormalizedCutsFilter :
 		void operator=(const Self&);    
 		int m_SigmaCurrents;
 		int m_numberOfFibersForEigenDecomposition;
+		int m_numberOfNeighbors;
 //		void SaveClustersInMeshes(MembershipFunctionVectorType mfv);
 		MembershipFunctionVectorType *m_membershipFunctions; 
 };  
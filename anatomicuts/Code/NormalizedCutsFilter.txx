@@ -180,12 +180,22 @@ NormalizedCutsFilter < TMesh ,TMembershipFunctionType>::SelectCentroidsParallel(
 	//int zeros =0;
 	std::vector<std::pair<int, int>> inIndeces;
 	std::vector<std::pair<int, int>> outIndeces;
-	for (unsigned i=0; i<n; i++) 
+	bool nearestNeighbors = this->GetNumberOfNeighbors() > 0 && this->GetNumberOfNeighbors() < (int)n-1;
+	if(nearestNeighbors)
 	{
-		for (unsigned j=i; j<n; j++) 
+		outIndeces = this->NearestNeighborPairs(samples, selected);
+		for (unsigned k=0; k<outIndeces.size(); k++) 
+			inIndeces.push_back(std::pair<int,int>(selected[outIndeces[k].first],selected[outIndeces[k].second]));
+	}
+	else
+	{
+		for (unsigned i=0; i<n; i++) 
 		{
-			inIndeces.push_back(std::pair<int,int>(selected[i],selected[j]));
-			outIndeces.push_back(std::pair<int,int>(i,j));
+			for (unsigned j=i; j<n; j++) 
+			{
+				inIndeces.push_back(std::pair<int,int>(selected[i],selected[j]));
+				outIndeces.push_back(std::pair<int,int>(i,j));
+			}
 		}
 	}
 
@@ -196,6 +206,7 @@ NormalizedCutsFilter < TMesh ,TMembershipFunctionType>::SelectCentroidsParallel(
 	//std::cout <<  "domain "<< domain[1] << std::endl;
 	typename MembershipFunctionType::Pointer hola = (*this->GetMembershipFunctionVector())[0];
 	threadedMembershipFunction->SetStuff(samples,inIndeces, outIndeces,hola,n);
+	threadedMembershipFunction->SetTruncateResults(!nearestNeighbors);
 	threadedMembershipFunction->Execute(hola ,domain);
 	vnl_sparse_matrix<double>* ms= threadedMembershipFunction->GetResults();
 	for (unsigned i=0; i<n; i++) 
@@ -212,8 +223,12 @@ NormalizedCutsFilter < TMesh ,TMembershipFunctionType>::SelectCentroidsParallel(
 	vnl_sparse_matrix<double> prod(n,n);
 	diagonal.subtract(*ms,prod);
 
+	// Only the two smallest pairs are used. With the sparse affinity the
+	// Lanczos solver is asked for just a few of them, so it does not have
+	// to build an n-dimensional Krylov space.
+	int numberOfPairs = (nearestNeighbors)? std::min((int)n-1, 4) : n-1;
 	vnl_sparse_symmetric_eigensystem es;
-	int res = es.CalculateNPairs(prod, diagonal, n-1, 0.0000001,0,true, true,1000000,-1);//this->GetNumberOfClusters());
+	int res = es.CalculateNPairs(prod, diagonal, numberOfPairs, 0.0000001,0,true, true,1000000,-1);//this->GetNumberOfClusters());
 	if(res<0)
 		std::cout << " ERROR " <<std::endl;
 
@@ -243,6 +258,69 @@ NormalizedCutsFilter < TMesh ,TMembershipFunctionType>::SelectCentroidsParallel(
 	delete ms;
 	return indices;
 }
+// Candidate pairs (i,j), i<=j, of positions in 'selected' for the sparse
+// affinity matrix: every fiber with itself and with its k nearest neighbors.
+// Fibers are compared by their two endpoints (in a fixed order, so that the
+// direction of tracking does not matter) and their midpoint, using a kd-tree.
+template< class TMesh,class  TMembershipFunctionType>
+	std::vector<std::pair<int,int>>	
+NormalizedCutsFilter < TMesh ,TMembershipFunctionType>::NearestNeighborPairs(typename SampleType::Pointer samples, const std::vector<int>& selected)
+{
+	typedef itk::Vector<double,9> EndPointsVectorType;
+	typedef ListSample<EndPointsVectorType> EndPointsSampleType;
+	typedef KdTreeGenerator<EndPointsSampleType> EndPointsTreeGeneratorType;
+	typedef typename EndPointsTreeGeneratorType::KdTreeType EndPointsTreeType;
+
+	typename EndPointsSampleType::Pointer endPoints = EndPointsSampleType::New();
+	endPoints->SetMeasurementVectorSize(9);
+	for (unsigned i=0; i<selected.size(); i++) 
+	{
+		const MeasurementVectorType& mv = samples->GetMeasurementVector(selected[i]);
+		int last = mv.Size()/3-1;
+		int first = 0;
+		for(int k=0;k<3;k++)
+		{
+			if(mv[3*first+k] != mv[3*last+k])
+			{
+				if(mv[3*first+k] > mv[3*last+k])
+					std::swap(first,last);
+				break;
+			}
+		}
+		EndPointsVectorType v;
+		for(int k=0;k<3;k++)
+		{
+			v[k] = mv[3*first+k];
+			v[k+3] = mv[3*last+k];
+			v[k+6] = mv[3*((mv.Size()/3)/2)+k];
+		}
+		endPoints->PushBack(v);
+	}
+
+	typename EndPointsTreeGeneratorType::Pointer generator = EndPointsTreeGeneratorType::New();
+	generator->SetSample(endPoints);
+	generator->SetBucketSize(16);
+	generator->Update();
+	typename EndPointsTreeType::Pointer tree = generator->GetOutput();
+
+	std::vector<std::pair<int,int>> pairs;
+	typename EndPointsTreeType::InstanceIdentifierVectorType neighbors;
+	for (unsigned i=0; i<selected.size(); i++) 
+	{
+		pairs.push_back(std::pair<int,int>(i,i));
+		tree->Search(endPoints->GetMeasurementVector(i), this->GetNumberOfNeighbors()+1, neighbors);
+		for (unsigned k=0; k<neighbors.size(); k++) 
+		{
+			int j = neighbors[k];
+			if(j != (int)i)
+				pairs.push_back(std::pair<int,int>(std::min((int)i,j),std::max((int)i,j)));
+		}
+	}
+	std::sort(pairs.begin(), pairs.end());
+	pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+	std::cout << " nearest neighbor pairs " << pairs.size() << std::endl;
+	return pairs;
+}
 template< class TMesh,class  TMembershipFunctionType>
 	std::vector<std::pair<int,int>>	
 NormalizedCutsFilter < TMesh ,TMembershipFunctionType>::SelectCentroids(typename SampleType::Pointer samples, const typename MembershipFunctionType::Pointer membershipFunction )
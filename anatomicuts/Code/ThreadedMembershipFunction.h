@@ -28,11 +28,14 @@ class ThreadedMembershipFunction :  public itk::DomainThreader<itk::ThreadedInde
 			m_membershipFunction =  msf;
 			m_matrixDim = n;
 		}
+		// The results were always stored as ints, truncating the memberships.  The all-pairs
+		// matrix keeps that; the nearest neighbor one needs the fractional values.
+		void SetTruncateResults(bool truncate) { m_truncateResults = truncate; }
 		vnl_sparse_matrix<double>* GetResults();
 		std::vector<int> GetMaxIndeces(); //{return this->m_maxIndex;}
 
 	protected:
-		ThreadedMembershipFunction(){}
+		ThreadedMembershipFunction() : m_truncateResults(true) {}
 		~ThreadedMembershipFunction(){}
 
 	private:
@@ -43,7 +46,8 @@ class ThreadedMembershipFunction :  public itk::DomainThreader<itk::ThreadedInde
 		//std::vector<vnl_sparse_matrix<double>*> m_results;
 		std::vector<std::vector<int>> m_maxIndex;
 		std::vector<std::vector<double>> m_maxValue;
-		int* m_results2;
+		std::vector<double> m_results2;
+		bool m_truncateResults;
 		typename MembershipFunctionType::Pointer m_membershipFunction;
 		void BeforeThreadedExecution();
 		void ThreadedExecution(const DomainType&, const itk::ThreadIdType);
@@ -25,7 +25,7 @@ ThreadedMembershipFunction< TMembershipFunctionType >::BeforeThreadedExecution()
 		this->m_maxValue[ii].resize(m_matrixDim,0);
 //		this->m_results[ii] = new vnl_sparse_matrix<double>(m_matrixDim, m_matrixDim);
 	}
-	this->m_results2 = new int[m_indeces.size()];
+	this->m_results2.resize(m_indeces.size());
 
 }
 template< class  TMembershipFunctionType> void
@@ -39,7 +39,7 @@ ThreadedMembershipFunction< TMembershipFunctionType >::ThreadedExecution(const D
 		i = m_outIndeces[ii].first;// [0];
 		j= m_outIndeces[ii].second; //[1];
 		//(*m_results[threadId])(i,j)=(*m_results[threadId])(j,i)= val;
-		m_results2[ii]=val;
+		m_results2[ii]= m_truncateResults ? (double)(int)val : val;
 		if( val > m_maxValue[threadId][i])
 		{
 			m_maxValue[threadId][i]=val;
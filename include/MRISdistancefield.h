@@ -27,7 +27,9 @@
 #include "mrisurf.h"
 #include "diag.h"
 
-MRI *MRISdistancefield(MRIS *mris, MRI *mri_tmp, double max_distance, int signedfield);
+// brick-parallel narrow-band distance field, signed by scanline parity if signedfield
+// (positive inside); mris must be in the voxel coordinates of mri_dist (MRI_FLOAT)
+MRI *MRISdistancefield(MRIS *mris, MRI *mri_dist, double max_distance, int signedfield);
 
 #include <iostream>
 #include "utilsmath.h"
@@ -32,6 +32,17 @@ MRI *MRIextractDistanceMap(MRI *mri_src,
                            int mode,
                            MRI *mri_mask);
 
+/* Exact Euclidean version of MRIextractDistanceMap: separable, O(N),
+   parallel across scanlines and aware of anisotropic voxels (distances are
+   in units of the x voxel size). The mask does not block paths. Setting
+   FS_DTRANS_EDT makes MRIextractDistanceMap use it. */
+MRI *MRIextractDistanceMapEDT(MRI *mri_src,
+                              MRI *mri_dst,
+                              int label,
+                              float max_distance,
+                              int mode,
+                              MRI *mri_mask);
+
 void MRISextractOutsideDistanceMap(MRIS *mris,
                                    MRI *mri_src,
                                    int label,
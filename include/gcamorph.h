@@ -311,6 +311,13 @@ int       GCAMinitLookupTables(GCA_MORPH *gcam) ;
 double    GCAMelasticEnergy(GCA_MORPH *gcam) ;
 MRI       *GCAMestimateLameConstants(GCA_MORPH *gcam) ;
 int       GCAMwrite( const GCA_MORPH *gcam, const char *fname );
+// node encoding of .m3z files written by GCAMwrite(), overridden by the
+// GCAM_M3Z_ENCODING environment variable (float, float16 or quant16)
+#define GCAM_M3Z_LEGACY   -1  // version 1, node by node
+#define GCAM_M3Z_FLOAT     0  // version 2 bulk arrays, lossless
+#define GCAM_M3Z_FLOAT16   1  // version 2, displacements as half floats
+#define GCAM_M3Z_QUANT16   2  // version 2, displacements quantized to 16 bits
+extern int gcam_m3z_encoding ;
 //int       GCAMwriteInverse(const char *gcamfname, GCA_MORPH *gcam, MRI *mrtemplate=NULL);
 int       GCAMwriteInverseNonTal(const char *gcamfname, GCA_MORPH *gcam);
 GCA_MORPH *GCAMread(const char *fname) ;
@@ -379,6 +386,13 @@ MRI       *GCAMbuildMostLikelyVolume(GCA_MORPH *gcam, MRI *mri) ;
 MRI       *GCAMbuildLabelVolume(GCA_MORPH *gcam, MRI *mri) ;
 MRI       *GCAMbuildVolume(GCA_MORPH *gcam, MRI *mri) ;
 int       GCAMinvert(GCA_MORPH *gcam, MRI *mri=NULL) ;
+// how GCAMinvert() computes mri_{x,y,z}ind
+#define GCAM_INVERT_SPLAT   0  // splat the nodes, soap bubble the holes
+#define GCAM_INVERT_NEWTON  1  // solve gcam(p) = voxel by Newton's method
+extern int gcam_invert_method ;
+// returns NO_ERROR or an error code, the max residual (image voxels) in *pmax_residual,
+// or -1 there if no voxel converged and the nodes were splatted instead
+int       GCAMinvertNewton(GCA_MORPH *gcam, MRI *mri, double tol, int max_iter, double *pmax_residual) ;
 GCA_MORPH* GCAMfillInverse(GCA_MORPH* gcam);
 int       GCAMfreeInverse(GCA_MORPH *gcam) ;
 int       GCAMcomputeMaxPriorLabels(GCA_MORPH *gcam) ;
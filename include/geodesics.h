@@ -18,6 +18,23 @@ typedef struct {
 // computes and returns the nearest geodesics for every vertex in the surface:
 Geodesics* computeGeodesics(MRIS* surf, float maxdist);
 
+// Geodesic neighbourhoods in compressed sparse row form: the neighbours of
+// vertex k are v[offset[k]] ... v[offset[k+1]-1] with distances in dist[].
+// Unlike Geodesics, there is no limit on the number of neighbours.
+typedef struct {
+  int nvertices;
+  size_t *offset;  // nvertices+1 entries
+  int *v;
+  float *dist;
+} GeodesicsCSR;
+
+// same neighbourhoods as computeGeodesics(), computed in parallel
+GeodesicsCSR* computeGeodesicsCSR(MRIS* surf, float maxdist);
+void geodesicsFreeCSR(GeodesicsCSR **pgeo);
+Geodesics* geodesicsFromCSR(GeodesicsCSR *csr);
+int geodesicsWriteCSR(GeodesicsCSR *geo, char* fname);  // V2 file format
+GeodesicsCSR* geodesicsReadCSR(char* fname);
+
 // save/load geodesics:
 void geodesicsWrite(Geodesics* geo, int nvertices, char* fname);
 Geodesics* geodesicsRead(char* fname, int *nvertices);
@@ -71,6 +71,19 @@ typedef struct
   MRI *rvar; // residual variance across neighborhood
 } LGTM;
 
+/*
+  Sparse column storage for the GTM design matrices. Each column (seg)
+  only keeps the nonzero entries inside its padded bounding box. Rows are
+  0-based in the mask order of GTMvol2mat() and ascending within a column.
+*/
+typedef struct
+{
+  int rows, cols;
+  int *nnz;    // number of entries in each column
+  int **row;   // row of each entry
+  float **val; // value of each entry
+} GTM_SPARSE_X;
+
 typedef struct 
 {
   MRI *yvol; // source (PET) data
@@ -115,7 +128,8 @@ typedef struct
   MATRIX *ttpct; // percent of the signal in each seg from each tt
 
   // GLM stuff for GTM
-  MATRIX *X,*X0;
+  GTM_SPARSE_X *Xsp,*X0sp; // design matrix with and without PSF
+  MATRIX *X,*X0; // dense copies, only created by GTMdenseX()
   MATRIX *y, *XtX, *iXtX, *Xty, *beta, *res, *yhat,*betavar;
   MATRIX *rvar,*rvargm,*rvarbrain,*rvarUnscaled; // residual variance: all vox and only GM
   MATRIX *rL1,*rL1gm,*rL1brain,*rL1Unscaled; // residual L1 (mean(abs())): all vox and only GM
@@ -210,6 +224,14 @@ int GTMprintReplaceList(FILE *fp, const int nReplace, const int *ReplaceThis, co
 int GTMcheckReplaceList(const int nReplace, const int *ReplaceThis, const int *WithThat);
 int GTMloadReplacmentList(const char *fname, int *nReplace, int *ReplaceThis, int *WithThat);
 int GTMcheckX(MATRIX *X);
+GTM_SPARSE_X *GTMsparseXalloc(int rows, int cols);
+int GTMsparseXfree(GTM_SPARSE_X **pX);
+MATRIX *GTMsparseXtoDense(GTM_SPARSE_X *X, MATRIX *D);
+MATRIX *GTMsparseAtB(GTM_SPARSE_X *A, GTM_SPARSE_X *B, MATRIX *AtB);
+MATRIX *GTMsparseXty(GTM_SPARSE_X *X, MATRIX *y, MATRIX *Xty);
+MATRIX *GTMsparseXbeta(GTM_SPARSE_X *X, MATRIX *beta, MATRIX *yhat);
+int GTMdenseX(GTM *gtm);
+int *GTMrowNthSeg(GTM *gtm);
 int GTMautoMask(GTM *gtm);
 int GTMrvarGM(GTM *gtm);
 int GTMttest(GTM *gtm);
@@ -87,6 +87,9 @@ int     LabelDump(FILE *fp, LABEL *area) ;
 LABEL   *LabelRead(const char *subject_name,const char *label_name) ;
 LABEL   *LabelReadFrom(const char *subject_name, FILE *fp) ;
 int     LabelWriteInto(LABEL *area, FILE *fp) ;
+// LabelRead() and LabelReadFrom() recognize binary labels, LabelWrite() writes
+// them when FS_LABEL_BINARY is set in the environment
+int     LabelWriteBinaryInto(LABEL *area, FILE *fp) ;
 int     LabelWrite(LABEL *area,const char *fname) ;
 int     LabelToCurrent(LABEL *area, MRI_SURFACE *mris) ;
 int     LabelToCanonical(LABEL *area, MRI_SURFACE *mris) ;
@@ -0,0 +1,94 @@
+/**
+ * @brief queue-based and parallel flood-fill primitives
+ *
+ * The fills in this file touch each voxel a bounded number of times instead
+ * of repeating full-volume raster sweeps until nothing changes.
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef MRIFLOODFILL_H
+#define MRIFLOODFILL_H
+
+#include <vector>
+
+#include "mri.h"
+
+// face, face+edge, and face+edge+corner connectivity
+#define FLOODFILL_CONNECT_6   6
+#define FLOODFILL_CONNECT_18 18
+#define FLOODFILL_CONNECT_26 26
+
+/*
+  Fills every voxel of mri_dst that is 'connectivity'-connected to a voxel
+  already equal to fill_val and whose mri_src value lies in [low, high].
+  Voxels are only visited when they are reached, so the cost is O(#filled)
+  after one scan for the seeds. mri_src may be the same volume as mri_dst.
+  Returns the number of voxels filled (not counting the seeds).
+*/
+int MRIfloodFill(MRI *mri_src, MRI *mri_dst, int connectivity, float low, float high, float fill_val);
+
+/*
+  Same as MRIfloodFill(), but grows only from the given seed voxel, which is
+  set to fill_val regardless of its mri_src value. Avoids the seed scan.
+*/
+int MRIfloodFillFromSeed(MRI *mri_src, MRI *mri_dst, int x, int y, int z,
+                         int connectivity, float low, float high, float fill_val);
+
+/*
+  Multi-seed label propagation. The nonzero voxels of mri_labels are seeds;
+  their labels are grown breadth-first into the zero voxels whose mri_src
+  value lies in [low, high]. Each wavefront is processed in parallel, and a
+  voxel reached by several labels in the same wave takes the largest one, so
+  the result does not depend on the number of threads.
+  Returns the number of voxels labeled.
+*/
+int MRIfloodFillLabels(MRI *mri_src, MRI *mri_labels, int connectivity, float low, float high);
+
+/*
+  Worklist for replaying an in-place (Gauss-Seidel) raster sweep without
+  rescanning the volume. Sweeps visit voxels in increasing (dir = 1) or
+  decreasing (dir = -1) x-fastest linear order. After a full first sweep,
+  the caller schedules only the voxels whose inputs changed: schedule()
+  queues a voxel in the current sweep if it has not been passed yet and in
+  the next sweep otherwise, and defer() always queues it for the next sweep.
+  Visiting the scheduled voxels in order gives exactly the result of
+  repeating full sweeps, provided unchanged inputs yield unchanged outputs.
+*/
+class MRIrasterWorklist
+{
+public:
+  MRIrasterWorklist(const MRI *mri);
+
+  // starts a new sweep in direction dir over everything deferred so far
+  void begin(int dir);
+  // next voxel of the current sweep, false when the sweep is exhausted
+  bool next(int *px, int *py, int *pz);
+  void schedule(int x, int y, int z);
+  void defer(int x, int y, int z);
+  size_t pending() const { return deferred.size(); }
+
+private:
+  size_t index(int x, int y, int z) const { return ((size_t)z * height + y) * width + x; }
+  bool before(size_t a, size_t b) const { return dir > 0 ? a < b : a > b; }
+
+  int width, height, depth;
+  int dir;
+  size_t cursor;
+  bool started;
+  std::vector<size_t> heap;      // current sweep, ordered by 'dir'
+  std::vector<size_t> deferred;  // next sweep
+  std::vector<unsigned char> queued;
+};
+
+#endif
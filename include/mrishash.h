@@ -101,6 +101,26 @@ MRIS_HASH_TABLE* MHTcreateFaceTable_Resolution  (MRIS* mris, int which, float re
 MRIS_HASH_TABLE* MHTcreateVertexTable           (MRIS* mris, int which);
 MRIS_HASH_TABLE* MHTcreateVertexTable_Resolution(MRIS* mris, int which, float res);
 
+// Same tables, stored as a counting-sort grid (a cell-offset array into one
+// packed bin array) instead of individually allocated buckets. They are built
+// in parallel in O(N). Outside MHT_maybeParallel_begin() and _end() they are
+// queried without locks, from any thread, as long as nothing changes them.
+// Between those calls they are locked like the other tables, so faces can be
+// added and removed concurrently.
+// Setting FS_MHT_GRID in the environment makes the creators above use it too.
+//
+MRIS_HASH_TABLE* MHTcreateFaceTableGrid_Resolution  (MRIS* mris, int which, float res);
+MRIS_HASH_TABLE* MHTcreateVertexTableGrid_Resolution(MRIS* mris, int which, float res);
+
+// Updates a grid table after the vertices moved, recomputing the face
+// centroids and moving only the faces/vertices whose voxels changed.
+// Returns the number of those, or -1 if mht is NULL, is not a grid table, or
+// its surface now has a different number of faces, in which case the caller
+// should create a new table. Not to be called between MHT_maybeParallel_begin()
+// and _end().
+//
+int MHTrefit(MRIS_HASH_TABLE* mht);
+
 // Version
 //
 int MHT_gw_version(void);           // version of that unit
@@ -24,4 +24,6 @@ MRIS_HASH_TABLE* MHTcreateFaceTable             (Minimal_Surface_MRIS::Surface s
 MRIS_HASH_TABLE* MHTcreateFaceTable_Resolution  (Minimal_Surface_MRIS::Surface surface, int which, float res);
 MRIS_HASH_TABLE* MHTcreateVertexTable           (Minimal_Surface_MRIS::Surface surface, int which);
 MRIS_HASH_TABLE* MHTcreateVertexTable_Resolution(Minimal_Surface_MRIS::Surface surface, int which, float res);
+MRIS_HASH_TABLE* MHTcreateFaceTableGrid_Resolution  (Minimal_Surface_MRIS::Surface surface, int which, float res);
+MRIS_HASH_TABLE* MHTcreateVertexTableGrid_Resolution(Minimal_Surface_MRIS::Surface surface, int which, float res);
 
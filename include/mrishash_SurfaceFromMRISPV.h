@@ -22,4 +22,6 @@ MRIS_HASH_TABLE* MHTcreateFaceTable             (SurfaceFromMRISPV::XYZPositionC
 MRIS_HASH_TABLE* MHTcreateFaceTable_Resolution  (SurfaceFromMRISPV::XYZPositionConsequences::Surface surface, int which, float res);
 MRIS_HASH_TABLE* MHTcreateVertexTable           (SurfaceFromMRISPV::XYZPositionConsequences::Surface surface, int which);
 MRIS_HASH_TABLE* MHTcreateVertexTable_Resolution(SurfaceFromMRISPV::XYZPositionConsequences::Surface surface, int which, float res);
+MRIS_HASH_TABLE* MHTcreateFaceTableGrid_Resolution  (SurfaceFromMRISPV::XYZPositionConsequences::Surface surface, int which, float res);
+MRIS_HASH_TABLE* MHTcreateVertexTableGrid_Resolution(SurfaceFromMRISPV::XYZPositionConsequences::Surface surface, int which, float res);
 
@@ -45,6 +45,7 @@ typedef struct MRIS_HASH_BUCKET
     int              const max_bins ;
     int                    nused ;
     int                    size, ysize, zsize ;
+    bool                   gridded ;    // owned by a grid table: only locked while MHT_maybeParallel, bins may be packed
 } MHBT ;
 
 
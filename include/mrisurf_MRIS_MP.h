@@ -20,6 +20,7 @@
     ELT(const,  int,         nfaces         ) SEP \
     ELT(const,  char,        nsize          ) SEP \
     ELT(const,  double,      radius         ) SEP \
+    ELT(const,  float,       orig_area      ) SEP \
     ELT(const,  VERTEX_TOPOLOGY const *, vertices_topology) \
     ELTX(const, FACE_TOPOLOGY   const *, faces_topology)
 
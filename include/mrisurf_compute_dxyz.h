@@ -21,6 +21,7 @@
 //  and using either the MRIS or another representation of the Surface Face Vertex information
 //
 #include "mrisurf_metricProperties.h"
+#include "mrisurf_MRIS_MP.h"
 
 void mrisDxyzSetLocationMoveLen(double newval);
 int mrisComputeAngleAreaTerms(MRIS *mris, INTEGRATION_PARMS *parms);
@@ -70,3 +71,35 @@ void vertexComputeNormalSpringTerm(MRIS* mris, int vno, float* dx, float* dy, fl
 // tangential spring
 void mrisComputeTangentialSpringTerm(MRIS *mris, double l_spring);
 void vertexComputeTangentialSpringTerm(MRIS* mris, int vno, float* dx, float* dy, float* dz, double l_spring = 1.0);
+
+// MRIS_MP versions of the terms mrisIntegrationEpoch and MRISinflateBrain spend most of their time in.
+// They add to v_dx,v_dy,v_dz in the same order as the MRIS versions, so give the same sums.
+//
+int mrisComputeAngleAreaTerms       (MRIS_MP *mris, INTEGRATION_PARMS *parms);
+int mrisComputeDistanceTerm         (MRIS_MP *mris, INTEGRATION_PARMS *parms);
+int mrisComputeNonlinearAreaTerm    (MRIS_MP *mris, INTEGRATION_PARMS *parms);
+int mrisComputeNonlinearDistanceTerm(MRIS_MP *mris, INTEGRATION_PARMS *parms);
+int mrisComputeSpringTerm           (MRIS_MP *mris, double l_spring);
+
+// Runs the terms above on an MRIS_MP copy of the surface, made the first time one of them is needed.
+// The surface must not move while this exists. The dx,dy,dz are moved into the copy before each term
+// and back out after it, so the terms on the MRIS can be interleaved with these.
+// FREESURFER_OLD_mrisComputeGradientTerms runs them all on the MRIS instead.
+//
+struct MRIScomputeGradientTerms_MP {
+    MRIScomputeGradientTerms_MP(MRIS* mris);
+    ~MRIScomputeGradientTerms_MP();
+
+    void angleAreaTerms(INTEGRATION_PARMS *parms);
+    void distanceTerm  (INTEGRATION_PARMS *parms);
+    void springTerm    (double l_spring);
+
+private:
+    MRIS* const mris;
+    MRIS_MP     mp;
+    float      *dx, *dy, *dz;
+    int         state;              // 0 not loaded yet, 1 loaded, -1 use the MRIS
+
+    MRIS_MP* begin();               // nullptr when the MRIS must be used
+    void     end();
+};
@@ -146,7 +146,7 @@ LIST_OF_SSETERMS
 #undef ELT
 #define MRIS MRIS_MP
 #define ELT(NAME, SIGNATURE, CALL)    double mrisCompute##NAME SIGNATURE;
-LIST_OF_PER_VERTEX_SSETERMS_Implemented SEP LIST_OF_PER_FACE_SSETERMS
+LIST_OF_SSETERMS                                        // see MRIScomputeSSE_canDo for the ones that are available for MRIS_MP
 #undef ELT
 #undef MRIS
 
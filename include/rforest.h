@@ -58,6 +58,24 @@ typedef struct
   NODE **leaves ;
 } TREE ;
 
+/*
+  flattened form of the trees for classification. The nodes of each tree
+  are stored breadth-first in shared arrays, with the two children of a
+  node adjacent so that a lookup is a single index computation.
+*/
+typedef struct
+{
+  int    ntrees ;
+  int    nclasses ;
+  int    nnodes ;
+  int    nleaves ;
+  int    *tree_root ;     // first node of each tree, -1 if the tree isn't used in classification
+  int    *feature ;       // split feature, -1 for a leaf
+  double *thresh ;        // go left if feature < thresh
+  int    *child ;         // index of the left child (right is child+1), or the leaf # for a leaf
+  int    *leaf_counts ;   // nclasses class counts for each leaf
+} RF_COMPILED ;
+
 typedef struct
 {
   int    nfeatures ;
@@ -79,6 +97,7 @@ typedef struct
   char   **feature_names ;   // for diags
   double max_class_ratio ;  // don't let there be way more of one class than another
   double *pvals ;           // classification probabilities
+  RF_COMPILED *compiled ;   // built on demand by RFclassifyBatch, freed when the trees change
 } RANDOM_FOREST, RF ;
 
 RANDOM_FOREST *RFalloc(int ntrees, int nfeatures, int nclasses, int max_depth,
@@ -89,6 +108,8 @@ int  RFtrain(RANDOM_FOREST *rf, double feature_fraction, double training_fractio
 int  RFwrite(RANDOM_FOREST *rf, char *fname) ;
 int  RFwriteInto(RANDOM_FOREST *rf, FILE *fp) ;
 int  RFclassify(RANDOM_FOREST *rf, double *feature, double *p_pval, int true_class) ;
+int  RFcompile(RANDOM_FOREST *rf) ;
+int  RFclassifyBatch(RANDOM_FOREST *rf, double **features, int nvectors, int *classes, double *pvals) ;
 int  RFcomputeOutOfBagCorrect(RANDOM_FOREST *rf, int *training_classes, double **training_data,int ntraining);
 int  RFtrainTree(RANDOM_FOREST *rf, int tno, int *training_classes, double **training_data, int ntraining);
 int  RFsetNumberOfClasses(RANDOM_FOREST *rf, int nlabels) ;
@@ -140,7 +140,7 @@ namespace Math
    \param mris - the surface whose vertices have to be converted to vox space
    \param mri_template - the MRI template of the same subject which is needed for the ras2vox call
   */
-  void ConvertSurfaceRASToVoxel(MRIS *mris, MRI *mri_template)
+  inline void ConvertSurfaceRASToVoxel(MRIS *mris, MRI *mri_template)
   {
     MRISfreeDistsButNotOrig(mris);
       // MRISsetXYZ will invalidate all of these,
@@ -235,7 +235,7 @@ namespace Math
     \returns mid - the mid eigenvector
     \returns min - the min eigenvector
   */
-  void GetSortedEigenVectors ( vnl_symmetric_eigensystem<double> &eigenSystem,
+  inline void GetSortedEigenVectors ( vnl_symmetric_eigensystem<double> &eigenSystem,
                                double *evalues,
                                double *max,
                                double *mid,
@@ -302,7 +302,7 @@ namespace Math
     \param pt - the point 
     \returns the distance in double
   */
-  double  DistancePointToFace(VERTEX *v0,
+  inline double DistancePointToFace(VERTEX *v0,
                               VERTEX *v1,
                               VERTEX *v2,
                               double pt[3]) 
@@ -552,7 +552,7 @@ namespace Math
    * For a given vertex mark all the voxels less than r_i distance apart
    * as voxels in the shell
    */
-  MRI* MRISmaxedgeshell(MRI *mrisrc, MRIS *mris, MRI* mridst, int clearflag)
+  inline MRI* MRISmaxedgeshell(MRI *mrisrc, MRIS *mris, MRI* mridst, int clearflag)
   {
     /* For each vertex, find the edge with the 
        maximum length and store it in an array */
@@ -599,7 +599,7 @@ namespace Math
    * the format for the output, to match size and type.
    * The surface is recreated in the MRI space (mri_dst) 
    * from the tesselated surface (mris) as voxels of 255 */
-  MRI *MRISbshell(MRI *mri_src,MRI_SURFACE *mris,MRI *mri_dst,int clearflag)
+  inline MRI *MRISbshell(MRI *mri_src,MRI_SURFACE *mris,MRI *mri_dst,int clearflag)
   {
     int width,height,depth,j,imnr, fno;
     double x0,y0,z0,x1,y1,z1,x2,y2,z2;
@@ -48,6 +48,7 @@
 #include "connectcomp.h"
 #include "mrisegment.h"
 #include "ctrpoints.h"
+#include "mrifloodfill.h"
 
 
 /*-------------------------------------------------------------------
@@ -3360,12 +3361,59 @@ main(int argc, char *argv[])
   return(0) ;
 }
 
+/*
+  one fill_brain update of voxel (j, i, imnr) in a sweep in direction dir:
+  an unfilled wm voxel takes the largest of its three neighbors that precede
+  it in the sweep. Returns 1 if the voxel was filled.
+*/
+static int
+fill_brain_voxel(MRI *mri_fill, MRI *mri_im, int threshold, int j, int i, int imnr, int dir)
+{
+  int v1,v2,v3,vmax ;
+
+  if (j == Gx && i == Gy && imnr == Gz)
+  {
+    DiagBreak() ;
+  }
+  if (MRIvox(mri_fill, j, i, imnr) ==0)   /* not filled yet */
+  {
+    if ((threshold<0 &&   /* previous filled off */
+         MRIvox(mri_im, j, i, imnr)<-threshold)  ||
+        (threshold>=0 &&
+         MRIvox(mri_im, j, i, imnr) >threshold))/* wm is on */
+    {
+      /* three inside 6-connected nbrs */
+      v1=MRIvox(mri_fill, j, i, imnr-dir);
+      v2=MRIvox(mri_fill, j, i-dir, imnr);
+      v3=MRIvox(mri_fill, j-dir, i, imnr) ;
+      if (v1>0||v2>0||v3>0)       /* if any are on */
+      {
+        /* set vmax to biggest of three
+           interior neighbors */
+        vmax =
+          (v1>=v2&&v1>=v3)?v1:((v2>=v1&&v2>=v3)?v2:v3);
+
+        MRIvox(mri_fill, j, i, imnr) = vmax;
+        return(1) ;
+      }
+    }
+  }
+  return(0) ;
+}
+
+/*
+  Alternating forward/backward sweeps until fewer than min_filled voxels
+  change. Only the first sweep in each direction visits the whole volume;
+  after that a voxel can only change if one of the neighbors it reads was
+  filled, so the worklist replays exactly the voxels the full sweeps would
+  have changed, in the same order.
+*/
 static int
 fill_brain(MRI *mri_fill, MRI *mri_im, int threshold)
 {
   int dir = -1, nfilled = 10000, ntotal = 0,iter = 0;
   int im0,im1,j0,j1,i0,i1,imnr,i,j;
-  int v1,v2,v3,vmax ;
+  MRIrasterWorklist worklist(mri_fill) ;
 
   mriFindBoundingBox(mri_im) ;
   while (nfilled>min_filled && iter<MAX_ITERATIONS)
@@ -3389,43 +3437,54 @@ fill_brain(MRI *mri_fill, MRI *mri_im, int threshold)
       j0 = mri_fill->width - 2 ;
       i1=j1= -1;
     }
-    for (imnr=im0; imnr!=im1; imnr+=dir)
+    if (iter <= 2)
     {
-      for (i=i0; i!=i1; i+=dir)
+      for (imnr=im0; imnr!=im1; imnr+=dir)
       {
-        for (j=j0; j!=j1; j+=dir)
+        for (i=i0; i!=i1; i+=dir)
         {
-          if (j == Gx && i == Gy && imnr == Gz)
+          for (j=j0; j!=j1; j+=dir)
           {
-            DiagBreak() ;
-          }
-          if (MRIvox(mri_fill, j, i, imnr) ==0)   /* not filled yet */
-          {
-            if ((threshold<0 &&   /* previous filled off */
-                 MRIvox(mri_im, j, i, imnr)<-threshold)  ||
-                (threshold>=0 &&
-                 MRIvox(mri_im, j, i, imnr) >threshold))/* wm is on */
+            if (fill_brain_voxel(mri_fill, mri_im, threshold, j, i, imnr, dir))
             {
-              /* three inside 6-connected nbrs */
-              v1=MRIvox(mri_fill, j, i, imnr-dir);
-              v2=MRIvox(mri_fill, j, i-dir, imnr);
-              v3=MRIvox(mri_fill, j-dir, i, imnr) ;
-              if (v1>0||v2>0||v3>0)       /* if any are on */
+              nfilled++;
+              if (iter > 1)   /* the first backward sweep is a full one */
               {
-                /* set vmax to biggest of three
-                   interior neighbors */
-                vmax =
-                  (v1>=v2&&v1>=v3)?v1:((v2>=v1&&v2>=v3)?v2:v3);
-
-                MRIvox(mri_fill, j, i, imnr) = vmax;
-                nfilled++;
-                ntotal++;
+                worklist.defer(j-dir, i, imnr) ;
+                worklist.defer(j, i-dir, imnr) ;
+                worklist.defer(j, i, imnr-dir) ;
               }
             }
           }
         }
       }
     }
+    else
+    {
+      worklist.begin(dir) ;
+      while (worklist.next(&j, &i, &imnr))
+      {
+        if (dir == 1 && (imnr < 1 || imnr > mri_fill->depth-2 || i < 1 || j < 1))
+        {
+          continue ;
+        }
+        if (dir == -1 && (imnr > mri_fill->depth-2 || i > mri_fill->height-2 || j > mri_fill->width-2))
+        {
+          continue ;
+        }
+        if (fill_brain_voxel(mri_fill, mri_im, threshold, j, i, imnr, dir))
+        {
+          nfilled++;
+          worklist.schedule(j+dir, i, imnr) ;
+          worklist.schedule(j, i+dir, imnr) ;
+          worklist.schedule(j, i, imnr+dir) ;
+          worklist.defer(j-dir, i, imnr) ;
+          worklist.defer(j, i-dir, imnr) ;
+          worklist.defer(j, i, imnr-dir) ;
+        }
+      }
+    }
+    ntotal += nfilled ;
     if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON)
     {
       fprintf(stderr, "%d voxels filled\n",nfilled);
@@ -3439,50 +3498,107 @@ fill_brain(MRI *mri_fill, MRI *mri_im, int threshold)
   return(NO_ERROR) ;
 }
 
+/*
+  one fill_holes update of voxel (x, i, z): an unfilled voxel with at most
+  neighbor_threshold unfilled neighbors takes the largest neighboring value.
+  Returns 1 if the voxel was filled.
+*/
+static int
+fill_hole_voxel(MRI *mri_fill, int x, int i, int z)
+{
+  int cnt, cntmax = neighbor_threshold ;
+  int im0,i0,x0;
+  int v,vmax;
+
+  if (MRIvox(mri_fill, x, i, z)==0 &&
+      i>ylim0-10 && i<ylim1+10 && x>xlim0-10 && x<xlim1+10)
+  {
+    cnt = 0;
+    vmax = 0;
+    for (im0= -1; im0<=1; im0++)
+      for (i0= -1; i0<=1; i0++)
+        for (x0= -1; x0<=1; x0++)
+        {
+          v = MRIvox(mri_fill, x+x0, i+i0, z+im0) ;
+          if (v>vmax)
+          {
+            vmax = v;
+          }
+          if (v == 0)
+          {
+            cnt++;  /* count # of nbrs which are off */
+          }
+          if (cnt>cntmax)
+          {
+            im0=i0=x0=1;
+          }  /* break out
+                                           of all 3 loops */
+        }
+    if (cnt<=cntmax)   /* toggle pixel (off to on, or on to off) */
+    {
+      MRIvox(mri_fill, x, i, z) = vmax;
+      return(1) ;
+    }
+  }
+  return(0) ;
+}
+
+/*
+  Forward sweeps until no more holes are filled. After the first full sweep
+  only the neighbors of voxels that were filled are revisited (see
+  fill_brain), which gives the same result as repeating the full sweeps.
+*/
 static int
 fill_holes(MRI *mri_fill)
 {
-  int  nfilled, ntotal = 0, cnt, cntmax= neighbor_threshold ;
+  int  nfilled, ntotal = 0, iter = 0 ;
   int im0,x0,i0,z,i,x;
-  int v,vmax;
+  MRIrasterWorklist worklist(mri_fill) ;
 
   do
   {
     nfilled = 0;
-    for (z=1; z!=mri_fill->depth-1; z++)
-      for (i=1; i!=mri_fill->height-1; i++)
-        for (x=1; x!=mri_fill->width-1; x++)
-          if (MRIvox(mri_fill, x, i, z)==0 &&
-              i>ylim0-10 && i<ylim1+10 && x>xlim0-10 && x<xlim1+10)
-          {
-            cnt = 0;
-            vmax = 0;
-            for (im0= -1; im0<=1; im0++)
-              for (i0= -1; i0<=1; i0++)
-                for (x0= -1; x0<=1; x0++)
-                {
-                  v = MRIvox(mri_fill, x+x0, i+i0, z+im0) ;
-                  if (v>vmax)
-                  {
-                    vmax = v;
-                  }
-                  if (v == 0)
-                  {
-                    cnt++;  /* count # of nbrs which are off */
-                  }
-                  if (cnt>cntmax)
-                  {
-                    im0=i0=x0=1;
-                  }  /* break out
-                                                   of all 3 loops */
-                }
-            if (cnt<=cntmax)   /* toggle pixel (off to on, or on to off) */
+    if (iter++ == 0)
+    {
+      for (z=1; z!=mri_fill->depth-1; z++)
+        for (i=1; i!=mri_fill->height-1; i++)
+          for (x=1; x!=mri_fill->width-1; x++)
+            if (fill_hole_voxel(mri_fill, x, i, z))
             {
-              MRIvox(mri_fill, x, i, z) = vmax;
               nfilled++;
-              ntotal++;
+              for (im0= -1; im0<=1; im0++)
+                for (i0= -1; i0<=1; i0++)
+                  for (x0= -1; x0<=1; x0++)
+                    if (im0 < 0 || (im0 == 0 && (i0 < 0 || (i0 == 0 && x0 < 0))))
+                    {
+                      worklist.defer(x+x0, i+i0, z+im0) ;
+                    }
             }
-          }
+    }
+    else
+    {
+      worklist.begin(1) ;
+      while (worklist.next(&x, &i, &z))
+      {
+        if (z < 1 || z > mri_fill->depth-2 || i < 1 || i > mri_fill->height-2 ||
+            x < 1 || x > mri_fill->width-2)
+        {
+          continue ;
+        }
+        if (fill_hole_voxel(mri_fill, x, i, z))
+        {
+          nfilled++;
+          for (im0= -1; im0<=1; im0++)
+            for (i0= -1; i0<=1; i0++)
+              for (x0= -1; x0<=1; x0++)
+                if (im0 || i0 || x0)
+                {
+                  worklist.schedule(x+x0, i+i0, z+im0) ;
+                }
+        }
+      }
+    }
+    ntotal += nfilled ;
     if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON)
     {
       fprintf(stderr, "%d holes filled\n",nfilled);
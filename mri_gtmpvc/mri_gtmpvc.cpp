@@ -614,7 +614,7 @@ int main(int argc, char *argv[])
   PrintMemUsage(logfp);
   mytimer.reset();
   GTMbuildX(gtm);
-  if(gtm->X==NULL) exit(1);
+  if(gtm->Xsp==NULL) exit(1);
   printf(" gtm build time %4.1f sec\n",mytimer.seconds());fflush(stdout);
   fprintf(logfp,"GTM-Build-time %4.1f sec\n",mytimer.seconds());fflush(logfp);
   if(Gdiag_no > 0) PrintMemUsage(stdout);
@@ -740,7 +740,7 @@ int main(int argc, char *argv[])
       MatrixFree(&gtm->X);
       MatrixFree(&gtm->X0);
       GTMbuildX(gtm);
-      if(gtm->X==NULL) exit(1);
+      if(gtm->Xsp==NULL) exit(1);
       printf(" gtm build time %4.1f sec\n", mytimer.seconds()); fflush(stdout);
       fprintf(logfp,"GTM-rebuild-time %4.1f sec\n", mytimer.seconds()); fflush(logfp);
       if(Gdiag_no > 0) PrintMemUsage(stdout);
@@ -756,6 +756,10 @@ int main(int argc, char *argv[])
 
   //printf("Freeing segpvf\n"); fflush(stdout);
   //MRIfree(&gtm->segpvf);
+  if(SaveX0 || SaveX || DoGTMMat) {
+    // X and X0 are kept sparse, expand them only when needed
+    if(GTMdenseX(gtm)) exit(1);
+  }
   if(SaveX0) {
     printf("Writing X0 to %s\n",Xfile);
     MatlabWrite(gtm->X0, X0file,"X0");
@@ -923,6 +927,7 @@ int main(int argc, char *argv[])
 
   printf("Freeing X\n");
   MatrixFree(&gtm->X);
+  GTMsparseXfree(&gtm->Xsp);
 
   nopvc = GTMnoPVC(gtm);
   sprintf(tmpstr,"%s/nopvc.nii.gz",OutDir);
@@ -1006,6 +1011,7 @@ int main(int argc, char *argv[])
   
   printf("Freeing X0\n");
   MatrixFree(&gtm->X0);
+  GTMsparseXfree(&gtm->X0sp);
 
 
   if(yhatFile|| yhatFullFoVFile){
@@ -2135,7 +2141,7 @@ double GTMcostPSF(GTM *gtm)
   GTMpsfStd(gtm);
 
   GTMbuildX(gtm);
-  if(gtm->X==NULL) exit(1);
+  if(gtm->Xsp==NULL) exit(1);
 
   err=GTMsolve(gtm); 
   GTMrvarGM(gtm);
@@ -2500,30 +2506,24 @@ MRI *GTMsimAnatSeg(GTM *gtm)
  */
 int GTMsom(GTM *gtm)
 {
-  int rthseg, cthseg, k, f, c,r,s,segid;
+  int rthseg, cthseg, n, f, *rowseg;
   double val,cbeta,sum;
 
   gtm->som = MatrixAlloc(gtm->nsegs,gtm->nsegs,MATRIX_REAL);
 
   f = 0; // only one frame with the matrix
+  rowseg = GTMrowNthSeg(gtm);
   for(cthseg=0; cthseg < gtm->nsegs; cthseg++){
-    k = 0;
     cbeta = gtm->beta->rptr[cthseg+1][f+1];
-    for(s=0; s < gtm->yvol->depth; s++){ // crs order is important here!
-      for(c=0; c < gtm->yvol->width; c++){
-	for(r=0; r < gtm->yvol->height; r++){
-	  if(gtm->mask && MRIgetVoxVal(gtm->mask,c,r,s,0) < 0.5) continue;
-	  val = cbeta*gtm->X->rptr[k+1][cthseg+1];
-	  segid = MRIgetVoxVal(gtm->gtmseg,c,r,s,0);
-	  if(segid != 0) {
-	    rthseg = GTMsegid2nthseg(gtm,segid);
-	    gtm->som->rptr[rthseg+1][cthseg+1] += val;
-	  }
-	  k++;
-	}
-      }
+    // only the voxels where column cthseg of X is nonzero contribute
+    for(n=0; n < gtm->Xsp->nnz[cthseg]; n++){
+      rthseg = rowseg[gtm->Xsp->row[cthseg][n]];
+      if(rthseg < 0) continue;
+      val = cbeta*gtm->Xsp->val[cthseg][n];
+      gtm->som->rptr[rthseg+1][cthseg+1] += val;
     }
   } // cthseg
+  free(rowseg);
     
   /* Normalize SOM(rNoPVC,cGTM) is the proportion that cGTM
      contributes to rNoPVC, ie, it is the amount of spill-out of
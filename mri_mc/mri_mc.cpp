@@ -30,6 +30,9 @@
 #include <ctype.h>
 #include <unistd.h>
 
+#include <unordered_map>
+#include <vector>
+
 #include "fio.h"
 #include "const.h"
 #include "diag.h"
@@ -43,6 +46,7 @@
 #include "tags.h"
 #include "gca.h"
 #include "MC.h"
+#include "romp_support.h"
 
 #define MAXFACES    3000000
 #define MAXVERTICES 1500000
@@ -546,39 +550,68 @@ int saveTesselation2(tesselation_parms *parms) {
   return(NO_ERROR) ;
 }
 
-void generateMCtesselation(tesselation_parms * parms) {
-  int i,j,k,width,imgsize,*tab1,*tab2,ref,ind,nf,p;
-  int xmin,ymin,zmin,xmax,ymax,zmax;
-  int vt[12],*vk1,*vk2,*vj1,*vj2,*tmp;
-  int f_c[12],vind[12];
-  MRI *mri;
-  int vertex_index;
-  int debug=0;
-
-  fprintf(stderr,"\npreprocessing...");
-  mri=preprocessingStep(parms);
-  allocateTesselation(parms);
-  fprintf(stderr,"done\n");
+/*
+  Marching cubes over one z-slab [k0,k1). Vertices are created by the cube
+  that owns their edge (7, 10 and 11) exactly as in a serial sweep, so they
+  are numbered in sweep order within the slab. Edges 0-3 of the first plane
+  belong to the slab below and are recorded by edge key in 'shared'; the
+  vertices this slab creates on its top plane are indexed by the same key
+  in 'top' so the slab above can resolve them.
+*/
+typedef struct mc_slab_ {
+  int k0, k1;
+  std::vector<quad_vertex_type> vertex;
+  std::vector<int> face;     // 3 per face: local vertex, or -(n+1) for shared[n]
+  std::vector<long> shared;  // edge keys of vertices created by the slab below
+  std::unordered_map<long, int> top;
+} mc_slab;
+
+static int *mcTable(int connectivity, int ref) {
+  switch (connectivity) {
+  case 1:
+    return MC6p[ref];
+  case 2:
+    return MC18[ref];
+  case 3:
+    return MC6[ref];
+  default:
+    return MC26[ref];
+  }
+}
 
-  width=mri->width;
-  imgsize=mri->width*mri->height;
+// The bounding box is padded by one voxel, so it reaches outside the volume
+// when the object touches its border; those voxels are background
+static inline int mcVoxel(MRI *mri, int i, int j, int k) {
+  if (i<0 || j<0 || k<0 || i>=mri->width || j>=mri->height || k>=mri->depth)
+    return 0;
+  return MRIvox(mri,i,j,k);
+}
 
+static void mcNewVertex(mc_slab *slab, float imnr, float i, float j, int *vind) {
+  quad_vertex_type v;
+  memset(&v, 0, sizeof(v));
+  v.imnr = imnr;
+  v.i = i;
+  v.j = j;
+  *vind = slab->vertex.size();
+  slab->vertex.push_back(v);
+}
 
-  xmin=parms->xmin;
-  ymin=parms->ymin;
-  zmin=parms->zmin;
-  xmax=parms->xmax;
-  ymax=parms->ymax;
-  zmax=parms->zmax;
+static void generateMCslab(MRI *mri, tesselation_parms *parms, mc_slab *slab) {
+  int i,j,k,width,height,imgsize,ind,ref,nf,p;
+  int vt[12],vind[12],f_c[12];
+  long plane;
 
-  tab1=(int*)calloc(imgsize,sizeof(int));
-  tab2=(int*)calloc(imgsize,sizeof(int));
+  // the cubes start one voxel before the volume (see mcVoxel), so the
+  // tables are indexed by i+1, j+1 and k+1, in rows of width+2
+  width=mri->width+2;
+  height=mri->height+2;
+  imgsize=width*height;
 
-  //vertices memory
-  vk1=(int*)calloc(2*imgsize,sizeof(int));
-  vk2=(int*)calloc(2*imgsize,sizeof(int));
-  vj1=(int*)calloc(width,sizeof(int));
-  vj2=(int*)calloc(width,sizeof(int));
+  // vk: vertices on the x/y edges of the bottom (1) and top (2) plane of the
+  // current cubes, vj: vertices on the z edges of the previous (1) and
+  // current (2) row
+  std::vector<int> vk1(2*imgsize,-1), vk2(2*imgsize,-1), vj1(width,-1), vj2(width,-1);
 
   f_c[0]=0;
   f_c[1]=1;
@@ -593,197 +626,169 @@ void generateMCtesselation(tesselation_parms * parms) {
   f_c[6]=0;
   f_c[7]=1;
 
-  fprintf(stderr,"starting generation of surface...");
-
-  for (k=zmin;k<zmax;k++) {
-    if (!(k % 10))
-      fprintf(stderr,"\n   slice nb %d...",k);
-    for (j=ymin;j<ymax;j++) {
-      for (i=xmin;i<xmax;i++) {
-
-        ind=i+width*j;
+  for (k=slab->k0;k<slab->k1;k++) {
+    plane=(long)(k+1)*2*imgsize;
+    for (j=parms->ymin;j<parms->ymax;j++) {
+      for (i=parms->xmin;i<parms->xmax;i++) {
+        ind=(i+1)+width*(j+1);
         ref=0;
-        if (((k+1)<mri->depth) && MRIvox(mri,i,j,k+1))
+        if (mcVoxel(mri,i,j,k))
+          ref+=1;
+        if (mcVoxel(mri,i+1,j,k))
+          ref+=2;
+        if (mcVoxel(mri,i,j+1,k))
+          ref+=4;
+        if (mcVoxel(mri,i+1,j+1,k))
+          ref+=8;
+        if (mcVoxel(mri,i,j,k+1))
           ref+=16;
-        if (((k+1)<mri->depth) && ((i+1)<mri->width) && MRIvox(mri,i+1,j,k+1))
+        if (mcVoxel(mri,i+1,j,k+1))
           ref+=32;
-        if (((k+1)<mri->depth) && ((j+1)<mri->height) && MRIvox(mri,i,j+1,k+1))
+        if (mcVoxel(mri,i,j+1,k+1))
           ref+=64;
-        if (((k+1)<mri->depth) && 
-            ((j+1)<mri->height) && 
-            ((i+1)<mri->width) && 
-            MRIvox(mri,i+1,j+1,k+1))
+        if (mcVoxel(mri,i+1,j+1,k+1))
           ref+=128;
 
-        tab2[ind]=(ref/16);
-        ref+=tab1[ind]; //this is the indice of the cube
-
-
+        int const *table=mcTable(parms->connectivity,ref);
         nf=0;
-        switch (parms->connectivity) {
-        case 1:
-          while (MC6p[ref][3*nf]>=0) nf++;
-          break;
-        case 2:
-          while (MC18[ref][3*nf]>=0) nf++;
-          break;
-        case 3:
-          while (MC6[ref][3*nf]>=0) nf++;
-          break;
-        default:
-          while (MC26[ref][3*nf]>=0) nf++;
-          break;
-        }
+        while (table[3*nf]>=0) nf++;
         if (nf==0) continue;
-        //fprintf(stderr,"\n %d %d. ",j,i);
-        //fprintf(stderr," ref=%d, ind=%d,",ref,ind);
-        //fprintf(stderr,"%d face(s)\n",nf);
 
         memset(vt,0,12*sizeof(int));
         memset(vind,0,12*sizeof(int));
-
-        switch (parms->connectivity) {
-        case 1:
-          for (p=0;p<3*nf;p++) vt[MC6p[ref][p]]++;
-          break;
-        case 2:
-          for (p=0;p<3*nf;p++) vt[MC18[ref][p]]++;
-          break;
-        case 3:
-          for (p=0;p<3*nf;p++) vt[MC6[ref][p]]++;
-          break;
-        default:
-          for (p=0;p<3*nf;p++) vt[MC26[ref][p]]++;
-          break;
-        }
-
+        for (p=0;p<3*nf;p++) vt[table[p]]++;
 
         //find references of vertices and eventually allocate them!
-        for (p=0;p<4;p++) //find the vertex number
-          if (vt[p])
-            vind[p]=vk1[2*ind+f_c[p]];
+        for (p=0;p<4;p++)
+          if (vt[p]) {
+            if (k==slab->k0) {
+              slab->shared.push_back(plane+2*ind+f_c[p]);
+              vind[p]=-(int)slab->shared.size();
+            } else
+              vind[p]=vk1[2*ind+f_c[p]];
+          }
         for (p=4;p<6;p++)
           if (vt[p])
-            vind[p]=vj1[i+f_c[p]];
-        if (vt[6])         //already created
-        {
-          vind[6]=vj2[i];
-        }
-        if (vt[7]) //create a new vertex number and save it into v7 and vj2
-        {
-          vertex_index=parms->vertex_index;
-          //fprintf(stderr,"c(7):%d- ",vertex_index);
-          if (vertex_index >= parms->maxvertices-1)
-            reallocateVertices(parms);
-          vind[7]=vertex_index;
-          parms->vertex[vertex_index].imnr = k+0.5;
-          parms->vertex[vertex_index].i = i+1;
-          parms->vertex[vertex_index].j = j+1;
-          parms->vertex[vertex_index].num = 0;
-          vj2[i+1]=vertex_index;
-          parms->vertex_index++;
-
-          //     printf(stderr," !!!!*!!! ");
+            vind[p]=vj1[i+1+f_c[p]];
+        if (vt[6]) //already created
+          vind[6]=vj2[i+1];
+        if (vt[7]) { //create a new vertex number and save it into vj2
+          mcNewVertex(slab,k+0.5,i+1,j+1,&vind[7]);
+          vj2[i+2]=vind[7];
         }
         if (vt[8]) //already created
-        {
           vind[8]=vk2[2*ind+f_c[8]];
-        }
         if (vt[9]) //already created
-        {
           vind[9]=vk2[2*ind+f_c[9]];
+        if (vt[10]) { //create a new vertex number and save it into vk2
+          mcNewVertex(slab,k+1,i+0.5,j+1,&vind[10]);
+          vk2[2*ind+f_c[10]]=vind[10];
+          if (k==slab->k1-1)
+            slab->top[plane+2*imgsize+2*ind+f_c[10]]=vind[10];
         }
-        if (vt[10]) //create a new vertex number and save it into vk2
-        {
-          vertex_index=parms->vertex_index;
-          //fprintf(stderr,"c(10):%d- ",vertex_index);
-          if (vertex_index >= parms->maxvertices-1)
-            reallocateVertices(parms);
-          vind[10]=vertex_index;
-          parms->vertex[vertex_index].imnr = k+1;
-          parms->vertex[vertex_index].i = i+0.5;
-          parms->vertex[vertex_index].j = j+1;
-          parms->vertex[vertex_index].num = 0;
-          vk2[2*ind+f_c[10]]=vertex_index;
-          parms->vertex_index++;
-        }
-        if (vt[11]) //create a new vertex number and save it into vk2
-        {
-          vertex_index=parms->vertex_index;
-          //fprintf(stderr,"c(11):%d- ",vertex_index);
-          if (vertex_index >= parms->maxvertices-1)
-            reallocateVertices(parms);
-          vind[11]=vertex_index;
-          parms->vertex[vertex_index].imnr = k+1;
-          parms->vertex[vertex_index].i = i+1;
-          parms->vertex[vertex_index].j = j+0.5;
-          parms->vertex[vertex_index].num = 0;
-          vk2[2*ind+f_c[11]]=vertex_index;
-          parms->vertex_index++;
+        if (vt[11]) { //create a new vertex number and save it into vk2
+          mcNewVertex(slab,k+1,i+1,j+0.5,&vind[11]);
+          vk2[2*ind+f_c[11]]=vind[11];
+          if (k==slab->k1-1)
+            slab->top[plane+2*imgsize+2*ind+f_c[11]]=vind[11];
         }
         //now create faces
-        for (p=0;p<nf;p++) {
-          int face_index=parms->face_index;
-          if (face_index >= parms->maxfaces-1)
-            reallocateFaces(parms);
-
-          switch (parms->connectivity) {
-          case 1:
-            parms->face[face_index].v[0] = vind[MC6p[ref][3*p]];
-            parms->face[face_index].v[1] = vind[MC6p[ref][3*p+1]];
-            parms->face[face_index].v[2] = vind[MC6p[ref][3*p+2]];
-            break;
-          case 2:
-            parms->face[face_index].v[0] = vind[MC18[ref][3*p]];
-            parms->face[face_index].v[1] = vind[MC18[ref][3*p+1]];
-            parms->face[face_index].v[2] = vind[MC18[ref][3*p+2]];
-            break;
-          case 3:
-            parms->face[face_index].v[0] = vind[MC6[ref][3*p]];
-            parms->face[face_index].v[1] = vind[MC6[ref][3*p+1]];
-            parms->face[face_index].v[2] = vind[MC6[ref][3*p+2]];
-            break;
-          default:
-            parms->face[face_index].v[0] = vind[MC26[ref][3*p]];
-            parms->face[face_index].v[1] = vind[MC26[ref][3*p+1]];
-            parms->face[face_index].v[2] = vind[MC26[ref][3*p+2]];
-            break;
-          }
-          parms->face_index++;
-        }
-        //fprintf(stderr,"%d %d,",parms->face_index,parms->vertex_index);
-        //fprintf(stderr,"?");
+        for (p=0;p<3*nf;p++)
+          slab->face.push_back(vind[table[p]]);
+      }
+      vj1.swap(vj2);
+      std::fill(vj2.begin(),vj2.end(),-1);
+    }
+    vk1.swap(vk2);
+    std::fill(vk2.begin(),vk2.end(),-1);
+  }
+}
 
-        //fprintf(stderr,"\n ");
-        //for(p=0;p<12;p++) fprintf(stderr,": p=%d vt=%d v=%d ",
-        //p,vt[p],vind[p]);
+/*
+  The volume is cut into z-slabs that are tessellated in parallel. Vertex
+  and face numbers are the slab-local ones offset by the counts of the
+  slabs below, which gives the same surface, in the same order, as a single
+  serial sweep, whatever the number of threads.
+*/
+void generateMCtesselation(tesselation_parms * parms) {
+  int s,nslabs,nvertices,nfaces;
+  MRI *mri;
 
-        if (debug)
-          pause();
+  fprintf(stderr,"\npreprocessing...");
+  mri=preprocessingStep(parms);
+  allocateTesselation(parms);
+  fprintf(stderr,"done\n");
 
-      }
-      tmp=vj1;
-      vj1=vj2;
-      vj2=tmp;
-      memset(vj2,-1,width*sizeof(int));
-    }
-    tmp=tab1;
-    tab1=tab2;
-    tab2=tmp;
-    memset(tab2,-1,imgsize*sizeof(int));
+  nslabs=MAX(1,MIN(4*omp_get_max_threads(),(parms->zmax-parms->zmin)/4));
+  std::vector<mc_slab> slabs(nslabs);
+  for (s=0;s<nslabs;s++) {
+    slabs[s].k0=parms->zmin+(long)(parms->zmax-parms->zmin)*s/nslabs;
+    slabs[s].k1=parms->zmin+(long)(parms->zmax-parms->zmin)*(s+1)/nslabs;
+  }
 
-    tmp=vk1;
-    vk1=vk2;
-    vk2=tmp;
-    memset(vk2,-1,2*imgsize*sizeof(int));
+  fprintf(stderr,"starting generation of surface (%d slabs)...",nslabs);
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic,1)
+#endif
+  for (s=0;s<nslabs;s++) {
+    ROMP_PFLB_begin
+    generateMCslab(mri,parms,&slabs[s]);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
 
+  // number the vertices slab by slab
+  std::vector<int> vertex_offset(nslabs+1,0), face_offset(nslabs+1,0);
+  for (s=0;s<nslabs;s++) {
+    vertex_offset[s+1]=vertex_offset[s]+slabs[s].vertex.size();
+    face_offset[s+1]=face_offset[s]+slabs[s].face.size()/3;
+  }
+  nvertices=vertex_offset[nslabs];
+  nfaces=face_offset[nslabs];
+  if (nvertices>parms->maxvertices) {
+    free(parms->vertex);
+    parms->maxvertices=nvertices;
+    parms->vertex=(quad_vertex_type*)lcalloc(parms->maxvertices,sizeof(quad_vertex_type));
+  }
+  if (nfaces>parms->maxfaces) {
+    free(parms->face);
+    parms->maxfaces=nfaces;
+    parms->face=(quad_face_type*)lcalloc(parms->maxfaces,sizeof(quad_face_type));
   }
-  free(tab1);
-  free(tab2);
-  free(vj1);
-  free(vj2);
-  free(vk1);
-  free(vk2);
+  if (!parms->vertex || !parms->face)
+    ErrorExit(ERROR_NOMEMORY, "%s: could not allocate %d vertices and %d faces",
+              Progname,nvertices,nfaces) ;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic,1)
+#endif
+  for (s=0;s<nslabs;s++) {
+    ROMP_PFLB_begin
+    mc_slab *slab=&slabs[s];
+    // resolve the vertices shared with the slab below through their edge keys
+    std::vector<int> shared(slab->shared.size());
+    for (int n=0;n<(int)shared.size();n++) {
+      std::unordered_map<long,int>::const_iterator it;
+      if (s==0 || (it=slabs[s-1].top.find(slab->shared[n]))==slabs[s-1].top.end())
+        ErrorExit(ERROR_BADPARM, "%s: unmatched vertex on slab boundary %d",
+                  Progname,slab->k0) ;
+      shared[n]=vertex_offset[s-1]+it->second;
+    }
+    memcpy(&parms->vertex[vertex_offset[s]],slab->vertex.data(),
+           slab->vertex.size()*sizeof(quad_vertex_type));
+    for (int n=0;n<(int)slab->face.size()/3;n++)
+      for (int p=0;p<3;p++) {
+        int v=slab->face[3*n+p];
+        parms->face[face_offset[s]+n].v[p] = v<0 ? shared[-v-1] : vertex_offset[s]+v;
+      }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+  parms->vertex_index=nvertices;
+  parms->face_index=nfaces;
+
   MRIfree(&mri);
   fprintf(stderr,"\nconstructing final surface...");
   saveTesselation2(parms);
@@ -73,6 +73,9 @@ ENDHELP --------------------------------------------------------------
 #include <stdlib.h>
 #include <math.h>
 double round(double x);
+#include <algorithm>
+#include <functional>
+#include <vector>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/utsname.h>
@@ -101,6 +104,7 @@ double round(double x);
 #include "volcluster.h"
 #include "surfcluster.h"
 #include "randomfields.h"
+#include "romp_support.h"
 
 static int  parse_commandline(int argc, char **argv);
 static void check_options(void);
@@ -151,26 +155,52 @@ int *nSmoothsList;
 double fwhmmax=30;
 int SaveWeight=0;
 int FixFSALH = 1;
+int *maskoutvtxno;
+double avgvtxarea;
+int ThreshOrder[100];
+
+// Per-thread state for running repetitions concurrently
+typedef struct {
+  RFS *rfs;
+  MRI *z, *zabs, *p, *sig;
+  std::vector<float> tmp; // smoothing scratch
+  // union-find over the vertices for McSimClusterSweep()
+  std::vector<std::pair<float,int> > cand;
+  std::vector<int> parent, count;
+  std::vector<double> area, weight;
+  std::vector<char> sgn;
+  // results for each threshold
+  std::vector<int> nClusters, maxcount;
+  std::vector<double> maxarea, maxweight;
+} MCSIM_WORK;
+
+// Masked nearest-neighbor smoothing operator in CSR form, and the
+// area each vertex contributes to a cluster
+std::vector<int> SmoothRowStart, SmoothCols;
+std::vector<float> VtxArea;
+
+static void McSimSmoothOperator(MRIS *surf, MRI *mask);
+static void McSimVertexArea(MRIS *surf);
+static bool McSimThreshGreater(int a, int b);
+static void McSimWorkAlloc(MCSIM_WORK *w);
+static unsigned long McSimRepSeed(int seed, int nthRep);
+static void McSimSmooth(MCSIM_WORK *w, int nSmoothSteps);
+static void McSimClusterSweep(MCSIM_WORK *w, const float *val, int thsign);
+static void McSimRep(MCSIM_WORK *w, int nthRep);
 
 /*---------------------------------------------------------------*/
 int main(int argc, char *argv[]) {
-  int nargs, n, err,k, *maskoutvtxno;
+  int nargs, n, err;
   char tmpstr[2000], *SUBJECTS_DIR, fname[2000];
   const char *signstr = NULL; // Is this intended to mask the global?
   //char *OutDir = NULL;
-  RFS *rfs;
-  int nSmoothsPrev, nSmoothsDelta;
-  MRI *z, *zabs=NULL, *sig=NULL, *p=NULL;
   int FreeMask = 0;
   int nthSign, nthFWHM, nthThresh;
-  double sigmax, zmax, threshadj, csize, csizeavg, cweightvtx, searchspace,avgvtxarea;
-  int csizen;
-  int nClusters, cmax,rmax,smax;
-  SURFCLUSTERSUM *SurfClustList;
+  double searchspace;
+  int nthreads, nbatch;
   Timer mytimer;
   LABEL *clabel;
   FILE *fp, *fpLog=NULL;
-  float **ppVal, **ppSig, **ppVal0, **ppSig0, **ppZ, **ppZ0;
 
   nargs = handleVersionOption(argc, argv, "mri_mcsim");
   if (nargs && argc - nargs == 1) exit (0);
@@ -359,15 +389,22 @@ int main(int argc, char *argv[]) {
     fprintf(fp,"%5.1f %4d\n",FWHMList[nthFWHM],nSmoothsList[nthFWHM]);
   fclose(fp);
 
-  // Alloc the z and sig maps
-  z   = MRIallocSequence(surf->nvertices, 1,1, MRI_FLOAT, 1);
-  sig = MRIallocSequence(surf->nvertices, 1,1, MRI_FLOAT, 1);
+  // Build the smoothing operator and the vertex areas used for
+  // clustering once; the repetitions only read them
+  McSimSmoothOperator(surf, mask);
+  McSimVertexArea(surf);
 
-  // Set up the random field specification
-  rfs = RFspecInit(SynthSeed,NULL);
-  rfs->name = strcpyalloc("gaussian");
-  rfs->params[0] = 0;
-  rfs->params[1] = 1;
+  // Thresholds in decreasing order so that McSimClusterSweep() can
+  // cluster at all of them in a single pass
+  for(nthThresh = 0; nthThresh < nThreshList; nthThresh++) ThreshOrder[nthThresh] = nthThresh;
+  std::stable_sort(ThreshOrder, ThreshOrder+nThreshList, McSimThreshGreater);
+
+  // Each thread gets its own random field spec and work maps. The
+  // stream is reseeded for every repetition (see McSimRepSeed()), so
+  // the results do not depend on the number of threads.
+  nthreads = omp_get_max_threads();
+  std::vector<MCSIM_WORK> work(nthreads);
+  for(n=0; n < nthreads; n++) McSimWorkAlloc(&work[n]);
 
   printf("Thresholds (%d): ",nThreshList);
   for(n=0; n < nThreshList; n++) printf("%5.2f ",ThreshList[n]);
@@ -379,117 +416,33 @@ int main(int argc, char *argv[]) {
   for(n=0; n < nFWHMList; n++) printf("%5.2f ",FWHMList[n]);
   printf("\n");
 
-  // Set up pointer to the val field
-  ppVal = (float **) calloc(surf->nvertices,sizeof(float *));
-  ppVal0 = ppVal;
-  ppSig = (float **) calloc(surf->nvertices,sizeof(float *));
-  ppSig0 = ppSig;
-  ppZ = (float **) calloc(surf->nvertices,sizeof(float *));
-  ppZ0 = ppZ;
-  for(k=0; k < surf->nvertices; k++){
-    ppVal[k] = &(surf->vertices[k].val);
-    ppSig[k] = &(MRIFseq_vox(sig,k,0,0,0));
-    ppZ[k] = &(MRIFseq_vox(z,k,0,0,0));
-  }
-
   // Start the simulation loop
-  printf("\n\nStarting Simulation over %d Repetitions\n",nRepetitions);
-  if(fpLog) fprintf(fpLog,"\n\nStarting Simulation over %d Repetitions\n",nRepetitions);
+  printf("\n\nStarting Simulation over %d Repetitions (%d threads)\n",nRepetitions,nthreads);
+  if(fpLog) fprintf(fpLog,"\n\nStarting Simulation over %d Repetitions (%d threads)\n",nRepetitions,nthreads);
   mytimer.reset() ;
-  for(nthRep = 0; nthRep < nRepetitions; nthRep++){
+  nthRep = 0;
+  while(nthRep < nRepetitions){
+    // Run one repetition per thread, then check for the save/stop files
+    nbatch = MIN(nthreads, nRepetitions-nthRep);
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+    for(int nthBatchRep = 0; nthBatchRep < nbatch; nthBatchRep++){
+      ROMP_PFLB_begin
+      McSimRep(&work[omp_get_thread_num()], nthRep+nthBatchRep);
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+    nthRep += nbatch;
+
     msecTime = mytimer.milliseconds() ;
-    printf("%5d %7.2f ",nthRep,(msecTime/1000.0)/60);
+    printf("%5d %7.2f\n",nthRep,(msecTime/1000.0)/60);
     fflush(stdout);
     if(fpLog) {
-      fprintf(fpLog,"%5d %7.1f ",nthRep,(msecTime/1000.0)/60);
+      fprintf(fpLog,"%5d %7.1f\n",nthRep,(msecTime/1000.0)/60);
       fflush(fpLog);
     }
-    // Synthesize an unsmoothed z map
-    RFsynth(z,rfs,mask); 
-    nSmoothsPrev = 0;
-    
-    // Loop through FWHMs
-    for(nthFWHM=0; nthFWHM < nFWHMList; nthFWHM++){
-      printf("%d ",nthFWHM);
-      fflush(stdout);
-      if(fpLog) {
-	fprintf(fpLog,"%d ",nthFWHM);
-	fflush(fpLog);
-      }
-      nSmoothsDelta = nSmoothsList[nthFWHM] - nSmoothsPrev;
-      nSmoothsPrev = nSmoothsList[nthFWHM];
-      // Incrementally smooth z
-      MRISsmoothMRIFastFrame(surf, z, 0, nSmoothsDelta, mask);
-      // Rescale
-      RFrescale(z,rfs,mask,z);
-      // Slightly tortured way to get the right p-values because
-      //   RFstat2P() computes one-sided, but I handle sidedness
-      //   during thresholding.
-      // First, use zabs to get a two-sided pval bet 0 and 0.5
-      zabs = MRIabs(z,zabs);
-      p = RFstat2P(zabs,rfs,mask,0,p);
-      // Next, mult pvals by 2 to get two-sided bet 0 and 1
-      MRIscalarMul(p,p,2.0);
-      sig = MRIlog10(p,NULL,sig,1); // sig = -log10(p)
-
-      for(nthSign = 0; nthSign < nSignList; nthSign++){
-	csd = csdList[nthFWHM][0][nthSign]; // just need csd->threshsign
-
-	// If test is not ABS then apply the sign
-	if(csd->threshsign != 0) MRIsetSign(sig,z,0);
-
-	// Get the max stats
-	sigmax = MRIframeMax(sig,0,mask,csd->threshsign,
-			     &cmax,&rmax,&smax);
-	zmax = MRIgetVoxVal(z,cmax,rmax,smax,0);
-	if(csd->threshsign == 0){
-	  zmax = fabs(zmax);
-	  sigmax = fabs(sigmax);
-	}
-	// Mask
-	if(mask) {
-	  //MRImask(sig,mask,sig,0.0,0.0); // a little slow
-	  for(k=0; k < nmaskout; k++) MRIsetVoxVal(sig, maskoutvtxno[k],0,0,0, 0.0);
-	}
-
-	// Copy sig to vertexval
-	//MRIScopyMRI(surf, sig, 0, "val"); // MRIScopyMRI() is a little slow
-	ppVal = ppVal0;
-	ppSig = ppSig0;
-	for(k=0; k < surf->nvertices; k++) *(*ppVal++) = *(*ppSig++);
-
-	for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
-	  csd = csdList[nthFWHM][nthThresh][nthSign];
-
-	  // Surface clustering
-	  // Set the threshold
-	  if(csd->threshsign == 0) threshadj = csd->thresh;
-	  else threshadj = csd->thresh - log10(2.0); // one-sided test
-	  // Compute clusters
-	  SurfClustList = sclustMapSurfClusters(surf,threshadj,-1,csd->threshsign,
-						0,&nClusters,NULL,NULL);
-	  // Actual area of cluster with max area
-	  csize  = sclustMaxClusterArea(SurfClustList, nClusters);
-	  // Number of vertices of cluster with max number of vertices. 
-	  // Note: this may be a different cluster from above!
-	  csizen = sclustMaxClusterCount(SurfClustList, nClusters);
-	  cweightvtx = sclustMaxClusterWeightVtx(SurfClustList, nClusters, csd->threshsign);
-	  // Area of this cluster based on average vertex area. This just scales
-	  // the number of vertices.
-	  csizeavg = csizen * avgvtxarea;
-	  if(UseAvgVtxArea) csize = csizeavg;
-	  // Store results
-	  csd->nClusters[nthRep] = nClusters;
-	  csd->MaxClusterSize[nthRep] = csize;
-	  csd->MaxClusterSizeVtx[nthRep] = csizen;
-	  csd->MaxClusterWeightVtx[nthRep] = cweightvtx;
-	  csd->MaxSig[nthRep] = sigmax;
-	  csd->MaxStat[nthRep] = zmax;
-	} // Sign
-      } // Thresh
-    } // FWHM
-    printf("\n");
-    if(fpLog) fprintf(fpLog,"\n");
     if(SaveEachIter || fio_FileExistsReadable(SaveFile)) SaveOutput();
     if(fio_FileExistsReadable(StopFile)) {
       printf("Found stop file %s\n",StopFile);
@@ -906,3 +859,325 @@ int SaveOutput(void)
   return(0);
 }
 
+
+/*---------------------------------------------------------------
+  McSimSmoothOperator() - builds the operator applied by
+  McSimSmooth(). Row vno lists vno itself followed by its unripped,
+  in-mask neighbors, the same terms (in the same order) as
+  MRISsmoothMRIFastFrame() averages. Rows of out-of-mask vertices
+  are empty. Unlike MRISsmoothMRIFastFrame(), which caches its state
+  in statics, the operator can be shared by concurrent repetitions.
+  ---------------------------------------------------------------*/
+static void McSimSmoothOperator(MRIS *surf, MRI *mask)
+{
+  int vno, nthnbr, nbrvno;
+
+  SmoothRowStart.resize(surf->nvertices+1);
+  SmoothCols.clear();
+  for(vno=0; vno < surf->nvertices; vno++){
+    SmoothRowStart[vno] = SmoothCols.size();
+    if(mask && MRIgetVoxVal(mask,vno,0,0,0) < 0.5) continue;
+    SmoothCols.push_back(vno);
+    for(nthnbr=0; nthnbr < surf->vertices_topology[vno].vnum; nthnbr++){
+      nbrvno = surf->vertices_topology[vno].v[nthnbr];
+      if(surf->vertices[nbrvno].ripflag) continue;
+      if(mask && MRIgetVoxVal(mask,nbrvno,0,0,0) < 0.5) continue;
+      SmoothCols.push_back(nbrvno);
+    }
+  }
+  SmoothRowStart[surf->nvertices] = SmoothCols.size();
+}
+
+/*---------------------------------------------------------------
+  McSimVertexArea() - area of each vertex as counted by
+  SurfClusterSummary(), including FS_CLUSTER_USE_AVG_VERTEX_AREA.
+  ---------------------------------------------------------------*/
+static void McSimVertexArea(MRIS *surf)
+{
+  int vno, ClusterUseAvgVertexArea=0;
+  double avgvertexarea;
+
+  if(surf->group_avg_vtxarea_loaded)
+    avgvertexarea = surf->group_avg_surface_area/surf->nvertices;
+  else
+    avgvertexarea = surf->total_area/surf->nvertices;
+  if(getenv("FS_CLUSTER_USE_AVG_VERTEX_AREA") != NULL)
+    sscanf(getenv("FS_CLUSTER_USE_AVG_VERTEX_AREA"),"%d",&ClusterUseAvgVertexArea);
+
+  VtxArea.resize(surf->nvertices);
+  for(vno=0; vno < surf->nvertices; vno++){
+    if(ClusterUseAvgVertexArea)               VtxArea[vno] = avgvertexarea;
+    else if(!surf->group_avg_vtxarea_loaded) VtxArea[vno] = surf->vertices[vno].area;
+    else                                     VtxArea[vno] = surf->vertices[vno].group_avg_area;
+  }
+}
+
+static bool McSimThreshGreater(int a, int b)
+{
+  return(ThreshList[a] > ThreshList[b]);
+}
+
+/*---------------------------------------------------------------*/
+static void McSimWorkAlloc(MCSIM_WORK *w)
+{
+  int nv = surf->nvertices;
+
+  w->rfs = RFspecInit(SynthSeed,NULL);
+  w->rfs->name = strcpyalloc("gaussian");
+  w->rfs->params[0] = 0;
+  w->rfs->params[1] = 1;
+
+  w->z    = MRIallocSequence(nv, 1,1, MRI_FLOAT, 1);
+  w->zabs = MRIallocSequence(nv, 1,1, MRI_FLOAT, 1);
+  w->p    = MRIallocSequence(nv, 1,1, MRI_FLOAT, 1);
+  w->sig  = MRIallocSequence(nv, 1,1, MRI_FLOAT, 1);
+
+  w->tmp.resize(nv);
+  w->parent.assign(nv,-1);
+  w->count.resize(nv);
+  w->area.resize(nv);
+  w->weight.resize(nv);
+  w->sgn.resize(nv);
+  w->nClusters.resize(nThreshList);
+  w->maxcount.resize(nThreshList);
+  w->maxarea.resize(nThreshList);
+  w->maxweight.resize(nThreshList);
+}
+
+/*---------------------------------------------------------------
+  McSimRepSeed() - seed of the noise stream of repetition nthRep.
+  A splitmix64 hash of (seed,nthRep) so that neighboring repetitions
+  get unrelated streams. Never 0, which would make RFspecSetSeed()
+  pick a time-based seed.
+  ---------------------------------------------------------------*/
+static unsigned long McSimRepSeed(int seed, int nthRep)
+{
+  unsigned long long x;
+
+  x = ((unsigned long long)(unsigned int)seed << 32) | (unsigned int)nthRep;
+  x += 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  x = x ^ (x >> 31);
+  return((unsigned long)(x % 2147483646) + 1);
+}
+
+/*---------------------------------------------------------------
+  McSimSmooth() - applies nSmoothSteps steps of nearest-neighbor
+  averaging to w->z. Gives the same values as
+  MRISsmoothMRIFastFrame(surf,z,0,nSmoothSteps,mask).
+  ---------------------------------------------------------------*/
+static void McSimSmooth(MCSIM_WORK *w, int nSmoothSteps)
+{
+  int nthstep, vno, k, k0, k1, nv = surf->nvertices;
+  float *z = &MRIFseq_vox(w->z,0,0,0,0), *t = &w->tmp[0], sumF;
+
+  for(vno=0; vno < nv; vno++)
+    if(SmoothRowStart[vno] == SmoothRowStart[vno+1]) z[vno] = 0;
+
+  for(nthstep=0; nthstep < nSmoothSteps; nthstep++){
+    for(vno=0; vno < nv; vno++){
+      k0 = SmoothRowStart[vno];
+      k1 = SmoothRowStart[vno+1];
+      if(k0 == k1) {
+	t[vno] = z[vno];
+	continue;
+      }
+      sumF = z[SmoothCols[k0]];
+      for(k=k0+1; k < k1; k++) sumF += z[SmoothCols[k]];
+      t[vno] = sumF/(k1-k0);
+    }
+    memcpy(z,t,nv*sizeof(float));
+  }
+}
+
+/*---------------------------------------------------------------
+  McSimClusterSweep() - for every threshold, computes the number of
+  clusters and the max cluster area, vertex count, and vertex weight
+  that sclustMapSurfClusters() would give for the vertex values in
+  val, without modifying the surface. Vertices are added in order of
+  decreasing value and merged with the neighbors already added
+  (union-find), so each lower threshold continues from the clusters
+  of the one above it instead of regrowing them. Area and count only
+  grow as clusters merge, so their max is kept as a running max. The
+  weight can shrink when clusters of opposite sign merge; when that
+  can happen, the max weight is found by scanning the clusters.
+  Results go to w->nClusters, etc, indexed by threshold.
+  ---------------------------------------------------------------*/
+static inline int McSimFind(std::vector<int> &parent, int vno)
+{
+  while(parent[vno] != vno){
+    parent[vno] = parent[parent[vno]];
+    vno = parent[vno];
+  }
+  return(vno);
+}
+
+static inline float McSimThresh(int nthThresh, int thsign)
+{
+  if(thsign == 0) return(ThreshList[nthThresh]);
+  return(ThreshList[nthThresh] - log10(2.0)); // one-sided test
+}
+
+static void McSimClusterSweep(MCSIM_WORK *w, const float *val, int thsign)
+{
+  int nthOrder, nthThresh, vno, nbr, nbrvno, root, r2, k, ncand, ncomp, maxcount, pure;
+  float e, thmin;
+  double maxarea, maxweight, wt;
+
+  if(nThreshList == 0) return;
+
+  // Value that clustValueInRange() compares to the threshold
+  thmin = McSimThresh(ThreshOrder[nThreshList-1],thsign);
+  w->cand.clear();
+  for(vno=0; vno < surf->nvertices; vno++){
+    e = val[vno];
+    if(thsign == 0)  e = fabs(e);
+    if(thsign == -1) e = -e;
+    if(e >= thmin) w->cand.push_back(std::make_pair(e,vno));
+  }
+  std::sort(w->cand.begin(), w->cand.end(), std::greater<std::pair<float,int> >());
+  ncand = w->cand.size();
+
+  k = 0;
+  ncomp = 0;
+  maxarea = 0;
+  maxcount = 0;
+  maxweight = 0;
+  pure = 1; // all clusters have weights of a single (and the tested) sign
+  for(nthOrder=0; nthOrder < nThreshList; nthOrder++){
+    nthThresh = ThreshOrder[nthOrder];
+    thmin = McSimThresh(nthThresh,thsign);
+
+    // Add the vertices that reach this threshold
+    for(; k < ncand && w->cand[k].first >= thmin; k++){
+      vno = w->cand[k].second;
+      w->parent[vno] = vno;
+      w->count[vno] = 1;
+      w->area[vno] = VtxArea[vno];
+      w->weight[vno] = val[vno];
+      w->sgn[vno] = (val[vno] > 0) ? 1 : ((val[vno] < 0) ? 2 : 0);
+      if(thsign != 0 && val[vno]*thsign < 0) pure = 0;
+      ncomp++;
+      root = vno;
+      for(nbr=0; nbr < surf->vertices_topology[vno].vnum; nbr++){
+	nbrvno = surf->vertices_topology[vno].v[nbr];
+	if(w->parent[nbrvno] < 0) continue;
+	r2 = McSimFind(w->parent,nbrvno);
+	if(r2 == root) continue;
+	if(w->count[r2] > w->count[root]) std::swap(root,r2);
+	w->parent[r2] = root;
+	w->count[root]  += w->count[r2];
+	w->area[root]   += w->area[r2];
+	w->weight[root] += w->weight[r2];
+	w->sgn[root]    |= w->sgn[r2];
+	ncomp--;
+      }
+      if(w->sgn[root] == 3) pure = 0;
+      if(maxarea  < w->area[root])  maxarea  = w->area[root];
+      if(maxcount < w->count[root]) maxcount = w->count[root];
+      wt = w->weight[root];
+      if(thsign == 0 && fabs(maxweight) < fabs(wt)) maxweight = wt;
+      if(thsign == +1 && maxweight < wt) maxweight = wt;
+      if(thsign == -1 && maxweight > wt) maxweight = wt;
+    }
+
+    w->nClusters[nthThresh] = ncomp;
+    w->maxarea[nthThresh]   = maxarea;
+    w->maxcount[nthThresh]  = maxcount;
+    if(ncomp == 0 || pure) w->maxweight[nthThresh] = (float)maxweight;
+    else {
+      // same as sclustMaxClusterWeightVtx()
+      double maxw;
+      if(thsign == 0) maxw = 0;
+      else            maxw = -thsign * 10e10;
+      for(int j=0; j < k; j++){
+	vno = w->cand[j].second;
+	if(McSimFind(w->parent,vno) != vno) continue;
+	wt = (float)w->weight[vno];
+	if(thsign == 0 && fabs(maxw) < fabs(wt)) maxw = wt;
+	if(thsign == +1 && maxw < wt) maxw = wt;
+	if(thsign == -1 && maxw > wt) maxw = wt;
+      }
+      w->maxweight[nthThresh] = (float)maxw;
+    }
+  }
+
+  for(int j=0; j < k; j++) w->parent[w->cand[j].second] = -1;
+}
+
+/*---------------------------------------------------------------
+  McSimRep() - runs repetition nthRep using the work space w and
+  stores its results in csdList. Only w is modified, so repetitions
+  can run concurrently.
+  ---------------------------------------------------------------*/
+static void McSimRep(MCSIM_WORK *w, int nthRep)
+{
+  int nthFWHM, nthSign, nthThresh, nSmoothsPrev, k, cmax, rmax, smax, csizen;
+  double sigmax, zmax, csize;
+  CSD *csd;
+
+  // Synthesize an unsmoothed z map from this repetition's stream
+  RFspecSetSeed(w->rfs, McSimRepSeed(SynthSeed,nthRep));
+  RFsynth(w->z,w->rfs,mask);
+  nSmoothsPrev = 0;
+
+  // Loop through FWHMs
+  for(nthFWHM=0; nthFWHM < nFWHMList; nthFWHM++){
+    // Incrementally smooth z
+    McSimSmooth(w, nSmoothsList[nthFWHM] - nSmoothsPrev);
+    nSmoothsPrev = nSmoothsList[nthFWHM];
+    // Rescale
+    RFrescale(w->z,w->rfs,mask,w->z);
+    // Slightly tortured way to get the right p-values because
+    //   RFstat2P() computes one-sided, but I handle sidedness
+    //   during thresholding.
+    // First, use zabs to get a two-sided pval bet 0 and 0.5
+    MRIabs(w->z,w->zabs);
+    RFstat2P(w->zabs,w->rfs,mask,0,w->p);
+    // Next, mult pvals by 2 to get two-sided bet 0 and 1
+    MRIscalarMul(w->p,w->p,2.0);
+    MRIlog10(w->p,NULL,w->sig,1); // sig = -log10(p)
+
+    for(nthSign = 0; nthSign < nSignList; nthSign++){
+      csd = csdList[nthFWHM][0][nthSign]; // just need csd->threshsign
+
+      // If test is not ABS then apply the sign
+      if(csd->threshsign != 0) MRIsetSign(w->sig,w->z,0);
+
+      // Get the max stats
+      sigmax = MRIframeMax(w->sig,0,mask,csd->threshsign,&cmax,&rmax,&smax);
+      zmax = MRIgetVoxVal(w->z,cmax,rmax,smax,0);
+      if(csd->threshsign == 0){
+	zmax = fabs(zmax);
+	sigmax = fabs(sigmax);
+      }
+      // Mask
+      if(mask) {
+	for(k=0; k < nmaskout; k++) MRIFseq_vox(w->sig,maskoutvtxno[k],0,0,0) = 0.0;
+      }
+
+      // Surface clustering at all thresholds
+      McSimClusterSweep(w, &MRIFseq_vox(w->sig,0,0,0,0), csd->threshsign);
+
+      for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
+	csd = csdList[nthFWHM][nthThresh][nthSign];
+	// Actual area of cluster with max area
+	csize = w->maxarea[nthThresh];
+	// Number of vertices of cluster with max number of vertices.
+	// Note: this may be a different cluster from above!
+	csizen = w->maxcount[nthThresh];
+	// Area based on average vertex area. This just scales
+	// the number of vertices.
+	if(UseAvgVtxArea) csize = csizen * avgvtxarea;
+	// Store results
+	csd->nClusters[nthRep] = w->nClusters[nthThresh];
+	csd->MaxClusterSize[nthRep] = csize;
+	csd->MaxClusterSizeVtx[nthRep] = csizen;
+	csd->MaxClusterWeightVtx[nthRep] = w->maxweight[nthThresh];
+	csd->MaxSig[nthRep] = sigmax;
+	csd->MaxStat[nthRep] = zmax;
+      } // Thresh
+    } // Sign
+  } // FWHM
+}
@@ -101,6 +101,9 @@
 
   --tol1d tol1d : tolerance on powell 1d minimizations
 
+  --lbfgs : use L-BFGS with the analytic gradient instead of powell
+  --lbfgs-tol tol : L-BFGS gradient and cost tolerance (def 1e-5)
+
   --1dmin : use brute force 1D minimizations instead of powell
   --n1dmin n1dmin : number of 1d minimization (default = 3)
 
@@ -178,6 +181,9 @@
 #include "annotation.h"
 #include "transform.h"
 #include "label.h"
+#include "romp_support.h"
+
+#include <vector>
 
 #ifdef X
 #undef X
@@ -187,10 +193,17 @@ int MRISbbrSurfs(char *subject);
 
 double *GetSurfCosts(MRI *mov, MRI *notused, MATRIX *R0, MATRIX *R,
 		     double *p, int dof, double *costs);
+MATRIX *BBRparams2R(MATRIX *R0, double *p, int dof, MATRIX *R);
 int MinPowell(MRI *mov, MRI *notused, MATRIX *R, double *params,
 	      int dof, double ftol, double linmintol, int nmaxiters,
 	      char *costfile, double *costs, int *niters);
 float compute_powell_cost(float *p) ;
+int MinLBFGS(MRI *mov, MRI *notused, MATRIX *R, double *params,
+	     int dof, double tol, double *costs, int *niters);
+void compute_lbfgs_gradient(float *p, float *g);
+int BBRcanUseKernel(void);
+double BBRcostGrad(MRI *mov, MATRIX *R0, MATRIX *R, double *p, int dof,
+		   double *grad, int *pnhits);
 double RelativeSurfCost(MRI *mov, MATRIX *R0);
 
 char *costfile_powell = NULL;
@@ -211,6 +224,9 @@ static int  singledash(char *flag);
 static int istringnmatch(const char *str1, const char *str2, int n);
 double VertexCost(double vctx, double vwm, double slope, 
 		  double center, double sign, double *pct);
+double VertexCostGrad(double vctx, double vwm, double slope, 
+		      double center, double sign, double *targcon,
+		      double *pct, double *dcdctx, double *dcdwm);
 
 
 int main(int argc, char *argv[]) ;
@@ -261,6 +277,12 @@ int nMaxItersPowell = 36;
 double TolPowell = 1e-8;
 double LinMinTolPowell = 1e-8;
 
+int UseLBFGS = 0;
+double TolLBFGS = 1e-5;
+// gradient computed along with the last cost when using L-BFGS
+int BBRgradCacheValid = 0;
+double BBRgradCacheP[12], BBRgradCache[12];
+
 #define NMAX 100
 int ntx=0, nty=0, ntz=0, nax=0, nay=0, naz=0;
 double txlist[NMAX],tylist[NMAX],tzlist[NMAX];
@@ -759,9 +781,16 @@ int main(int argc, char **argv) {
   }
 
   mytimer.reset() ;
-  printf("Starting Powell Minimization\n");
-  MinPowell(mov, NULL, R, p, dof, TolPowell, LinMinTolPowell,
-	    nMaxItersPowell,SegRegCostFile, costs, &nth);
+  if(UseLBFGS){
+    printf("Starting L-BFGS Minimization\n");
+    if(MinLBFGS(mov, NULL, R, p, dof, TolLBFGS, costs, &nth) != NO_ERROR)
+      printf("WARNING: L-BFGS did not converge, keeping the last accepted step\n");
+  }
+  else {
+    printf("Starting Powell Minimization\n");
+    MinPowell(mov, NULL, R, p, dof, TolPowell, LinMinTolPowell,
+	      nMaxItersPowell,SegRegCostFile, costs, &nth);
+  }
   secCostTime = mytimer.seconds() ;
 
   // Compute relative final cost 
@@ -1238,6 +1267,12 @@ static int parse_commandline(int argc, char **argv) {
       sscanf(pargv[0],"%d",&nsubsampbrute);
       nargsused = 1;
     } 
+    else if (istringnmatch(option, "--lbfgs-tol",0)) {
+      if (nargc < 1) argnerr(option,1);
+      sscanf(pargv[0],"%lf",&TolLBFGS);
+      nargsused = 1;
+    }
+    else if (istringnmatch(option, "--lbfgs",0)) UseLBFGS = 1;
     else if (istringnmatch(option, "--nmax",0)) {
       if (nargc < 1) argnerr(option,1);
       sscanf(pargv[0],"%d",&nMaxItersPowell);
@@ -1708,6 +1743,8 @@ static void dump_options(FILE *fp)
   fprintf(fp,"frame  %d\n",frame);
   fprintf(fp,"TolPowell %lf\n",TolPowell);
   fprintf(fp,"nMaxItersPowell %d\n",nMaxItersPowell);
+  fprintf(fp,"UseLBFGS %d\n",UseLBFGS);
+  if(UseLBFGS) fprintf(fp,"TolLBFGS %lf\n",TolLBFGS);
   fprintf(fp,"n1dmin  %d\n",n1dmin);
   if(interpcode == SAMPLE_SINC) fprintf(fp,"sinc hw  %d\n",sinchw);
   fprintf(fp,"Profile   %d\n",DoProfile);
@@ -1800,13 +1837,24 @@ float compute_powell_cost(float *p)
   static double copt = -1;
   static double cprev = -1;
   double costs[8], pp[12], cdelta;
-  int n, newopt;
+  int n, newopt, nhits;
   FILE *fp;
 
   if(R==NULL) R = MatrixAlloc(4,4,MATRIX_REAL);
   for(n=0; n < dof; n++) pp[n] = p[n+1];
   
-  GetSurfCosts(mov, NULL, R0, R, pp, dof, costs);
+  if(UseLBFGS && BBRcanUseKernel()){
+    // L-BFGS needs the cost to match the kernel's gradient. The kernel sums in
+    // blocks, so it differs from GetSurfCosts() in the last bits; Powell keeps
+    // GetSurfCosts() so its results do not change.
+    costs[7] = BBRcostGrad(mov, R0, R, pp, dof, UseLBFGS ? BBRgradCache : NULL, &nhits);
+    costs[0] = nhits;
+    if(UseLBFGS){
+      for(n=0; n < dof; n++) BBRgradCacheP[n] = pp[n];
+      BBRgradCacheValid = 1;
+    }
+  }
+  else GetSurfCosts(mov, NULL, R0, R, pp, dof, costs);
 
   // This is for a fast check on convergence
   //costs[7] = 0;
@@ -2097,31 +2145,51 @@ double VertexCost(double vctx, double vwm, double slope,
 }
 
 /*-------------------------------------------------------*/
-double *GetSurfCosts(MRI *mov, MRI *notused, MATRIX *R0, MATRIX *R,
-		     double *p, int dof, double *costs)
+/*
+  VertexCostGrad() - same as VertexCost() but also returns the
+  derivatives of the cost wrt vctx and vwm. If targcon is non-NULL,
+  the cost is (d-*targcon)^2 as in GetSurfCosts().
+*/
+double VertexCostGrad(double vctx, double vwm, double slope, 
+		      double center, double sign, double *targcon,
+		      double *pct, double *dcdctx, double *dcdwm)
 {
-  static MRI *vlhwm=NULL, *vlhctx=NULL, *vrhwm=NULL, *vrhctx=NULL;
-  extern MRI *lhcost, *rhcost;
-  extern MRI *lhcon, *rhcon;
-  extern char *lhcostfile, *rhcostfile;
-  extern char *lhconfile, *rhconfile;
-  extern int UseMask, UseLH, UseRH;
-  extern MRI *lhsegmask, *rhsegmask;
-  extern MRI *lhCortexLabel, *rhCortexLabel;
-  extern MRIS *lhwm, *rhwm, *lhctx, *rhctx;
-  extern int PenaltySign;
-  extern double PenaltySlope;
-  extern int nsubsamp;
-  extern int interpcode;
-  double angles[3],d,dsum,dsum2,dstd,dmean,vwm,vctx,c,csum,csum2,cstd,cmean,val;
-  MATRIX *Mrot=NULL, *Mtrans=NULL, *Mscale=NULL, *Mshear=NULL;
-  int nhits,n;
-  //FILE *fp;
-
-  if(R==NULL){
-    printf("ERROR: GetSurfCosts(): R cannot be NULL\n");
-    return(NULL);
+  double d,a=0,c,eps=0,m,dadd=0,dcdd;
+  if(!ExcludeZeroVoxels) eps = FLT_EPSILON;
+  m = (vctx+vwm)/2.0 + eps;
+  d = 100*(vctx-vwm)/m; // percent contrast
+  if(sign ==  0) {
+    a = -fabs(slope*(d-center));
+    dadd = (slope*(d-center) >= 0) ? -slope : +slope;
+  }
+  if(sign == -1) {a = -(slope*(d-center)); dadd = -slope;}
+  if(sign == +1) {a = +(slope*(d-center)); dadd = +slope;}
+  if(sign == -2){
+    if(d >= 0) {a = -(slope*(d-center)); dadd = -slope;}
+    else       {a = 0; dadd = 0;}
+  }
+  c = 1+tanh(a);
+  dcdd = (1-tanh(a)*tanh(a))*dadd;
+  if(targcon){
+    c = (d-*targcon)*(d-*targcon);
+    dcdd = 2*(d-*targcon);
   }
+  *dcdctx = dcdd*100*(m - (vctx-vwm)/2.0)/(m*m);
+  *dcdwm  = dcdd*100*(-m - (vctx-vwm)/2.0)/(m*m);
+  *pct = d;
+  return(c);
+}
+
+/*-------------------------------------------------------*/
+/*
+  BBRparams2R() - builds the registration for the given parameters
+  (transmm, rotdeg, scale, shear) relative to R0:
+  R = Mshear*Mscale*Mtrans*Mrot*R0
+*/
+MATRIX *BBRparams2R(MATRIX *R0, double *p, int dof, MATRIX *R)
+{
+  double angles[3];
+  MATRIX *Mrot=NULL, *Mtrans=NULL, *Mscale=NULL, *Mshear=NULL;
 
   Mtrans = MatrixIdentity(4,NULL);
   if(dof > 0){
@@ -2161,6 +2229,37 @@ double *GetSurfCosts(MRI *mov, MRI *notused, MATRIX *R0, MATRIX *R,
   MatrixFree(&Mscale);
   MatrixFree(&Mshear);
 
+  return(R);
+}
+
+/*-------------------------------------------------------*/
+double *GetSurfCosts(MRI *mov, MRI *notused, MATRIX *R0, MATRIX *R,
+		     double *p, int dof, double *costs)
+{
+  static MRI *vlhwm=NULL, *vlhctx=NULL, *vrhwm=NULL, *vrhctx=NULL;
+  extern MRI *lhcost, *rhcost;
+  extern MRI *lhcon, *rhcon;
+  extern char *lhcostfile, *rhcostfile;
+  extern char *lhconfile, *rhconfile;
+  extern int UseMask, UseLH, UseRH;
+  extern MRI *lhsegmask, *rhsegmask;
+  extern MRI *lhCortexLabel, *rhCortexLabel;
+  extern MRIS *lhwm, *rhwm, *lhctx, *rhctx;
+  extern int PenaltySign;
+  extern double PenaltySlope;
+  extern int nsubsamp;
+  extern int interpcode;
+  double d,dsum,dsum2,dstd,dmean,vwm,vctx,c,csum,csum2,cstd,cmean,val;
+  int nhits,n;
+  //FILE *fp;
+
+  if(R==NULL){
+    printf("ERROR: GetSurfCosts(): R cannot be NULL\n");
+    return(NULL);
+  }
+
+  R = BBRparams2R(R0, p, dof, R);
+
   //printf("Trans: %g %g %g\n",p[0],p[1],p[2]);
   //printf("Rot:   %g %g %g\n",p[3],p[4],p[5]);
   //printf("Scale: %g %g %g\n",p[6],p[7],p[8]);
@@ -2306,6 +2405,302 @@ double *GetSurfCosts(MRI *mov, MRI *notused, MATRIX *R0, MATRIX *R,
   return(costs);
 }
 
+/*-------------------------------------------------------*/
+/*
+  BBRcanUseKernel() - returns 1 if BBRcostGrad() computes the cost of
+  GetSurfCosts() for the current options, up to rounding: it adds the
+  vertices in blocks, so the sums differ in the last bits.
+*/
+int BBRcanUseKernel(void)
+{
+  if(interpcode != SAMPLE_TRILINEAR) return(0);
+  if(vsm != NULL) return(0);
+  return(1);
+}
+
+/* 4x4 helpers for the parameter derivatives of R */
+static void bbrMat4Mul(double A[4][4], double B[4][4], double C[4][4])
+{
+  double T[4][4];
+  int r,c,k;
+  for(r=0; r < 4; r++){
+    for(c=0; c < 4; c++){
+      T[r][c] = 0;
+      for(k=0; k < 4; k++) T[r][c] += A[r][k]*B[k][c];
+    }
+  }
+  memcpy(C,T,sizeof(T));
+}
+static void bbrMat4Identity(double A[4][4])
+{
+  int r,c;
+  for(r=0; r < 4; r++) for(c=0; c < 4; c++) A[r][c] = (r==c);
+}
+static void bbrMat4FromMatrix(MATRIX *M, double A[4][4])
+{
+  int r,c;
+  for(r=0; r < 4; r++) for(c=0; c < 4; c++) A[r][c] = M->rptr[r+1][c+1];
+}
+
+/*
+  bbrParamDerivs() - computes dcrs[k] = ras2vox * dR/dp[k] for each of
+  the dof parameters, where R = Mshear*Mscale*Mtrans*Mrot*R0 as in
+  BBRparams2R() and ras2vox maps mov tkreg RAS to mov voxels. Only
+  the top three rows are used.
+*/
+static void bbrParamDerivs(MATRIX *ras2vox, MATRIX *R0, double *p, int dof, double dcrs[12][4][4])
+{
+  double F[5][4][4], dF[4][4], A[4][4], Rx[4][4], Ry[4][4], Rz[4][4], D[4][4];
+  double g, b, a, k2r = M_PI/180;
+  int k, f, fk;
+
+  bbrMat4FromMatrix(ras2vox,A);
+  bbrMat4FromMatrix(R0,F[4]);
+
+  // F[0]=Mshear F[1]=Mscale F[2]=Mtrans F[3]=Mrot F[4]=R0
+  bbrMat4Identity(F[0]);
+  if(dof > 9){
+    F[0][0][1] = p[9];
+    F[0][0][2] = p[10];
+    F[0][1][2] = p[11];
+  }
+  bbrMat4Identity(F[1]);
+  if(dof > 6){
+    F[1][0][0] = p[6];
+    F[1][1][1] = p[7];
+    F[1][2][2] = p[8];
+  }
+  bbrMat4Identity(F[2]);
+  F[2][0][3] = p[0];
+  F[2][1][3] = p[1];
+  F[2][2][3] = p[2];
+
+  // Mrot = Rz*Ry*Rx as in MRIangles2RotMat()
+  g = 0; b = 0; a = 0;
+  if(dof > 3){
+    g = p[3]*k2r;
+    b = p[4]*k2r;
+    a = p[5]*k2r;
+  }
+  bbrMat4Identity(Rx);
+  Rx[1][1] = cos(g); Rx[1][2] = -sin(g);
+  Rx[2][1] = sin(g); Rx[2][2] =  cos(g);
+  bbrMat4Identity(Ry);
+  Ry[0][0] = cos(b); Ry[0][2] = sin(b);
+  Ry[2][0] = -sin(b); Ry[2][2] = cos(b);
+  bbrMat4Identity(Rz);
+  Rz[0][0] = cos(a); Rz[0][1] = -sin(a);
+  Rz[1][0] = sin(a); Rz[1][1] =  cos(a);
+  bbrMat4Mul(Rz,Ry,F[3]);
+  bbrMat4Mul(F[3],Rx,F[3]);
+
+  for(k=0; k < dof; k++){
+    // derivative of the factor that depends on p[k]
+    memset(dF,0,sizeof(dF));
+    if(k < 3){
+      fk = 2;
+      dF[k][3] = 1;
+    }
+    else if(k < 6){
+      fk = 3;
+      memset(D,0,sizeof(D));
+      if(k == 3){
+	D[1][1] = -sin(g)*k2r; D[1][2] = -cos(g)*k2r;
+	D[2][1] =  cos(g)*k2r; D[2][2] = -sin(g)*k2r;
+	bbrMat4Mul(Rz,Ry,dF);
+	bbrMat4Mul(dF,D,dF);
+      }
+      if(k == 4){
+	D[0][0] = -sin(b)*k2r; D[0][2] =  cos(b)*k2r;
+	D[2][0] = -cos(b)*k2r; D[2][2] = -sin(b)*k2r;
+	bbrMat4Mul(Rz,D,dF);
+	bbrMat4Mul(dF,Rx,dF);
+      }
+      if(k == 5){
+	D[0][0] = -sin(a)*k2r; D[0][1] = -cos(a)*k2r;
+	D[1][0] =  cos(a)*k2r; D[1][1] = -sin(a)*k2r;
+	bbrMat4Mul(D,Ry,dF);
+	bbrMat4Mul(dF,Rx,dF);
+      }
+    }
+    else if(k < 9){
+      fk = 1;
+      dF[k-6][k-6] = 1;
+    }
+    else {
+      fk = 0;
+      if(k ==  9) dF[0][1] = 1;
+      if(k == 10) dF[0][2] = 1;
+      if(k == 11) dF[1][2] = 1;
+    }
+    memcpy(dcrs[k],A,sizeof(A));
+    for(f=0; f < 5; f++){
+      if(f == fk) bbrMat4Mul(dcrs[k],dF,dcrs[k]);
+      else        bbrMat4Mul(dcrs[k],F[f],dcrs[k]);
+    }
+  }
+}
+
+/*
+  bbrSample() - samples frame 0 of mov at surface point xyz the same
+  way MRIvol2surfVSM() does with trilinear interpolation (0 when the
+  nearest voxel is out of the volume). If grad is non-NULL, also
+  returns the derivative of the sample wrt the parameters.
+*/
+static float bbrSample(MRI *mov, AffineMatrix *ras2vox, double dcrs[12][4][4], int dof,
+		       float x, float y, float z, double *grad)
+{
+  AffineVector Scrs, Txyz;
+  float fcol, frow, fslc, val;
+  int k;
+
+  SetAffineVector(&Txyz, x, y, z);
+  AffineMV(&Scrs, ras2vox, &Txyz);
+  GetAffineVector(&Scrs, &fcol, &frow, &fslc);
+  if(grad) for(k=0; k < dof; k++) grad[k] = 0;
+  if(nint(fcol) < 0 || nint(fcol) >= mov->width ||
+     nint(frow) < 0 || nint(frow) >= mov->height ||
+     nint(fslc) < 0 || nint(fslc) >= mov->depth) return(0);
+  MRIsampleSeqVolume(mov, fcol, frow, fslc, &val, 0, 0);
+  if(grad == NULL) return(val);
+
+  // Gradient of the trilinear interpolant, with the same clamping
+  double c = fcol, r = frow, s = fslc, gc = 0, gr = 0, gs = 0;
+  int cm, cp, rm, rp, sm, sp;
+  double cmd, rmd, smd, cpd, rpd, spd;
+  int incol = (c >= 0 && c < mov->width-1);
+  int inrow = (r >= 0 && r < mov->height-1);
+  int inslc = (s >= 0 && s < mov->depth-1);
+  c = MAX(MIN(c, mov->width-1.0), 0.0);
+  r = MAX(MIN(r, mov->height-1.0), 0.0);
+  s = MAX(MIN(s, mov->depth-1.0), 0.0);
+  cm = (int)c; cp = MIN(mov->width-1, cm+1);
+  rm = (int)r; rp = MIN(mov->height-1, rm+1);
+  sm = (int)s; sp = MIN(mov->depth-1, sm+1);
+  cmd = c - cm; rmd = r - rm; smd = s - sm;
+  cpd = 1 - cmd; rpd = 1 - rmd; spd = 1 - smd;
+  double v000 = MRIgetVoxVal(mov,cm,rm,sm,0), v001 = MRIgetVoxVal(mov,cm,rm,sp,0);
+  double v010 = MRIgetVoxVal(mov,cm,rp,sm,0), v011 = MRIgetVoxVal(mov,cm,rp,sp,0);
+  double v100 = MRIgetVoxVal(mov,cp,rm,sm,0), v101 = MRIgetVoxVal(mov,cp,rm,sp,0);
+  double v110 = MRIgetVoxVal(mov,cp,rp,sm,0), v111 = MRIgetVoxVal(mov,cp,rp,sp,0);
+  if(incol) gc = rpd*spd*(v100-v000) + rpd*smd*(v101-v001) + rmd*spd*(v110-v010) + rmd*smd*(v111-v011);
+  if(inrow) gr = cpd*spd*(v010-v000) + cpd*smd*(v011-v001) + cmd*spd*(v110-v100) + cmd*smd*(v111-v101);
+  if(inslc) gs = cpd*rpd*(v001-v000) + cpd*rmd*(v011-v010) + cmd*rpd*(v101-v100) + cmd*rmd*(v111-v110);
+  for(k=0; k < dof; k++){
+    double (*D)[4] = dcrs[k];
+    grad[k] = gc*(D[0][0]*x + D[0][1]*y + D[0][2]*z + D[0][3]) +
+              gr*(D[1][0]*x + D[1][1]*y + D[1][2]*z + D[1][3]) +
+              gs*(D[2][0]*x + D[2][1]*y + D[2][2]*z + D[2][3]);
+  }
+  return(val);
+}
+
+/*-------------------------------------------------------*/
+/*
+  BBRcostGrad() - computes the BBR cost (costs[7] of GetSurfCosts())
+  directly from the surfaces without going through MRIvol2surfVSM().
+  The vertices are processed in parallel in fixed-size blocks whose
+  partial sums are added in order, so the result does not depend on
+  the number of threads. If grad is non-NULL, the analytic gradient
+  of the cost wrt the dof parameters is also computed. R is set to
+  the registration at p. Only valid if BBRcanUseKernel().
+*/
+#define BBR_BLOCK 512
+double BBRcostGrad(MRI *mov, MATRIX *R0, MATRIX *R, double *p, int dof,
+		   double *grad, int *pnhits)
+{
+  MATRIX *ras2vox0, *ras2vox, *vox2ras;
+  AffineMatrix ras2voxAffine;
+  double dcrs[12][4][4], csum, gsum[12], cost;
+  int hemi, nhits, nblocks, b, k;
+
+  R = BBRparams2R(R0, p, dof, R);
+  // recomputed each call, it is cheap and mov can change
+  vox2ras = MRIxfmCRS2XYZtkreg(mov);
+  ras2vox0 = MatrixInverse(vox2ras, NULL);
+  MatrixFree(&vox2ras);
+  // same float product as MRIvol2surfVSM()
+  ras2vox = MatrixMultiply(ras2vox0, R, NULL);
+  SetAffineMatrix(&ras2voxAffine, ras2vox);
+  if(grad) bbrParamDerivs(ras2vox0, R0, p, dof, dcrs);
+
+  csum = 0;
+  nhits = 0;
+  for(k=0; k < dof; k++) gsum[k] = 0;
+
+  for(hemi = 0; hemi < 2; hemi++){
+    MRIS *wm, *ctx;
+    MRI *cortex, *segmask, *label, *targcon;
+    if(hemi == 0){
+      if(!UseLH) continue;
+      wm = lhwm; ctx = lhctx; cortex = lhCortexLabel; segmask = lhsegmask; label = lhlabel; targcon = TargConLH;
+    }
+    else {
+      if(!UseRH) continue;
+      wm = rhwm; ctx = rhctx; cortex = rhCortexLabel; segmask = rhsegmask; label = rhlabel; targcon = TargConRH;
+    }
+    int nitems = (wm->nvertices + nsubsamp - 1)/nsubsamp;
+    nblocks = (nitems + BBR_BLOCK - 1)/BBR_BLOCK;
+    std::vector<double> bcsum(nblocks,0), bgsum((size_t)nblocks*12,0);
+    std::vector<int> bnhits(nblocks,0);
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic,1)
+#endif
+    for(b = 0; b < nblocks; b++){
+      ROMP_PFLB_begin
+      double gwm[12], gctx[12], d, c, dcdctx, dcdwm, tval, *ptval;
+      float vwm, vctx;
+      int item, n, kk;
+      for(item = b*BBR_BLOCK; item < MIN((b+1)*BBR_BLOCK, nitems); item++){
+	n = item*nsubsamp;
+	VERTEX *vw = &wm->vertices[n], *vc = &ctx->vertices[n];
+	if(vw->ripflag != 0) continue;
+	if(cortex && MRIgetVoxVal(cortex,n,0,0,0) < 0.5) continue;
+	if(UseMask && MRIgetVoxVal(segmask,n,0,0,0) < 0.5) continue;
+	if(UseLabel && MRIgetVoxVal(label,n,0,0,0) < 0.5) continue;
+	vwm = bbrSample(mov, &ras2voxAffine, dcrs, dof, vw->x, vw->y, vw->z, grad ? gwm : NULL);
+	if(vwm == 0.0 && ExcludeZeroVoxels) continue;
+	vctx = 0;
+	if(grad) for(kk=0; kk < dof; kk++) gctx[kk] = 0;
+	if(!vc->ripflag) vctx = bbrSample(mov, &ras2voxAffine, dcrs, dof, vc->x, vc->y, vc->z, grad ? gctx : NULL);
+	if(vctx == 0.0 && ExcludeZeroVoxels) continue;
+	ptval = NULL;
+	if(targcon){
+	  tval = MRIgetVoxVal(targcon,n,0,0,0);
+	  ptval = &tval;
+	}
+	c = VertexCostGrad(vctx, vwm, PenaltySlope, PenaltyCenter, PenaltySign, ptval, &d, &dcdctx, &dcdwm);
+	bnhits[b]++;
+	bcsum[b] += c;
+	if(grad) for(kk=0; kk < dof; kk++) bgsum[(size_t)b*12+kk] += dcdctx*gctx[kk] + dcdwm*gwm[kk];
+      }
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    for(b = 0; b < nblocks; b++){
+      nhits += bnhits[b];
+      csum += bcsum[b];
+      for(k=0; k < dof; k++) gsum[k] += bgsum[(size_t)b*12+k];
+    }
+  }
+  MatrixFree(&ras2vox);
+  MatrixFree(&ras2vox0);
+
+  if(nhits == 0){
+    cost = 10.0; // as in GetSurfCosts()
+    if(grad) for(k=0; k < dof; k++) grad[k] = 0;
+  }
+  else {
+    cost = csum/nhits;
+    if(grad) for(k=0; k < dof; k++) grad[k] = gsum[k]/nhits;
+  }
+  if(pnhits) *pnhits = nhits;
+  return(cost);
+}
+
 /*---------------------------------------------------------*/
 int MinPowell(MRI *mov, MRI *notused, MATRIX *R, double *params,
 	      int dof, double ftol, double linmintol, int nmaxiters,
@@ -2343,6 +2738,88 @@ int MinPowell(MRI *mov, MRI *notused, MATRIX *R, double *params,
   return(NO_ERROR) ;
 }
 
+/*---------------------------------------------------------*/
+/*
+  compute_lbfgs_gradient() - gradient of compute_powell_cost(). Uses
+  the gradient computed with the last cost if it was at the same
+  point, otherwise computes it with BBRcostGrad(). If the kernel
+  cannot be used (eg, vsm or nearest interp), falls back to central
+  differences of GetSurfCosts().
+*/
+void compute_lbfgs_gradient(float *p, float *g)
+{
+  extern MRI *mov;
+  extern int dof;
+  static MATRIX *R = NULL;
+  double costs[8], pp[12], grad[12], cplus, h;
+  int n, same;
+
+  if(R==NULL) R = MatrixAlloc(4,4,MATRIX_REAL);
+  for(n=0; n < dof; n++) pp[n] = p[n+1];
+
+  same = BBRgradCacheValid;
+  for(n=0; n < dof && same; n++) if(BBRgradCacheP[n] != pp[n]) same = 0;
+
+  if(same) for(n=0; n < dof; n++) grad[n] = BBRgradCache[n];
+  else if(BBRcanUseKernel()) BBRcostGrad(mov, R0, R, pp, dof, grad, NULL);
+  else {
+    for(n=0; n < dof; n++){
+      // mm and deg for trans and rot, unitless for scale and shear
+      if(n < 6) h = 1e-2;
+      else      h = 1e-4;
+      pp[n] += h;
+      GetSurfCosts(mov, NULL, R0, R, pp, dof, costs);
+      cplus = costs[7];
+      pp[n] -= 2*h;
+      GetSurfCosts(mov, NULL, R0, R, pp, dof, costs);
+      grad[n] = (cplus-costs[7])/(2*h);
+      pp[n] += h;
+    }
+  }
+  for(n=0; n < dof; n++) g[n+1] = grad[n];
+}
+
+/*---------------------------------------------------------*/
+/*
+  MinLBFGS() - same as MinPowell() but minimizes with L-BFGS using
+  the gradient from compute_lbfgs_gradient(). Returns the status of
+  OpenDFPMin() (0 on success). params and costs are those of the last
+  accepted step even on failure, and *niters is always set.
+*/
+int MinLBFGS(MRI *mov, MRI *notused, MATRIX *R, double *params,
+	     int dof, double tol, double *costs, int *niters)
+{
+  MATRIX *R0;
+  float *pLBFGS, fret;
+  int n, err;
+
+  printf("Init L-BFGS Params dof = %d\n",dof);
+  pLBFGS = vector(1, dof) ;
+  for(n=0; n < dof; n++) {
+    pLBFGS[n+1] = params[n];
+    printf("%d %g\n",n,params[n]);
+  }
+  if(!BBRcanUseKernel())
+    printf("INFO: using finite differences for the gradient (vsm or non-trilinear interp)\n");
+
+  R0 = MatrixCopy(R,NULL);
+
+  // OpenDFPMin() leaves niters alone on some failures
+  *niters = 0;
+  fret = compute_powell_cost(pLBFGS);
+  err = OpenDFPMin(pLBFGS, dof, tol, niters, &fret, compute_powell_cost,
+		   compute_lbfgs_gradient, NULL, NULL, NULL);
+  if(err) printf("WARNING: L-BFGS failed with code %d\n",err);
+  printf("L-BFGS done niters = %d\n",*niters);
+
+  for(n=0; n < dof; n++) params[n] = pLBFGS[n+1];
+  GetSurfCosts(mov, NULL, R0, R, params, dof, costs);
+
+  MatrixFree(&R0);
+  free_vector(pLBFGS, 1, dof);
+  return(err) ;
+}
+
 /*-------------------------------------------------------*/
 double RelativeSurfCost(MRI *mov, MATRIX *R0)
 {
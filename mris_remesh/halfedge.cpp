@@ -0,0 +1,819 @@
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+#include "romp_support.h"
+
+#include "halfedge.h"
+
+using namespace std;
+
+
+/** Builds the half-edge structure from a triangle list.
+ Every undirected edge must be used by exactly two trias with opposite
+ orientation and every vertex fan must be a single closed disk, otherwise
+ false is returned. Unused vertices are kept but marked as deleted. */
+bool HalfEdgeMesh::build(const std::vector<Vector> &points, const std::vector<std::vector<int>> &tria)
+{
+  struct HalfRec { long long key; int from, to, slot; };
+
+  long long nv = points.size();
+  int nf = tria.size();
+  vector<HalfRec> recs(3 * nf);
+  for (int t = 0; t < nf; t++)
+  for (int i = 0; i < 3; i++)
+  {
+    int a = tria[t][i];
+    int b = tria[t][(i+1)%3];
+    if (a == b) return false;
+    recs[3*t+i].key  = a < b ? a * nv + b : b * nv + a;
+    recs[3*t+i].from = a;
+    recs[3*t+i].to   = b;
+    recs[3*t+i].slot = 3*t+i;
+  }
+  sort(recs.begin(), recs.end(), [](const HalfRec &r0, const HalfRec &r1) {
+    return r0.key < r1.key || (r0.key == r1.key && r0.from < r1.from);
+  });
+
+  // pairs of consecutive records must be the two opposite halves of one edge
+  if (recs.size() % 2 != 0) return false;
+  for (size_t k = 0; k < recs.size(); k += 2)
+  {
+    if (recs[k].key != recs[k+1].key || recs[k].from != recs[k+1].to) return false;
+    if (k + 2 < recs.size() && recs[k+2].key == recs[k].key) return false;
+  }
+
+  vector<int> slot(3 * nf);
+  hto.resize(recs.size());
+  hnext.resize(recs.size());
+  hface.resize(recs.size());
+  for (size_t h = 0; h < recs.size(); h++)
+  {
+    slot[recs[h].slot] = h;
+    hto[h] = recs[h].to;
+    hface[h] = recs[h].slot / 3;
+  }
+
+  pos = points;
+  vhe.assign(nv, -1);
+  fhe.resize(nf);
+  vector<int> nout(nv, 0);
+  for (int t = 0; t < nf; t++)
+  {
+    fhe[t] = slot[3*t];
+    for (int i = 0; i < 3; i++)
+    {
+      int h = slot[3*t+i];
+      hnext[h] = slot[3*t+(i+1)%3];
+      vhe[from(h)] = h;
+      nout[from(h)]++;
+    }
+  }
+
+  // a vertex fan that does not reach all outgoing half-edges is a non-manifold vertex
+  for (int v = 0; v < (int)nv; v++)
+  {
+    if (vhe[v] < 0) continue;
+    int n = 0;
+    int h = vhe[v];
+    do { n++; h = hnext[h ^ 1]; } while (h != vhe[v] && n <= nout[v]);
+    if (n != nout[v]) return false;
+  }
+
+  return true;
+}
+
+
+/** Writes the live vertices and faces, renumbered consecutively. */
+void HalfEdgeMesh::extract(std::vector<Vector> &points, std::vector<std::vector<int>> &tria) const
+{
+  vector<int> vmap(pos.size(), -1);
+  points.clear();
+  for (unsigned int v = 0; v < pos.size(); v++)
+  {
+    if (vhe[v] < 0) continue;
+    vmap[v] = points.size();
+    points.push_back(pos[v]);
+  }
+
+  tria.clear();
+  for (unsigned int f = 0; f < fhe.size(); f++)
+  {
+    int h = fhe[f];
+    if (h < 0) continue;
+    tria.push_back({ vmap[from(h)], vmap[hto[h]], vmap[hto[hnext[h]]] });
+  }
+}
+
+
+/** Drops deleted vertices, edges and faces from the pools. */
+void HalfEdgeMesh::compact()
+{
+  int nv = pos.size(), ne = nedges(), nf = fhe.size();
+  vector<int> vmap(nv, -1), emap(ne, -1), fmap(nf, -1);
+  int nv1 = 0, ne1 = 0, nf1 = 0;
+  for (int v = 0; v < nv; v++) if (vhe[v] >= 0) vmap[v] = nv1++;
+  for (int e = 0; e < ne; e++) if (edgeAlive(e)) emap[e] = ne1++;
+  for (int f = 0; f < nf; f++) if (fhe[f] >= 0) fmap[f] = nf1++;
+
+  auto hmap = [&emap](int h) { return 2 * emap[h >> 1] + (h & 1); };
+
+  vector<Vector> pos1(nv1);
+  vector<int> vhe1(nv1), fhe1(nf1), hto1(2*ne1), hnext1(2*ne1), hface1(2*ne1);
+  for (int v = 0; v < nv; v++)
+  {
+    if (vmap[v] < 0) continue;
+    pos1[vmap[v]] = pos[v];
+    vhe1[vmap[v]] = hmap(vhe[v]);
+  }
+  for (int f = 0; f < nf; f++)
+    if (fmap[f] >= 0) fhe1[fmap[f]] = hmap(fhe[f]);
+  for (int h = 0; h < 2*ne; h++)
+  {
+    if (emap[h >> 1] < 0) continue;
+    int h1 = hmap(h);
+    hto1[h1] = vmap[hto[h]];
+    hnext1[h1] = hmap(hnext[h]);
+    hface1[h1] = fmap[hface[h]];
+  }
+
+  pos.swap(pos1);
+  vhe.swap(vhe1);
+  fhe.swap(fhe1);
+  hto.swap(hto1);
+  hnext.swap(hnext1);
+  hface.swap(hface1);
+}
+
+
+double HalfEdgeMesh::getAverageEdgeLength() const
+{
+  double l = 0;
+  int n = 0;
+  for (int e = 0; e < nedges(); e++)
+  {
+    if (!edgeAlive(e)) continue;
+    l += edgeLength(e);
+    n++;
+  }
+  return n > 0 ? l / n : 0;
+}
+
+
+Vector HalfEdgeMesh::faceNormal(int f) const
+{
+  int h = fhe[f];
+  const Vector &p0 = pos[from(h)];
+  Vector n = cross(pos[hto[h]] - p0, pos[hto[hnext[h]]] - p0);
+  double len = n.norm();
+  if (len > 0) n *= 1.0 / len;
+  return n;
+}
+
+
+void HalfEdgeMesh::computeValences()
+{
+  valence.resize(pos.size());
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (int v = 0; v < (int)pos.size(); v++)
+  {
+    ROMP_PFLB_begin
+    int n = 0;
+    if (vhe[v] >= 0)
+    {
+      int h = vhe[v];
+      do { n++; h = hnext[h ^ 1]; } while (h != vhe[v]);
+    }
+    valence[v] = n;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+
+void HalfEdgeMesh::neighbors(int v, std::vector<int> &N) const
+{
+  N.clear();
+  int h = vhe[v];
+  do { N.push_back(hto[h]); h = hnext[h ^ 1]; } while (h != vhe[v]);
+}
+
+
+/** Locks all given vertices for the current pass, or none if one is taken. */
+bool HalfEdgeMesh::claim(const std::vector<int> &verts)
+{
+  for (unsigned int i = 0; i < verts.size(); i++)
+    if (lock[verts[i]] == stamp) return false;
+  for (unsigned int i = 0; i < verts.size(); i++)
+    lock[verts[i]] = stamp;
+  return true;
+}
+
+
+/** Greedily picks candidates (in the given priority order) whose lock sets
+ are disjoint. Without ring only the two trias at the edge are touched, so
+ their four vertices are locked; with ring the whole 1-ring of both edge
+ vertices is. */
+int HalfEdgeMesh::selectIndependent(const std::vector<int> &cand, bool ring, std::vector<int> &chosen)
+{
+  lock.resize(pos.size(), 0);
+  stamp++;
+  chosen.clear();
+  vector<int> verts, N;
+  for (unsigned int i = 0; i < cand.size(); i++)
+  {
+    int h = cand[i];
+    verts.clear();
+    if (ring)
+    {
+      neighbors(from(h), verts);
+      neighbors(hto[h], N);
+      verts.insert(verts.end(), N.begin(), N.end());
+    }
+    else
+    {
+      verts.push_back(from(h));
+      verts.push_back(hto[h]);
+      verts.push_back(hto[hnext[h]]);
+      verts.push_back(hto[hnext[h ^ 1]]);
+    }
+    if (claim(verts)) chosen.push_back(h);
+  }
+  return chosen.size();
+}
+
+
+/** Splits half-edge h (a->b, with trias (a,b,c) and (b,a,d)) at its midpoint.
+ The new vertex is v, the new edges e..e+2 and the new faces f, f+1. */
+void HalfEdgeMesh::split(int h, int v, int e, int f)
+{
+  int t  = h ^ 1;
+  int h1 = hnext[h], h2 = hnext[h1];   // b->c, c->a
+  int t1 = hnext[t], t2 = hnext[t1];   // a->d, d->b
+  int a = hto[t], b = hto[h], c = hto[h1], d = hto[t1];
+  int f0 = hface[h], f1 = hface[t];
+  int mb = 2*e,     bm = 2*e+1;
+  int mc = 2*(e+1), cm = 2*(e+1)+1;
+  int md = 2*(e+2), dm = 2*(e+2)+1;
+
+  pos[v] = 0.5 * (pos[a] + pos[b]);
+
+  // h becomes a->m, t becomes m->a
+  hto[h] = v;
+  hto[mb] = b; hto[bm] = v;
+  hto[mc] = c; hto[cm] = v;
+  hto[md] = d; hto[dm] = v;
+
+  // (a,m,c)
+  hnext[h] = mc; hnext[mc] = h2; hnext[h2] = h;
+  hface[h] = hface[mc] = hface[h2] = f0;
+  // (m,b,c)
+  hnext[mb] = h1; hnext[h1] = cm; hnext[cm] = mb;
+  hface[mb] = hface[h1] = hface[cm] = f;
+  // (m,a,d)
+  hnext[t] = t1; hnext[t1] = dm; hnext[dm] = t;
+  hface[t] = hface[t1] = hface[dm] = f1;
+  // (b,m,d)
+  hnext[bm] = md; hnext[md] = t2; hnext[t2] = bm;
+  hface[bm] = hface[md] = hface[t2] = f+1;
+
+  fhe[f0] = h; fhe[f] = mb; fhe[f1] = t; fhe[f+1] = bm;
+  vhe[v] = mb;
+  vhe[b] = h1;
+}
+
+
+/** Removes the chosen candidates, which are a subsequence of cand. */
+static void removeChosen(std::vector<int> &cand, const std::vector<int> &chosen)
+{
+  unsigned int k = 0, n = 0;
+  for (unsigned int i = 0; i < cand.size(); i++)
+  {
+    if (k < chosen.size() && cand[i] == chosen[k]) k++;
+    else cand[n++] = cand[i];
+  }
+  cand.resize(n);
+}
+
+
+/** Splits all edges longer than hi. Each pass splits an independent set of
+ the candidates; later passes only look at the candidates left over and the
+ edges created by the previous pass, as no other edge changes length. */
+int HalfEdgeMesh::splitLongEdges(double hi)
+{
+  if (verbose > 0) cout << "HalfEdgeMesh::splitLongEdges( " << hi << " )" << endl;
+  vector<vector<int>> found(omp_get_max_threads());
+  vector<pair<double,int>> q;
+  vector<int> cand, chosen;
+  int total = 0;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (int e = 0; e < nedges(); e++)
+  {
+    ROMP_PFLB_begin
+    if (edgeAlive(e) && edgeLength(e) > hi) found[omp_get_thread_num()].push_back(2*e);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+  for (unsigned int i = 0; i < found.size(); i++) cand.insert(cand.end(), found[i].begin(), found[i].end());
+
+  while (!cand.empty())
+  {
+    // longest first, as in insertVerticesOnLongEdgesQueue
+    q.resize(cand.size());
+    for (unsigned int i = 0; i < cand.size(); i++) q[i] = pair<double,int>(-edgeLength(cand[i] >> 1), cand[i]);
+    sort(q.begin(), q.end());
+    for (unsigned int i = 0; i < q.size(); i++) cand[i] = q[i].second;
+
+    int n = selectIndependent(cand, false, chosen);
+    int v0 = pos.size(), e0 = nedges(), f0 = fhe.size();
+    pos.resize(v0 + n);
+    vhe.resize(v0 + n);
+    fhe.resize(f0 + 2*n);
+    hto.resize(2*(e0 + 3*n));
+    hnext.resize(2*(e0 + 3*n));
+    hface.resize(2*(e0 + 3*n));
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+    for (int i = 0; i < n; i++)
+    {
+      ROMP_PFLB_begin
+      split(chosen[i], v0 + i, e0 + 3*i, f0 + 2*i);
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+    total += n;
+
+    removeChosen(cand, chosen);
+    for (int i = 0; i < n; i++)
+    {
+      if (edgeLength(chosen[i] >> 1) > hi) cand.push_back(chosen[i]);
+      for (int k = 0; k < 3; k++)
+        if (edgeLength(e0 + 3*i + k) > hi) cand.push_back(2*(e0 + 3*i + k));
+    }
+  }
+
+  if (verbose > 0) cout << "  " << total << " vertices inserted! " << endl;
+  return total;
+}
+
+
+/** Tests if half-edge h (a->b) can be collapsed into its midpoint:
+ the link condition must hold, no valence may drop below 3, no new edge
+ may be longer than hi and no remaining tria may flip its normal. */
+bool HalfEdgeMesh::canCollapse(int h, double hi, std::vector<int> &Na, std::vector<int> &Nb) const
+{
+  int t = h ^ 1;
+  int a = from(h), b = hto[h];
+  int c = hto[hnext[h]], d = hto[hnext[t]];
+  if (valence[a] <= 3 || valence[b] <= 3 || valence[c] <= 3 || valence[d] <= 3) return false;
+
+  neighbors(a, Na);
+  neighbors(b, Nb);
+  Vector midpoint = 0.5 * (pos[a] + pos[b]);
+  for (unsigned int i = 0; i < Na.size(); i++)
+    if (Na[i] != b && (pos[Na[i]] - midpoint).norm() > hi) return false;
+  for (unsigned int i = 0; i < Nb.size(); i++)
+    if (Nb[i] != a && (pos[Nb[i]] - midpoint).norm() > hi) return false;
+
+  sort(Na.begin(), Na.end());
+  sort(Nb.begin(), Nb.end());
+  unsigned int i = 0, j = 0;
+  int common = 0;
+  while (i < Na.size() && j < Nb.size())
+  {
+    if (Na[i] < Nb[j]) i++;
+    else if (Nb[j] < Na[i]) j++;
+    else { common++; i++; j++; }
+  }
+  if (common != 2) return false;
+
+  // same normal test as Remesher::contractEdge
+  double eps = cos(M_PI/3.0);
+  int f0 = hface[h], f1 = hface[t];
+  for (int k = 0; k < 2; k++)
+  {
+    int v = k == 0 ? a : b;
+    int g = vhe[v];
+    do
+    {
+      int f = hface[g];
+      if (f != f0 && f != f1)
+      {
+        Vector tn = cross(pos[hto[g]] - midpoint, pos[hto[hnext[g]]] - midpoint);
+        double len = tn.norm();
+        if (len == 0 || tn * faceNormal(f) / len < eps) return false;
+      }
+      g = hnext[g ^ 1];
+    } while (g != vhe[v]);
+  }
+
+  return true;
+}
+
+
+/** Collapses half-edge h (a->b, with trias (a,b,c) and (b,a,d)) into its
+ midpoint. Vertex a, both trias and the edges a-b, b-c and d-b are deleted;
+ c-a and a-d take over the places of c-b and b-d. */
+void HalfEdgeMesh::collapse(int h)
+{
+  int t  = h ^ 1;
+  int h1 = hnext[h], h2 = hnext[h1];   // b->c, c->a
+  int t1 = hnext[t], t2 = hnext[t1];   // a->d, d->b
+  int a = hto[t], b = hto[h], c = hto[h1], d = hto[t1];
+  int o1 = h1 ^ 1;                     // c->b
+  int q2 = t2 ^ 1;                     // b->d
+  int po1 = prev(o1), pq2 = prev(q2);
+
+  pos[b] = 0.5 * (pos[a] + pos[b]);
+
+  int g = vhe[a];
+  do { hto[g ^ 1] = b; g = hnext[g ^ 1]; } while (g != vhe[a]);
+
+  hnext[po1] = h2; hnext[h2] = hnext[o1]; hface[h2] = hface[o1];
+  if (fhe[hface[o1]] == o1) fhe[hface[o1]] = h2;
+  hnext[pq2] = t1; hnext[t1] = hnext[q2]; hface[t1] = hface[q2];
+  if (fhe[hface[q2]] == q2) fhe[hface[q2]] = t1;
+
+  fhe[hface[h]] = -1;
+  fhe[hface[t]] = -1;
+  hto[h] = hto[t] = -1;
+  hto[h1] = hto[o1] = -1;
+  hto[t2] = hto[q2] = -1;
+
+  vhe[a] = -1;
+  vhe[b] = h2 ^ 1;
+  vhe[c] = h2;
+  vhe[d] = t1 ^ 1;
+  valence[b] += valence[a] - 4;
+  valence[c]--;
+  valence[d]--;
+  valence[a] = 0;
+}
+
+
+/** Collapses edges shorter than lo. A collapse only changes the trias at
+ the kept vertex and the valences of the vertices at the edge, so later
+ passes look at the valid candidates left over and recheck only the short
+ edges whose canCollapse outcome could have changed. */
+int HalfEdgeMesh::collapseShortEdges(double lo, double hi)
+{
+  if (verbose > 0) cout << "HalfEdgeMesh::collapseShortEdges( " << lo << " , " << hi << " )" << endl;
+  int nthreads = omp_get_max_threads();
+  vector<vector<int>> found(nthreads);
+  vector<vector<int>> Na(nthreads), Nb(nthreads);
+  vector<pair<double,int>> q;
+  vector<int> edges, cand, chosen, moved, ring;
+  vector<char> state(nedges(), 0);  // 0 unknown, 1 cannot collapse, 2 can
+  int total = 0;
+
+  computeValences();
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (int e = 0; e < nedges(); e++)
+  {
+    ROMP_PFLB_begin
+    if (edgeAlive(e) && edgeLength(e) < lo) found[omp_get_thread_num()].push_back(e);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+  for (unsigned int i = 0; i < found.size(); i++) edges.insert(edges.end(), found[i].begin(), found[i].end());
+  sort(edges.begin(), edges.end());
+
+  while (!edges.empty())
+  {
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+    for (int i = 0; i < (int)edges.size(); i++)
+    {
+      ROMP_PFLB_begin
+      int tid = omp_get_thread_num();
+      if (state[edges[i]] == 0) state[edges[i]] = canCollapse(2*edges[i], hi, Na[tid], Nb[tid]) ? 2 : 1;
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    // shortest first, as in contractShortEdgesQueue
+    q.clear();
+    for (unsigned int i = 0; i < edges.size(); i++)
+      if (state[edges[i]] == 2) q.push_back(pair<double,int>(edgeLength(edges[i]), 2*edges[i]));
+    if (q.empty()) break;
+    sort(q.begin(), q.end());
+    cand.resize(q.size());
+    for (unsigned int i = 0; i < q.size(); i++) cand[i] = q[i].second;
+
+    int n = selectIndependent(cand, true, chosen);
+    moved.resize(3*n);
+    for (int i = 0; i < n; i++)
+    {
+      int h = chosen[i];
+      moved[3*i]   = hto[h];
+      moved[3*i+1] = hto[hnext[h]];
+      moved[3*i+2] = hto[hnext[h ^ 1]];
+    }
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+    for (int i = 0; i < n; i++)
+    {
+      ROMP_PFLB_begin
+      collapse(chosen[i]);
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+    total += n;
+
+    // valid candidates left over stay valid unless a collapse changed them
+    removeChosen(cand, chosen);
+    edges.clear();
+    for (unsigned int i = 0; i < cand.size(); i++)
+      if (edgeAlive(cand[i] >> 1) && edgeLength(cand[i] >> 1) < lo) edges.push_back(cand[i] >> 1);
+    for (int i = 0; i < 3*n; i++)
+    {
+      int v = moved[i];
+      if (i % 3 == 0)
+      {
+        // b moved and all trias that changed are at b: recheck the edges at b and its ring
+        neighbors(v, ring);
+        ring.push_back(v);
+        for (unsigned int j = 0; j < ring.size(); j++)
+        {
+          int g = vhe[ring[j]];
+          do
+          {
+            state[g >> 1] = 0;
+            if (edgeLength(g >> 1) < lo) edges.push_back(g >> 1);
+            g = hnext[g ^ 1];
+          } while (g != vhe[ring[j]]);
+        }
+      }
+      else
+      {
+        // c and d lost one valence: recheck the edges opposite to them
+        int g = vhe[v];
+        do
+        {
+          int e = hnext[g] >> 1;
+          state[e] = 0;
+          if (edgeLength(e) < lo) edges.push_back(e);
+          g = hnext[g ^ 1];
+        } while (g != vhe[v]);
+      }
+    }
+    sort(edges.begin(), edges.end());
+    edges.erase(unique(edges.begin(), edges.end()), edges.end());
+  }
+
+  if (verbose > 0) cout << "  " << total << " edges contracted" << endl;
+  return total;
+}
+
+
+/** Tests if flipping half-edge h (a->b) to c-d reduces the deviation of the
+ four valences from 6 without folding the two trias over. */
+bool HalfEdgeMesh::flipGain(int h) const
+{
+  int t = h ^ 1;
+  int a = from(h), b = hto[h];
+  int c = hto[hnext[h]], d = hto[hnext[t]];
+  if (c == d || valence[a] <= 3 || valence[b] <= 3) return false;
+
+  int before = abs(valence[a] - 6) + abs(valence[b] - 6) + abs(valence[c] - 6) + abs(valence[d] - 6);
+  int after  = abs(valence[a] - 7) + abs(valence[b] - 7) + abs(valence[c] - 5) + abs(valence[d] - 5);
+  if (after >= before) return false;
+
+  // c-d must not be an edge already
+  int g = vhe[c];
+  do { if (hto[g] == d) return false; g = hnext[g ^ 1]; } while (g != vhe[c]);
+
+  Vector n = faceNormal(hface[h]) + faceNormal(hface[t]);
+  Vector n0 = cross(pos[a] - pos[c], pos[d] - pos[c]);
+  Vector n1 = cross(pos[c] - pos[b], pos[d] - pos[b]);
+  double eps = cos(M_PI/3.0);
+  double l0 = n0.norm(), l1 = n1.norm(), l = n.norm();
+  if (l0 == 0 || l1 == 0 || l == 0) return false;
+  return n0 * n / (l0 * l) >= eps && n1 * n / (l1 * l) >= eps;
+}
+
+
+/** Flips half-edge h (a->b, with trias (a,b,c) and (b,a,d)) to d->c,
+ giving trias (c,a,d) and (b,c,d). */
+void HalfEdgeMesh::flip(int h)
+{
+  int t  = h ^ 1;
+  int h1 = hnext[h], h2 = hnext[h1];   // b->c, c->a
+  int t1 = hnext[t], t2 = hnext[t1];   // a->d, d->b
+  int a = hto[t], b = hto[h], c = hto[h1], d = hto[t1];
+  int f0 = hface[h], f1 = hface[t];
+
+  hto[h] = c;
+  hto[t] = d;
+  hnext[h2] = t1; hnext[t1] = h; hnext[h] = h2;
+  hface[h2] = hface[t1] = hface[h] = f0;
+  hnext[h1] = t; hnext[t] = t2; hnext[t2] = h1;
+  hface[h1] = hface[t] = hface[t2] = f1;
+
+  fhe[f0] = h;
+  fhe[f1] = t;
+  vhe[a] = t1;
+  vhe[b] = h1;
+  valence[a]--;
+  valence[b]--;
+  valence[c]++;
+  valence[d]++;
+}
+
+
+/** Flips edges while that lowers the valence deviation. A flip only changes
+ the valences of its four vertices, so later passes look at the candidates
+ left over and the edges of the trias at those vertices. */
+int HalfEdgeMesh::flipEdges()
+{
+  if (verbose > 0) cout << "HalfEdgeMesh::flipEdges()" << endl;
+  vector<int> edges, ok, cand, chosen;
+  int total = 0;
+
+  computeValences();
+  edges.resize(nedges());
+  for (int e = 0; e < nedges(); e++) edges[e] = e;
+
+  // every flip strictly lowers the total valence deviation, so this terminates
+  while (!edges.empty())
+  {
+    ok.resize(edges.size());
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+    for (int i = 0; i < (int)edges.size(); i++)
+    {
+      ROMP_PFLB_begin
+      ok[i] = edgeAlive(edges[i]) && flipGain(2*edges[i]);
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    cand.clear();
+    for (unsigned int i = 0; i < edges.size(); i++)
+      if (ok[i]) cand.push_back(2*edges[i]);
+    if (cand.empty()) break;
+
+    int n = selectIndependent(cand, false, chosen);
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+    for (int i = 0; i < n; i++)
+    {
+      ROMP_PFLB_begin
+      flip(chosen[i]);
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+    total += n;
+
+    removeChosen(cand, chosen);
+    edges.clear();
+    for (unsigned int i = 0; i < cand.size(); i++) edges.push_back(cand[i] >> 1);
+    for (int i = 0; i < n; i++)
+    {
+      int h = chosen[i];
+      int quad[4] = { from(h), hto[h], hto[hnext[h]], hto[hnext[h ^ 1]] };
+      for (int j = 0; j < 4; j++)
+      {
+        int g = vhe[quad[j]];
+        do
+        {
+          edges.push_back(g >> 1);
+          edges.push_back(hnext[g] >> 1);
+          g = hnext[g ^ 1];
+        } while (g != vhe[quad[j]]);
+      }
+    }
+    sort(edges.begin(), edges.end());
+    edges.erase(unique(edges.begin(), edges.end()), edges.end());
+  }
+
+  if (verbose > 0) cout << "  " << total << " edges flipped" << endl;
+  return total;
+}
+
+
+/** Area weighted tangential smoothing as in Remesher::tangentialSmoothing
+ with gravity and tangent set, but all vertices are updated from the
+ previous positions (Jacobi instead of in-place), so it runs in parallel. */
+void HalfEdgeMesh::tangentialSmoothing(int it)
+{
+  if (verbose > 0) cout << "HalfEdgeMesh::tangentialSmoothing( " << it << " )" << endl;
+  int nv = pos.size(), nf = fhe.size();
+  vector<double> farea(nf), A(nv);
+  vector<Vector> fn(nf), npos(nv);
+
+  for (int run = 0; run < it; run++)
+  {
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+    for (int f = 0; f < nf; f++)
+    {
+      ROMP_PFLB_begin
+      if (fhe[f] >= 0)
+      {
+        int h = fhe[f];
+        const Vector &p0 = pos[from(h)];
+        Vector n = cross(pos[hto[h]] - p0, pos[hto[hnext[h]]] - p0);
+        double len = n.norm();
+        farea[f] = 0.5 * len;
+        fn[f] = len > 0 ? (1.0 / len) * n : n;
+      }
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+    for (int v = 0; v < nv; v++)
+    {
+      ROMP_PFLB_begin
+      A[v] = 0;
+      if (vhe[v] >= 0)
+      {
+        int h = vhe[v];
+        do { A[v] += farea[hface[h]] / 3.0; h = hnext[h ^ 1]; } while (h != vhe[v]);
+      }
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+    for (int v = 0; v < nv; v++)
+    {
+      ROMP_PFLB_begin
+      npos[v] = pos[v];
+      if (vhe[v] >= 0)
+      {
+        Vector gi(0,0,0), n(0,0,0);
+        double d = 0;
+        int h = vhe[v];
+        do
+        {
+          d += A[hto[h]];
+          gi += A[hto[h]] * pos[hto[h]];
+          n += fn[hface[h]];
+          h = hnext[h ^ 1];
+        } while (h != vhe[v]);
+        double len = n.norm();
+        if (d > 0 && len > 0)
+        {
+          // update into tangent plane
+          double lambda = 0.99; // damping factor
+          n *= 1.0 / len;
+          Vector u = (1.0/d) * gi - pos[v];
+          npos[v] = pos[v] + lambda * (u - (u * n) * n);
+        }
+      }
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    pos.swap(npos);
+  }
+}
+
+
+/** Remeshing by Botsch and Kobbelt 2004, one iteration at target length l. */
+void HalfEdgeMesh::remeshBK(double l)
+{
+  // 1. Split edges at midpoint that are longer than 4/3 l
+  splitLongEdges(l*4.0/3.0);
+
+  // 2. Collapse edges shorter than 4/5 l into midpoint
+  collapseShortEdges(l*4.0/5.0, l*4.0/3.0);
+  compact();
+
+  // 3. Flip edges to optimize valence
+  flipEdges();
+
+  // 4. Tangential Smoothing
+  tangentialSmoothing(2);
+}
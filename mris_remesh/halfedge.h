@@ -0,0 +1,71 @@
+#pragma once
+
+#include <vector>
+
+#include "remesher.h"
+
+
+// -------- Half-Edge Mesh --------
+
+/*
+  Pooled half-edge storage for closed, consistently oriented 2-manifold
+  triangle meshes. Edge e owns the half-edges 2e and 2e+1, so the twin of h
+  is h^1 and never has to be updated. Elements live in flat arrays that only
+  grow during a pass; deleted elements are marked with -1 and dropped by
+  compact(). Every operation touches only the faces spanned by a set of
+  locked vertices, so operations with disjoint lock sets can run in parallel,
+  and new elements are numbered from the selection order, so the result does
+  not depend on the number of threads.
+*/
+class HalfEdgeMesh
+{
+public:
+
+  // returns false if the input is not a closed, consistently oriented manifold
+  bool build(const std::vector<Vector> &points, const std::vector<std::vector<int>> &tria);
+  void extract(std::vector<Vector> &points, std::vector<std::vector<int>> &tria) const;
+
+  // one Botsch-Kobbelt iteration at target edge length l
+  void remeshBK(double l);
+
+  int splitLongEdges(double hi);
+  int collapseShortEdges(double lo, double hi);
+  int flipEdges();
+  void tangentialSmoothing(int it = 1);
+
+  void compact();
+  double getAverageEdgeLength() const;
+
+  int verbose = 0;
+
+private:
+  std::vector<Vector> pos;
+  std::vector<int> vhe;      // one outgoing half-edge per vertex, -1 if deleted
+  std::vector<int> fhe;      // one half-edge per face, -1 if deleted
+  std::vector<int> hto;      // target vertex per half-edge, -1 if the edge is deleted
+  std::vector<int> hnext;
+  std::vector<int> hface;
+
+  std::vector<int> valence;
+  std::vector<int> lock;
+  int stamp = 0;
+
+  int from(int h) const { return hto[h ^ 1]; }
+  int prev(int h) const { return hnext[hnext[h]]; }
+  int nedges() const { return hto.size() / 2; }
+  bool edgeAlive(int e) const { return hto[2 * e] >= 0; }
+  double edgeLength(int e) const { return (pos[hto[2 * e]] - pos[hto[2 * e + 1]]).norm(); }
+  Vector faceNormal(int f) const;
+
+  void computeValences();
+  void neighbors(int v, std::vector<int> &N) const;
+  bool claim(const std::vector<int> &verts);
+  int selectIndependent(const std::vector<int> &cand, bool ring, std::vector<int> &chosen);
+
+  bool canCollapse(int h, double hi, std::vector<int> &Na, std::vector<int> &Nb) const;
+  bool flipGain(int h) const;
+
+  void split(int h, int v, int e, int f);
+  void collapse(int h);
+  void flip(int h);
+};
@@ -19,6 +19,7 @@ int main(int argc, char **argv)
   parser.addArgument("--desired-face-area", 1, Float);
   // optional
   parser.addArgument("--iters", 1, Int);
+  parser.addArgument("--parallel");
   parser.parse(argc, argv);
 
   // read input surface
@@ -34,6 +35,7 @@ int main(int argc, char **argv)
 
   // init the remesher
   Remesher remesher = Remesher(surf);
+  remesher.parallel = parser.exists("parallel");
 
   // quick sanity check to make sure only one remesh method was specified
   int numtargets = int(parser.exists("remesh")) +
@@ -7,6 +7,7 @@
 #include <utility>
 
 #include "remesher.h"
+#include "halfedge.h"
 
 using namespace std;
 
@@ -390,8 +391,18 @@ void Remesher::remeshBK(unsigned int it, double l, bool ridge)
 
   std::cout << "remeshing to edge length " << l << " with " << it << " iterations" << std::endl;
 
+  // if asked for, closed manifolds run the passes in parallel on the half-edge core
+  HalfEdgeMesh hem;
+  hem.verbose = verbose;
+  bool halfedge = parallel && !ridge && hem.build(points3d, tria);
+  if (halfedge)
+  {
+    for (unsigned int ii = 0; ii<it; ii++) hem.remeshBK(l);
+    hem.extract(points3d, tria);
+  }
+
   // loop through iterations
-  for (unsigned int ii = 0; ii<it; ii++)
+  for (unsigned int ii = 0; !halfedge && ii<it; ii++)
   {
     // 1. Split edges at midpoint that are longer than 4/3 l
     while ( insertVerticesOnLongEdgesQueue(l*4.0/3.0) > 0) {};
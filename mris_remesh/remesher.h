@@ -278,6 +278,11 @@ public:
   
   int verbose = 0;
 
+  // remeshBK runs closed manifolds on the parallel HalfEdgeMesh core, which
+  // also flips edges, smooths from the previous positions and rejects
+  // collapses that create edges longer than 4/3 l, so the output differs
+  bool parallel = false;
+
 private:
   std::vector<Vector> points3d;
   std::vector<std::vector<int>> tria;
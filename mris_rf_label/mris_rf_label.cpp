@@ -66,8 +66,8 @@ main(int argc, char *argv[]) {
   Timer start ;
   LABEL         *cortex_label, *training_label ;
   RANDOM_FOREST *rf ;
-  double        *feature, pval ;
-  int           classnum ;
+  double        *feature, pval, **features, *pvals ;
+  int           classnum, *classes, *vnos, nvectors, n ;
   MRI_SURFACE   *mris ;
   MRI           *mri_labels ;
   VERTEX        *v ;
@@ -154,14 +154,41 @@ main(int argc, char *argv[]) {
   }
   mri_labels = MRIallocSequence(mris->nvertices, 1, 1, MRI_FLOAT, 2) ;
   nfeatures = noverlays*(nbhd_size+1) ;
-  feature = (double *)calloc(nfeatures, sizeof(double)) ;
-  for (vno = 0 ; vno < mris->nvertices ; vno++)
+  // classify all the unripped vertices in one batch
+  features = (double **)calloc(mris->nvertices, sizeof(double *)) ;
+  classes = (int *)calloc(mris->nvertices, sizeof(int)) ;
+  pvals = (double *)calloc(mris->nvertices, sizeof(double)) ;
+  vnos = (int *)calloc(mris->nvertices, sizeof(int)) ;
+  if (features == NULL || classes == NULL || pvals == NULL || vnos == NULL)
+    ErrorExit(ERROR_NOMEMORY, "%s: could not allocate %d feature vectors", Progname, mris->nvertices) ;
+  for (nvectors = vno = 0 ; vno < mris->nvertices ; vno++)
   {
     v = &mris->vertices[vno] ; 
     if (v->ripflag)
       continue ;
+    feature = (double *)calloc(nfeatures, sizeof(double)) ;
+    if (feature == NULL)
+      ErrorExit(ERROR_NOMEMORY, "%s: could not allocate feature vector %d", Progname, vno) ;
     for (i = 0 ; i < noverlays ; i++)
       feature[i] = MRIgetVoxVal(mri_overlays[i], vno, 0, 0, 0) ;
+    vnos[nvectors] = vno ;
+    features[nvectors++] = feature ;
+  }
+  if (RFclassifyBatch(rf, features, nvectors, classes, pvals) != NO_ERROR)
+  {
+    // the batch classifier can't handle this forest, so fall back to one vertex at a time
+    printf("classifying %d vertices one at a time\n", nvectors) ;
+    for (n = 0 ; n < nvectors ; n++)
+      classes[n] = RFclassify(rf, features[n], &pvals[n], mris->vertices[vnos[n]].marked);
+  }
+
+  for (n = 0 ; n < nvectors ; n++)
+  {
+    vno = vnos[n] ;
+    v = &mris->vertices[vno] ; 
+    feature = features[n] ;
+    classnum = classes[n] ;
+    pval = pvals[n] ;
     if (vno == Gdiag_no)
     {
       printf("classifying vertex %d\n", vno) ;
@@ -169,11 +196,7 @@ main(int argc, char *argv[]) {
 	printf("\t%s: %2.1f\n", rf->feature_names[i], feature[i]) ;
       Gdiag |= DIAG_VERBOSE ;
       DiagBreak() ;
-    }
-
-    classnum = RFclassify(rf, feature, &pval, v->marked);
-    if (vno == Gdiag_no)
-    {
+      classnum = RFclassify(rf, feature, &pval, v->marked);  // for the per-tree diagnostics
       printf("\tclass = %d, pval = %2.2f\n", classnum, pval) ;
       Gdiag &= ~DIAG_VERBOSE ;
       DiagBreak() ;
@@ -184,7 +207,12 @@ main(int argc, char *argv[]) {
     if (classnum == 0)
       pval = 1-pval ;
     MRIsetVoxVal(mri_labels, vno, 0, 0, 1, pval) ;
+    free(feature) ;
   }
+  free(features) ;
+  free(classes) ;
+  free(pvals) ;
+  free(vnos) ;
 
   LabelFree(&cortex_label) ;
   if (training_label)
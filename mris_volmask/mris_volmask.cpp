@@ -4,7 +4,7 @@
  * Uses the 4 surfaces of a scan to construct a mask volume showing the
  * position of each voxel with respect to the surfaces - GM, WM, LH or RH.
  *
- * Uses the MRISOBBTree algorithm
+ * Uses narrow-band signed distance fields to the surfaces
  */
 /*
  * Original Author: Krish Subramaniam
@@ -22,13 +22,13 @@
  */
 
 // STL
+#include <algorithm>
 #include <string>
 #include <iostream>
 #include <iomanip>
 #include <cstdio>
 #include <vector>
 
-#include "MRISOBBTree.h"
 #include "MRISdistancefield.h"
 #include "fastmarching.h"
 #include "cmd_line_interface.h"
@@ -53,8 +53,6 @@
 ;
 const char *Progname;
 
-typedef Math::Point<int> Pointd;
-
 // static function declarations
 // forward declaration
 struct IoParams;
@@ -241,22 +239,30 @@ main(int ac, char* av[])
   MRI* maskLeftHemi=NULL;
   MRI* maskRightHemi=NULL;
 
+  // the distance fields are parallel themselves, so when the hemis run
+  // in parallel each one gets half of the threads
+  int nthreads_hemi = 1, nthreads_dist = 1;
 #ifdef _OPENMP
+  nthreads_dist = omp_get_max_threads();
   if (params.bParallel){
     printf("Running hemis in parallel\n");
-    omp_set_num_threads(2);
+    nthreads_hemi = 2;
+    nthreads_dist = std::max(1, nthreads_dist / 2);
+    omp_set_max_active_levels(2);
   }
   else{
     printf("Running hemis serially\n");
-    omp_set_num_threads(1);
   }
 #endif
 
   int hemi;
   #ifdef HAVE_OPENMP
-  #pragma omp parallel for 
+  #pragma omp parallel for num_threads(nthreads_hemi)
   #endif
   for(hemi=0; hemi < 2; hemi ++){
+#ifdef _OPENMP
+    omp_set_num_threads(nthreads_dist);
+#endif
     if(hemi == 0 && params.DoLH){
       /*  Process LEFT hemisphere */
       printf("Processing left hemi\n"); fflush(stdout);
@@ -663,140 +669,12 @@ ComputeSurfaceDistanceFunction(MRIS* mris,
                                MRI* mri_distfield,
                                float thickness)
 {
-  int res;
-  MRI *mri_visited, *_mridist;
-  _mridist  = MRIclone(mri_distfield, NULL);
-  mri_visited  = MRIcloneDifferentType(mri_distfield, MRI_INT);
-
   // Convert surface vertices to vox space
   Math::ConvertSurfaceRASToVoxel(mris, mri_distfield);
 
-  // Find the distance field
-  MRISDistanceField *distfield = new MRISDistanceField(mris, _mridist);
-  distfield->SetMaxDistance(thickness);
-  distfield->Generate(); //mri_dist now has the distancefield
-
-  // Construct the OBB Tree
-  MRISOBBTree* OBBTree = new MRISOBBTree(mris);
-  OBBTree->ConstructTree();
-
-  std::queue<Pointd* > ptsqueue;
-  // iterate through all the volume points
-  // and apply sign
-  for(int i=0; i< mri_distfield->width; i++)
-  {
-    //std::cerr << i <<" ";
-    for(int j=0; j< mri_distfield->height; j++)
-    {
-      for(int k=0; k< mri_distfield->depth; k++)
-      {
-        if ( MRIIvox(mri_visited, i, j, k ))
-        {
-          continue;
-        }
-        res = OBBTree->PointInclusionTest(i, j, k);
-        Pointd *pt = new Pointd;
-        pt->v[0] = i;
-        pt->v[1] = j;
-        pt->v[2] = k;
-        ptsqueue.push( pt );
-
-        // First serve all the points in the queue before going to the next voxel
-        while ( !ptsqueue.empty() )
-        {
-          // serve the front and pop it
-          Pointd *p = ptsqueue.front();
-          const int x = p->v[0];
-          const int y = p->v[1];
-          const int z = p->v[2];
-          delete p;
-          ptsqueue.pop();
-
-          if ( MRIIvox(mri_visited, x, y, z) )
-          {
-            continue;
-          }
-          MRIIvox(mri_visited, x, y, z) =  res;
-          const float dist = MRIFvox(_mridist, x, y, z);
-          MRIFvox(_mridist, x, y, z) =  dist*res;
-
-          // mark its 6 neighbors if distance > 1 ( triangle inequality )
-          if ( dist > 1 )
-          {
-            // left neighbor in x
-            if ( x>0 && !MRIIvox(mri_visited, x-1, y, z))
-            {
-              Pointd *ptemp = new Pointd;
-              ptemp->v[0]   = x - 1;
-              ptemp->v[1]   = y;
-              ptemp->v[2]   = z;
-              ptsqueue.push(ptemp);
-            }
-            // bottom neighbor in y
-            if ( y>0 && !MRIIvox(mri_visited, x, y-1, z))
-            {
-              Pointd *ptemp = new Pointd;
-              ptemp->v[0]   = x;
-              ptemp->v[1]   = y - 1;
-              ptemp->v[2]   = z;
-              ptsqueue.push(ptemp);
-            }
-            // front neighbor in z
-            if ( z>0 && !MRIIvox(mri_visited, x, y, z-1))
-            {
-              Pointd *ptemp = new Pointd;
-              ptemp->v[0]   = x;
-              ptemp->v[1]   = y;
-              ptemp->v[2]   = z - 1;
-              ptsqueue.push(ptemp);
-            }
-            // right neighbor in x
-            if ( x<mri_visited->width-1 && !MRIIvox(mri_visited, x+1, y, z))
-            {
-              Pointd *ptemp = new Pointd;
-              ptemp->v[0]   = x + 1;
-              ptemp->v[1]   = y;
-              ptemp->v[2]   = z;
-              ptsqueue.push(ptemp);
-            }
-            // top neighbor in y
-            if ( y<mri_visited->height-1 && !MRIIvox(mri_visited, x, y+1, z))
-            {
-              Pointd *ptemp = new Pointd;
-              ptemp->v[0]   = x;
-              ptemp->v[1]   = y + 1;
-              ptemp->v[2]   = z;
-              ptsqueue.push(ptemp);
-            }
-            // back neighbor in z
-            if ( z<mri_visited->depth-1 && !MRIIvox(mri_visited, x, y, z+1))
-            {
-              Pointd *ptemp = new Pointd;
-              ptemp->v[0]   = x;
-              ptemp->v[1]   = y;
-              ptemp->v[2]   = z + 1;
-              ptsqueue.push(ptemp);
-            }
-          }
-        }
-      }
-    }
-  }
-  for(int i=0; i< mri_distfield->width; i++)
-  {
-    for(int j=0; j< mri_distfield->height; j++)
-    {
-      for(int k=0; k< mri_distfield->depth; k++)
-      {
-        MRIFvox(mri_distfield, i, j, k) = MRIFvox(_mridist, i, j, k);
-      }
-    }
-  }
+  // Find the signed distance field, positive inside the surface
+  MRISdistancefield(mris, mri_distfield, thickness, 1);
 
-  MRIfree(&mri_visited);
-  MRIfree(&_mridist);
-  delete OBBTree;
-  delete distfield;
   return(mri_distfield);
 }
 
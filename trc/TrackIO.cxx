@@ -88,6 +88,14 @@ bool CTrackIO::GetHeader(TRACK_HEADER* header)
 	return true;
 }
 
+// Reads and writes go through a large stdio buffer, so that the many small
+// freads/fwrites of a track file do not each hit the disk.
+void CTrackIO::SetFileBuffer()
+{
+	m_fileBuffer.resize(TRACK_IO_BUFFER_SIZE);
+	setvbuf(m_pFile, &m_fileBuffer[0], _IOFBF, m_fileBuffer.size());
+}
+
 bool CTrackIO::Close()
 {
 	bool ret = true;
@@ -122,12 +130,14 @@ bool CTrackReader::Open(const char* filename, TRACK_HEADER* header)
 	Close();
 	m_nErrorCode = TE_NO_ERROR;
 	m_bOldFormat = false;
+	m_trackOffsets.clear();
 	m_pFile = fopen(filename, "rb");
 	if (!m_pFile)
 	{
 		m_nErrorCode = TE_CAN_NOT_OPEN;
 		return false;
 	}
+	SetFileBuffer();
 
 	fseek(m_pFile, 0, SEEK_END);
 	m_nSize = ftell(m_pFile);
@@ -280,6 +290,11 @@ bool CTrackReader::GetNextRawData(int nCount, float* data)
 		return false;
 	}
 	int nSize = (3+m_header.n_scalars)*nCount + m_header.n_properties;
+	if (nSize == 0)
+	{
+		m_nErrorCode = TE_NO_ERROR;
+		return true;
+	}
 	if (fread(data, sizeof(float)*nSize, 1, m_pFile) != 1)
 		m_nErrorCode = TE_CAN_NOT_READ;
 	else
@@ -303,48 +318,54 @@ bool CTrackReader::GetNextTrackData(int nCount, float* pt_data, float* scalars,
 	if (m_header.n_scalars == 0 && m_header.n_properties == 0)
 		return GetNextRawData(nCount, pt_data);
 
-	// read point and scalar data
-	for (int i = 0; i < nCount; i++)
+	// read the whole record at once, then split it into points, scalars
+	// and properties. The properties are consumed even if not wanted, so
+	// that the next GetNextPointCount() starts at the next track.
+	int nStride = 3 + m_header.n_scalars;
+	m_trackBuffer.resize(nStride*nCount + m_header.n_properties);
+	if (!GetNextRawData(nCount, m_trackBuffer.data()))
+		return false;
+
+	const float* rec = m_trackBuffer.data();
+	for (int i = 0; i < nCount; i++, rec += nStride)
 	{
-		if (fread(pt_data+i*3, sizeof(float)*3, 1, m_pFile) != 1)
-		{
-			m_nErrorCode = TE_CAN_NOT_READ;
-			break;
-		}
+		memcpy(pt_data+i*3, rec, sizeof(float)*3);
 		if (m_header.n_scalars && scalars)
-		{
-			if (fread(scalars+i*m_header.n_scalars, sizeof(float)*m_header.n_scalars, 1, m_pFile) != 1)
-			{
-				m_nErrorCode = TE_CAN_NOT_READ;
-				break;
-			}
-		}
-		else
-		{
-			fseek(m_pFile, sizeof(float)*m_header.n_scalars, SEEK_CUR);
-		}
-	}
-	if (!m_nErrorCode && m_bByteSwap)
-	{
-		SWAP_FLOAT(pt_data, nCount*3);
-		if (scalars)
-			SWAP_FLOAT(scalars, nCount*m_header.n_scalars);
-	}
-	
-	// read property data
-	if (m_header.n_properties && properties && 
-		fread(properties, sizeof(float)*m_header.n_properties, 1, m_pFile) != 1)
-	{
-		m_nErrorCode = TE_CAN_NOT_READ;
+			memcpy(scalars+i*m_header.n_scalars, rec+3, sizeof(float)*m_header.n_scalars);
 	}
-	
-	if (!m_nErrorCode && m_bByteSwap)
+	if (m_header.n_properties && properties)
+		memcpy(properties, rec, sizeof(float)*m_header.n_properties);
+
+	return true;
+}
+
+// Batched reading: reads up to nmax tracks at the current position into one
+// buffer. Track i has counts[i] points and its raw record (points with their
+// scalars, then properties, as returned by GetNextRawData()) starts at
+// data[starts[i]]. The records do not overlap, so they can be processed in
+// parallel. Returns the number of tracks read, 0 at the end of the file.
+int CTrackReader::GetNextTrackBatch(int nmax, std::vector<int>& counts, std::vector<size_t>& starts, 
+	std::vector<float>& data)
+{
+	counts.clear();
+	starts.clear();
+	data.clear();
+
+	int n;
+	while ((int)counts.size() < nmax && GetNextPointCount(&n))
 	{
-		if (properties)
-			SWAP_FLOAT(properties, m_header.n_properties);
+		size_t start = data.size();
+		data.resize(start + (3+m_header.n_scalars)*n + m_header.n_properties);
+		if (!GetNextRawData(n, data.data()+start))
+		{
+			data.resize(start);
+			break;
+		}
+		counts.push_back(n);
+		starts.push_back(start);
 	}
 
-	return m_nErrorCode == TE_NO_ERROR;
+	return counts.size();
 }
 
 // Static function. Get header info from a given track file directly
@@ -357,8 +378,53 @@ bool CTrackReader::GetHeader(const char* filename, TRACK_HEADER *header)
 	return ret;
 }
 
+// Builds the track offset index with one pass over the point counts (the
+// track data is skipped). The current position is kept.
+bool CTrackReader::BuildIndex()
+{
+	if (!m_pFile)
+	{
+		m_nErrorCode = TE_NOT_INITIALIZED;
+		return false;
+	}
+	long pos = ftell(m_pFile);
+	long offset = m_bOldFormat ? 3*(sizeof(int)+sizeof(float)) : sizeof(TRACK_HEADER);
+	fseek(m_pFile, offset, SEEK_SET);
+
+	int n;
+	m_trackOffsets.clear();
+	while (GetNextPointCount(&n))
+	{
+		m_trackOffsets.push_back(offset);
+		offset += sizeof(int) + sizeof(float)*(n*(3+m_header.n_scalars)+m_header.n_properties);
+		fseek(m_pFile, offset, SEEK_SET);
+	}
+	fseek(m_pFile, pos, SEEK_SET);
+	m_nErrorCode = TE_NO_ERROR;
+
+	return true;
+}
+
+// Positions the reader at track n (0-based), so that the next
+// GetNextPointCount() returns its point count. Builds the index if needed.
+bool CTrackReader::SeekTrack(int n)
+{
+	if (m_trackOffsets.empty() && !BuildIndex())
+		return false;
+	if (n < 0 || n >= (int)m_trackOffsets.size())
+	{
+		m_nErrorCode = TE_CAN_NOT_READ;
+		return false;
+	}
+	fseek(m_pFile, m_trackOffsets[n], SEEK_SET);
+	m_nErrorCode = TE_NO_ERROR;
+
+	return true;
+}
+
 // if number of tracks was not recorded in the header, this routine will 
-// take longer to excute as it will go through the whole file
+// take longer to excute as it will go through the whole file once (and
+// keep the track offsets for SeekTrack())
 bool CTrackReader::GetNumberOfTracks(int* cnt)
 {
 	if (!m_pFile)
@@ -369,17 +435,9 @@ bool CTrackReader::GetNumberOfTracks(int* cnt)
 	}
 	if (m_header.n_count == 0)
 	{
-		long pos = ftell(m_pFile);
-		fseek(m_pFile, m_bOldFormat ? 3*(sizeof(int)+sizeof(float)) : sizeof(TRACK_HEADER), SEEK_SET);
-		
-		int n;
-		*cnt = 0;
-		while (GetNextPointCount(&n))
-		{
-			*cnt += 1;
-			fseek(m_pFile, sizeof(float)*(n*(3+m_header.n_scalars)+m_header.n_properties), SEEK_CUR);
-		}
-		fseek(m_pFile, pos, SEEK_SET);
+		if (m_trackOffsets.empty())
+			BuildIndex();
+		*cnt = m_trackOffsets.size();
 		m_header.n_count = *cnt;
 	}
 	else
@@ -434,6 +492,7 @@ bool CTrackWriter::Initialize(const char* filename, TRACK_HEADER header)
 		m_nErrorCode = TE_NOT_INITIALIZED;
 		return false;
 	}
+	SetFileBuffer();
 
 	if (header.hdr_size != sizeof(TRACK_HEADER))
 		header.ByteSwap();
@@ -465,7 +524,7 @@ bool CTrackWriter::WriteNextTrack(int ncount, float* data)
 		m_nErrorCode = TE_CAN_NOT_WRITE;
 	long nSize = (ncount*(3+m_header.n_scalars)+m_header.n_properties)*sizeof(float);
 
-	if (fwrite(data, nSize, 1, m_pFile) != 1)
+	if (nSize > 0 && fwrite(data, nSize, 1, m_pFile) != 1)
 		m_nErrorCode = TE_CAN_NOT_WRITE;
 
 	if (!m_nErrorCode)
@@ -473,6 +532,8 @@ bool CTrackWriter::WriteNextTrack(int ncount, float* data)
 	return m_nErrorCode == TE_NO_ERROR;
 }
 
+// Interleaves points and scalars into one record, which is written at once.
+// Missing scalars or properties are written as 0.
 bool CTrackWriter::WriteNextTrack(int ncount, float* pts, float* scalars, float* properties)
 {
 	if (!m_pFile)
@@ -480,26 +541,21 @@ bool CTrackWriter::WriteNextTrack(int ncount, float* pts, float* scalars, float*
 		m_nErrorCode = TE_NOT_INITIALIZED;
 		return false;
 	}
-	m_nErrorCode = TE_NO_ERROR;
-	
-	if (fwrite(&ncount, sizeof(int), 1, m_pFile) != 1)
-		m_nErrorCode = TE_CAN_NOT_WRITE;
 
-	for (int i = 0; i < ncount; i++)
+	int nStride = 3 + m_header.n_scalars;
+	m_trackBuffer.assign(nStride*ncount + m_header.n_properties, 0);
+
+	float* rec = m_trackBuffer.data();
+	for (int i = 0; i < ncount; i++, rec += nStride)
 	{
-		if (fwrite(pts+i*3, sizeof(float)*3, 1, m_pFile) != 1)
-			m_nErrorCode = TE_CAN_NOT_WRITE;
-		if (m_header.n_scalars 
-			&& fwrite(scalars+i*m_header.n_scalars, sizeof(float)*m_header.n_scalars, 1, m_pFile) != 1)
-			m_nErrorCode = TE_CAN_NOT_WRITE;
+		memcpy(rec, pts+i*3, sizeof(float)*3);
+		if (m_header.n_scalars && scalars)
+			memcpy(rec+3, scalars+i*m_header.n_scalars, sizeof(float)*m_header.n_scalars);
 	}
-	
-	if (m_header.n_properties && fwrite(properties, sizeof(float)*m_header.n_properties, 1, m_pFile) != 1)
-		m_nErrorCode = TE_CAN_NOT_WRITE;
+	if (m_header.n_properties && properties)
+		memcpy(rec, properties, sizeof(float)*m_header.n_properties);
 
-	if (!m_nErrorCode)
-		m_header.n_count ++;
-	return m_nErrorCode == TE_NO_ERROR;
+	return WriteNextTrack(ncount, m_trackBuffer.data());
 }
 
 
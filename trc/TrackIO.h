@@ -55,6 +55,10 @@
 //
 //			reader.Close();
 //
+//			For large files, GetNextTrackBatch(...) reads many tracks into one
+//			buffer, whose records can then be processed in parallel, and
+//			BuildIndex()/SeekTrack(...) give random access to the tracks.
+//
 ///////////////////////////////////////////////////////////////////////////////
 
 #ifndef _TrackIO_H_
@@ -75,6 +79,11 @@
 #define HEADER_VERSION		2
 #endif
 
+// size of the stdio buffer used for reading and writing track files
+#ifndef TRACK_IO_BUFFER_SIZE
+#define TRACK_IO_BUFFER_SIZE	(1 << 20)
+#endif
+
 struct TRACK_HEADER 
 {
 	char			id_string[6];	// first 5 chars must be "TRACK"
@@ -188,10 +197,15 @@ public:
 	int	GetLastErrorCode() { return m_nErrorCode; }
 
 protected:
+	void	SetFileBuffer();
+
 	TRACK_HEADER	m_header;
 	FILE*	m_pFile;
 
 	int		m_nErrorCode;
+
+	std::vector<char>	m_fileBuffer;	// stdio buffer of m_pFile
+	std::vector<float>	m_trackBuffer;	// one whole track record
 };
 
 class CTrackReader : public CTrackIO
@@ -207,6 +221,10 @@ public:
 	int GetProgress();
 	int  GetNumberOfTracks();
 	bool GetNumberOfTracks(int* cnt);
+	bool BuildIndex();
+	bool SeekTrack(int n);
+	int  GetNextTrackBatch(int nmax, std::vector<int>& counts, std::vector<size_t>& starts, 
+		std::vector<float>& data);
 	bool ByteSwapped() { return m_bByteSwap; }
 	bool IsOldFormat() { return m_bOldFormat; }
 	void AllowOldFormat(bool bAllow) { m_bAllowOldFormat = bAllow; }
@@ -218,6 +236,7 @@ protected:
 	bool			m_bOldFormat;
 	long			m_nSize;
 	bool			m_bAllowOldFormat;
+	std::vector<long>	m_trackOffsets;	// file offset of each track, see BuildIndex()
 };
 
 class CTrackWriter : public CTrackIO
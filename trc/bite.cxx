@@ -20,77 +20,25 @@
 
 #include <bite.h>
 
-using namespace std;
-
-int Bite::mNumDir, Bite::mNumB0, Bite::mNumTract, Bite::mNumBedpost;
-float Bite::mFminPath;
-vector<unsigned int> Bite::mBaselineImages;
-vector<float> Bite::mGradients, Bite::mBvalues;
-
-Bite::Bite(MRI *Dwi, MRI **Phi, MRI **Theta, MRI **F,
-           MRI **V0, MRI **F0, MRI *D0,
-           int CoordX, int CoordY, int CoordZ) :
-           mCoordX(CoordX), mCoordY(CoordY), mCoordZ(CoordZ) {
-  float fsum, vx, vy, vz;
-
-  mDwi.clear();
-  mPhiSamples.clear();
-  mThetaSamples.clear();
-  mFSamples.clear();
-  mPhi.clear();
-  mTheta.clear();
-  mF.clear();
-
-  // DWI intensity values
-  for (int idir = 0; idir < mNumDir; idir++)
-    mDwi.push_back(MRIgetVoxVal(Dwi, mCoordX, mCoordY, mCoordZ, idir));
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-  // Initialize s0
-  mS0 = 0;
-  for (vector<unsigned int>::const_iterator ibase = mBaselineImages.begin();
-                                            ibase < mBaselineImages.end();
-                                            ibase++)
-      mS0 += mDwi[*ibase];
-  mS0 /= mNumB0;
-
-  // Samples of phi, theta, f
-  for (int isamp = 0; isamp < mNumBedpost; isamp++)
-    for (int itract = 0; itract < mNumTract; itract++) {
-      mPhiSamples.push_back(MRIgetVoxVal(Phi[itract],
-                                         mCoordX, mCoordY, mCoordZ, isamp));
-      mThetaSamples.push_back(MRIgetVoxVal(Theta[itract],
-                                         mCoordX, mCoordY, mCoordZ, isamp));
-      mFSamples.push_back(MRIgetVoxVal(F[itract],
-                                         mCoordX, mCoordY, mCoordZ, isamp));
-    }
-
-  fsum = 0;
-  for (int itract = 0; itract < mNumTract; itract++) {
-    // Initialize phi, theta
-    vx = MRIgetVoxVal(V0[itract], mCoordX, mCoordY, mCoordZ, 0),
-    vy = MRIgetVoxVal(V0[itract], mCoordX, mCoordY, mCoordZ, 1),
-    vz = MRIgetVoxVal(V0[itract], mCoordX, mCoordY, mCoordZ, 2);
-    mPhi.push_back(atan2(vy, vx));
-    mTheta.push_back(acos(vz / sqrt(vx*vx + vy*vy + vz*vz)));
-
-    // Initialize f
-    mF.push_back(MRIgetVoxVal(F0[itract], mCoordX, mCoordY, mCoordZ, 0));
-    fsum += MRIgetVoxVal(F0[itract], mCoordX, mCoordY, mCoordZ, 0);
-  }
+using namespace std;
 
-  // Initialize d
-  mD = MRIgetVoxVal(D0, mCoordX, mCoordY, mCoordZ, 0);
-  //mD = log(mDwi[mNumDir-1] / mS0 / (1-fsum);
+//
+// Acquisition scheme, common for all voxels of a volume
+//
+BiteScheme::BiteScheme() : mNumDir(0), mNumB0(0), mNumTract(0),
+                           mNumBedpost(0), mFminPath(0) {
 }
 
-Bite::~Bite() {
+BiteScheme::~BiteScheme() {
 }
 
-//
-// Set variables that are common for all voxels
-//
-void Bite::SetStatic(const string GradientFile, const string BvalueFile,
-                     int NumTract, int NumBedpost, float FminPath) {
+void BiteScheme::ReadScheme(const string GradientFile, const string BvalueFile,
+                            int NumTract, int NumBedpost, float FminPath) {
   float val;
   ifstream gfile(GradientFile, ios::in);
   ifstream bfile(BvalueFile, ios::in);
@@ -145,49 +93,370 @@ void Bite::SetStatic(const string GradientFile, const string BvalueFile,
   mFminPath = FminPath;
 }
 
-int Bite::GetNumTract() { return mNumTract; }
+int BiteScheme::GetNumTract() const { return mNumTract; }
 
-int Bite::GetNumDir() { return mNumDir; }
+int BiteScheme::GetNumDir() const { return mNumDir; }
 
-int Bite::GetNumB0() { return mNumB0; }
+int BiteScheme::GetNumB0() const { return mNumB0; }
 
-int Bite::GetNumBedpost() { return mNumBedpost; }
+int BiteScheme::GetNumBedpost() const { return mNumBedpost; }
 
-float Bite::GetLowBvalue() { return mBvalues[mBaselineImages[0]]; }
+float BiteScheme::GetLowBvalue() const { return mBvalues[mBaselineImages[0]]; }
+
+//
+// State of an individual voxel in one MCMC chain
+//
+BiteState::BiteState() : mSample(-1), mPathTract(0),
+                         mLikelihood0(0), mLikelihood1(0),
+                         mPrior0(0), mPrior1(0) {
+}
+
+float BiteState::GetLikelihoodOffPath() const { return mLikelihood0; }
+
+float BiteState::GetLikelihoodOnPath() const { return mLikelihood1; }
+
+float BiteState::GetPriorOffPath() const { return mPrior0; }
+
+float BiteState::GetPriorOnPath() const { return mPrior1; }
+
+float BiteState::GetPosteriorOffPath() const { return mLikelihood0 + mPrior0; }
+
+float BiteState::GetPosteriorOnPath() const { return mLikelihood1 + mPrior1; }
+
+//
+// Diffusion data of all voxels in a mask
+//
+const int BiteStore::mFileVersion = 2;
+
+// Magic, version, dimensions and the signature of the input files
+const size_t BiteStore::mHeaderSize = 6 * sizeof(int) +
+                                      sizeof(unsigned long long);
+
+BiteStore::BiteStore() : mScheme(0), mNumVox(0), mNumDir(0), mNumTract(0),
+                         mNumBedpost(0), mSize(0), mData(0),
+                         mMap(0), mMapSize(0) {
+  SetLayout();
+}
+
+BiteStore::~BiteStore() {
+  Unmap();
+}
+
+//
+// Find where each variable starts in the contiguous data array
+//
+void BiteStore::SetLayout() {
+  const size_t nvox = mNumVox,
+               ntract = mNumTract,
+               nsamp = (size_t) mNumBedpost * ntract;
+
+  mDwiStart          = 0;
+  mS0Start           = mDwiStart          + nvox * mNumDir;
+  mDStart            = mS0Start           + nvox;
+  mPhiSamplesStart   = mDStart            + nvox;
+  mThetaSamplesStart = mPhiSamplesStart   + nvox * nsamp;
+  mFSamplesStart     = mThetaSamplesStart + nvox * nsamp;
+  mPhi0Start         = mFSamplesStart     + nvox * nsamp;
+  mTheta0Start       = mPhi0Start         + nvox * ntract;
+  mF0Start           = mTheta0Start       + nvox * ntract;
+  mSize              = mF0Start           + nvox * ntract;
+}
+
+void BiteStore::Unmap() {
+  if (mMap) {
+    munmap(mMap, mMapSize);
+    mMap = 0;
+    mMapSize = 0;
+  }
+}
+
+//
+// Allocate space for the data of all voxels in a mask
+//
+void BiteStore::Allocate(const BiteScheme *Scheme, int NumVox) {
+  Unmap();
+
+  mScheme = Scheme;
+  mNumVox = NumVox;
+  mNumDir = Scheme->mNumDir;
+  mNumTract = Scheme->mNumTract;
+  mNumBedpost = Scheme->mNumBedpost;
+  SetLayout();
+
+  mBuffer.assign(mSize, 0);
+  mData = mBuffer.data();
+}
+
+//
+// Copy the data of a voxel from the input volumes
+//
+void BiteStore::SetVoxel(int Index, MRI *Dwi, MRI **Phi, MRI **Theta, MRI **F,
+                         MRI **V0, MRI **F0, MRI *D0,
+                         int CoordX, int CoordY, int CoordZ) {
+  float s0, vx, vy, vz;
+  float *dwi = &mBuffer[mDwiStart + (size_t) Index * mNumDir],
+        *phisamp = &mBuffer[mPhiSamplesStart +
+                            (size_t) Index * mNumBedpost * mNumTract],
+        *thetasamp = &mBuffer[mThetaSamplesStart +
+                              (size_t) Index * mNumBedpost * mNumTract],
+        *fsamp = &mBuffer[mFSamplesStart +
+                          (size_t) Index * mNumBedpost * mNumTract],
+        *phi0 = &mBuffer[mPhi0Start + (size_t) Index * mNumTract],
+        *theta0 = &mBuffer[mTheta0Start + (size_t) Index * mNumTract],
+        *f0 = &mBuffer[mF0Start + (size_t) Index * mNumTract];
+
+  // DWI intensity values
+  for (int idir = 0; idir < mNumDir; idir++)
+    dwi[idir] = MRIgetVoxVal(Dwi, CoordX, CoordY, CoordZ, idir);
+
+  // Initialize s0
+  s0 = 0;
+  for (vector<unsigned int>::const_iterator
+                              ibase = mScheme->mBaselineImages.begin();
+                              ibase < mScheme->mBaselineImages.end(); ibase++)
+      s0 += dwi[*ibase];
+  mBuffer[mS0Start + Index] = s0 / mScheme->mNumB0;
+
+  // Samples of phi, theta, f
+  for (int isamp = 0; isamp < mNumBedpost; isamp++)
+    for (int itract = 0; itract < mNumTract; itract++) {
+      *phisamp   = MRIgetVoxVal(Phi[itract],   CoordX, CoordY, CoordZ, isamp);
+      *thetasamp = MRIgetVoxVal(Theta[itract], CoordX, CoordY, CoordZ, isamp);
+      *fsamp     = MRIgetVoxVal(F[itract],     CoordX, CoordY, CoordZ, isamp);
+
+      phisamp++;
+      thetasamp++;
+      fsamp++;
+    }
+
+  for (int itract = 0; itract < mNumTract; itract++) {
+    // Initial phi, theta
+    vx = MRIgetVoxVal(V0[itract], CoordX, CoordY, CoordZ, 0),
+    vy = MRIgetVoxVal(V0[itract], CoordX, CoordY, CoordZ, 1),
+    vz = MRIgetVoxVal(V0[itract], CoordX, CoordY, CoordZ, 2);
+    phi0[itract] = atan2(vy, vx);
+    theta0[itract] = acos(vz / sqrt(vx*vx + vy*vy + vz*vz));
+
+    // Initial f
+    f0[itract] = MRIgetVoxVal(F0[itract], CoordX, CoordY, CoordZ, 0);
+  }
+
+  // Initialize d
+  mBuffer[mDStart + Index] = MRIgetVoxVal(D0, CoordX, CoordY, CoordZ, 0);
+}
+
+//
+// Hash of the path, size and modification time of each input file, so that a
+// saved store is rebuilt when any of the files it was made from changes
+//
+unsigned long long
+BiteStore::InputSignature(const vector<string> &InputFiles) {
+  unsigned long long hash = 14695981039346656037ULL;	// FNV-1a
+  struct stat filestat;
+
+  for (vector<string>::const_iterator ifile = InputFiles.begin();
+                                      ifile < InputFiles.end(); ifile++) {
+    string key = *ifile;
+
+    if (stat(ifile->c_str(), &filestat) == 0)
+      key += " " + to_string((long long) filestat.st_size) +
+             " " + to_string((long long) filestat.st_mtim.tv_sec) +
+             " " + to_string((long long) filestat.st_mtim.tv_nsec);
+    else
+      key += " missing";
+
+    for (size_t k = 0; k <= key.size(); k++) {		// Including the '\0'
+      hash ^= (unsigned char) key.c_str()[k];
+      hash *= 1099511628211ULL;
+    }
+  }
+
+  return hash;
+}
+
+//
+// Read the dimensions of the data saved in a file
+//
+bool BiteStore::ReadFileSize(const string StoreFile, int &NumVox,
+                             int &NumDir, int &NumTract, int &NumBedpost,
+                             unsigned long long &Signature) {
+  int header[6];
+  ifstream infile(StoreFile, ios::in | ios::binary);
+
+  if (!infile)
+    return false;
+
+  if (!infile.read((char *) header, sizeof(header)) ||
+      !infile.read((char *) &Signature, sizeof(Signature)))
+    return false;
+
+  if (header[0] != 0x42495445 || header[1] != mFileVersion)	// "BITE"
+    return false;
+
+  NumVox = header[2];
+  NumDir = header[3];
+  NumTract = header[4];
+  NumBedpost = header[5];
+
+  return true;
+}
+
+//
+// Memory-map the data saved in a file, if it matches the expected scheme,
+// number of voxels and input files
+//
+bool BiteStore::MapFile(const string StoreFile, const BiteScheme *Scheme,
+                        int NumVox, unsigned long long Signature) {
+  int nvox, ndir, ntract, nbedpost, fd;
+  unsigned long long signature;
+  struct stat filestat;
+  void *map;
+
+  if (!ReadFileSize(StoreFile, nvox, ndir, ntract, nbedpost, signature) ||
+      nvox != NumVox || ndir != Scheme->mNumDir ||
+      ntract != Scheme->mNumTract || nbedpost != Scheme->mNumBedpost ||
+      signature != Signature)
+    return false;
+
+  Unmap();
+  mBuffer.clear();
+
+  mScheme = Scheme;
+  mNumVox = nvox;
+  mNumDir = ndir;
+  mNumTract = ntract;
+  mNumBedpost = nbedpost;
+  SetLayout();
+
+  fd = open(StoreFile.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  if (fstat(fd, &filestat) != 0 ||
+      (size_t) filestat.st_size != mHeaderSize + mSize * sizeof(float)) {
+    close(fd);
+    return false;
+  }
+
+  map = mmap(0, filestat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return false;
+
+  mMap = map;
+  mMapSize = filestat.st_size;
+  mData = (const float *) ((const char *) mMap + mHeaderSize);
+
+  return true;
+}
+
+//
+// Save the data to a file that can be memory-mapped later. The data are
+// written to a temporary file that then replaces the store, so that processes
+// that have the old store mapped keep seeing intact data.
+//
+void BiteStore::WriteFile(const string StoreFile,
+                          unsigned long long Signature) const {
+  const int header[6] = { 0x42495445, mFileVersion,
+                          mNumVox, mNumDir, mNumTract, mNumBedpost };
+  string tmpfile = StoreFile + ".XXXXXX";
+  FILE *fp;
+  int fd;
+
+  fd = mkstemp(&tmpfile[0]);
+  if (fd < 0 || !(fp = fdopen(fd, "wb"))) {
+    cout << "ERROR: Could not open " << tmpfile << " for writing" << endl;
+    exit(1);
+  }
+
+  fchmod(fd, 0644);
+
+  if (fwrite(header, sizeof(header), 1, fp) != 1 ||
+      fwrite(&Signature, sizeof(Signature), 1, fp) != 1 ||
+      (mSize > 0 && fwrite(mData, sizeof(float), mSize, fp) != mSize) ||
+      fclose(fp) != 0 ||
+      rename(tmpfile.c_str(), StoreFile.c_str()) != 0) {
+    cout << "ERROR: Could not write " << StoreFile << endl;
+    unlink(tmpfile.c_str());
+    exit(1);
+  }
+}
+
+int BiteStore::GetNumVox() const { return mNumVox; }
+
+//
+// Data of an individual voxel
+//
+Bite::Bite(const BiteStore &Store, int Index) :
+           mScheme(Store.mScheme),
+           mNumDir(Store.mNumDir), mNumTract(Store.mNumTract),
+           mS0(Store.mData[Store.mS0Start + Index]),
+           mD(Store.mData[Store.mDStart + Index]),
+           mDwi(Store.mData + Store.mDwiStart + (size_t) Index * mNumDir),
+           mPhiSamples(Store.mData + Store.mPhiSamplesStart +
+                       (size_t) Index * Store.mNumBedpost * mNumTract),
+           mThetaSamples(Store.mData + Store.mThetaSamplesStart +
+                         (size_t) Index * Store.mNumBedpost * mNumTract),
+           mFSamples(Store.mData + Store.mFSamplesStart +
+                     (size_t) Index * Store.mNumBedpost * mNumTract),
+           mPhi0(Store.mData + Store.mPhi0Start + (size_t) Index * mNumTract),
+           mTheta0(Store.mData + Store.mTheta0Start +
+                   (size_t) Index * mNumTract),
+           mF0(Store.mData + Store.mF0Start + (size_t) Index * mNumTract) {
+}
+
+Bite::~Bite() {
+}
+
+//
+// Current values of phi, theta, f in a chain: the initial values until the
+// first sampling, then the chosen BEDPOST sample
+//
+const float *Bite::GetPhi(const BiteState &State) const {
+  if (State.mSample < 0)
+    return mPhi0;
+
+  return mPhiSamples + State.mSample * mNumTract;
+}
+
+const float *Bite::GetTheta(const BiteState &State) const {
+  if (State.mSample < 0)
+    return mTheta0;
+
+  return mThetaSamples + State.mSample * mNumTract;
+}
+
+const float *Bite::GetF(const BiteState &State) const {
+  if (State.mSample < 0)
+    return mF0;
+
+  return mFSamples + State.mSample * mNumTract;
+}
 
 //
 // Draw samples from marginal posteriors of diffusion parameters
 //
-void Bite::SampleParameters() {
-  const int isamp = (int) round(drand48() * (mNumBedpost-1))
-                                            * mNumTract;
-  vector<float>::const_iterator samples;
- 
-  samples = mPhiSamples.begin() + isamp;
-  copy(samples, samples + mNumTract, mPhi.begin());
- 
-  samples = mThetaSamples.begin() + isamp;
-  copy(samples, samples + mNumTract, mTheta.begin());
- 
-  samples = mFSamples.begin() + isamp;
-  copy(samples, samples + mNumTract, mF.begin());
+void Bite::SampleParameters(BiteState &State,
+                            unsigned short *RandState) const {
+  State.mSample = (int) round(erand48(RandState)
+                              * (mScheme->mNumBedpost-1));
 }
 
 //
 // Compute likelihood given that voxel is off path
 //
-void Bite::ComputeLikelihoodOffPath() {
+void Bite::ComputeLikelihoodOffPath(BiteState &State) const {
   double like = 0;
-  vector<float>::const_iterator ri = mGradients.begin();
-  vector<float>::const_iterator bi = mBvalues.begin();
-  vector<float>::const_iterator sij = mDwi.begin();
+  vector<float>::const_iterator ri = mScheme->mGradients.begin();
+  vector<float>::const_iterator bi = mScheme->mBvalues.begin();
+  const float *sij = mDwi;
 
   for (int idir = mNumDir; idir > 0; idir--) {
     double sbar = 0, fsum = 0;
     const double bidj = (*bi) * mD;
-    vector<float>::const_iterator fjl = mF.begin();
-    vector<float>::const_iterator phijl = mPhi.begin();
-    vector<float>::const_iterator thetajl = mTheta.begin();
+    const float *fjl = GetF(State);
+    const float *phijl = GetPhi(State);
+    const float *thetajl = GetTheta(State);
 
     for (int itract = mNumTract; itract > 0; itract--) {
       const double iprod =
@@ -211,32 +480,33 @@ void Bite::ComputeLikelihoodOffPath() {
     sij++;
   }
 
-  mLikelihood0 = (float) log(like/2) * mNumDir/2;
+  State.mLikelihood0 = (float) log(like/2) * mNumDir/2;
 }
 
 //
 // Compute likelihood given that voxel is on path
 //
-void Bite::ComputeLikelihoodOnPath(float PathPhi, float PathTheta) {
+void Bite::ComputeLikelihoodOnPath(BiteState &State,
+                                   float PathPhi, float PathTheta) const {
   double like = 0;
-  vector<float>::const_iterator ri = mGradients.begin();
-  vector<float>::const_iterator bi = mBvalues.begin();
-  vector<float>::const_iterator sij = mDwi.begin();
+  vector<float>::const_iterator ri = mScheme->mGradients.begin();
+  vector<float>::const_iterator bi = mScheme->mBvalues.begin();
+  const float *sij = mDwi;
 
   // Choose which anisotropic compartment in voxel corresponds to path
-  ChoosePathTractAngle(PathPhi, PathTheta);
+  ChoosePathTractAngle(State, PathPhi, PathTheta);
 
   // Calculate likelihood by replacing the chosen tract orientation from path
   for (int idir = mNumDir; idir > 0; idir--) {
     double sbar = 0, fsum = 0;
     const double bidj = (*bi) * mD;
-    vector<float>::const_iterator fjl = mF.begin();
-    vector<float>::const_iterator phijl = mPhi.begin();
-    vector<float>::const_iterator thetajl = mTheta.begin();
+    const float *fjl = GetF(State);
+    const float *phijl = GetPhi(State);
+    const float *thetajl = GetTheta(State);
 
     for (int itract = 0; itract < mNumTract; itract++) {
       double iprod;
-      if (itract == mPathTract)
+      if (itract == State.mPathTract)
         iprod = (ri[0] * cos(PathPhi) + ri[1] * sin(PathPhi)) * sin(PathTheta)
               + ri[2] * cos(PathTheta);
       else
@@ -260,26 +530,27 @@ void Bite::ComputeLikelihoodOnPath(float PathPhi, float PathTheta) {
     sij++;
   }
 
-  mLikelihood1 = (float) log(like/2) * mNumDir/2;
+  State.mLikelihood1 = (float) log(like/2) * mNumDir/2;
 }
 
 //
 // Find tract closest to path orientation
 //
-void Bite::ChoosePathTractAngle(float PathPhi, float PathTheta) {
+void Bite::ChoosePathTractAngle(BiteState &State,
+                                float PathPhi, float PathTheta) const {
   double maxprod = 0;
-  vector<float>::const_iterator fjl = mF.begin();
-  vector<float>::const_iterator phijl = mPhi.begin();
-  vector<float>::const_iterator thetajl = mTheta.begin();
+  const float *fjl = GetF(State);
+  const float *phijl = GetPhi(State);
+  const float *thetajl = GetTheta(State);
 
   for (int itract = 0; itract < mNumTract; itract++) {
-    if (*fjl > mFminPath) {
+    if (*fjl > mScheme->mFminPath) {
       const double iprod =
         (cos(PathPhi) * cos(*phijl) + sin(PathPhi) * sin(*phijl)) 
         * sin(PathTheta) * sin(*thetajl) + cos(PathTheta) * cos(*thetajl);
 
       if (iprod > maxprod) {
-        mPathTract = itract;
+        State.mPathTract = itract;
         maxprod = iprod;
       }
     }
@@ -290,29 +561,31 @@ void Bite::ChoosePathTractAngle(float PathPhi, float PathTheta) {
   }
 
   if (maxprod == 0)
-    mPathTract = 0;
+    State.mPathTract = 0;
 }
 
 //
 // Find tract that changes the likelihood the least
 //
-void Bite::ChoosePathTractLike(float PathPhi, float PathTheta) {
+void Bite::ChoosePathTractLike(BiteState &State,
+                               float PathPhi, float PathTheta) const {
   double mindlike = numeric_limits<double>::max();
+  const float *fj = GetF(State);
 
   for (int jtract = 0; jtract < mNumTract; jtract++)
-    if (mF[jtract] > mFminPath) {
+    if (fj[jtract] > mScheme->mFminPath) {
       double dlike, like = 0;
-      vector<float>::const_iterator ri = mGradients.begin();
-      vector<float>::const_iterator bi = mBvalues.begin();
-      vector<float>::const_iterator sij = mDwi.begin();
+      vector<float>::const_iterator ri = mScheme->mGradients.begin();
+      vector<float>::const_iterator bi = mScheme->mBvalues.begin();
+      const float *sij = mDwi;
 
       // Calculate likelihood by replacing the chosen tract orientation from path
       for (int idir = mNumDir; idir > 0; idir--) {
         double sbar = 0, fsum = 0;
         const double bidj = (*bi) * mD;
-        vector<float>::const_iterator fjl = mF.begin();
-        vector<float>::const_iterator phijl = mPhi.begin();
-        vector<float>::const_iterator thetajl = mTheta.begin();
+        const float *fjl = GetF(State);
+        const float *phijl = GetPhi(State);
+        const float *thetajl = GetTheta(State);
 
         for (int itract = 0; itract < mNumTract; itract++) {
           double iprod;
@@ -341,61 +614,54 @@ void Bite::ChoosePathTractLike(float PathPhi, float PathTheta) {
       }
 
       like = log(like/2) * mNumDir/2;
-      dlike = fabs(like - (double) mLikelihood0);
+      dlike = fabs(like - (double) State.mLikelihood0);
 
       if (dlike < mindlike) {
-        mPathTract = jtract;
-//        mLikelihood1 = (float) like;
+        State.mPathTract = jtract;
+//        State.mLikelihood1 = (float) like;
         mindlike = dlike;
       }
     }
 
   if (mindlike == numeric_limits<double>::max()) {
-    mPathTract = 0;
-//    mLikelihood1 = 
+    State.mPathTract = 0;
+//    State.mLikelihood1 = 
   }
 }
 
 //
 // Compute prior given that voxel is off path
 //
-void Bite::ComputePriorOffPath() {
-  vector<float>::const_iterator fjl = mF.begin() + mPathTract;
-  vector<float>::const_iterator thetajl = mTheta.begin() + mPathTract;
+void Bite::ComputePriorOffPath(BiteState &State) const {
+  const float *fjl = GetF(State) + State.mPathTract;
+  const float *thetajl = GetTheta(State) + State.mPathTract;
 
 //cout << (*fjl) << " " << log((*fjl - 1) * log(1 - *fjl)) << " "
 //     << log(((double)*fjl - 1) * log(1 - (double)*fjl)) << endl;
 
 if (1) 
-  mPrior0 = log((*fjl - 1) * log(1 - *fjl)) - log(fabs(sin(*thetajl)));
+  State.mPrior0 = log((*fjl - 1) * log(1 - *fjl)) - log(fabs(sin(*thetajl)));
 else  
-  mPrior0 = 0;
+  State.mPrior0 = 0;
 }
 
 //
 // Compute prior given that voxel is on path
 //
-void Bite::ComputePriorOnPath() {
-  mPrior1 = 0;
-}
-
-bool Bite::IsAllFZero() {
-  return (*max_element(mF.begin(), mF.end()) < mFminPath);
+void Bite::ComputePriorOnPath(BiteState &State) const {
+  State.mPrior1 = 0;
 }
 
-bool Bite::IsFZero() { return (mF[mPathTract] < mFminPath); }
+bool Bite::IsAllFZero(const BiteState &State) const {
+  const float *fj = GetF(State);
 
-bool Bite::IsThetaZero() { return (mTheta[mPathTract] == 0); }
-
-float Bite::GetLikelihoodOffPath() { return mLikelihood0; }
-
-float Bite::GetLikelihoodOnPath() { return mLikelihood1; }
-
-float Bite::GetPriorOffPath() { return mPrior0; }
-
-float Bite::GetPriorOnPath() { return mPrior1; }
-
-float Bite::GetPosteriorOffPath() { return mLikelihood0 + mPrior0; }
+  return (*max_element(fj, fj + mNumTract) < mScheme->mFminPath);
+}
 
-float Bite::GetPosteriorOnPath() { return mLikelihood1 + mPrior1; }
+bool Bite::IsFZero(const BiteState &State) const {
+  return (GetF(State)[State.mPathTract] < mScheme->mFminPath);
+}
 
+bool Bite::IsThetaZero(const BiteState &State) const {
+  return (GetTheta(State)[State.mPathTract] == 0);
+}
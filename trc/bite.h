@@ -28,58 +28,142 @@
 #include <limits>
 #include <algorithm>
 #include <math.h>
+#include <stdlib.h>
 #include "mri.h"
 
+class BiteScheme {	// Acquisition scheme, common for all voxels of a volume
+  public:
+    BiteScheme();
+    ~BiteScheme();
+    void ReadScheme(const std::string GradientFile,
+                    const std::string BvalueFile,
+                    int NumTract, int NumBedpost, float FminPath);
+    int GetNumTract() const;
+    int GetNumDir() const;
+    int GetNumB0() const;
+    int GetNumBedpost() const;
+    float GetLowBvalue() const;
+
+  private:
+    friend class Bite;
+    friend class BiteStore;
+
+    int mNumDir, mNumB0, mNumTract, mNumBedpost;
+    float mFminPath;
+    std::vector<unsigned int> mBaselineImages;
+    std::vector<float> mGradients,		// [3 x mNumDir]
+                       mBvalues;		// [mNumDir]
+};
+
+class BiteState {	// State of an individual voxel in one MCMC chain
+  public:
+    BiteState();
+    float GetLikelihoodOffPath() const;
+    float GetLikelihoodOnPath() const;
+    float GetPriorOffPath() const;
+    float GetPriorOnPath() const;
+    float GetPosteriorOffPath() const;
+    float GetPosteriorOnPath() const;
+
+  private:
+    friend class Bite;
+
+    int mSample,				// -1 before first sampling
+        mPathTract;
+    float mLikelihood0, mLikelihood1, mPrior0, mPrior1;
+};
+
+//
+// Diffusion data of all voxels in a mask, stored as one contiguous array per
+// variable (indexed by voxel) instead of one object per voxel. The arrays can
+// be written to a file and memory-mapped from it, so that the page cache is
+// shared by all processes that run on the same data. The file records a
+// signature of the input files it was made from, so that it is only reused
+// while they are unchanged.
+//
+class BiteStore {
+  public:
+    BiteStore();
+    ~BiteStore();
+    void Allocate(const BiteScheme *Scheme, int NumVox);
+    void SetVoxel(int Index, MRI *Dwi, MRI **Phi, MRI **Theta, MRI **F,
+                  MRI **V0, MRI **F0, MRI *D0,
+                  int CoordX, int CoordY, int CoordZ);
+    static unsigned long long
+      InputSignature(const std::vector<std::string> &InputFiles);
+    static bool ReadFileSize(const std::string StoreFile, int &NumVox,
+                             int &NumDir, int &NumTract, int &NumBedpost,
+                             unsigned long long &Signature);
+    bool MapFile(const std::string StoreFile, const BiteScheme *Scheme,
+                 int NumVox, unsigned long long Signature);
+    void WriteFile(const std::string StoreFile,
+                   unsigned long long Signature) const;
+    int GetNumVox() const;
+
+  private:
+    friend class Bite;
+
+    static const int mFileVersion;
+    static const size_t mHeaderSize;
+
+    const BiteScheme *mScheme;
+    int mNumVox, mNumDir, mNumTract, mNumBedpost;
+    size_t mDwiStart,				// [mNumVox x mNumDir]
+           mS0Start, mDStart,			// [mNumVox]
+           mPhiSamplesStart,			// [mNumVox x mNumBedpost x mNumTract]
+           mThetaSamplesStart,			// [mNumVox x mNumBedpost x mNumTract]
+           mFSamplesStart,			// [mNumVox x mNumBedpost x mNumTract]
+           mPhi0Start, mTheta0Start, mF0Start,	// [mNumVox x mNumTract]
+           mSize;
+    const float *mData;				// Either mBuffer or mapped file
+    std::vector<float> mBuffer;
+    void *mMap;
+    size_t mMapSize;
+
+    void SetLayout();
+    void Unmap();
+};
+
+//
+// Data of an individual voxel, as a read-only view into a BiteStore, so the
+// same voxels can be used by several MCMC chains at once, each with its own
+// BiteState vector
+//
 class Bite {
   public:
-    Bite(MRI *Dwi, MRI **Phi, MRI **Theta, MRI **F,
-         MRI **V0, MRI **F0, MRI *D0,
-         int CoordX, int CoordY, int CoordZ);
+    Bite(const BiteStore &Store, int Index);
     ~Bite();
 
   private:
-    static int mNumDir, mNumB0, mNumTract, mNumBedpost;
-    static float mFminPath;
-    static std::vector<unsigned int> mBaselineImages;
-    static std::vector<float> mGradients,	// [3 x mNumDir]
-                              mBvalues;		// [mNumDir]
-
-    int mCoordX, mCoordY, mCoordZ, mPathTract;
-    float mS0, mD, mLikelihood0, mLikelihood1, mPrior0, mPrior1;
-    std::vector<float> mDwi;			// [mNumDir]
-    std::vector<float> mPhiSamples;		// [mNumTract x mNumBedpost]
-    std::vector<float> mThetaSamples;		// [mNumTract x mNumBedpost]
-    std::vector<float> mFSamples;		// [mNumTract x mNumBedpost]
-    std::vector<float> mPhi;			// [mNumTract]
-    std::vector<float> mTheta;			// [mNumTract]
-    std::vector<float> mF;			// [mNumTract]
+    const BiteScheme *mScheme;
+    int mNumDir, mNumTract;
+    float mS0, mD;
+    const float *mDwi,				// [mNumDir]
+                *mPhiSamples,			// [mNumTract x mNumBedpost]
+                *mThetaSamples,			// [mNumTract x mNumBedpost]
+                *mFSamples,			// [mNumTract x mNumBedpost]
+                *mPhi0,				// [mNumTract]
+                *mTheta0,			// [mNumTract]
+                *mF0;				// [mNumTract]
+
+    const float *GetPhi(const BiteState &State) const;
+    const float *GetTheta(const BiteState &State) const;
+    const float *GetF(const BiteState &State) const;
 
   public:
-    static void SetStatic(const std::string GradientFile,
-                          const std::string BvalueFile,
-                          int NumTract, int NumBedpost, float FminPath);
-    static int GetNumTract();
-    static int GetNumDir();
-    static int GetNumB0();
-    static int GetNumBedpost();
-    static float GetLowBvalue();
-
-    void SampleParameters();
-    void ComputeLikelihoodOffPath();
-    void ComputeLikelihoodOnPath(float PathPhi, float PathTheta);
-    void ChoosePathTractAngle(float PathPhi, float PathTheta);
-    void ChoosePathTractLike(float PathPhi, float PathTheta);
-    void ComputePriorOffPath();
-    void ComputePriorOnPath();
-    bool IsAllFZero();
-    bool IsFZero();
-    bool IsThetaZero();
-    float GetLikelihoodOffPath();
-    float GetLikelihoodOnPath();
-    float GetPriorOffPath();
-    float GetPriorOnPath();
-    float GetPosteriorOffPath();
-    float GetPosteriorOnPath();
+    void SampleParameters(BiteState &State, unsigned short *RandState) const;
+    void ComputeLikelihoodOffPath(BiteState &State) const;
+    void ComputeLikelihoodOnPath(BiteState &State,
+                                 float PathPhi, float PathTheta) const;
+    void ChoosePathTractAngle(BiteState &State,
+                              float PathPhi, float PathTheta) const;
+    void ChoosePathTractLike(BiteState &State,
+                             float PathPhi, float PathTheta) const;
+    void ComputePriorOffPath(BiteState &State) const;
+    void ComputePriorOnPath(BiteState &State) const;
+    bool IsAllFZero(const BiteState &State) const;
+    bool IsFZero(const BiteState &State) const;
+    bool IsThetaZero(const BiteState &State) const;
 };
 
 #endif
@@ -23,11 +23,6 @@
 using namespace std;
 
 const unsigned int Aeon::mDiffStep = 3;
-int Aeon::mMaxAPosterioriPath;
-unsigned int Aeon::mMaxAPosterioriPath0;
-vector<float> Aeon::mPriorSamples;
-vector< vector<int> > Aeon::mBasePathPointSamples;
-MRI *Aeon::mBaseMask;
 
 const unsigned int Coffin::mMaxTryMask = 100,
                    Coffin::mMaxTryWhite = 10,
@@ -36,52 +31,35 @@ const float Coffin::mTangentBinSize = 1/3.0,	// 0.1,
             Coffin::mCurvatureBinSize = 0.01;	// 0.002;
 
 //
-// A single point in time
-//
-Aeon::Aeon() {
-  mNx = mNy = mNz = mNxy = mNumVox = 0;
-  mMask = 0;
-  ClearPath();
-}
-
-Aeon::~Aeon() {
-}
-
-//
-// Set the common base template mask for all time points
+// Deleter for volumes that are shared among containers
 //
-void Aeon::SetBaseMask(MRI *BaseMask) { mBaseMask = BaseMask; }
+static void FreeSharedVolume(MRI *Vol) { MRIfree(&Vol); }
 
 //
-// Save a sample of the atlas-based path priors, common among all time points
-//
-void Aeon::SavePathPriors(vector<float> &Priors) {
-  mPriorSamples.insert(mPriorSamples.end(), Priors.begin(), Priors.end());
-}
-
+// Input data of a single point in time
 //
-// Save a path sample in base space, common among all time points
-//
-void Aeon::SaveBasePath(vector<int> &PathPoints) {
-  mBasePathPointSamples.push_back(PathPoints);
+AeonData::AeonData() : mNx(0), mNy(0), mNz(0), mNxy(0), mNumVox(0),
+                       mMask(0), mBaseMask(0) {
 }
 
-//
-// Set a path sample as the MAP path
-//
-void Aeon::SetPathMap(unsigned int PathIndex) {
-  mMaxAPosterioriPath0 = PathIndex;
+AeonData::~AeonData() {
+  if (mMask)
+    MRIfree(&mMask);
 }
 
 //
 // Read data specific to a single time point
 //
-void Aeon::ReadData(const string RootDir, const string DwiFile,
-                    const string GradientFile, const string BvalueFile,
-                    const string MaskFile, const string BedpostDir,
-                    const int NumTract, const float FminPath,
-                    const string BaseXfmFile) {
-  string dwifile, gradfile, bvalfile, maskfile, bpdir, fname;
+void AeonData::ReadData(const string RootDir, const string DwiFile,
+                        const string GradientFile, const string BvalueFile,
+                        const string MaskFile, const string BedpostDir,
+                        const int NumTract, const float FminPath,
+                        const string BaseXfmFile, MRI *BaseMask,
+                        const string StoreFile) {
+  int nvox, ndir, ntract, nbedpost;
+  unsigned long long signature = 0, storesignature;
+  string dwifile, gradfile, bvalfile, maskfile, bpdir, storefile, fname;
+  vector<string> inputfiles;
   MRI *dwi, *phi[NumTract], *theta[NumTract], *f[NumTract],
       *v0[NumTract], *f0[NumTract], *d0;
 
@@ -93,6 +71,70 @@ void Aeon::ReadData(const string RootDir, const string DwiFile,
   bvalfile   = mRootDir + BvalueFile;
   maskfile   = mRootDir + MaskFile;
   bpdir      = mRootDir + BedpostDir;
+  if (!StoreFile.empty())
+    storefile = mRootDir + StoreFile;
+
+  // Read mask
+  cout << "Loading mask from " << maskfile << endl;
+  mMask = MRIread(maskfile.c_str());
+  if (!mMask) {
+    cout << "ERROR: Could not read " << maskfile << endl;
+    exit(1);
+  }
+
+  // Size of diffusion-weighted images
+  mNx = mMask->width;
+  mNy = mMask->height;
+  mNz = mMask->depth;
+  mNxy = mNx * mNy;
+
+  mDataIndex.clear();
+  mNumVox = 0;
+  for (int iz = 0; iz < mNz; iz++)
+    for (int iy = 0; iy < mNy; iy++)
+      for (int ix = 0; ix < mNx; ix++)
+        if (MRIgetVoxVal(mMask, ix, iy, iz, 0)) {
+          mDataIndex.push_back(mNumVox);
+          mNumVox++;
+        }
+        else
+          mDataIndex.push_back(-1);
+
+  cout << "INFO: Found " << mNumVox << " voxels in brain mask" << endl;
+
+  // Files that the voxel-wise data are made from
+  inputfiles.push_back(maskfile);
+  inputfiles.push_back(dwifile);
+  inputfiles.push_back(gradfile);
+  inputfiles.push_back(bvalfile);
+  for (int itract = 0; itract < NumTract; itract++) {
+    const string tract = to_string(itract+1);
+
+    inputfiles.push_back(bpdir + "/merged_ph" + tract + "samples.nii.gz");
+    inputfiles.push_back(bpdir + "/merged_th" + tract + "samples.nii.gz");
+    inputfiles.push_back(bpdir + "/merged_f" + tract + "samples.nii.gz");
+    inputfiles.push_back(bpdir + "/dyads" + tract + ".nii.gz");
+    inputfiles.push_back(bpdir + "/mean_f" + tract + "samples.nii.gz");
+  }
+  inputfiles.push_back(bpdir + "/mean_dsamples.nii.gz");
+
+  if (!storefile.empty())
+    signature = BiteStore::InputSignature(inputfiles);
+
+  // Map previously saved voxel-wise data, if they match this mask and
+  // were made from the same, unchanged input files
+  if (!storefile.empty() &&
+      BiteStore::ReadFileSize(storefile, nvox, ndir, ntract, nbedpost,
+                              storesignature) &&
+      nvox == mNumVox && ntract == NumTract && storesignature == signature) {
+    mScheme.ReadScheme(gradfile, bvalfile, NumTract, nbedpost, FminPath);
+
+    if (mData.MapFile(storefile, &mScheme, mNumVox, signature)) {
+      cout << "Mapped voxel-wise data from " << storefile << endl;
+      ReadBaseXfm(BaseXfmFile, BaseMask);
+      return;
+    }
+  }
 
   // Read diffusion-weighted images
   cout << "Loading DWIs from " << dwifile << endl;
@@ -102,17 +144,9 @@ void Aeon::ReadData(const string RootDir, const string DwiFile,
     exit(1);
   }
 
-  // Size of diffusion-weighted images
-  mNx = dwi->width;
-  mNy = dwi->height;
-  mNz = dwi->depth;
-  mNxy = mNx * mNy;
-
-  // Read mask
-  cout << "Loading mask from " << maskfile << endl;
-  mMask = MRIread(maskfile.c_str());
-  if (!mMask) {
-    cout << "ERROR: Could not read " << maskfile << endl;
+  if (dwi->width != mNx || dwi->height != mNy || dwi->depth != mNz) {
+    cout << "ERROR: Dimensions of " << dwifile << " and " << maskfile
+         << " do not match" << endl;
     exit(1);
   }
 
@@ -159,41 +193,28 @@ void Aeon::ReadData(const string RootDir, const string DwiFile,
   }
 
   // Initialize voxel-wise diffusion model
-  Bite::SetStatic(gradfile, bvalfile, NumTract, phi[0]->nframes, FminPath);
+  mScheme.ReadScheme(gradfile, bvalfile, NumTract, phi[0]->nframes, FminPath);
 
-  if (Bite::GetNumDir() != dwi->nframes) {
+  if (mScheme.GetNumDir() != dwi->nframes) {
     cout << "ERROR: Dimensions of " << bvalfile << " and " << dwifile
          << " do not match" << endl;
     exit(1);
   }
 
   cout << "INFO: Found "
-       << Bite::GetNumB0() << " baseline images (b = "
-       << Bite::GetLowBvalue() << ") out of a total of "
-       << Bite::GetNumDir() << " frames" << endl;
+       << mScheme.GetNumB0() << " baseline images (b = "
+       << mScheme.GetLowBvalue() << ") out of a total of "
+       << mScheme.GetNumDir() << " frames" << endl;
 
-  mData.clear();
+  mData.Allocate(&mScheme, mNumVox);
   for (int iz = 0; iz < mNz; iz++)
     for (int iy = 0; iy < mNy; iy++)
-      for (int ix = 0; ix < mNx; ix++)
-        if (MRIgetVoxVal(mMask, ix, iy, iz, 0)) {
-          Bite data = Bite(dwi, phi, theta, f, v0, f0, d0, ix, iy, iz);
-          mData.push_back(data);
-        }
+      for (int ix = 0; ix < mNx; ix++) {
+        const int idata = mDataIndex[ix + iy*mNx + iz*mNxy];
 
-  mDataMask.clear();
-  mNumVox = 0;
-  for (int iz = 0; iz < mNz; iz++)
-    for (int iy = 0; iy < mNy; iy++)
-      for (int ix = 0; ix < mNx; ix++)
-        if (MRIgetVoxVal(mMask, ix, iy, iz, 0)) {
-          mDataMask.push_back(&mData[mNumVox]);
-          mNumVox++;
-        }
-        else
-          mDataMask.push_back(0);
-
-  cout << "INFO: Found " << mNumVox << " voxels in brain mask" << endl;
+        if (idata >= 0)
+          mData.SetVoxel(idata, dwi, phi, theta, f, v0, f0, d0, ix, iy, iz);
+      }
 
   // Free temporary variables
   MRIfree(&dwi);
@@ -208,8 +229,22 @@ void Aeon::ReadData(const string RootDir, const string DwiFile,
 
   MRIfree(&d0);
 
-  // Read transform from base template space to native DWI space
-  // (only used for longitudinal data)
+  // Save voxel-wise data to be mapped by later runs
+  if (!storefile.empty()) {
+    cout << "Saving voxel-wise data to " << storefile << endl;
+    mData.WriteFile(storefile, signature);
+  }
+
+  ReadBaseXfm(BaseXfmFile, BaseMask);
+}
+
+//
+// Read transform from base template space to native DWI space
+// (only used for longitudinal data)
+//
+void AeonData::ReadBaseXfm(const string BaseXfmFile, MRI *BaseMask) {
+  mBaseMask = BaseMask;
+
   if (!BaseXfmFile.empty()) {
     string regfile = mRootDir + BaseXfmFile;
     if (!mBaseMask) {
@@ -221,6 +256,65 @@ void Aeon::ReadData(const string RootDir, const string DwiFile,
   }
 }
 
+//
+// A single point in time
+//
+Aeon::Aeon() {
+  mNx = mNy = mNz = mNxy = mNumVox = 0;
+  mMask = 0;
+  ClearPath();
+}
+
+Aeon::~Aeon() {
+}
+
+//
+// Read data specific to this time point, which can then be shared with
+// copies of this time point that are used to reconstruct other pathways
+//
+void Aeon::ReadData(const string RootDir, const string DwiFile,
+                    const string GradientFile, const string BvalueFile,
+                    const string MaskFile, const string BedpostDir,
+                    const int NumTract, const float FminPath,
+                    const string BaseXfmFile, MRI *BaseMask,
+                    const string StoreFile) {
+  mInput = std::make_shared<AeonData>();
+  mInput->ReadData(RootDir, DwiFile, GradientFile, BvalueFile,
+                   MaskFile, BedpostDir, NumTract, FminPath,
+                   BaseXfmFile, BaseMask, StoreFile);
+
+  mNx = mInput->mNx;
+  mNy = mInput->mNy;
+  mNz = mInput->mNz;
+  mNxy = mInput->mNxy;
+  mNumVox = mInput->mNumVox;
+  mMask = mInput->mMask;
+  mRootDir = mInput->mRootDir;
+
+  ResetDiffusionParameters();
+}
+
+//
+// Save a sample of the atlas-based path priors, common among all time points
+//
+void Aeon::SavePathPriors(vector<float> &Priors) {
+  mPriorSamples.insert(mPriorSamples.end(), Priors.begin(), Priors.end());
+}
+
+//
+// Save a path sample in base space, common among all time points
+//
+void Aeon::SaveBasePath(vector<int> &PathPoints) {
+  mBasePathPointSamples.push_back(PathPoints);
+}
+
+//
+// Set a path sample as the MAP path
+//
+void Aeon::SetPathMap(unsigned int PathIndex) {
+  mMaxAPosterioriPath0 = PathIndex;
+}
+
 //
 // Return a pointer to this time point's mask
 //
@@ -230,7 +324,7 @@ MRI *Aeon::GetMask() const { return mMask; }
 // Return a pointer to this time point's base template mask
 // (null if running in cross-sectional mode)
 //
-MRI *Aeon::GetBaseMask() const { return mBaseMask; }
+MRI *Aeon::GetBaseMask() const { return mInput->mBaseMask; }
 
 //
 // Return this time point's spatial resolution
@@ -244,13 +338,6 @@ float Aeon::GetDz() const { return mMask->zsize; }
 //
 unsigned int Aeon::GetNumSample() const { return mPathPointSamples.size(); }
 
-//
-// Free the space allocation to this time point's mask for clean-up
-//
-void Aeon::FreeMask() {
-  MRIfree(&mMask);
-}
-
 //
 // Set this time point's output directory for the current pathway
 //
@@ -325,7 +412,7 @@ bool Aeon::MapPathFromBase(Spline &BaseSpline) {
   vector<float>::iterator iphi, itheta;
   vector<float> diff1;
 
-  if (mBaseReg.IsEmpty()) {	// Single time point, there is no base
+  if (mInput->mBaseReg.IsEmpty()) {	// Single time point, there is no base
     // Copy spline points
     mPathPointsNew.resize(BaseSpline.GetAllPointsEnd() -
                           BaseSpline.GetAllPointsBegin());
@@ -354,7 +441,7 @@ bool Aeon::MapPathFromBase(Spline &BaseSpline) {
       for (int k = 0; k < 3; k++)
         pointf[k] = (float) iptbase[k];
 
-      mBaseReg.ApplyXfm(pointf, pointf.begin());
+      mInput->mBaseReg.ApplyXfm(pointf, pointf.begin());
 
       for (int k = 0; k < 3; k++)
         point[k] = (int) round(pointf[k]);
@@ -474,23 +561,31 @@ void Aeon::RemovePathPoints(vector<bool> &DoRemove, unsigned int NewSize) {
   mPathLength = mPathPoints.size() / 3;
 }
 
+//
+// Reset the diffusion parameters of all voxels to their initial values,
+// so that the MCMC chain does not depend on any previously run chain
+//
+void Aeon::ResetDiffusionParameters() {
+  mDataState.assign(mNumVox, BiteState());
+}
+
 //
 // Propose diffusion parameters by sampling from their marginal posteriors
 // for this time point along the proposed and current path
 //
-void Aeon::ProposeDiffusionParameters() {
+void Aeon::ProposeDiffusionParameters(unsigned short *RandState) {
   vector<int>::const_iterator ipt;
 
   // Sample parameters on proposed path
   for (ipt = mPathPointsNew.begin(); ipt < mPathPointsNew.end(); ipt += 3) {
-    Bite *ivox = mDataMask[ipt[0] + ipt[1]*mNx + ipt[2]*mNxy];
-    ivox->SampleParameters();
+    const int idata = GetDataIndex(ipt);
+    Bite(mInput->mData, idata).SampleParameters(mDataState[idata], RandState);
   }
 
   // Sample parameters on current path
   for (ipt = mPathPoints.begin(); ipt < mPathPoints.end(); ipt += 3) {
-    Bite *ivox = mDataMask[ipt[0] + ipt[1]*mNx + ipt[2]*mNxy];
-    ivox->SampleParameters();
+    const int idata = GetDataIndex(ipt);
+    Bite(mInput->mData, idata).SampleParameters(mDataState[idata], RandState);
   }
 }
 
@@ -518,11 +613,13 @@ bool Aeon::ComputePathDataFit() {
 
   for (vector<int>::iterator ipt = mPathPointsNew.begin();
                              ipt < mPathPointsNew.end(); ipt += 3) {
-    Bite *ivox = mDataMask[ipt[0] + ipt[1]*mNx + ipt[2]*mNxy];
+    const int idata = GetDataIndex(ipt);
+    const Bite ivox(mInput->mData, idata);
+    BiteState &istate = mDataState[idata];
 
-    ivox->ComputeLikelihoodOffPath();
-    ivox->ComputeLikelihoodOnPath(*iphi, *itheta);
-    if (ivox->IsFZero()) {
+    ivox.ComputeLikelihoodOffPath(istate);
+    ivox.ComputeLikelihoodOnPath(istate, *iphi, *itheta);
+    if (ivox.IsFZero(istate)) {
       ostringstream msg;
       msg << "Reject due to f=0 at "
           << ipt[0] << " " << ipt[1] << " " << ipt[2];
@@ -533,7 +630,7 @@ bool Aeon::ComputePathDataFit() {
 
       return false;
     }
-    if (ivox->IsThetaZero()) {
+    if (ivox.IsThetaZero(istate)) {
       ostringstream msg;
       msg << "Accept due to theta=0 at "
           << ipt[0] << " " << ipt[1] << " " << ipt[2];
@@ -544,14 +641,14 @@ bool Aeon::ComputePathDataFit() {
 
       return false;
     }
-    ivox->ComputePriorOffPath();
-    ivox->ComputePriorOnPath();
+    ivox.ComputePriorOffPath(istate);
+    ivox.ComputePriorOnPath(istate);
 
-    mLikelihoodOnPathNew += ivox->GetLikelihoodOnPath();
-    mPriorOnPathNew += ivox->GetPriorOnPath();
+    mLikelihoodOnPathNew += istate.GetLikelihoodOnPath();
+    mPriorOnPathNew += istate.GetPriorOnPath();
 
-    mLikelihoodOffPathNew += ivox->GetLikelihoodOffPath();
-    mPriorOffPathNew += ivox->GetPriorOffPath();
+    mLikelihoodOffPathNew += istate.GetLikelihoodOffPath();
+    mPriorOffPathNew += istate.GetPriorOffPath();
 
     iphi++;
     itheta++;
@@ -570,11 +667,13 @@ bool Aeon::ComputePathDataFit() {
 
   for (vector<int>::iterator ipt = mPathPoints.begin();
                              ipt < mPathPoints.end(); ipt += 3) {
-    Bite *ivox = mDataMask[ipt[0] + ipt[1]*mNx + ipt[2]*mNxy];
+    const int idata = GetDataIndex(ipt);
+    const Bite ivox(mInput->mData, idata);
+    BiteState &istate = mDataState[idata];
 
-    ivox->ComputeLikelihoodOffPath();
-    ivox->ComputeLikelihoodOnPath(*iphi, *itheta);
-    if (ivox->IsFZero()) {
+    ivox.ComputeLikelihoodOffPath(istate);
+    ivox.ComputeLikelihoodOnPath(istate, *iphi, *itheta);
+    if (ivox.IsFZero(istate)) {
       ostringstream msg;
       msg << "Accept due to f=0 at "
           << ipt[0] << " " << ipt[1] << " " << ipt[2];
@@ -585,7 +684,7 @@ bool Aeon::ComputePathDataFit() {
 
       return false;
     }
-    if (ivox->IsThetaZero()) {
+    if (ivox.IsThetaZero(istate)) {
       ostringstream msg;
       msg << "Reject due to theta=0 at "
           << ipt[0] << " " << ipt[1] << " " << ipt[2];
@@ -596,14 +695,14 @@ bool Aeon::ComputePathDataFit() {
 
       return false;
     }
-    ivox->ComputePriorOffPath();
-    ivox->ComputePriorOnPath();
+    ivox.ComputePriorOffPath(istate);
+    ivox.ComputePriorOnPath(istate);
 
-    mLikelihoodOnPath += ivox->GetLikelihoodOnPath();
-    mPriorOnPath += ivox->GetPriorOnPath();
+    mLikelihoodOnPath += istate.GetLikelihoodOnPath();
+    mPriorOnPath += istate.GetPriorOnPath();
 
-    mLikelihoodOffPath += ivox->GetLikelihoodOffPath();
-    mPriorOffPath += ivox->GetPriorOffPath();
+    mLikelihoodOffPath += istate.GetLikelihoodOffPath();
+    mPriorOffPath += istate.GetPriorOffPath();
 
     iphi++;
     itheta++;
@@ -626,7 +725,7 @@ int Aeon::FindErrorSegment(Spline &BaseSpline) {
     return iseg;
 
   // Find where along the spline the error occured
-  if (mBaseReg.IsEmpty()) {	// Single time point, there is no base
+  if (mInput->mBaseReg.IsEmpty()) {	// Single time point, there is no base
     for (vector<int>::const_iterator iptbase = BaseSpline.GetAllPointsBegin();
                                      iptbase < BaseSpline.GetAllPointsEnd();
                                      iptbase += 3)
@@ -646,7 +745,7 @@ int Aeon::FindErrorSegment(Spline &BaseSpline) {
       for (int k = 0; k < 3; k++)
         pointf[k] = (float) iptbase[k];
 
-      mBaseReg.ApplyXfm(pointf, pointf.begin());
+      mInput->mBaseReg.ApplyXfm(pointf, pointf.begin());
 
       for (int k = 0; k < 3; k++)
         point[k] = (int) round(pointf[k]);
@@ -727,7 +826,7 @@ void Aeon::WriteOutputs() {
   // Find maximum a posteriori path, if it hasn't been found yet:
   // Case where this is the first of multiple time points
   if (!mBasePathPointSamples.empty() && mMaxAPosterioriPath < 0) {
-    pdvol = MRIclone(mBaseMask, NULL);
+    pdvol = MRIclone(mInput->mBaseMask, NULL);
 
     ComputePathHisto(pdvol, mBasePathPointSamples);
     ComputePathLengths(lengths, mBasePathPointSamples);
@@ -961,9 +1060,9 @@ unsigned int Aeon::GetNumFZerosNew() const {
 
   for (vector<int>::const_iterator ipt = mPathPointsNew.begin();
                                    ipt < mPathPointsNew.end(); ipt += 3) {
-    Bite *ivox = mDataMask[ipt[0] + ipt[1]*mNx + ipt[2]*mNxy];
+    const int idata = GetDataIndex(ipt);
 
-    if (ivox->IsAllFZero())
+    if (Bite(mInput->mData, idata).IsAllFZero(mDataState[idata]))
       nzeros++;
   }
 
@@ -978,9 +1077,9 @@ unsigned int Aeon::GetNumFZeros() const {
 
   for (vector<int>::const_iterator ipt = mPathPoints.begin();
                                    ipt < mPathPoints.end(); ipt += 3) {
-    Bite *ivox = mDataMask[ipt[0] + ipt[1]*mNx + ipt[2]*mNxy];
+    const int idata = GetDataIndex(ipt);
 
-    if (ivox->IsAllFZero())
+    if (Bite(mInput->mData, idata).IsAllFZero(mDataState[idata]))
       nzeros++;
   }
 
@@ -1057,6 +1156,7 @@ Coffin::Coffin(const string OutDir, vector<string> InDirList,
                const string DwiFile,
                const string GradientFile, const string BvalueFile,
                const string MaskFile, const string BedpostDir,
+               const string StoreFile,
                const int NumTract, const float FminPath,
                const string BaseXfmFile, const string BaseMaskFile,
                const string InitFile,
@@ -1094,8 +1194,10 @@ Coffin::Coffin(const string OutDir, vector<string> InDirList,
            << "Gradients: " << GradientFile << endl
            << "B-values: " << BvalueFile << endl
            << "Mask: " << MaskFile << endl
-           << "BEDPOST directory: " << BedpostDir << endl
-           << "Max number of tracts per voxel: " << NumTract << endl
+           << "BEDPOST directory: " << BedpostDir << endl;
+  if (!StoreFile.empty())
+    infostr << "Voxel-wise data file: " << StoreFile << endl;
+  infostr  << "Max number of tracts per voxel: " << NumTract << endl
            << "Tract volume fraction threshold: " << FminPath << endl;
   if (!BaseXfmFile.empty())
     infostr << "Base-to-DWI affine registration: " << BaseXfmFile << endl;
@@ -1124,10 +1226,8 @@ Coffin::Coffin(const string OutDir, vector<string> InDirList,
       cout << "ERROR: Could not read " << BaseMaskFile << endl;
       exit(1);
     }
-    Aeon::SetBaseMask(mMask);
+    mBaseMask = std::shared_ptr<MRI>(mMask, FreeSharedVolume);
   }
-  else		// No base needed when running in cross-sectional mode
-    Aeon::SetBaseMask(0);
 
   // Read diffusion data, anatomical segmentation, and transform to atlas
   // for each time point
@@ -1140,7 +1240,7 @@ Coffin::Coffin(const string OutDir, vector<string> InDirList,
   for (vector<Aeon>::iterator idwi = mDwi.begin(); idwi < mDwi.end(); idwi++) {
     idwi->ReadData(*idir, DwiFile, GradientFile, BvalueFile,
                           MaskFile, BedpostDir, NumTract, FminPath,
-                          BaseXfmFile);
+                          BaseXfmFile, mMask, StoreFile);
     idir++;
   }
 
@@ -1197,15 +1297,18 @@ Coffin::Coffin(const string OutDir, vector<string> InDirList,
   }
 
   // Read DWI-to-atlas registration
+  mAffineReg = std::make_shared<AffineReg>();
 #ifndef NO_CVS_UP_IN_HERE
+  mNonlinReg = std::make_shared<NonlinReg>();
+
   if (!NonlinXfmFile.empty()) {
-    mAffineReg.ReadXfm(AffineXfmFile, mMask, atlasref);
-    mNonlinReg.ReadXfm(NonlinXfmFile, atlasref);
+    mAffineReg->ReadXfm(AffineXfmFile, mMask, atlasref);
+    mNonlinReg->ReadXfm(NonlinXfmFile, atlasref);
   }
   else
 #endif
   if (!AffineXfmFile.empty())
-    mAffineReg.ReadXfm(AffineXfmFile, mMask, atlasref);
+    mAffineReg->ReadXfm(AffineXfmFile, mMask, atlasref);
 
 	/*
 vector<float> pt(3);
@@ -1232,9 +1335,12 @@ exit(1);
       exit(1);
     }
 
-    mAseg.push_back(aseg);
+    mAseg.push_back(std::shared_ptr<MRI>(aseg, FreeSharedVolume));
   }
 
+  // Seed random number generator
+  SetRandomSeed(0);
+
   // Create output directory for current pathway for each time point
   SetOutputDir(OutDir);
 
@@ -1251,17 +1357,41 @@ exit(1);
                     KeepSampleNth, UpdatePropNth, PropStdFile);
 }
 
-Coffin::~Coffin() {
-  if (mMask != mDwi[0].GetMask())
-    MRIfree(&mMask);
-
+//
+// Copy a container to reconstruct other pathways in parallel: the input data
+// (diffusion data, masks, registrations, segmentations) are shared with the
+// source, not duplicated, and are not modified by either container.
+// The pathway and MCMC parameters must be set in the copy before running it.
+//
+Coffin::Coffin(const Coffin &Source) :
+               mDebug(Source.mDebug),
+               mNx(Source.mNx), mNy(Source.mNy), mNz(Source.mNz),
+               mNxy(Source.mNxy),
+               mPriorSetLocal(Source.mPriorSetLocal),
+               mPriorSetNear(Source.mPriorSetNear),
+               mInfoGeneral(Source.mInfoGeneral),
+               mResolution(Source.mResolution),
+               mMask(Source.mMask), mRoi1(0), mRoi2(0),
+               mXyzPrior0(0), mXyzPrior1(0),
+               mBaseMask(Source.mBaseMask),
+               mAffineReg(Source.mAffineReg),
+#ifndef NO_CVS_UP_IN_HERE
+               mNonlinReg(Source.mNonlinReg),
+#endif
+               mAseg(Source.mAseg),
+               mDwi(Source.mDwi) {
+  // Start from a clean path for each time point
   for (vector<Aeon>::iterator idwi = mDwi.begin(); idwi < mDwi.end(); idwi++)
-    idwi->FreeMask();
+    idwi->ClearPath();
 
-  for (vector<MRI *>::iterator iaseg = mAseg.begin(); iaseg < mAseg.end();
-                                                      iaseg++)
-    MRIfree(&(*iaseg));
+  mSpline.SetMask(mMask);
+
+  mAtlasCoords.resize(mNxy*mNz);
 
+  copy(Source.mRandState, Source.mRandState + 3, mRandState);
+}
+
+Coffin::~Coffin() {
   MRIfree(&mRoi1);
   MRIfree(&mRoi2);
 
@@ -1271,6 +1401,18 @@ Coffin::~Coffin() {
   }
 }
 
+//
+// Seed the random number generator of this container, so that the MCMC
+// samples of a pathway only depend on its own seed, whether pathways are
+// reconstructed one after the other or in parallel
+//
+void Coffin::SetRandomSeed(long Seed) {
+  // Same state as srand48(Seed)
+  mRandState[0] = 0x330E;
+  mRandState[1] = (unsigned short) (Seed & 0xFFFF);
+  mRandState[2] = (unsigned short) ((Seed >> 16) & 0xFFFF);
+}
+
 //
 // Set output directory for each time point
 //
@@ -1659,6 +1801,10 @@ void Coffin::SetPathway(const string InitFile,
       exit(1);
     }
   }
+
+  // Start the MCMC chain of this pathway from the initial diffusion parameters
+  for (vector<Aeon>::iterator idwi = mDwi.begin(); idwi < mDwi.end(); idwi++)
+    idwi->ResetDiffusionParameters();
 }
 
 //
@@ -2107,7 +2253,7 @@ bool Coffin::RunMcmcSingle() {
     // Perturb control points in random order
     for (int k = 0; k < mNumControl; k++)
       cptorder[k] = k;
-    random_shuffle(cptorder.begin(), cptorder.end());
+    RandomShuffle(cptorder);
 
     fill(mRejectControl.begin(), mRejectControl.end(), false);
 
@@ -2159,7 +2305,7 @@ bool Coffin::RunMcmcSingle() {
     // Perturb control points in random order
     for (int k = 0; k < mNumControl; k++)
       cptorder[k] = k;
-    random_shuffle(cptorder.begin(), cptorder.end());
+    RandomShuffle(cptorder);
 
     fill(mRejectControl.begin(), mRejectControl.end(), false);
 
@@ -2651,7 +2797,7 @@ bool Coffin::ProposePathFull() {
     double norm = 0;
 
     for (int ii = 0; ii < 3; ii++) {
-      *jump = round((*pstd) * PDFgaussian());
+      *jump = round((*pstd) * RandomGaussian());
       *newcoord = *coord + (int) *jump;
 
       *jump *= *jump;
@@ -2783,7 +2929,7 @@ bool Coffin::ProposePathSingle(int ControlIndex) {
 
   // Perturb current control point
   for (int ii = 0; ii < 3; ii++) {
-    *jump = round((*pstd) * PDFgaussian());
+    *jump = round((*pstd) * RandomGaussian());
     *newcoord = *coord + (int) *jump;
 
     *jump *= *jump;
@@ -2870,7 +3016,44 @@ bool Coffin::ProposePathSingle(int ControlIndex) {
 //
 void Coffin::ProposeDiffusionParameters() {
   for (vector<Aeon>::iterator idwi = mDwi.begin(); idwi < mDwi.end(); idwi++)
-    idwi->ProposeDiffusionParameters();
+    idwi->ProposeDiffusionParameters(mRandState);
+}
+
+//
+// Draw a random number from this container's own sequence,
+// uniformly distributed in [0, 1)
+//
+double Coffin::RandomUniform() {
+  return erand48(mRandState);
+}
+
+//
+// Draw a random number from this container's own sequence,
+// normally distributed with zero mean and unit variance
+// (same polar method as PDFgaussian)
+//
+double Coffin::RandomGaussian() {
+  double v1, v2, r2;
+
+  do {
+    v1 = 2.0 * erand48(mRandState) - 1.0;
+    v2 = 2.0 * erand48(mRandState) - 1.0;
+    r2 = v1 * v1 + v2 * v2;
+  } while (r2 > 1.0);
+
+  return (v1 * sqrt(-2.0 * log(r2) / r2));
+}
+
+//
+// Randomly permute an order of control points,
+// using this container's own sequence of random numbers
+//
+void Coffin::RandomShuffle(vector<int> &Order) {
+  for (int k = (int) Order.size() - 1; k > 0; k--) {
+    const int kswap = (int) (erand48(mRandState) * (k+1));
+
+    swap(Order[k], Order[kswap]);
+  }
 }
 
 //
@@ -2957,7 +3140,7 @@ bool Coffin::AcceptPath(bool UsePriorOnly) {
               + mPosteriorOffPath   - mPosteriorOnPath;
 
   // Accept or reject proposed path based on ratio of posteriors
-  if (drand48() < exp(-neglogratio)) {
+  if (RandomUniform() < exp(-neglogratio)) {
     if (mDebug) {
       mLog << "Accept due to posterior (alpha = " << exp(-neglogratio) << ")"
            << endl;
@@ -3131,10 +3314,11 @@ double Coffin::ComputeAnatomicalPrior(vector<int> &PathAtlasPoints) {
                 iy = iy0 + idir[1],
                 iz = iz0 + idir[2];
 
-      for (vector<MRI *>::const_iterator iaseg = mAseg.begin();
-                                         iaseg < mAseg.end(); iaseg++) {
+      for (vector< shared_ptr<MRI> >::const_iterator iaseg = mAseg.begin();
+                                                     iaseg < mAseg.end();
+                                                     iaseg++) {
         imatch = find(iid->begin(), iid->end(),
-                      (unsigned int) MRIgetVoxVal(*iaseg,
+                      (unsigned int) MRIgetVoxVal(iaseg->get(),
                                      ((ix > -1 && ix < mNxAtlas) ? ix : ix0),
                                      ((iy > -1 && iy < mNyAtlas) ? iy : iy0),
                                      ((iz > -1 && iz < mNzAtlas) ? iz : iz0),
@@ -3155,9 +3339,10 @@ double Coffin::ComputeAnatomicalPrior(vector<int> &PathAtlasPoints) {
     ipr = iprnear;
 
     iseg0 = seg0.begin();
-    for (vector<MRI *>::const_iterator iaseg = mAseg.begin();
-                                       iaseg < mAseg.end(); iaseg++) {
-      *iseg0 = MRIgetVoxVal(*iaseg, ix0, iy0, iz0, 0);
+    for (vector< shared_ptr<MRI> >::const_iterator iaseg = mAseg.begin();
+                                                   iaseg < mAseg.end();
+                                                   iaseg++) {
+      *iseg0 = MRIgetVoxVal(iaseg->get(), ix0, iy0, iz0, 0);
       iseg0++;
     }
 
@@ -3168,14 +3353,15 @@ double Coffin::ComputeAnatomicalPrior(vector<int> &PathAtlasPoints) {
                     iz = iz0 + idir[2];
 
       iseg0 = seg0.begin();
-      for (vector<MRI *>::const_iterator iaseg = mAseg.begin();
-                                         iaseg < mAseg.end(); iaseg++) {
+      for (vector< shared_ptr<MRI> >::const_iterator iaseg = mAseg.begin();
+                                                     iaseg < mAseg.end();
+                                                     iaseg++) {
         float seg = *iseg0;
 
         while ((ix > -1) && (ix < mNxAtlas) &&
                (iy > -1) && (iy < mNyAtlas) &&
                (iz > -1) && (iz < mNzAtlas) && (seg == *iseg0)) {
-          seg = MRIgetVoxVal(*iaseg, ix, iy, iz, 0);
+          seg = MRIgetVoxVal(iaseg->get(), ix, iy, iz, 0);
           dist++;
 
           ix += idir[0];
@@ -3413,7 +3599,8 @@ void Coffin::SavePathPosterior(bool IsPathAccepted) {
     priors[5] = (float) mShapePriorNew;
   }
 
-  Aeon::SavePathPriors(priors);
+  for (vector<Aeon>::iterator idwi = mDwi.begin(); idwi < mDwi.end(); idwi++)
+    idwi->SavePathPriors(priors);
 }
 
 //
@@ -3430,11 +3617,13 @@ void Coffin::SavePath() {
 
   // If in longitudinal mode, also save current path in base space
   if (mDwi[0].GetBaseMask())
-    Aeon::SaveBasePath(mPathPoints);
+    for (vector<Aeon>::iterator idwi = mDwi.begin(); idwi < mDwi.end(); idwi++)
+      idwi->SaveBasePath(mPathPoints);
 
   // Keep track of MAP path
   if (mPosteriorOnPath < mPosteriorOnPathMap) {
-    Aeon::SetPathMap(mDwi[0].GetNumSample() - 1);
+    for (vector<Aeon>::iterator idwi = mDwi.begin(); idwi < mDwi.end(); idwi++)
+      idwi->SetPathMap(mDwi[0].GetNumSample() - 1);
     mPosteriorOnPathMap = mPosteriorOnPath;
   }
 }
@@ -3602,13 +3791,13 @@ bool Coffin::IsZigZag(vector<int> &ControlPoints,
 //
 void Coffin::MapPointToAtlas(vector<int>::iterator OutPoint,
                              vector<int>::const_iterator InPoint) {
-  if (!mAffineReg.IsEmpty()) {
+  if (!mAffineReg->IsEmpty()) {
     vector<float> point(InPoint, InPoint+3);
 
-    mAffineReg.ApplyXfm(point, point.begin());
+    mAffineReg->ApplyXfm(point, point.begin());
 #ifndef NO_CVS_UP_IN_HERE
-    if (!mNonlinReg.IsEmpty())
-      mNonlinReg.ApplyXfm(point, point.begin());
+    if (!mNonlinReg->IsEmpty())
+      mNonlinReg->ApplyXfm(point, point.begin());
 #endif
 
     for (int k = 0; k < 3; k++)
@@ -3770,6 +3959,13 @@ bool Aeon::IsInMask(vector<int>::const_iterator Point) {
          (MRIgetVoxVal(mMask, Point[0], Point[1], Point[2], 0) > 0);
 }
 
+//
+// Find index of voxel data from voxel coordinates
+//
+int Aeon::GetDataIndex(vector<int>::const_iterator Point) const {
+  return mInput->mDataIndex[Point[0] + Point[1]*mNx + Point[2]*mNxy];
+}
+
 //
 // Compute leengths of path samples
 //
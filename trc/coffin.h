@@ -24,6 +24,7 @@
 #include "vial.h"	// Needs to be included first because of CVS libs
 
 #include <vector>
+#include <memory>
 #include <string>
 #include <iostream>
 #include <fstream>
@@ -40,33 +41,58 @@
 
 #include "TrackIO.h"
 
+class AeonData {	// Input data of one point in time, read-only once loaded
+  public:
+    AeonData();
+    ~AeonData();
+    void ReadData(const string RootDir, const string DwiFile,
+                  const string GradientFile, const string BvalueFile,
+                  const string MaskFile, const string BedpostDir,
+                  const int NumTract, const float FminPath,
+                  const string BaseXfmFile, MRI *BaseMask,
+                  const string StoreFile);
+
+  private:
+    friend class Aeon;
+
+    int mNx, mNy, mNz, mNxy, mNumVox;
+    MRI *mMask, *mBaseMask;
+    string mRootDir;
+    BiteScheme mScheme;
+    BiteStore mData;					// [mNumVox]
+    std::vector<int> mDataIndex;			// [mNx x mNy x mNz]
+    AffineReg mBaseReg;
+
+    void ReadBaseXfm(const string BaseXfmFile, MRI *BaseMask);
+};
+
 class Aeon {		// One point in time
   public:
     Aeon();
     ~Aeon();
-    static void SetBaseMask(MRI *BaseMask);
-    static void SavePathPriors(std::vector<float> &Priors);
-    static void SaveBasePath(std::vector<int> &PathPoints);
-    static void SetPathMap(unsigned int PathIndex);
     void ReadData(const string RootDir, const string DwiFile,
                   const string GradientFile, const string BvalueFile,
                   const string MaskFile, const string BedpostDir,
                   const int NumTract, const float FminPath,
-                  const string BaseXfmFile);
+                  const string BaseXfmFile, MRI *BaseMask,
+                  const string StoreFile);
+    void SavePathPriors(std::vector<float> &Priors);
+    void SaveBasePath(std::vector<int> &PathPoints);
+    void SetPathMap(unsigned int PathIndex);
     MRI *GetMask() const;
     MRI *GetBaseMask() const;
     float GetDx() const;
     float GetDy() const;
     float GetDz() const;
     unsigned int GetNumSample() const;
-    void FreeMask();
     void SetOutputDir(const string OutDir);
     const string &GetOutputDir() const;
     void ClearPath();
     bool MapPathFromBase(Spline &BaseSpline);
     void FindDuplicatePathPoints(std::vector<bool> &IsDuplicate);
     void RemovePathPoints(std::vector<bool> &DoRemove, unsigned int NewSize=0);
-    void ProposeDiffusionParameters();
+    void ResetDiffusionParameters();
+    void ProposeDiffusionParameters(unsigned short *RandState);
     bool ComputePathDataFit();
     int FindErrorSegment(Spline &BaseSpline);
     void UpdatePath();
@@ -99,15 +125,10 @@ class Aeon {		// One point in time
 
   private:
     static const unsigned int mDiffStep;
-    static int mMaxAPosterioriPath;
-    static unsigned int mMaxAPosterioriPath0;
-    static std::vector<float> mPriorSamples;
-    static std::vector< std::vector<int> > mBasePathPointSamples;
-    static MRI *mBaseMask;
 
     bool mRejectF, mAcceptF, mRejectTheta, mAcceptTheta;
-    int mNx, mNy, mNz, mNxy, mNumVox;
-    unsigned int mPathLength, mPathLengthNew;
+    int mNx, mNy, mNz, mNxy, mNumVox, mMaxAPosterioriPath;
+    unsigned int mPathLength, mPathLengthNew, mMaxAPosterioriPath0;
     double mLikelihoodOnPath, mPriorOnPath, mPosteriorOnPath,
            mLikelihoodOnPathNew, mPriorOnPathNew, mPosteriorOnPathNew,
            mLikelihoodOffPath, mPriorOffPath, mPosteriorOffPath,
@@ -117,11 +138,14 @@ class Aeon {		// One point in time
     std::vector<int> mPathPoints, mPathPointsNew, mErrorPoint;
     std::vector<float> mPathPhi, mPathPhiNew,
                        mPathTheta, mPathThetaNew,
-                       mDataFitSamples;
-    std::vector< std::vector<int> > mPathPointSamples;
-    std::vector<Bite> mData;				// [mNumVox]
-    std::vector<Bite *>mDataMask;			// [mNx x mNy x mNz]
-    AffineReg mBaseReg;
+                       mDataFitSamples,
+                       mPriorSamples;			// Common among time points
+    std::vector< std::vector<int> > mPathPointSamples,
+                                    mBasePathPointSamples;	// Common
+    std::shared_ptr<AeonData> mInput;			// Shared among pathways
+    std::vector<BiteState> mDataState;			// [mNumVox]
+
+    int GetDataIndex(std::vector<int>::const_iterator Point) const;
 
     bool IsInMask(std::vector<int>::const_iterator Point);
     void ComputePathLengths(std::vector<int> &PathLengths,
@@ -138,6 +162,7 @@ class Coffin {		// The main container
            const string DwiFile,
            const string GradientFile, const string BvalueFile,
            const string MaskFile, const string BedpostDir,
+           const string StoreFile,
            const int NumTract, const float FminPath,
            const string BaseXfmFile, const string BaseMaskFile,
            const string InitFile,
@@ -156,7 +181,9 @@ class Coffin {		// The main container
            const int KeepSampleNth, const int UpdatePropNth,
            const string PropStdFile,
            const bool Debug=false);
+    Coffin(const Coffin &Source);
     ~Coffin();
+    void SetRandomSeed(long Seed);
     void SetOutputDir(const string OutDir);
     void SetPathway(const string InitFile,
                     const string RoiFile1, const string RoiFile2,
@@ -176,6 +203,7 @@ class Coffin {		// The main container
   private:
     static const unsigned int mMaxTryMask, mMaxTryWhite, mDiffStep;
     static const float mTangentBinSize, mCurvatureBinSize;
+    unsigned short mRandState[3];
     bool mRejectSpline, mRejectPosterior,
          mRejectF, mAcceptF, mRejectTheta, mAcceptTheta;
     const bool mDebug;
@@ -210,11 +238,14 @@ class Coffin {		// The main container
     MRI *mMask, *mRoi1, *mRoi2, *mXyzPrior0, *mXyzPrior1;
     std::ofstream mLog;
     Spline mSpline;
-    AffineReg mAffineReg;
+
+    // Input data, shared with copies of this container
+    std::shared_ptr<MRI> mBaseMask;
+    std::shared_ptr<AffineReg> mAffineReg;
 #ifndef NO_CVS_UP_IN_HERE
-    NonlinReg mNonlinReg;
+    std::shared_ptr<NonlinReg> mNonlinReg;
 #endif
-    std::vector<MRI *> mAseg;
+    std::vector< std::shared_ptr<MRI> > mAseg;
     std::vector<Aeon> mDwi;
 
     void ReadControlPoints(const string ControlPointFile);
@@ -228,6 +259,9 @@ class Coffin {		// The main container
     bool ProposePathFull();
     bool ProposePathSingle(int ControlIndex);
     void ProposeDiffusionParameters();
+    double RandomUniform();
+    double RandomGaussian();
+    void RandomShuffle(std::vector<int> &Order);
     bool AcceptPath(bool UsePriorOnly=false);
     double ComputeXyzPriorOffPath(std::vector<int> &PathAtlasPoints);
     double ComputeXyzPriorOnPath(std::vector<int> &PathAtlasPoints);
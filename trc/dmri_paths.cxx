@@ -46,6 +46,7 @@ double round(double x);
 #include "version.h"
 #include "cmdargs.h"
 #include "timer.h"
+#include "romp_support.h"
 
 using namespace std;
 
@@ -57,7 +58,8 @@ static void print_help(void);
 static void print_version(void);
 static void dump_options();
 
-int debug = 0, checkoptsonly = 0;
+int debug = 0, checkoptsonly = 0, nthreads = 1;
+long randSeed = 6875;
 
 int main(int argc, char *argv[]);
 
@@ -68,7 +70,7 @@ unsigned int nTract = 1,
              nBurnIn = 5000, nSample = 5000, nKeepSample = 10, nUpdateProp = 40,
              localPriorSet = 15, neighPriorSet = 14;
 float fminPath = 0;
-string dwiFile, gradFile, bvalFile, maskFile, bedpostDir,
+string dwiFile, gradFile, bvalFile, maskFile, bedpostDir, storeFile,
        baseXfmFile, baseMaskFile, affineXfmFile, nonlinXfmFile;
 vector<string> outDir, inDirList, initFile, roiFile1, roiFile2,
                roiMeshFile1, roiMeshFile2, roiRefFile1, roiRefFile2,
@@ -117,6 +119,8 @@ int main(int argc, char **argv) {
   srand(6875);
   srand48(6875);
 
+  cputimer.reset();
+
   if (xyzPriorFile0.empty())  doxyzprior = false;
   if (tangPriorFile.empty())  dotangprior = false;
   if (curvPriorFile.empty())  docurvprior = false;
@@ -124,20 +128,28 @@ int main(int argc, char **argv) {
   if (localPriorFile.empty()) dolocalprior = false;
   if (stdPropFile.empty())    dopropinit = false;
 
-  islabel1 = (roiFile1[0].find(".label") != string::npos);
-  islabel2 = (roiFile2[0].find(".label") != string::npos);
+  // Index of .label mesh/reference files for each pathway
+  vector<int> ilabel1(outDir.size(), -1), ilabel2(outDir.size(), -1);
+
+  for (unsigned int iout = 0; iout < outDir.size(); iout++) {
+    islabel1 = (roiFile1[iout].find(".label") != string::npos);
+    islabel2 = (roiFile2[iout].find(".label") != string::npos);
+
+    if (islabel1) ilabel1[iout] = ilab1++;
+    if (islabel2) ilabel2[iout] = ilab2++;
+  }
 
   Coffin mycoffin(outDir[0], inDirList, dwiFile,
                   gradFile, bvalFile,
-                  maskFile, bedpostDir,
+                  maskFile, bedpostDir, storeFile,
                   nTract, fminPath,
                   baseXfmFile, baseMaskFile,
                   initFile[0],
                   roiFile1[0], roiFile2[0],
-                  islabel1 ? roiMeshFile1[ilab1] : string(),
-                  islabel2 ? roiMeshFile2[ilab2] : string(),
-                  islabel1 ? roiRefFile1[ilab1] : string(),
-                  islabel2 ? roiRefFile2[ilab2] : string(),
+                  (ilabel1[0] >= 0) ? roiMeshFile1[ilabel1[0]] : string(),
+                  (ilabel2[0] >= 0) ? roiMeshFile2[ilabel2[0]] : string(),
+                  (ilabel1[0] >= 0) ? roiRefFile1[ilabel1[0]] : string(),
+                  (ilabel2[0] >= 0) ? roiRefFile2[ilabel2[0]] : string(),
                   doxyzprior ? xyzPriorFile0[0] : string(),
                   doxyzprior ? xyzPriorFile1[0] : string(),
                   dotangprior ? tangPriorFile[0] : string(),
@@ -154,49 +166,91 @@ int main(int argc, char **argv) {
                   dopropinit ? stdPropFile[0] : string(),
                   debug);
 
-  if (islabel1) ilab1++;
-  if (islabel2) ilab2++;
-
-  for (unsigned int iout = 0; iout < outDir.size(); iout++) {
-    if (iout > 0) {
-      islabel1 = (roiFile1[iout].find(".label") != string::npos);
-      islabel2 = (roiFile2[iout].find(".label") != string::npos);
-
-      mycoffin.SetOutputDir(outDir[iout]);
-      mycoffin.SetPathway(initFile[iout],
-                  roiFile1[iout], roiFile2[iout],
-                  islabel1 ? roiMeshFile1[ilab1] : string(),
-                  islabel2 ? roiMeshFile2[ilab2] : string(),
-                  islabel1 ? roiRefFile1[ilab1] : string(),
-                  islabel2 ? roiRefFile2[ilab2] : string(),
-                  doxyzprior ? xyzPriorFile0[iout] : string(),
-                  doxyzprior ? xyzPriorFile1[iout] : string(),
-                  dotangprior ? tangPriorFile[iout] : string(),
-                  docurvprior ? curvPriorFile[iout] : string(),
-                  doneighprior ? neighPriorFile[iout] : string(),
-                  doneighprior ? neighIdFile[iout] : string(),
-                  dolocalprior ? localPriorFile[iout] : string(),
-                  dolocalprior ? localIdFile[iout] : string());
-      mycoffin.SetMcmcParameters(nBurnIn, nSample, nKeepSample, nUpdateProp,
-                  dopropinit ? stdPropFile[iout] : string());
-
-      if (islabel1) ilab1++;
-      if (islabel2) ilab2++;
+  // Set atlas-derived information and MCMC parameters for a given pathway
+  auto set_pathway = [&](Coffin &coffin, unsigned int iout) {
+    coffin.SetOutputDir(outDir[iout]);
+    coffin.SetPathway(initFile[iout],
+                roiFile1[iout], roiFile2[iout],
+                (ilabel1[iout] >= 0) ? roiMeshFile1[ilabel1[iout]] : string(),
+                (ilabel2[iout] >= 0) ? roiMeshFile2[ilabel2[iout]] : string(),
+                (ilabel1[iout] >= 0) ? roiRefFile1[ilabel1[iout]] : string(),
+                (ilabel2[iout] >= 0) ? roiRefFile2[ilabel2[iout]] : string(),
+                doxyzprior ? xyzPriorFile0[iout] : string(),
+                doxyzprior ? xyzPriorFile1[iout] : string(),
+                dotangprior ? tangPriorFile[iout] : string(),
+                docurvprior ? curvPriorFile[iout] : string(),
+                doneighprior ? neighPriorFile[iout] : string(),
+                doneighprior ? neighIdFile[iout] : string(),
+                dolocalprior ? localPriorFile[iout] : string(),
+                dolocalprior ? localIdFile[iout] : string());
+    coffin.SetMcmcParameters(nBurnIn, nSample, nKeepSample, nUpdateProp,
+                dopropinit ? stdPropFile[iout] : string());
+  };
+
+  // Each thread reconstructs one pathway at a time in its own container,
+  // which shares the input data of the first container. Every pathway has
+  // its own random seed, so its samples do not depend on the number of
+  // threads or on the order in which pathways are processed.
+  const int ncoffin = max(1, min(nthreads, (int) outDir.size()));
+  vector<Coffin *> coffins(ncoffin, &mycoffin);
+  vector<int> coffinpath(ncoffin, -1);
+
+  coffinpath[0] = 0;
+  for (int icoffin = 1; icoffin < ncoffin; icoffin++)
+    coffins[icoffin] = new Coffin(mycoffin);
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) num_threads(ncoffin) schedule(dynamic, 1)
+#endif
+  for (int iout = 0; iout < (int) outDir.size(); iout++) {
+    ROMP_PFLB_begin
+    const int icoffin = omp_get_thread_num();
+    Coffin *pathcoffin = coffins[icoffin];
+    Timer pathtimer;
+    bool success;
+
+    if (coffinpath[icoffin] != iout) {
+#ifdef HAVE_OPENMP
+      #pragma omp critical(dmri_paths_io)
+#endif
+      set_pathway(*pathcoffin, iout);
+
+      coffinpath[icoffin] = iout;
     }
 
+    pathcoffin->SetRandomSeed(randSeed + iout);
+
+#ifdef HAVE_OPENMP
+    #pragma omp critical(dmri_paths_io)
+#endif
     cout << "Processing pathway " << iout+1 << " of " << outDir.size() << "..."
          << endl;
-    cputimer.reset();
 
-    //if (mycoffin.RunMcmcFull())
-    if (mycoffin.RunMcmcSingle())
-      mycoffin.WriteOutputs();
-    else
-      cout << "ERROR: Pathway reconstruction failed" << endl;
+    //success = pathcoffin->RunMcmcFull();
+    success = pathcoffin->RunMcmcSingle();
+
+#ifdef HAVE_OPENMP
+    #pragma omp critical(dmri_paths_io)
+#endif
+    {
+      if (success)
+        pathcoffin->WriteOutputs();
+      else
+        cout << "ERROR: Pathway reconstruction failed" << endl;
 
-    cputime = cputimer.milliseconds();
-    printf("Done in %g sec.\n", cputime/1000.0);
+      printf("Pathway %d done in %g sec.\n", iout+1,
+             pathtimer.milliseconds()/1000.0);
+    }
+    ROMP_PFLB_end
   }
+  ROMP_PF_end
+
+  for (int icoffin = 1; icoffin < ncoffin; icoffin++)
+    delete coffins[icoffin];
+
+  cputime = cputimer.milliseconds();
+  printf("Done in %g sec.\n", cputime/1000.0);
 
   printf("dmri_paths done\n");
   return(0);
@@ -266,6 +320,11 @@ static int parse_commandline(int argc, char **argv) {
       bedpostDir = pargv[0];
       nargsused = 1;
     } 
+    else if (!strcmp(option, "--store")) {
+      if (nargc < 1) CMDargNErr(option,1);
+      storeFile = pargv[0];
+      nargsused = 1;
+    } 
     else if (!strcmp(option, "--ntr")) {
       if (nargc < 1) CMDargNErr(option,1);
       sscanf(pargv[0],"%u",&nTract);
@@ -424,6 +483,20 @@ static int parse_commandline(int argc, char **argv) {
         nargsused++;
       }
     }
+    else if (!strcmp(option, "--seed")) {
+      if (nargc < 1) CMDargNErr(option,1);
+      sscanf(pargv[0],"%ld",&randSeed);
+      nargsused = 1;
+    }
+    else if (!strcasecmp(option, "--threads") ||
+             !strcasecmp(option, "--nthreads")) {
+      if (nargc < 1) CMDargNErr(option,1);
+      sscanf(pargv[0],"%d",&nthreads);
+#ifdef HAVE_OPENMP
+      omp_set_num_threads(nthreads);
+#endif
+      nargsused = 1;
+    }
     else if (!strcmp(option, "--nb")) {
       if (nargc < 1) CMDargNErr(option,1);
       sscanf(pargv[0],"%u",&nBurnIn);
@@ -477,6 +550,11 @@ static void print_usage(void) {
   << "     Mask volume" << endl
   << "   --bpdir <dir>:" << endl
   << "     BEDPOST directory" << endl
+  << "   --store <file>:" << endl
+  << "     Binary file of voxel-wise DWI and BEDPOST data (relative to" << endl
+  << "     input directory, if specified): memory-mapped if it exists" << endl
+  << "     and matches the mask and the unchanged input files," << endl
+  << "     otherwise created from the inputs" << endl
   << "   --ntr <num>:" << endl
   << "     Max number of tracts per voxel (default 1)" << endl
   << "   --fmin <num>:" << endl
@@ -546,6 +624,12 @@ static void print_usage(void) {
   << "     Text file with initial proposal standard deviations" << endl
   << "     for control point perturbations (one per path or" << endl
   << "     default SD=1 for all control points and all paths)" << endl
+  << "   --seed <num>:" << endl
+  << "     Random seed of the first path, path n uses seed+n-1" << endl
+  << "     (default 6875)" << endl
+  << "   --nthreads <num>:" << endl
+  << "     Number of paths to reconstruct in parallel (default 1)," << endl
+  << "     results do not depend on this" << endl
   << endl
   << "Other options" << endl
   << "   --debug:     turn on debugging" << endl
@@ -699,8 +783,12 @@ static void dump_options() {
        << "Gradients: " << gradFile << endl
        << "B-values: " << bvalFile << endl
        << "Mask: " << maskFile << endl
-       << "BEDPOST directory: " << bedpostDir << endl
-       << "Max number of tracts per voxel: " << nTract << endl
+       << "BEDPOST directory: " << bedpostDir << endl;
+
+  if (!storeFile.empty())
+    cout << "Voxel-wise data file: " << storeFile << endl;
+
+  cout << "Max number of tracts per voxel: " << nTract << endl
        << "Tract volume fraction threshold: " << fminPath << endl;
 
   cout << "Initial control point file:";
@@ -798,7 +886,9 @@ static void dump_options() {
   cout << "Number of burn-in samples: " << nBurnIn << endl
        << "Number of post-burn-in samples: " << nSample << endl
        << "Keep every: " << nKeepSample << "-th sample" << endl
-       << "Update proposal every: " << nUpdateProp << "-th sample" << endl;
+       << "Update proposal every: " << nUpdateProp << "-th sample" << endl
+       << "Random seed: " << randSeed << endl
+       << "Number of threads: " << nthreads << endl;
 
   if (!stdPropFile.empty()) {
     cout << "Initial proposal SD file:";
@@ -33,6 +33,11 @@ void *malloc(size_t size);
 #endif
 
 #include <math.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include <map>
+#include <string>
 
 #include "mri.h"
 
@@ -1530,10 +1535,7 @@ char *SiemensAsciiTagEx(const char *dcmfile, const char *TagString, int cleanup)
   static int MAX_ASCIILIST = 512;
   static int INCREMENT = 64;
 
-  int k;
   FILE *fp;
-  char buf[1024];
-  char command[1024 + 32];
   char *plist = 0;
   char VariableName[512];
   char *VariableValue = 0;
@@ -1541,16 +1543,6 @@ char *SiemensAsciiTagEx(const char *dcmfile, const char *TagString, int cleanup)
   int newSize;
   char **newlists = 0;
 
-// Use this when debugging (gdb) because it will not fork
-// return(SiemensAsciiTag(dcmfile, TagString, cleanup));
-
-#ifdef Darwin
-  // This routine calls the unix "strings" command which operates
-  // differently on mac vs linux, so use the old, slow version of this
-  // routine if it is a mac.
-  return (SiemensAsciiTag(dcmfile, TagString, cleanup));
-#endif
-
   if (getenv("USE_SIEMENSASCIITAG")) return (SiemensAsciiTag(dcmfile, TagString, cleanup));
 
   // cleanup section.  Make sure to set cleanup =1 at the final call
@@ -1577,19 +1569,8 @@ char *SiemensAsciiTagEx(const char *dcmfile, const char *TagString, int cleanup)
     }
     // initialized to be zero
 
-    // Copy dcmfile to filename. If dcmfilename has parentheses then
-    // the unix strings command below will fail. The code below puts
-    // backslashes in front of any parens
     memset(&filename[0], 0, 1024);
-    k = 0;
-    for (unsigned int i = 0; i < strlen(dcmfile); i++) {
-      if (dcmfile[i] == '(' || dcmfile[i] == ')' || dcmfile[i] == '[' || dcmfile[i] == ']') {
-        filename[k] = 92;  // 92 is ascii dec for backslash
-        k++;
-      }
-      filename[k] = dcmfile[i];
-      k++;
-    }
+    strncpy(filename, dcmfile, 1023);
 
     // free allocated list of strings
     for (int i = 0; i < count; ++i) {
@@ -1599,37 +1580,54 @@ char *SiemensAsciiTagEx(const char *dcmfile, const char *TagString, int cleanup)
       }
     }
     // now build up string lists ///////////////////////////////////
+    // The file is read once and split into runs of at least 4 printable
+    // characters, which is what the unix "strings" command used to be
+    // popen'ed (and forked) for on every file.
     startOfAscii = 0;
-    strcpy(command, "strings ");
-    strcat(command, filename);
-    // Note: popen creates a fork, which can be a problem in gdb
-    if ((fp = popen(command, "r")) == NULL) {
-      fprintf(stderr, "could not open pipe for %s\n", filename);
+    count = 0;
+    if ((fp = fopen(dcmfile, "rb")) == NULL) {
+      fprintf(stderr, "could not open %s\n", dcmfile);
       return 0;
     }
-    count = 0;
-    while (fgets(buf, 1024, fp)) {
-      // replace CR with null
-      char *p = strrchr(buf, '\n');
-      if (p) {
-        *p = '\0';
+    fseek(fp, 0, SEEK_END);
+    long nbytes = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *contents = (char *)malloc(nbytes + 1);
+    if (contents == NULL || (long)fread(contents, 1, nbytes, fp) != nbytes) {
+      fprintf(stderr, "could not read %s\n", dcmfile);
+      free(contents);
+      fclose(fp);
+      return 0;
+    }
+    fclose(fp);
+    long end = 0;
+    for (long start = 0; start < nbytes; start = end + 1) {
+      for (end = start; end < nbytes; end++) {
+        unsigned char c = contents[end];
+        if (!((c >= 0x20 && c < 0x7f) || c == '\t')) break;
       }
+      if (end - start < 4) continue;
+      // terminate the run in place (contents has a spare byte at the end);
+      // runs of any length are kept whole
+      long len = end - start;
+      char *run = contents + start;
+      run[len] = 0;
 
       // check the region
-      //      if (strncmp(buf, "### ASCCONV BEGIN ###", 21)==0)
+      //      if (strncmp(run, "### ASCCONV BEGIN ###", 21)==0)
       // it seems the connectome scanner has begin fields that
       // do not include the chars ' ###'
-      if (strncmp(buf, "### ASCCONV BEGIN", 17) == 0) {
+      if (strncmp(run, "### ASCCONV BEGIN", 17) == 0) {
         startOfAscii = 1;
       }
-      else if (strncmp(buf, "### ASCCONV END ###", 19) == 0) {
+      else if (strncmp(run, "### ASCCONV END ###", 19) == 0) {
         startOfAscii = 0;
       }
 
       if (startOfAscii == 1) {
-        // printf("%d:%d, %s\n", count, strlen(buf), buf);
-        plist = (char *)malloc(strlen(buf) + 1);
-        strcpy(plist, buf);
+        // printf("%d:%ld, %s\n", count, len, run);
+        plist = (char *)malloc(len + 1);
+        memcpy(plist, run, len + 1);
         lists[count] = plist;
         ++count;
         // if we exhaused the list pointer
@@ -1657,17 +1655,17 @@ char *SiemensAsciiTagEx(const char *dcmfile, const char *TagString, int cleanup)
         }
       }
     }
-    pclose(fp);
+    free(contents);
   }
   // build up string lists available
   // search the tag
   for (int i = 0; i < count; ++i) {
     // get the variable name (the first string)
     VariableName[0] = 0;
-    sscanf(lists[i], "%s %*s %*s", VariableName);
+    sscanf(lists[i], "%511s %*s %*s", VariableName);
     if (VariableName[0] && (strcmp(VariableName, TagString) == 0)) {
       /* match found. get the value (the third string) */
-      sscanf(lists[i], "%*s %*s %s", tmpstr2);
+      sscanf(lists[i], "%*s %*s %511s", tmpstr2);
       VariableValue = (char *)calloc(strlen(tmpstr2) + 17, sizeof(char));
       memmove(VariableValue, tmpstr2, strlen(tmpstr2));
     }
@@ -2950,6 +2948,367 @@ char *sdcmExtractNumarisVer(const char *e_18_1020, int *Maj, int *Min, int *MinM
 
   return (ver);
 }
+/*--------------------------------------------------------------------
+  Optional persistent cache of SDCMFILEINFO headers, enabled by setting
+  the environment variable FS_SDCM_CACHE to a file name. Entries are
+  keyed by path and only used while the size and mtime of the file are
+  unchanged, so rescanning a session does not parse the DICOM files
+  again. Files that are not Siemens DICOM are remembered as such. The
+  whole cache is ignored if it was made with different settings of the
+  environment variables that GetSDCMFileInfo() looks at. When the cache
+  is written, entries of files that are gone or have changed are
+  dropped, and entries not used by this run are dropped once there are
+  more than SDCM_CACHE_MAX_ENTRIES.
+  *------------------------------------------------------------------*/
+#define SDCM_CACHE_VERSION 1
+#define SDCM_CACHE_MAX_ENTRIES 200000
+
+typedef struct
+{
+  long long mtime, size;
+  SDCMFILEINFO *sdfi;  // NULL if not a Siemens DICOM file
+  int used;            // looked up (or added) by this run
+} SDCM_CACHE_ENTRY;
+
+typedef struct
+{
+  std::string fname;
+  std::map<std::string, SDCM_CACHE_ENTRY> entries;
+  int nhits, nmisses;
+} SDCM_CACHE;
+
+#define SDCM_STR(field) offsetof(SDCMFILEINFO, field)
+static const size_t sdcmCacheStrings[] = {SDCM_STR(FileName),
+                                          SDCM_STR(PatientName),
+                                          SDCM_STR(StudyDate),
+                                          SDCM_STR(StudyTime),
+                                          SDCM_STR(SeriesTime),
+                                          SDCM_STR(AcquisitionTime),
+                                          SDCM_STR(PulseSequence),
+                                          SDCM_STR(ProtocolName),
+                                          SDCM_STR(PhEncDir),
+                                          SDCM_STR(NumarisVer),
+                                          SDCM_STR(ScannerModel),
+                                          SDCM_STR(TransferSyntaxUID)};
+#undef SDCM_STR
+
+// offset and number of elements of each numeric field
+#define SDCM_NUM(field, n) {offsetof(SDCMFILEINFO, field), n}
+static const size_t sdcmCacheInts[][2] = {SDCM_NUM(EchoNo, 1),
+                                          SDCM_NUM(SeriesNo, 1),
+                                          SDCM_NUM(ImageNo, 1),
+                                          SDCM_NUM(NImageRows, 1),
+                                          SDCM_NUM(NImageCols, 1),
+                                          SDCM_NUM(lRepetitions, 1),
+                                          SDCM_NUM(SliceArraylSize, 1),
+                                          SDCM_NUM(RunNo, 1),
+                                          SDCM_NUM(IsMosaic, 1),
+                                          SDCM_NUM(VolDim, 3),
+                                          SDCM_NUM(NFrames, 1),
+                                          SDCM_NUM(nthDirection, 1),
+                                          SDCM_NUM(UseSliceScaleFactor, 1),
+                                          SDCM_NUM(ErrorFlag, 1)};
+static const size_t sdcmCacheFloats[][2] = {SDCM_NUM(FlipAngle, 1),
+                                            SDCM_NUM(EchoTime, 1),
+                                            SDCM_NUM(RepetitionTime, 1),
+                                            SDCM_NUM(InversionTime, 1),
+                                            SDCM_NUM(FieldStrength, 1),
+                                            SDCM_NUM(PhEncFOV, 1),
+                                            SDCM_NUM(ReadoutFOV, 1),
+                                            SDCM_NUM(ImgPos, 3),
+                                            SDCM_NUM(Vc, 3),
+                                            SDCM_NUM(Vr, 3),
+                                            SDCM_NUM(Vs, 3),
+                                            SDCM_NUM(VolRes, 3),
+                                            SDCM_NUM(VolCenter, 3),
+                                            SDCM_NUM(LargestValue, 1)};
+static const size_t sdcmCacheDoubles[][2] = {SDCM_NUM(bValue, 1),
+                                             SDCM_NUM(SliceScaleFactor, 1),
+                                             SDCM_NUM(bval, 1),
+                                             SDCM_NUM(bvecx, 1),
+                                             SDCM_NUM(bvecy, 1),
+                                             SDCM_NUM(bvecz, 1),
+                                             SDCM_NUM(RescaleIntercept, 1),
+                                             SDCM_NUM(RescaleSlope, 1)};
+#undef SDCM_NUM
+
+#define SDCM_FIELD(sdfi, type, offset) ((type *)((char *)(sdfi) + (offset)))
+
+// the settings that change what GetSDCMFileInfo() returns
+static std::string sdcmCacheSettings(void)
+{
+  const char *dwi = getenv("FS_LOAD_DWI");
+  char tmpstr[100];
+
+  sprintf(tmpstr,
+          "scale=%d dwi=%d",
+          getenv("FS_NO_SLICE_SCALE_FACTOR") == NULL,
+          dwi == NULL || strcmp(dwi, "0") != 0);
+  return (std::string(tmpstr));
+}
+
+static char *sdcmCopyString(const char *str)
+{
+  if (str == NULL) return (NULL);
+  // same padding GetString() allocates with
+  char *copy = (char *)calloc(strlen(str) + 9, sizeof(char));
+  memmove(copy, str, strlen(str));
+  return (copy);
+}
+
+static SDCMFILEINFO *sdcmCopyFileInfo(const SDCMFILEINFO *sdfi)
+{
+  SDCMFILEINFO *copy;
+  unsigned int n;
+
+  copy = (SDCMFILEINFO *)calloc(1, sizeof(SDCMFILEINFO));
+  *copy = *sdfi;
+  for (n = 0; n < sizeof(sdcmCacheStrings) / sizeof(sdcmCacheStrings[0]); n++)
+    *SDCM_FIELD(copy, char *, sdcmCacheStrings[n]) = sdcmCopyString(*SDCM_FIELD(sdfi, char *, sdcmCacheStrings[n]));
+  return (copy);
+}
+
+// unlike FreeSDCMFileInfo(), this frees all the strings
+static void sdcmFreeFileInfo(SDCMFILEINFO **psdfi)
+{
+  unsigned int n;
+
+  for (n = 0; n < sizeof(sdcmCacheStrings) / sizeof(sdcmCacheStrings[0]); n++)
+    free(*SDCM_FIELD(*psdfi, char *, sdcmCacheStrings[n]));
+  free(*psdfi);
+  *psdfi = NULL;
+}
+
+// strings are written as their length (-1 for NULL) followed by the characters
+static int sdcmCacheReadString(FILE *fp, char **pstr)
+{
+  int len;
+
+  if (fscanf(fp, "%d", &len) != 1) return (0);
+  if (fgetc(fp) != ' ') return (0);
+  if (len < 0) {
+    *pstr = NULL;
+    return (1);
+  }
+  *pstr = (char *)calloc(len + 9, sizeof(char));
+  if ((int)fread(*pstr, sizeof(char), len, fp) != len) {
+    free(*pstr);
+    *pstr = NULL;
+    return (0);
+  }
+  return (fgetc(fp) == '\n');
+}
+
+static void sdcmCacheWriteString(FILE *fp, const char *str)
+{
+  if (str == NULL)
+    fprintf(fp, "-1 \n");
+  else
+    fprintf(fp, "%d %s\n", (int)strlen(str), str);
+}
+
+static void sdcmCacheFreeEntries(SDCM_CACHE *cache)
+{
+  std::map<std::string, SDCM_CACHE_ENTRY>::iterator it;
+  for (it = cache->entries.begin(); it != cache->entries.end(); ++it)
+    if (it->second.sdfi) sdcmFreeFileInfo(&it->second.sdfi);
+  cache->entries.clear();
+}
+
+/* Returns NULL if FS_SDCM_CACHE is not set. A missing, unreadable, or
+   outdated cache file just gives an empty cache. */
+static SDCM_CACHE *sdcmCacheOpen(void)
+{
+  const char *fname = getenv("FS_SDCM_CACHE");
+  SDCM_CACHE *cache;
+  SDCM_CACHE_ENTRY entry;
+  FILE *fp;
+  char line[1000], *path;
+  int version, IsSiemens, ok;
+  unsigned int n, k;
+
+  if (fname == NULL || strlen(fname) == 0) return (NULL);
+  cache = new SDCM_CACHE;
+  cache->fname = fname;
+  cache->nhits = cache->nmisses = 0;
+
+  fp = fopen(fname, "r");
+  if (fp == NULL) return (cache);
+  if (fgets(line, sizeof(line), fp) == NULL || sscanf(line, "SDCM_CACHE %d", &version) != 1 ||
+      version != SDCM_CACHE_VERSION || fgets(line, sizeof(line), fp) == NULL ||
+      std::string(line) != sdcmCacheSettings() + "\n") {
+    printf("INFO: ignoring outdated DICOM header cache %s\n", fname);
+    fclose(fp);
+    return (cache);
+  }
+
+  ok = 1;
+  while (ok && sdcmCacheReadString(fp, &path)) {
+    ok = (path != NULL && fscanf(fp, "%lld %lld %d", &entry.mtime, &entry.size, &IsSiemens) == 3);
+    entry.sdfi = NULL;
+    entry.used = 0;
+    if (ok && IsSiemens) {
+      entry.sdfi = (SDCMFILEINFO *)calloc(1, sizeof(SDCMFILEINFO));
+      for (n = 0; n < sizeof(sdcmCacheInts) / sizeof(sdcmCacheInts[0]); n++)
+        for (k = 0; k < sdcmCacheInts[n][1]; k++)
+          ok = ok && fscanf(fp, "%d", SDCM_FIELD(entry.sdfi, int, sdcmCacheInts[n][0]) + k) == 1;
+      for (n = 0; n < sizeof(sdcmCacheFloats) / sizeof(sdcmCacheFloats[0]); n++)
+        for (k = 0; k < sdcmCacheFloats[n][1]; k++)
+          ok = ok && fscanf(fp, "%f", SDCM_FIELD(entry.sdfi, float, sdcmCacheFloats[n][0]) + k) == 1;
+      for (n = 0; n < sizeof(sdcmCacheDoubles) / sizeof(sdcmCacheDoubles[0]); n++)
+        for (k = 0; k < sdcmCacheDoubles[n][1]; k++)
+          ok = ok && fscanf(fp, "%lf", SDCM_FIELD(entry.sdfi, double, sdcmCacheDoubles[n][0]) + k) == 1;
+      ok = ok && fgetc(fp) == '\n';
+      for (n = 0; ok && n < sizeof(sdcmCacheStrings) / sizeof(sdcmCacheStrings[0]); n++)
+        ok = sdcmCacheReadString(fp, SDCM_FIELD(entry.sdfi, char *, sdcmCacheStrings[n]));
+    }
+    else
+      ok = ok && fgetc(fp) == '\n';
+    if (ok)
+      cache->entries[path] = entry;
+    else {
+      printf("WARNING: DICOM header cache %s is corrupt, ignoring it\n", fname);
+      if (entry.sdfi) sdcmFreeFileInfo(&entry.sdfi);
+      sdcmCacheFreeEntries(cache);
+    }
+    free(path);
+  }
+  fclose(fp);
+  return (cache);
+}
+
+/* Drops the entries not used by this run whose file is gone or has
+   changed, then, while there are still more than SDCM_CACHE_MAX_ENTRIES,
+   the remaining unused ones. Entries used by this run are always kept.
+   Returns the number of entries dropped. */
+static int sdcmCachePrune(SDCM_CACHE *cache)
+{
+  std::map<std::string, SDCM_CACHE_ENTRY>::iterator it;
+  struct stat st;
+  int npruned = 0;
+
+  for (it = cache->entries.begin(); it != cache->entries.end();) {
+    if (it->second.used ||
+        (stat(it->first.c_str(), &st) == 0 && it->second.mtime == (long long)st.st_mtime &&
+         it->second.size == (long long)st.st_size)) {
+      ++it;
+      continue;
+    }
+    if (it->second.sdfi) sdcmFreeFileInfo(&it->second.sdfi);
+    cache->entries.erase(it++);
+    npruned++;
+  }
+  for (it = cache->entries.begin(); it != cache->entries.end() && cache->entries.size() > SDCM_CACHE_MAX_ENTRIES;) {
+    if (it->second.used) {
+      ++it;
+      continue;
+    }
+    if (it->second.sdfi) sdcmFreeFileInfo(&it->second.sdfi);
+    cache->entries.erase(it++);
+    npruned++;
+  }
+  return (npruned);
+}
+
+/* Prunes the cache, writes it (to a temporary file that is then renamed,
+   so a concurrent reader never sees a partial cache) and frees it. */
+static int sdcmCacheClose(SDCM_CACHE **pcache)
+{
+  SDCM_CACHE *cache = *pcache;
+  std::map<std::string, SDCM_CACHE_ENTRY>::iterator it;
+  char tmpfile[2000];
+  FILE *fp;
+  unsigned int n, k;
+  int err = 0, npruned;
+
+  if (cache == NULL) return (0);
+  *pcache = NULL;
+
+  npruned = sdcmCachePrune(cache);
+  if (cache->nmisses > 0 || npruned > 0) {
+    snprintf(tmpfile, sizeof(tmpfile), "%s.tmp.%d", cache->fname.c_str(), (int)getpid());
+    fp = fopen(tmpfile, "w");
+    if (fp == NULL) {
+      printf("WARNING: could not write DICOM header cache %s\n", tmpfile);
+      err = 1;
+    }
+    else {
+      fprintf(fp, "SDCM_CACHE %d\n%s\n", SDCM_CACHE_VERSION, sdcmCacheSettings().c_str());
+      for (it = cache->entries.begin(); it != cache->entries.end(); ++it) {
+        SDCMFILEINFO *sdfi = it->second.sdfi;
+        sdcmCacheWriteString(fp, it->first.c_str());
+        fprintf(fp, "%lld %lld %d", it->second.mtime, it->second.size, sdfi != NULL);
+        if (sdfi) {
+          // %a keeps the floating point values exact
+          for (n = 0; n < sizeof(sdcmCacheInts) / sizeof(sdcmCacheInts[0]); n++)
+            for (k = 0; k < sdcmCacheInts[n][1]; k++)
+              fprintf(fp, " %d", SDCM_FIELD(sdfi, int, sdcmCacheInts[n][0])[k]);
+          for (n = 0; n < sizeof(sdcmCacheFloats) / sizeof(sdcmCacheFloats[0]); n++)
+            for (k = 0; k < sdcmCacheFloats[n][1]; k++)
+              fprintf(fp, " %a", SDCM_FIELD(sdfi, float, sdcmCacheFloats[n][0])[k]);
+          for (n = 0; n < sizeof(sdcmCacheDoubles) / sizeof(sdcmCacheDoubles[0]); n++)
+            for (k = 0; k < sdcmCacheDoubles[n][1]; k++)
+              fprintf(fp, " %a", SDCM_FIELD(sdfi, double, sdcmCacheDoubles[n][0])[k]);
+          fprintf(fp, "\n");
+          for (n = 0; n < sizeof(sdcmCacheStrings) / sizeof(sdcmCacheStrings[0]); n++)
+            sdcmCacheWriteString(fp, *SDCM_FIELD(sdfi, char *, sdcmCacheStrings[n]));
+        }
+        else
+          fprintf(fp, "\n");
+      }
+      if (fclose(fp) != 0 || rename(tmpfile, cache->fname.c_str()) != 0) {
+        printf("WARNING: could not write DICOM header cache %s\n", cache->fname.c_str());
+        unlink(tmpfile);
+        err = 1;
+      }
+    }
+  }
+  if (cache->nhits > 0) printf("INFO: %d DICOM headers from cache %s\n", cache->nhits, cache->fname.c_str());
+
+  sdcmCacheFreeEntries(cache);
+  delete cache;
+  return (err);
+}
+
+/* GetSDCMFileInfo() through the cache (which may be NULL). *pIsSiemens
+   is set to whether dcmfile is a Siemens DICOM file; NULL is returned
+   for non-Siemens files and when GetSDCMFileInfo() fails. */
+static SDCMFILEINFO *sdcmCachedFileInfo(SDCM_CACHE *cache, const char *dcmfile, int *pIsSiemens)
+{
+  std::map<std::string, SDCM_CACHE_ENTRY>::iterator it;
+  SDCM_CACHE_ENTRY entry;
+  SDCMFILEINFO *sdfi;
+  struct stat st;
+
+  if (cache == NULL || stat(dcmfile, &st) != 0) {
+    *pIsSiemens = IsSiemensDICOM(dcmfile);
+    if (!*pIsSiemens) return (NULL);
+    return (GetSDCMFileInfo(dcmfile));
+  }
+
+  it = cache->entries.find(dcmfile);
+  if (it != cache->entries.end() && it->second.mtime == (long long)st.st_mtime &&
+      it->second.size == (long long)st.st_size) {
+    cache->nhits++;
+    it->second.used = 1;
+    *pIsSiemens = (it->second.sdfi != NULL);
+    return (it->second.sdfi ? sdcmCopyFileInfo(it->second.sdfi) : NULL);
+  }
+
+  *pIsSiemens = IsSiemensDICOM(dcmfile);
+  sdfi = *pIsSiemens ? GetSDCMFileInfo(dcmfile) : NULL;
+  if (*pIsSiemens && sdfi == NULL) return (NULL);  // failures are not cached
+
+  if (it != cache->entries.end() && it->second.sdfi) sdcmFreeFileInfo(&it->second.sdfi);
+  entry.mtime = st.st_mtime;
+  entry.size = st.st_size;
+  entry.sdfi = sdfi ? sdcmCopyFileInfo(sdfi) : NULL;
+  entry.used = 1;
+  cache->entries[dcmfile] = entry;
+  cache->nmisses++;
+  return (sdfi);
+}
+
 /*--------------------------------------------------------------------
   ScanSiemensDCMDir() - similar to ScanDir but returns only files that
   are Siemens DICOM Files. It also returns a pointer to an array of
@@ -2965,8 +3324,9 @@ SDCMFILEINFO **ScanSiemensDCMDir(const char *PathName, int *NSDCMFiles)
   int NFiles;
   char tmpstr[1000];
   SDCMFILEINFO **sdcmfi_list;
-  int pct, sumpct;
+  int pct, sumpct, IsSiemens;
   FILE *fp;
+  SDCM_CACHE *cache;
 
   char *pname = (char *)calloc(strlen(PathName) + 1, sizeof(char));
   strcpy(pname, PathName);
@@ -2993,24 +3353,10 @@ SDCMFILEINFO **ScanSiemensDCMDir(const char *PathName, int *NSDCMFiles)
   }
   fprintf(stderr, "INFO: Found %d files in %s\n", NFiles, pname);
 
-  /* Count the number of Siemens DICOM Files */
-  fprintf(stderr, "INFO: counting Siemens Files\n");
-  (*NSDCMFiles) = 0;
-  for (i = 0; i < NFiles; i++) {
-    sprintf(tmpstr, "%s/%s", pname, NameList[i]->d_name);
-    if (IsSiemensDICOM(tmpstr)) {
-      (*NSDCMFiles)++;
-    }
-  }
-
-  fprintf(stderr, "INFO: found %d Siemens Files\n", *NSDCMFiles);
-
-  if (*NSDCMFiles == 0) {
-    free(pname);
-    return (NULL);
-  }
-
-  sdcmfi_list = (SDCMFILEINFO **)calloc(*NSDCMFiles, sizeof(SDCMFILEINFO *));
+  /* Each file is checked once, and the info is loaded from the
+     Siemens DICOM Files as they are found */
+  sdcmfi_list = (SDCMFILEINFO **)calloc(NFiles, sizeof(SDCMFILEINFO *));
+  cache = sdcmCacheOpen();
 
   fprintf(stderr, "INFO: scanning info from Siemens Files\n");
 
@@ -3038,15 +3384,23 @@ SDCMFILEINFO **ScanSiemensDCMDir(const char *PathName, int *NSDCMFiles)
     }
 
     sprintf(tmpstr, "%s/%s", pname, NameList[i]->d_name);
-    if (IsSiemensDICOM(tmpstr)) {
-      sdcmfi_list[*NSDCMFiles] = GetSDCMFileInfo(tmpstr);
+    sdcmfi_list[*NSDCMFiles] = sdcmCachedFileInfo(cache, tmpstr, &IsSiemens);
+    if (IsSiemens) {
       if (sdcmfi_list[*NSDCMFiles] == NULL) {
+        sdcmCacheClose(&cache);
         return (NULL);
       }
       (*NSDCMFiles)++;
     }
   }
+  sdcmCacheClose(&cache);
   fprintf(stderr, "\n");
+  fprintf(stderr, "INFO: found %d Siemens Files\n", *NSDCMFiles);
+
+  if (*NSDCMFiles == 0) {
+    free(sdcmfi_list);
+    sdcmfi_list = NULL;
+  }
 
   // free memory
   while (NFiles--) {
@@ -3068,36 +3422,37 @@ SDCMFILEINFO **ScanSiemensDCMDir(const char *PathName, int *NSDCMFiles)
 SDCMFILEINFO **LoadSiemensSeriesInfo(char **SeriesList, int nList)
 {
   SDCMFILEINFO **sdfi_list;
-  int n;
+  SDCM_CACHE *cache;
+  int n, IsSiemens;
 
   // printf("LoadSiemensSeriesInfo()\n");
 
   sdfi_list = (SDCMFILEINFO **)calloc(nList, sizeof(SDCMFILEINFO *));
+  cache = sdcmCacheOpen();
 
   for (n = 0; n < nList; n++) {
     fflush(stdout);
     fflush(stderr);
 
-    // printf("%3d %s ---------------\n",n,SeriesList[n]);
-    if (!IsSiemensDICOM(SeriesList[n])) {
+    // printf("Getting file info %s ---------------\n",SeriesList[n]);
+    sdfi_list[n] = sdcmCachedFileInfo(cache, SeriesList[n], &IsSiemens);
+    if (!IsSiemens) {
       fprintf(stderr, "ERROR: %s is not a Siemens DICOM File\n", SeriesList[n]);
       fflush(stderr);
       free(sdfi_list);
+      sdcmCacheClose(&cache);
       return (NULL);
     }
-
-    // printf("Getting file info %s ---------------\n",SeriesList[n]);
-    fflush(stdout);
-    fflush(stderr);
-    sdfi_list[n] = GetSDCMFileInfo(SeriesList[n]);
     if (sdfi_list[n] == NULL) {
       fprintf(stderr, "ERROR: reading %s \n", SeriesList[n]);
       fflush(stderr);
       free(sdfi_list);
+      sdcmCacheClose(&cache);
       return (NULL);
     }
     exec_progress_callback(n, nList, 0, 1);
   }
+  sdcmCacheClose(&cache);
   fprintf(stderr, "\n");
   fflush(stdout);
   fflush(stderr);
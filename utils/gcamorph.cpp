@@ -28,6 +28,7 @@
 #include <string>
 #include <sstream>
 #include <iomanip>
+#include <vector>
 
 #define SHOW_EXEC_LOC 0
 
@@ -66,6 +67,7 @@
 #include "gcamorphtestutils.h"
 
 #include "mri_identify.h"
+#include "zlib.h"
 
 #if WITH_DMALLOC
 #include <dmalloc.h>
@@ -95,11 +97,14 @@ int fix_borders(GCA_MORPH *gcam);
 static GCA_MORPH *__m3zRead(const char *fname);
 static GCA_MORPH *__warpfieldRead(const char *fname);
 static int __m3zWrite(const GCA_MORPH *gcam, const char *fname);
+static int __m3zWriteBulk(const GCA_MORPH *gcam, const char *fname, int encoding);
 static int __warpfieldWrite(const GCA_MORPH *gcam, const char *fname);
+static int gcamInvertSplat(GCA_MORPH *gcam, MRI *mri);
 
 
 int gcam_write_grad = 0;
 int gcam_write_neg = 0;
+int gcam_invert_method = GCAM_INVERT_SPLAT;
 
 int dtrans_labels[] = {
     Left_Thalamus,
@@ -354,8 +359,22 @@ int GCAMwrite(const GCA_MORPH *gcam, const char *fname)
   printf("GCAMwrite(%s)\n", fname);
 
   int type = mri_identify(fname);
-  if (type == MGH_MORPH)
+  if (type == MGH_MORPH) {
+    int encoding = gcam_m3z_encoding;
+    char *cp = getenv("GCAM_M3Z_ENCODING");
+    if (cp) {
+      if (!stricmp(cp, "float"))
+        encoding = GCAM_M3Z_FLOAT;
+      else if (!stricmp(cp, "float16"))
+        encoding = GCAM_M3Z_FLOAT16;
+      else if (!stricmp(cp, "quant16"))
+        encoding = GCAM_M3Z_QUANT16;
+      else
+        printf("WARNING: GCAMwrite(): unknown GCAM_M3Z_ENCODING %s (expected float, float16 or quant16), ignoring it\n", cp);
+    }
+    if (encoding != GCAM_M3Z_LEGACY) return __m3zWriteBulk(gcam, fname, encoding);
     return __m3zWrite(gcam, fname);
+  }
   else if (type == MRI_MGH_FILE || type == NII_FILE)
     return __warpfieldWrite(gcam, fname);
 
@@ -453,6 +472,282 @@ int __m3zWrite(const GCA_MORPH *gcam, const char *fname)
   return (NO_ERROR);
 }
 
+/*
+  Version 2 (bulk) .m3z layout. After the same header as version 1 plus the
+  position encoding, each node field is stored as one array over all nodes,
+  x slowest and z fastest, big-endian:
+
+    origx, origy, origz, x, y, z   float, half float or 16-bit quantized
+    xn, yn, zn, label              int
+    valid                          uchar, 0 if all six positions were zero
+
+  For GCAM_M3Z_FLOAT16 and GCAM_M3Z_QUANT16 the positions are stored as the
+  displacement from the identity (node * spacing). Quantized arrays are
+  preceded by their float step size, which only covers the valid nodes; the
+  invalid ones are written as -32768. The tags follow as in version 1,
+  without TAG_GCAMORPH_LABELS. The arrays are compressed as independent
+  gzip members in parallel, so the file is still a plain gzip stream.
+*/
+#define GCAM_BULK_VERSION 2.0
+#define GCAM_BULK_BLOCK_SIZE (1 << 22)
+
+int gcam_m3z_encoding = GCAM_M3Z_LEGACY;
+
+// IEEE half float conversions, round to nearest even
+static unsigned short gcamFloatToHalf(float f)
+{
+  unsigned int u;
+  memcpy(&u, &f, sizeof(u));
+  unsigned int sign = (u >> 16) & 0x8000, mant = u & 0x007fffff;
+  int exp = (int)((u >> 23) & 0xff) - 127 + 15;
+
+  if (((u >> 23) & 0xff) == 0xff)  // inf or nan
+    return sign | 0x7c00 | (mant ? 0x200 : 0);
+  if (exp >= 0x1f) return sign | 0x7c00;  // overflow
+  if (exp <= 0) {  // subnormal or zero
+    if (exp < -10) return sign;
+    mant |= 0x00800000;
+    int shift = 14 - exp;
+    unsigned int half = mant >> shift, rem = mant & ((1u << shift) - 1), mid = 1u << (shift - 1);
+    if (rem > mid || (rem == mid && (half & 1))) half++;
+    return sign | half;
+  }
+  unsigned int half = sign | (exp << 10) | (mant >> 13), rem = mant & 0x1fff;
+  if (rem > 0x1000 || (rem == 0x1000 && (half & 1))) half++;
+  return half;
+}
+
+static float gcamHalfToFloat(unsigned short h)
+{
+  unsigned int sign = (h & 0x8000) << 16, exp = (h >> 10) & 0x1f, mant = h & 0x3ff, u;
+
+  if (exp == 0x1f)
+    u = sign | 0x7f800000 | (mant << 13);
+  else if (exp)
+    u = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+  else if (mant) {  // subnormal
+    exp = 127 - 15 + 1;
+    while (!(mant & 0x400)) {
+      mant <<= 1;
+      exp--;
+    }
+    u = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+  }
+  else
+    u = sign;
+  float f;
+  memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+static void gcamBulkPut(std::vector<unsigned char> &buf, size_t offset, unsigned int u, int nbytes)
+{
+  for (int b = 0; b < nbytes; b++) buf[offset + b] = (u >> (8 * (nbytes - 1 - b))) & 0xff;
+}
+
+static void gcamBulkPutInt(std::vector<unsigned char> &buf, int i)
+{
+  buf.resize(buf.size() + 4);
+  gcamBulkPut(buf, buf.size() - 4, (unsigned int)i, 4);
+}
+
+static void gcamBulkPutFloat(std::vector<unsigned char> &buf, float f)
+{
+  unsigned int u;
+  memcpy(&u, &f, sizeof(u));
+  buf.resize(buf.size() + 4);
+  gcamBulkPut(buf, buf.size() - 4, u, 4);
+}
+
+// position component c (origx, origy, origz, x, y, z) of a node
+static float gcamNodePosition(const GCA_MORPH_NODE *gcamn, int c)
+{
+  switch (c) {
+    case 0: return gcamn->origx;
+    case 1: return gcamn->origy;
+    case 2: return gcamn->origz;
+    case 3: return gcamn->x;
+    case 4: return gcamn->y;
+    default: return gcamn->z;
+  }
+}
+
+// the nodes whose six positions are all zero are read back as GCAM_POSITION_INVALID
+static bool gcamNodeHasPosition(const GCA_MORPH_NODE *gcamn)
+{
+  return !(FZERO(gcamn->origx) && FZERO(gcamn->origy) && FZERO(gcamn->origz) &&
+           FZERO(gcamn->x) && FZERO(gcamn->y) && FZERO(gcamn->z));
+}
+
+#define GCAM_QUANT16_INVALID 0x8000  // -32768, never produced for a valid node
+
+static int __m3zWriteBulk(const GCA_MORPH *gcam, const char *fname, int encoding)
+{
+  int const width = gcam->width, height = gcam->height, depth = gcam->depth;
+  long const nnodes = (long)width * height * depth;
+  std::vector<unsigned char> buf;
+
+  if (encoding != GCAM_M3Z_FLOAT && encoding != GCAM_M3Z_FLOAT16 && encoding != GCAM_M3Z_QUANT16)
+    ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAMwrite(%s): unknown m3z encoding %d", fname, encoding));
+
+  gcamBulkPutFloat(buf, GCAM_BULK_VERSION);
+  gcamBulkPutInt(buf, width);
+  gcamBulkPutInt(buf, height);
+  gcamBulkPutInt(buf, depth);
+  gcamBulkPutInt(buf, gcam->spacing);
+  gcamBulkPutFloat(buf, gcam->exp_k);
+  gcamBulkPutInt(buf, encoding);
+
+  for (int c = 0; c < 6; c++) {
+    int const nbytes = encoding == GCAM_M3Z_FLOAT ? 4 : 2;
+    float step = 1;
+    if (encoding == GCAM_M3Z_QUANT16) {
+      double maxabs = 0;
+      for (int x = 0; x < width; x++)
+        for (int y = 0; y < height; y++)
+          for (int z = 0; z < depth; z++) {
+            int const id[3] = {x, y, z};
+            if (!gcamNodeHasPosition(&gcam->nodes[x][y][z])) continue;
+            double d = gcamNodePosition(&gcam->nodes[x][y][z], c) - (double)id[c % 3] * gcam->spacing;
+            if (fabs(d) > maxabs) maxabs = fabs(d);
+          }
+      step = maxabs > 0 ? maxabs / 32767 : 1;
+      gcamBulkPutFloat(buf, step);
+    }
+    size_t const start = buf.size();
+    buf.resize(start + nnodes * nbytes);
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+    for (int x = 0; x < width; x++) {
+      ROMP_PFLB_begin
+      for (int y = 0; y < height; y++)
+        for (int z = 0; z < depth; z++) {
+          int const id[3] = {x, y, z};
+          size_t const offset = start + (((size_t)x * height + y) * depth + z) * nbytes;
+          float const pos = gcamNodePosition(&gcam->nodes[x][y][z], c);
+          float const delta = pos - (float)id[c % 3] * gcam->spacing;
+          unsigned int u;
+          if (encoding == GCAM_M3Z_FLOAT)
+            memcpy(&u, &pos, sizeof(u));
+          else if (encoding == GCAM_M3Z_FLOAT16)
+            u = gcamFloatToHalf(delta);
+          else if (!gcamNodeHasPosition(&gcam->nodes[x][y][z]))
+            u = GCAM_QUANT16_INVALID;
+          else
+            u = (unsigned short)(short)nint(delta / step);
+          gcamBulkPut(buf, offset, u, nbytes);
+        }
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+  }
+
+  for (int c = 0; c < 5; c++) {
+    size_t const start = buf.size();
+    buf.resize(start + nnodes * (c < 4 ? 4 : 1));
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+    for (int x = 0; x < width; x++) {
+      ROMP_PFLB_begin
+      for (int y = 0; y < height; y++)
+        for (int z = 0; z < depth; z++) {
+          GCA_MORPH_NODE const *gcamn = &gcam->nodes[x][y][z];
+          size_t const index = ((size_t)x * height + y) * depth + z;
+          switch (c) {
+            case 0: gcamBulkPut(buf, start + 4 * index, gcamn->xn, 4); break;
+            case 1: gcamBulkPut(buf, start + 4 * index, gcamn->yn, 4); break;
+            case 2: gcamBulkPut(buf, start + 4 * index, gcamn->zn, 4); break;
+            case 3: gcamBulkPut(buf, start + 4 * index, gcamn->label, 4); break;
+            default:
+              buf[start + index] = gcamNodeHasPosition(gcamn);
+              break;
+          }
+        }
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+  }
+
+  // compress each block as its own gzip member
+  int const gzipped = strstr(fname, ".m3z") != NULL;
+  int const nblocks = (buf.size() + GCAM_BULK_BLOCK_SIZE - 1) / GCAM_BULK_BLOCK_SIZE;
+  std::vector<std::vector<unsigned char> > blocks(gzipped ? nblocks : 0);
+  int failed = 0;
+  if (gzipped) {
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible) reduction(+ : failed)
+#endif
+    for (int b = 0; b < nblocks; b++) {
+      ROMP_PFLB_begin
+      size_t const start = (size_t)b * GCAM_BULK_BLOCK_SIZE;
+      size_t const len = MIN((size_t)GCAM_BULK_BLOCK_SIZE, buf.size() - start);
+      z_stream zs;
+      memset(&zs, 0, sizeof(zs));
+      if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        failed++;
+        ROMP_PFLB_continue;
+      }
+      blocks[b].resize(deflateBound(&zs, len));
+      zs.next_in = &buf[start];
+      zs.avail_in = len;
+      zs.next_out = &blocks[b][0];
+      zs.avail_out = blocks[b].size();
+      if (deflate(&zs, Z_FINISH) != Z_STREAM_END) failed++;
+      blocks[b].resize(zs.total_out);
+      deflateEnd(&zs);
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+  }
+  if (failed) ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "GCAMwrite(%s): compression failed", fname));
+
+  FILE *fp = fopen(fname, "wb");
+  if (!fp) {
+    errno = 0;
+    ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAMwrite(%s): could not open file", fname));
+  }
+  size_t nwritten = 0, nexpected = 0;
+  if (gzipped) {
+    for (int b = 0; b < nblocks; b++) {
+      nwritten += fwrite(&blocks[b][0], 1, blocks[b].size(), fp);
+      nexpected += blocks[b].size();
+    }
+  }
+  else {
+    nwritten = fwrite(&buf[0], 1, buf.size(), fp);
+    nexpected = buf.size();
+  }
+  fclose(fp);
+  if (nwritten != nexpected)
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "GCAMwrite(%s): could not write node arrays", fname));
+
+  // the tags go in one more gzip member
+  znzFile file = znzopen(fname, "ab", gzipped);
+  if (znz_isnull(file)) {
+    errno = 0;
+    ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAMwrite(%s): could not append to file", fname));
+  }
+  znzwriteInt(TAG_GCAMORPH_GEOM, file);
+  ((VOL_GEOM*)&gcam->image)->write(file);
+  ((VOL_GEOM*)&gcam->atlas)->write(file);
+
+  znzwriteInt(TAG_GCAMORPH_TYPE, file);
+  znzwriteInt(gcam->type, file);
+
+  if (gcam->m_affine) {
+    znzwriteInt(TAG_MGH_XFORM, file);
+    znzWriteMatrix(file, gcam->m_affine, 0);
+  }
+  znzclose(file);
+
+  return (NO_ERROR);
+}
+
 int GCAMwriteInverseNonTal(const char *gcamfname, GCA_MORPH *gcam)
 {
   char tmpstr[2000];
@@ -1157,6 +1452,91 @@ GCA_MORPH *__warpfieldRead(const char *fname)
   return warpfield->read(fname);
 }
 
+static void gcamSetNodePosition(GCA_MORPH_NODE *gcamn, int c, float pos)
+{
+  switch (c) {
+    case 0: gcamn->origx = pos; break;
+    case 1: gcamn->origy = pos; break;
+    case 2: gcamn->origz = pos; break;
+    case 3: gcamn->x = pos; break;
+    case 4: gcamn->y = pos; break;
+    default: gcamn->z = pos; break;
+  }
+}
+
+static unsigned int gcamBulkGet(const std::vector<unsigned char> &buf, size_t offset, int nbytes)
+{
+  unsigned int u = 0;
+  for (int b = 0; b < nbytes; b++) u = (u << 8) | buf[offset + b];
+  return u;
+}
+
+// reads the node arrays of a version 2 .m3z that follow the header
+static int gcamReadBulkNodes(GCA_MORPH *gcam, znzFile file)
+{
+  int const width = gcam->width, height = gcam->height, depth = gcam->depth;
+  size_t const nnodes = (size_t)width * height * depth;
+  std::vector<unsigned char> buf;
+
+  int const encoding = znzreadInt(file);
+  if (encoding != GCAM_M3Z_FLOAT && encoding != GCAM_M3Z_FLOAT16 && encoding != GCAM_M3Z_QUANT16)
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "GCAMread: unknown m3z encoding %d", encoding));
+
+  for (int c = 0; c < 11; c++) {
+    int const nbytes = c < 6 ? (encoding == GCAM_M3Z_FLOAT ? 4 : 2) : (c < 10 ? 4 : 1);
+    float const step = (c < 6 && encoding == GCAM_M3Z_QUANT16) ? znzreadFloat(file) : 1;
+    buf.resize(nnodes * nbytes);
+    if (znzread(&buf[0], 1, buf.size(), file) != buf.size())
+      ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "GCAMread: truncated node arrays"));
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+    for (int x = 0; x < width; x++) {
+      ROMP_PFLB_begin
+      for (int y = 0; y < height; y++)
+        for (int z = 0; z < depth; z++) {
+          GCA_MORPH_NODE *gcamn = &gcam->nodes[x][y][z];
+          size_t const index = ((size_t)x * height + y) * depth + z;
+          unsigned int const u = gcamBulkGet(buf, index * nbytes, nbytes);
+          int const id[3] = {x, y, z};
+          float pos;
+          switch (c) {
+            case 6: gcamn->xn = (int)u; break;
+            case 7: gcamn->yn = (int)u; break;
+            case 8: gcamn->zn = (int)u; break;
+            case 9: gcamn->label = (int)u; break;
+            case 10:
+              if (!u) {
+                gcamn->origx = gcamn->origy = gcamn->origz = gcamn->x = gcamn->y = gcamn->z = 0;
+                gcamn->invalid = GCAM_POSITION_INVALID;
+              }
+              else if (x == 0 || x == width - 1 || y == 0 || y == height - 1 || z == 0 || z == depth - 1)
+                gcamn->invalid = GCAM_AREA_INVALID;
+              else
+                gcamn->invalid = GCAM_VALID;
+              break;
+            default:
+              if (encoding == GCAM_M3Z_FLOAT)
+                memcpy(&pos, &u, sizeof(pos));
+              else if (encoding == GCAM_M3Z_FLOAT16)
+                pos = gcamHalfToFloat(u) + (float)id[c % 3] * gcam->spacing;
+              else
+                pos = (short)u * step + (float)id[c % 3] * gcam->spacing;
+              gcamSetNodePosition(gcamn, c, pos);
+              break;
+          }
+        }
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+  }
+  gcam->status = GCAM_LABELED;
+
+  return (NO_ERROR);
+}
+
 GCA_MORPH *__m3zRead(const char *fname)
 {
   GCA_MORPH *gcam;
@@ -1176,7 +1556,7 @@ GCA_MORPH *__m3zRead(const char *fname)
   }
 
   version = znzreadFloat(file);
-  if (version != GCAM_VERSION) {
+  if (version != GCAM_VERSION && version != GCAM_BULK_VERSION) {
     znzclose(file);
     ErrorReturn(NULL, (ERROR_BADFILE, "GCAMread(%s): invalid version # %2.3f\n", fname, version));
   }
@@ -1191,7 +1571,14 @@ GCA_MORPH *__m3zRead(const char *fname)
   // gcam->neg = znzreadInt(file) ;
   // gcam->ninputs = znzreadInt(file) ;
 
-  for (x = 0; x < width; x++) {
+  if (version == GCAM_BULK_VERSION) {
+    if (gcamReadBulkNodes(gcam, file) != NO_ERROR) {
+      znzclose(file);
+      GCAMfree(&gcam);
+      ErrorReturn(NULL, (ERROR_BADFILE, "GCAMread(%s): could not read node arrays", fname));
+    }
+  }
+  else for (x = 0; x < width; x++) {
     for (y = 0; y < height; y++) {
       for (z = 0; z < depth; z++) {
         gcamn = &gcam->nodes[x][y][z];
@@ -7496,11 +7883,6 @@ MRI *GCAMbuildVolume(GCA_MORPH *gcam, MRI *mri)
 // gcam->image anyway. Not sure why mri was ever put in there.
 int GCAMinvert(GCA_MORPH *gcam, MRI *mri)
 {
-  int x, y, z, width, height, depth;
-  MRI *mri_ctrl, *mri_counts;
-  GCA_MORPH_NODE *gcamn;
-  double xf, yf, zf;
-  float num;
   int freemri = 0;
   if(mri == NULL){
     VOL_GEOM *vg = &(gcam->image);
@@ -7510,6 +7892,29 @@ int GCAMinvert(GCA_MORPH *gcam, MRI *mri)
 
   if(gcam->mri_xind) return (NO_ERROR); /*  mri_{x,y,z}ind already computed*/
 
+  int err;
+  if (gcam_invert_method == GCAM_INVERT_NEWTON || getenv("GCAM_INVERT_NEWTON"))
+    err = GCAMinvertNewton(gcam, mri, 0.01, 20, NULL);
+  else
+    err = gcamInvertSplat(gcam, mri);
+  if(freemri) MRIfree(&mri);
+  return (err);
+}
+
+/*
+  GCAMinvert() with gcam_invert_method == GCAM_INVERT_SPLAT: splats each
+  node into the voxels around its image position, then fills the voxels
+  no node reached by soap bubble. Also the fallback of GCAMinvertNewton()
+  when none of its voxels converge.
+*/
+static int gcamInvertSplat(GCA_MORPH *gcam, MRI *mri)
+{
+  int x, y, z, width, height, depth;
+  MRI *mri_ctrl, *mri_counts;
+  GCA_MORPH_NODE *gcamn;
+  double xf, yf, zf;
+  float num;
+
   // verify the volume size ////////////////////////////////////////////
   if (mri->width != gcam->image.width || mri->height != gcam->image.height || mri->depth != gcam->image.depth)
     ErrorExit(ERROR_BADPARM,"mri passed volume size ( %d %d %d ) is different from "
@@ -7636,7 +8041,227 @@ int GCAMinvert(GCA_MORPH *gcam, MRI *mri)
     MRIwrite(gcam->mri_yind, "yi.mgz");
     MRIwrite(gcam->mri_zind, "zi.mgz");
   }
-  if(freemri) MRIfree(&mri);
+  return (NO_ERROR);
+}
+
+/*
+  Least-squares affine fit of the node positions as a function of the node
+  coordinates, returned inverted (image voxel -> node coords). Gives the
+  starting point of the Newton iterations in GCAMinvertNewton().
+*/
+static MATRIX *gcamFitInverseAffine(const GCA_MORPH *gcam)
+{
+  MATRIX *m_AtA = MatrixZero(4, 4, NULL), *m_AtB = MatrixZero(4, 3, NULL);
+
+  for (int x = 0; x < gcam->width; x++)
+    for (int y = 0; y < gcam->height; y++)
+      for (int z = 0; z < gcam->depth; z++) {
+        GCA_MORPH_NODE const *gcamn = &gcam->nodes[x][y][z];
+        if (gcamn->invalid == GCAM_POSITION_INVALID) continue;
+        double a[4] = {(double)x, (double)y, (double)z, 1.0}, b[3] = {gcamn->x, gcamn->y, gcamn->z};
+        for (int r = 0; r < 4; r++) {
+          for (int c = 0; c < 4; c++) *MATRIX_RELT(m_AtA, r + 1, c + 1) += a[r] * a[c];
+          for (int c = 0; c < 3; c++) *MATRIX_RELT(m_AtB, r + 1, c + 1) += a[r] * b[c];
+        }
+      }
+
+  MATRIX *m_inv = MatrixInverse(m_AtA, NULL);
+  MATRIX *m_affine;
+  if (m_inv) {
+    MATRIX *m_X = MatrixMultiply(m_inv, m_AtB, NULL);
+    m_affine = MatrixIdentity(4, NULL);
+    for (int r = 0; r < 3; r++)
+      for (int c = 0; c < 4; c++) *MATRIX_RELT(m_affine, r + 1, c + 1) = *MATRIX_RELT(m_X, c + 1, r + 1);
+    MatrixFree(&m_X);
+    MatrixFree(&m_inv);
+    m_inv = MatrixInverse(m_affine, NULL);
+    MatrixFree(&m_affine);
+  }
+  if (!m_inv) {  // degenerate morph, start from the node spacing alone
+    m_inv = MatrixIdentity(4, NULL);
+    for (int r = 1; r <= 3; r++) *MATRIX_RELT(m_inv, r, r) = 1.0 / gcam->spacing;
+  }
+  MatrixFree(&m_AtA);
+  MatrixFree(&m_AtB);
+  return (m_inv);
+}
+
+/*
+  Newton iterations for the node coords p with gcam(p) = (x, y, z), starting
+  from the p passed in. Returns the final distance in image voxels, which is
+  below tol on convergence, or -1 if p hit an invalid node or a singular
+  Jacobian.
+*/
+static double gcamNewtonInvertPoint(
+    const GCA_MORPH *gcam, double x, double y, double z, double *p, double tol, int max_iter)
+{
+  int const dims[3] = {gcam->width, gcam->height, gcam->depth};
+
+  for (int iter = 0;; iter++) {
+    int i[3];
+    double f[3];
+    for (int d = 0; d < 3; d++) {
+      p[d] = MAX(0, MIN(dims[d] - 1, p[d]));
+      i[d] = MAX(0, MIN(dims[d] - 2, (int)p[d]));
+      f[d] = p[d] - i[d];
+    }
+
+    // trilinear position and its derivatives along the node axes
+    double pos[3] = {0, 0, 0}, J[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+    for (int c = 0; c < 8; c++) {
+      int const o[3] = {c & 1, (c >> 1) & 1, (c >> 2) & 1};
+      GCA_MORPH_NODE const *gcamn = &gcam->nodes[i[0] + o[0]][i[1] + o[1]][i[2] + o[2]];
+      if (gcamn->invalid == GCAM_POSITION_INVALID) return (-1);
+      double w[3], dw[3];
+      for (int d = 0; d < 3; d++) {
+        w[d] = o[d] ? f[d] : 1 - f[d];
+        dw[d] = o[d] ? 1 : -1;
+      }
+      double const npos[3] = {gcamn->x, gcamn->y, gcamn->z};
+      for (int r = 0; r < 3; r++) {
+        pos[r] += w[0] * w[1] * w[2] * npos[r];
+        J[r][0] += dw[0] * w[1] * w[2] * npos[r];
+        J[r][1] += w[0] * dw[1] * w[2] * npos[r];
+        J[r][2] += w[0] * w[1] * dw[2] * npos[r];
+      }
+    }
+
+    double const res[3] = {pos[0] - x, pos[1] - y, pos[2] - z};
+    double const dist = sqrt(res[0] * res[0] + res[1] * res[1] + res[2] * res[2]);
+    if (dist < tol || iter >= max_iter) return (dist);
+
+    // p -= J^-1 * res by Cramer's rule
+    double const det = J[0][0] * (J[1][1] * J[2][2] - J[1][2] * J[2][1]) -
+                       J[0][1] * (J[1][0] * J[2][2] - J[1][2] * J[2][0]) +
+                       J[0][2] * (J[1][0] * J[2][1] - J[1][1] * J[2][0]);
+    if (fabs(det) < 1e-10) return (-1);
+    for (int d = 0; d < 3; d++) {
+      double Jd[3][3];
+      memcpy(Jd, J, sizeof(J));
+      for (int r = 0; r < 3; r++) Jd[r][d] = res[r];
+      p[d] -= (Jd[0][0] * (Jd[1][1] * Jd[2][2] - Jd[1][2] * Jd[2][1]) -
+               Jd[0][1] * (Jd[1][0] * Jd[2][2] - Jd[1][2] * Jd[2][0]) +
+               Jd[0][2] * (Jd[1][0] * Jd[2][1] - Jd[1][1] * Jd[2][0])) / det;
+    }
+  }
+}
+
+/*
+  Same result as GCAMinvert() with gcam_invert_method == GCAM_INVERT_NEWTON:
+  instead of splatting the nodes, solves gcam(p) = voxel for every voxel of
+  mri to within tol image voxels, each row of voxels in parallel. Each voxel
+  starts from the solution of its neighbor in the row, or from an affine fit
+  of the morph. Voxels that do not converge (outside the morph or next to
+  invalid nodes) are filled in from the others by soap bubble as in
+  GCAMinvert(). If no voxel converges, the inverse is computed by splatting
+  instead, as GCAMinvert() does by default. Returns NO_ERROR or an error
+  code; the largest residual of the converged voxels is returned in
+  *pmax_residual if it is not NULL, and -1 there if no voxel was solved.
+*/
+int GCAMinvertNewton(GCA_MORPH *gcam, MRI *mri, double tol, int max_iter, double *pmax_residual)
+{
+  int width, height, depth;
+  MRI *mri_ctrl;
+
+  if (pmax_residual) *pmax_residual = -1;
+  if (mri->width != gcam->image.width || mri->height != gcam->image.height || mri->depth != gcam->image.depth)
+    ErrorExit(ERROR_BADPARM,"mri passed volume size ( %d %d %d ) is different from "
+              "the one used to create M3D data ( %d %d %d )\n",
+              mri->width, mri->height, mri->depth, gcam->image.width, gcam->image.height,gcam->image.depth);
+  if (gcam->width < 2 || gcam->height < 2 || gcam->depth < 2)
+    ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAMinvertNewton: morph must have at least 2 nodes along each axis"));
+
+  width = mri->width;
+  height = mri->height;
+  depth = mri->depth;
+
+  GCAMfreeInverse(gcam);
+  gcam->mri_xind = MRIalloc(width, height, depth, MRI_FLOAT);
+  MRIcopyHeader(mri, gcam->mri_xind);
+  gcam->mri_yind = MRIalloc(width, height, depth, MRI_FLOAT);
+  MRIcopyHeader(mri, gcam->mri_yind);
+  gcam->mri_zind = MRIalloc(width, height, depth, MRI_FLOAT);
+  MRIcopyHeader(mri, gcam->mri_zind);
+  mri_ctrl = MRIalloc(width, height, depth, MRI_UCHAR);
+  MRIcopyHeader(mri, mri_ctrl);
+
+  if (!gcam->mri_xind || !gcam->mri_yind || !gcam->mri_zind || !mri_ctrl)
+    ErrorExit(ERROR_NOMEMORY, "GCAMinvertNewton: could not allocated %dx%dx%d index volumes", width, height, depth);
+
+  MATRIX *m_inv = gcamFitInverseAffine(gcam);
+  double A[3][4];
+  for (int r = 0; r < 3; r++)
+    for (int c = 0; c < 4; c++) A[r][c] = *MATRIX_RELT(m_inv, r + 1, c + 1);
+  MatrixFree(&m_inv);
+
+  // per-row statistics, summed afterwards so the totals do not depend on the threads
+  int const nrows = depth * height;
+  std::vector<double> row_max(nrows, 0), row_sum(nrows, 0);
+  std::vector<int> row_failed(nrows, 0);
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 1)
+#endif
+  for (int row = 0; row < nrows; row++) {
+    ROMP_PFLB_begin
+    int const z = row / height, y = row % height;
+    double p[3];
+    bool warm = false;
+
+    for (int x = 0; x < width; x++) {
+      if (x == Gx && y == Gy && z == Gz) DiagBreak();
+      double dist = -1;
+      if (warm) dist = gcamNewtonInvertPoint(gcam, x, y, z, p, tol, max_iter);
+      if (dist < 0 || dist >= tol) {
+        for (int r = 0; r < 3; r++) p[r] = A[r][0] * x + A[r][1] * y + A[r][2] * z + A[r][3];
+        dist = gcamNewtonInvertPoint(gcam, x, y, z, p, tol, max_iter);
+      }
+      warm = (dist >= 0 && dist < tol);
+      if (!warm) {
+        row_failed[row]++;
+        continue;
+      }
+      MRIFvox(gcam->mri_xind, x, y, z) = p[0];
+      MRIFvox(gcam->mri_yind, x, y, z) = p[1];
+      MRIFvox(gcam->mri_zind, x, y, z) = p[2];
+      MRIvox(mri_ctrl, x, y, z) = CONTROL_MARKED;
+      row_sum[row] += dist;
+      if (dist > row_max[row]) row_max[row] = dist;
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  double max_residual = 0, sum_residual = 0;
+  long nfailed = 0;
+  for (int row = 0; row < nrows; row++) {
+    nfailed += row_failed[row];
+    sum_residual += row_sum[row];
+    if (row_max[row] > max_residual) max_residual = row_max[row];
+  }
+  long const nvox = (long)width * height * depth;
+  printf("GCAMinvertNewton: %ld of %ld voxels converged, residual max %2.4f mean %2.4f voxels\n",
+         nvox - nfailed, nvox, max_residual, nvox > nfailed ? sum_residual / (nvox - nfailed) : 0.0);
+
+  if (nfailed > 0 && nfailed < nvox) {
+    MRIbuildVoronoiDiagram(gcam->mri_xind, mri_ctrl, gcam->mri_xind);
+    MRIsoapBubble(gcam->mri_xind, mri_ctrl, gcam->mri_xind, 50, 1);
+    MRIbuildVoronoiDiagram(gcam->mri_yind, mri_ctrl, gcam->mri_yind);
+    MRIsoapBubble(gcam->mri_yind, mri_ctrl, gcam->mri_yind, 50, 1);
+    MRIbuildVoronoiDiagram(gcam->mri_zind, mri_ctrl, gcam->mri_zind);
+    MRIsoapBubble(gcam->mri_zind, mri_ctrl, gcam->mri_zind, 50, 1);
+  }
+  MRIfree(&mri_ctrl);
+
+  if (nfailed == nvox) {
+    // nothing to fill the holes from, so splat the nodes instead
+    printf("GCAMinvertNewton: no voxel converged, inverting by splatting the nodes\n");
+    GCAMfreeInverse(gcam);
+    return (gcamInvertSplat(gcam, mri));
+  }
+
+  if (pmax_residual) *pmax_residual = max_residual;
   return (NO_ERROR);
 }
 
@@ -38,6 +38,7 @@
 #include "macros.h"
 #include "mrishash.h"
 #include "proto.h"
+#include "romp_support.h"
 #include "tags.h"
 #include "transform.h"
 #include "utils.h"
@@ -50,13 +51,15 @@ extern const char *Progname;
 
 static int gcsaFixSingularCovarianceMatrices(GCSA *gcsa);
 static int edge_to_index(VERTEX const *v, VERTEX const *vn);
-static int MRIScomputeVertexPermutation(MRI_SURFACE *mris, int *indices);
 static int GCSAupdateNodeMeans(GCSA_NODE *gcsan, int label, double *v_inputs, int ninputs);
 static int GCSAupdateNodeGibbsPriors(CP_NODE *cpn, int label, MRI_SURFACE *mris, int vno);
 static int GCSAupdateNodeCovariance(GCSA_NODE *gcsan, int label, double *v_inputs, int ninputs);
-static double gcsaNbhdGibbsLogLikelihood(
-    GCSA *gcsa, MRI_SURFACE *mris, double *v_inputs, int vno, double gibbs_coef, int label);
-static double gcsaVertexGibbsLogLikelihood(GCSA *gcsa, MRI_SURFACE *mris, double const *v_inputs, int vno, double gibbs_coef);
+static double gcsaNbhdGibbsLogLikelihood(GCSA *gcsa, MRI_SURFACE *mris, double *v_inputs, int vno, double gibbs_coef,
+                                         int label, int const *vno_prior, int const *vno_classifier);
+static double gcsaVertexGibbsLogLikelihood(GCSA *gcsa, MRI_SURFACE *mris, double const *v_inputs, int vno,
+                                           double gibbs_coef, int const *vno_prior, int const *vno_classifier);
+static void gcsaComputeCorrespondence(GCSA *gcsa, MRI_SURFACE *mris, int *vno_prior, int *vno_classifier);
+static int gcsaColorVertices(MRI_SURFACE *mris, std::vector<int> &order, std::vector<int> &color_start);
 static int add_gc_to_gcsan(GCSA_NODE *gcsan_src, int nsrc, GCSA_NODE *gcsan_dst);
 
 GCSA *GCSAalloc(int ninputs, int icno_priors, int icno_classifiers)
@@ -328,6 +331,71 @@ int GCSAsourceToPriorVertexNo(GCSA *gcsa, VERTEX const *v)
   return (vdstno);
 }
 
+/*
+  The prior and classifier vertex of every subject vertex, as found by
+  GCSAsourceToPriorVertex() and GCSAsourceToClassifierVertex(). The labeling
+  loops need them many times per vertex, so they are looked up once here.
+  The hash tables are only read, so the lookups run in parallel.
+*/
+static void gcsaComputeCorrespondence(GCSA *gcsa, MRI_SURFACE *mris, int *vno_prior, int *vno_classifier)
+{
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    ROMP_PFLB_begin
+    VERTEX const * const v_prior = GCSAsourceToPriorVertex(gcsa, &mris->vertices[vno]);
+    vno_prior[vno] = v_prior - gcsa->mris_priors->vertices;
+    vno_classifier[vno] = GCSAsourceToClassifierVertex(gcsa, v_prior) - gcsa->mris_classifiers->vertices;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+/*
+  Greedy coloring in which no two vertices within two edges of each other
+  share a color. The neighborhood Gibbs likelihood of a vertex reads the
+  labels out to its neighbors' neighbors, so all vertices of one color can
+  be relabeled at the same time. On return order[color_start[c]] ..
+  order[color_start[c+1]-1] are the vertices of color c. Returns the number
+  of colors.
+*/
+static int gcsaColorVertices(MRI_SURFACE *mris, std::vector<int> &order, std::vector<int> &color_start)
+{
+  std::vector<int> color(mris->nvertices, -1), used, count;
+  int ncolors = 0;
+
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
+    // used[c] == vno means color c is taken within two edges of vno
+    for (int n = 0; n < vt->vnum; n++) {
+      VERTEX_TOPOLOGY const * const vnt = &mris->vertices_topology[vt->v[n]];
+      if (color[vt->v[n]] >= 0) used[color[vt->v[n]]] = vno;
+      for (int m = 0; m < vnt->vnum; m++)
+        if (color[vnt->v[m]] >= 0) used[color[vnt->v[m]]] = vno;
+    }
+    int c;
+    for (c = 0; c < ncolors; c++)
+      if (used[c] != vno) break;
+    if (c == ncolors) {
+      ncolors++;
+      used.push_back(-1);
+      count.push_back(0);
+    }
+    color[vno] = c;
+    count[c]++;
+  }
+
+  color_start.assign(ncolors + 1, 0);
+  for (int c = 0; c < ncolors; c++) color_start[c + 1] = color_start[c] + count[c];
+  order.resize(mris->nvertices);
+  std::vector<int> next(color_start.begin(), color_start.end() - 1);
+  for (int vno = 0; vno < mris->nvertices; vno++) order[next[color[vno]]++] = vno;
+
+  return (ncolors);
+}
+
 
 static int GCSAupdateNodeMeans(GCSA_NODE *gcsan, int label, double *v_inputs, int ninputs)
 {
@@ -950,30 +1018,32 @@ int GCSAbuildMostLikelyLabels(GCSA *gcsa, MRI_SURFACE *mris)
 static int Gvno = -1;
 MRI *GCSAlabel(GCSA *gcsa, MRI_SURFACE *mris)
 {
-  int vno, vno_classifier, label, vno_prior;
-  VERTEX *v, *v_classifier, *v_prior;
-  GCSA_NODE *gcsan;
-  CP_NODE *cpn;
-  double v_inputs[100], p[3];
-
   MRI *probabilities = MRIallocSequence(mris->nvertices,1,1,MRI_FLOAT,3);
 
-  for (vno = 0; vno < mris->nvertices; vno++) {
-    v = &mris->vertices[vno];
-    if (v->ripflag) continue;
+  std::vector<int> vno_priors(mris->nvertices), vno_classifiers(mris->nvertices);
+  gcsaComputeCorrespondence(gcsa, mris, vno_priors.data(), vno_classifiers.data());
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    ROMP_PFLB_begin
+    VERTEX *v = &mris->vertices[vno];
+    double v_inputs[100], p[3];
+
+    if (v->ripflag) ROMP_PFLB_continue;
     if (vno == Gdiag_no) DiagBreak();
     GCSAload_inputs(v_inputs, gcsa->inputvals, vno);
 
-    v_prior = GCSAsourceToPriorVertex(gcsa, v);
-    vno_prior = v_prior - gcsa->mris_priors->vertices;
+    int vno_prior = vno_priors[vno];
     if (vno_prior == Gdiag_no) DiagBreak();
-    v_classifier = GCSAsourceToClassifierVertex(gcsa, v_prior);
-    vno_classifier = v_classifier - gcsa->mris_classifiers->vertices;
+    int vno_classifier = vno_classifiers[vno];
     if (vno_classifier == Gdiag_no) DiagBreak();
-    gcsan = &gcsa->gc_nodes[vno_classifier];
+    GCSA_NODE *gcsan = &gcsa->gc_nodes[vno_classifier];
 
-    cpn = &gcsa->cp_nodes[vno_prior];
-    label = GCSANclassify(gcsan, cpn, v_inputs, gcsa->ninputs, p, NULL, 0, vno);
+    CP_NODE *cpn = &gcsa->cp_nodes[vno_prior];
+    int label = GCSANclassify(gcsan, cpn, v_inputs, gcsa->ninputs, p, NULL, 0, vno);
     v->annotation = label;
     //v->val2 = p ; // posterior prob in val2
     for(int k=0; k < 3; k++) MRIsetVoxVal(probabilities,vno,0,0,k,p[k]);
@@ -991,7 +1061,9 @@ MRI *GCSAlabel(GCSA *gcsa, MRI_SURFACE *mris)
         MatrixPrint(stdout, gcs->v_means);
       }
     } // diag
+    ROMP_PFLB_end
   } //vertex
+  ROMP_PF_end
 
   //MRIwrite(probabilities,"probabilities.mgz");
 
@@ -1007,14 +1079,9 @@ int GCSANclassify(GCSA_NODE *gcsan, CP_NODE *cpn, double *v_inputs, int ninputs,
 
   CP *cp;
   GCS *gcs;
-  static MATRIX *m_cov_inv = NULL;
-  static VECTOR *v_tmp = NULL, *v_x = NULL;
-
-  if (v_x && ninputs != v_x->rows) {
-    MatrixFree(&m_cov_inv);
-    MatrixFree(&v_tmp);
-    VectorFree(&v_x);
-  }
+  // not static, GCSAlabel() classifies vertices in parallel
+  MATRIX *m_cov_inv = NULL;
+  VECTOR *v_tmp = NULL, *v_x = NULL;
 
   ptotal = 0.0;
   max_p = -10000;
@@ -1053,6 +1120,7 @@ int GCSANclassify(GCSA_NODE *gcsan, CP_NODE *cpn, double *v_inputs, int ninputs,
       MatrixAdd(m_tmp, gcs->m_cov, m_tmp);
       m_cov_inv = MatrixInverse(m_tmp, NULL);
       if(!m_cov_inv) ErrorExit(ERROR_BADPARM, "GCSANclassify: could not regularize matrix");
+      MatrixFree(&m_tmp);
     }
     // Compute delta*inv(Sigma)*delta'
     v_tmp = MatrixMultiply(m_cov_inv, v_x, v_tmp);
@@ -1070,7 +1138,6 @@ int GCSANclassify(GCSA_NODE *gcsan, CP_NODE *cpn, double *v_inputs, int ninputs,
 	     vno,n,cpn->labels[n],v_inputs[0],gcs->v_means->rptr[1][1],gcs->m_cov->rptr[1][1],v_x->rptr[1][1],det,proj,plikelihood,p,cp->prior);
       fflush(stdout);
     }
-    fflush(stdout);
     if (p > max_p) {
       max_p = p;
       best_label = cpn->labels[n];
@@ -1088,6 +1155,10 @@ int GCSANclassify(GCSA_NODE *gcsan, CP_NODE *cpn, double *v_inputs, int ninputs,
     pprob[2] = best_prior;
   }
 
+  if (m_cov_inv) MatrixFree(&m_cov_inv);
+  if (v_tmp) VectorFree(&v_tmp);
+  if (v_x) VectorFree(&v_x);
+
   return (best_label);
 }
 
@@ -1296,16 +1367,19 @@ static int edge_to_index(VERTEX const * const v, VERTEX const * const vn)
 int gcsa_write_iterations = 0;
 char *gcsa_write_fname = NULL;
 
+/*
+  Iterated conditional modes on the neighborhood Gibbs likelihood. Each pass
+  relabels the vertices one color of gcsaColorVertices() at a time, and the
+  vertices of one color in parallel. Vertices of a color do not see each
+  other's labels, so the result does not depend on the number of threads.
+*/
 int GCSAreclassifyUsingGibbsPriors(GCSA *gcsa, MRI_SURFACE *mris)
 {
-  int *indices;
-  int n, vno, i, nchanged, label, best_label, old_label, vno_prior, vno_classifier, niter, examined;
-  double ll, max_ll;
-  // GCSA_NODE *gcsan;
-  CP_NODE *cpn;
-  double v_inputs[100];
+  int n, vno, nchanged, niter, examined, ncolors;
+  std::vector<int> vno_priors(mris->nvertices), vno_classifiers(mris->nvertices), order, color_start;
 
-  indices = (int *)calloc(mris->nvertices, sizeof(int));
+  gcsaComputeCorrespondence(gcsa, mris, vno_priors.data(), vno_classifiers.data());
+  ncolors = gcsaColorVertices(mris, order, color_start);
 
   niter = 0;
   if (gcsa_write_iterations != 0) {
@@ -1320,59 +1394,68 @@ int GCSAreclassifyUsingGibbsPriors(GCSA *gcsa, MRI_SURFACE *mris)
   do {
     nchanged = 0;
     examined = 0;
-    MRIScomputeVertexPermutation(mris, indices);
-    for (i = 0; i < mris->nvertices; i++) {
-      vno = indices[i];
-      VERTEX* const v = &mris->vertices[vno];
-      if (v->marked == 0) continue;
-      v->marked = 0;
-      examined++;
-
-      if (vno == Gdiag_no) DiagBreak();
-
-      GCSAload_inputs(v_inputs, gcsa->inputvals, vno);
-
-      VERTEX const * const v_prior = GCSAsourceToPriorVertex(gcsa, v);
-      vno_prior = v_prior - gcsa->mris_priors->vertices;
-      if (vno_prior == Gdiag_no) DiagBreak();
-      cpn = &gcsa->cp_nodes[vno_prior];
-      if (cpn->nlabels <= 1) continue;
-
-      VERTEX const * const v_classifier = GCSAsourceToClassifierVertex(gcsa, v_prior);
-      vno_classifier = v_classifier - gcsa->mris_classifiers->vertices;
-      // gcsan = &gcsa->gc_nodes[vno_classifier];
-      if (vno_classifier == Gdiag_no) DiagBreak();
-
-      best_label = old_label = v->annotation;
-      if (vno == Gdiag_no) printf("reclassifying vertex %d...\n", vno);
-      max_ll = gcsaNbhdGibbsLogLikelihood(gcsa, mris, v_inputs, vno, 1.0, old_label);
-      for (n = 0; n < cpn->nlabels; n++) {
-        label = cpn->labels[n];
-        ll = gcsaNbhdGibbsLogLikelihood(gcsa, mris, v_inputs, vno, 1.0, label);
-        if (vno == Gdiag_no)
-          printf("\tlabel %s (%d, %d): ll=%2.3f\n",
-                 annotation_to_name(label, NULL),
-                 label,
-                 annotation_to_index(label),
-                 ll);
-        if (ll > max_ll) {
-          max_ll = ll;
-          best_label = label;
-          if (vno == Gdiag_no) printf("\tlabel %s NEW MAX\n", annotation_to_name(label, NULL));
+    for (int c = 0; c < ncolors; c++) {
+      ROMP_PF_begin
+#ifdef HAVE_OPENMP
+      #pragma omp parallel for if_ROMP(shown_reproducible) reduction(+ : nchanged, examined)
+#endif
+      for (int i = color_start[c]; i < color_start[c + 1]; i++) {
+        ROMP_PFLB_begin
+        int const vno = order[i];
+        VERTEX* const v = &mris->vertices[vno];
+        double v_inputs[100];
+
+        if (v->marked == 0) ROMP_PFLB_continue;
+        v->marked = 0;
+        examined++;
+
+        if (vno == Gdiag_no) DiagBreak();
+
+        GCSAload_inputs(v_inputs, gcsa->inputvals, vno);
+
+        int const vno_prior = vno_priors[vno];
+        if (vno_prior == Gdiag_no) DiagBreak();
+        CP_NODE const * const cpn = &gcsa->cp_nodes[vno_prior];
+        if (cpn->nlabels <= 1) ROMP_PFLB_continue;
+
+        if (vno_classifiers[vno] == Gdiag_no) DiagBreak();
+
+        int best_label, old_label;
+        best_label = old_label = v->annotation;
+        if (vno == Gdiag_no) printf("reclassifying vertex %d...\n", vno);
+        double max_ll = gcsaNbhdGibbsLogLikelihood(
+            gcsa, mris, v_inputs, vno, 1.0, old_label, vno_priors.data(), vno_classifiers.data());
+        for (int n = 0; n < cpn->nlabels; n++) {
+          int const label = cpn->labels[n];
+          double const ll = gcsaNbhdGibbsLogLikelihood(
+              gcsa, mris, v_inputs, vno, 1.0, label, vno_priors.data(), vno_classifiers.data());
+          if (vno == Gdiag_no)
+            printf("\tlabel %s (%d, %d): ll=%2.3f\n",
+                   annotation_to_name(label, NULL),
+                   label,
+                   annotation_to_index(label),
+                   ll);
+          if (ll > max_ll) {
+            max_ll = ll;
+            best_label = label;
+            if (vno == Gdiag_no) printf("\tlabel %s NEW MAX\n", annotation_to_name(label, NULL));
+          }
         }
+        if (best_label != old_label) {
+          if (vno == Gdiag_no)
+            printf("v %d: label changed from %s (%d) to %s (%d)\n",
+                   vno,
+                   annotation_to_name(old_label, NULL),
+                   old_label,
+                   annotation_to_name(best_label, NULL),
+                   best_label);
+          v->marked = 1;
+          nchanged++;
+          v->annotation = best_label;
+        }
+        ROMP_PFLB_end
       }
-      if (best_label != old_label) {
-        if (vno == Gdiag_no)
-          printf("v %d: label changed from %s (%d) to %s (%d)\n",
-                 vno,
-                 annotation_to_name(old_label, NULL),
-                 old_label,
-                 annotation_to_name(best_label, NULL),
-                 best_label);
-        v->marked = 1;
-        nchanged++;
-        v->annotation = best_label;
-      }
+      ROMP_PF_end
     }
     printf("%03d: %6d changed, %d examined...\n", niter, nchanged, examined);
     niter++;
@@ -1394,29 +1477,16 @@ int GCSAreclassifyUsingGibbsPriors(GCSA *gcsa, MRI_SURFACE *mris)
     }
   } while (nchanged > MIN_CHANGED);
 
-  free(indices);
   return (NO_ERROR);
 }
 
-int MRIScomputeVertexPermutation(MRI_SURFACE *mris, int *indices)
-{
-  int i, index, tmp;
-
-  for (i = 0; i < mris->nvertices; i++) {
-    indices[i] = i;
-  }
-  for (i = 0; i < mris->nvertices; i++) {
-    index = (int)randomNumber(0.0, (double)(mris->nvertices - 0.0001));
-    tmp = indices[index];
-    indices[index] = indices[i];
-    indices[i] = tmp;
-  }
-
-  return (NO_ERROR);
-}
-
-static double gcsaNbhdGibbsLogLikelihood(
-    GCSA *gcsa, MRI_SURFACE *mris, double *v_inputs, int const vno, double gibbs_coef, int label)
+/*
+  vno_prior and vno_classifier are the correspondence from
+  gcsaComputeCorrespondence(), or NULL to look it up in the hash tables.
+*/
+static double gcsaNbhdGibbsLogLikelihood(GCSA *gcsa, MRI_SURFACE *mris, double *v_inputs, int const vno,
+                                         double gibbs_coef, int label, int const *vno_prior,
+                                         int const *vno_classifier)
 {
   VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
   VERTEX                * const v  = &mris->vertices[vno];
@@ -1424,12 +1494,12 @@ static double gcsaNbhdGibbsLogLikelihood(
   int old_annotation = v->annotation;
   v->annotation = label;
 
-  double total_ll = gcsaVertexGibbsLogLikelihood(gcsa, mris, v_inputs, vno, gibbs_coef);
+  double total_ll = gcsaVertexGibbsLogLikelihood(gcsa, mris, v_inputs, vno, gibbs_coef, vno_prior, vno_classifier);
 
   int n;
   for (n = 0; n < vt->vnum; n++) {
     double ll = 
-    	gcsaVertexGibbsLogLikelihood(gcsa, mris, v_inputs, vt->v[n], gibbs_coef);
+    	gcsaVertexGibbsLogLikelihood(gcsa, mris, v_inputs, vt->v[n], gibbs_coef, vno_prior, vno_classifier);
     total_ll += ll;
   }
 
@@ -1443,32 +1513,27 @@ static double gcsaVertexGibbsLogLikelihood(
     MRI_SURFACE  * const mris, 
     double const * const v_inputs, 
     int            const vno, 
-    double  	   const gibbs_coef)
+    double  	   const gibbs_coef,
+    int const    * const vno_priors,
+    int const    * const vno_classifiers)
 {
-  static MATRIX *m_cov_inv = NULL;
-  static VECTOR *v_tmp = NULL, *v_x = NULL;
-
-  if (v_x && gcsa->ninputs != v_x->cols) {
-    MatrixFree(&m_cov_inv);
-    MatrixFree(&v_tmp);
-    VectorFree(&v_x);
-  }
-
   VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
   VERTEX          const * const v  = &mris->vertices         [vno];
 
-  VERTEX const * const v_prior = GCSAsourceToPriorVertex(gcsa, v);
-  int const vno_prior = v_prior - gcsa->mris_priors->vertices;
+  int vno_prior, vno_classifier;
+  if (vno_priors) {
+    vno_prior = vno_priors[vno];
+    vno_classifier = vno_classifiers[vno];
+  }
+  else {
+    VERTEX const * const v_prior = GCSAsourceToPriorVertex(gcsa, v);
+    vno_prior = v_prior - gcsa->mris_priors->vertices;
+    vno_classifier = GCSAsourceToClassifierVertex(gcsa, v_prior) - gcsa->mris_classifiers->vertices;
+  }
   if (vno_prior == Gdiag_no) DiagBreak();
-
-  CP_NODE * const cpn = &gcsa->cp_nodes[vno_prior];
-
-  VERTEX const * const v_classifier = 
-    GCSAsourceToClassifierVertex(gcsa, v_prior);
-    
-  int const vno_classifier = v_classifier - gcsa->mris_classifiers->vertices;
   if (vno_classifier == Gdiag_no) DiagBreak();
 
+  CP_NODE * const cpn = &gcsa->cp_nodes[vno_prior];
   GCSA_NODE * const gcsan = &gcsa->gc_nodes[vno_classifier];
 
   int const label = v->annotation;
@@ -1490,17 +1555,20 @@ static double gcsaVertexGibbsLogLikelihood(
   CP  * const cp  = &cpn->cps[np];
 
   /* compute Mahalanobis distance */
-  v_x = VectorCopy(gcs->v_means, v_x);
+  VECTOR *v_x = VectorCopy(gcs->v_means, NULL);
   { int i;
     for (i = 0; i < gcsa->ninputs; i++) VECTOR_ELT(v_x, i + 1) -= v_inputs[i];
   }
-  m_cov_inv = MatrixInverse(gcs->m_cov, m_cov_inv);
+  MATRIX *m_cov_inv = MatrixInverse(gcs->m_cov, NULL);
   if (!m_cov_inv) ErrorExit(ERROR_BADPARM, "GCSAvertexLogLikelihood: could not invert matrix");
 
   double const det = MatrixDeterminant(gcs->m_cov);
-  v_tmp = MatrixMultiply(m_cov_inv, v_x, v_tmp);
+  VECTOR *v_tmp = MatrixMultiply(m_cov_inv, v_x, NULL);
 
   double ll = -0.5 * VectorDot(v_x, v_tmp) - 0.5 * log(det);
+  MatrixFree(&m_cov_inv);
+  VectorFree(&v_tmp);
+  VectorFree(&v_x);
   double nbr_prior = 0.0;
   
   int n;
@@ -1577,7 +1645,7 @@ int GCSAreclassifyLabel(GCSA *gcsa, MRI_SURFACE *mris, LABEL *area)
         VERTEX const * const vn = &mris->vertices[vt->v[n]];
         if (vn->annotation == annotation) continue;
         ;
-        ll = gcsaNbhdGibbsLogLikelihood(gcsa, mris, v_inputs, vno, 1.0, vn->annotation);
+        ll = gcsaNbhdGibbsLogLikelihood(gcsa, mris, v_inputs, vno, 1.0, vn->annotation, NULL, NULL);
 
         // if likelihood increased, or annotation is still at its
         // initial (v->annotation) value
@@ -2,6 +2,7 @@
 // for calculating geodesics on a polyhedral surface
 //
 
+#include <limits.h>
 #include <stdlib.h>
 #include <algorithm>  
 #include <iomanip>
@@ -16,9 +17,7 @@
 #include "mrisurf.h"
 #include "timer.h"
 
-#ifdef _OPENMP
 #include "romp_support.h"
-#endif
 
 // Vertex
 struct Vertex
@@ -49,27 +48,299 @@ static int getIndex(int *arr, int vid);
 static float distanceBetween(int v1, int v2, MRIS *surf);
 static int findNeighbor(int faceidx, int v1, int v2, MRIS *surf);
 static Vertex extendedPoint(Vertex A, Vertex B, float dA, float dB, float dAB);
-static std::pair< int, int > makeKey(int a, int b);
 static void progressBar(float progress);
 
-Geodesics *computeGeodesics(MRIS *surf, float maxdist)
+// per-thread scratch for the geodesic engine. Everything here is reset
+// through the 'touched' lists, so a seed costs O(size of its neighbourhood)
+// instead of O(nvertices).
+#define GEO_UNREACHED -2.0f  // vertex not reached from the seed
+#define GEO_HIDDEN    -1.0f  // reached, but no path to the seed known (yet)
+
+struct GeoScratch
+{
+  std::vector< char > inChain;  // per face
+  std::vector< int > chain;
+  std::stack< StackItem > stack;
+  std::vector< float > dist;    // per vertex, GEO_UNREACHED when untouched
+  std::vector< int > touched;
+};
+
+static void geodesicsReach(GeoScratch &s, int vno, float distance)
+{
+  if (s.dist[vno] == GEO_UNREACHED) {
+    s.dist[vno] = GEO_HIDDEN;
+    s.touched.push_back(vno);
+  }
+  if (distance >= 0 && (s.dist[vno] < 0 || distance < s.dist[vno])) s.dist[vno] = distance;
+}
+
+/*
+  Step 1 for a single seed: unfold the triangle chains around vertexID into
+  the plane and record every vertex within maxdist, with the straight-line
+  (line-of-sight) distance for the ones visible from the seed. The result
+  is sorted by vertex number so that other seeds can look it up.
+*/
+static void geodesicsLineOfSight(int vertexID, MRIS *surf, std::vector< Triangle > const &triangles, float maxdist,
+                                 GeoScratch &s, std::vector< int > &nbrs, std::vector< float > &dists)
+{
+  int idxlookup[] = {0, 2, 1, 0};  // fast lookup table to find remaining index
+  Triangle const *triangle;
+  StackItem stackitem;
+  Vertex A, B, C, D;
+  int iA, iB, iC, iD;
+  int current_idx;
+  float min_angle, max_angle, current_angle, distance;
+
+  s.dist[vertexID] = GEO_HIDDEN;  // the seed is not its own neighbour
+  s.touched.push_back(vertexID);
+
+  VERTEX_TOPOLOGY const * const basevertex = &surf->vertices_topology[vertexID];
+  // begin chain with each face that neighbors the current base vertex:
+  for (int i = 0; i < basevertex->num; i++) {
+    // clear triangle chain:
+    for (unsigned int c = 0; c < s.chain.size(); c++) s.inChain[s.chain[c]] = 0;
+    s.chain.clear();
+    // set up initial triangle in plane:
+    current_idx = basevertex->f[i];
+    triangle = &triangles[current_idx];
+    s.chain.push_back(current_idx);
+    s.inChain[current_idx] = 1;
+    iC = getIndex((int *)triangle->vert, vertexID);
+    iA = (iC + 1) % 3;
+    iB = (iC + 2) % 3;
+    min_angle = 0.0;
+    max_angle = triangle->angle[iC];
+    A.x = triangle->length[iB];
+    A.y = 0.0;
+    A.id = triangle->vert[iA];
+    B.x = triangle->length[iA] * cos(max_angle);
+    B.y = triangle->length[iA] * sin(max_angle);
+    B.id = triangle->vert[iB];
+    C.x = 0.0;
+    C.y = 0.0;
+    C.id = triangle->vert[iC];
+    // the edges from C to A and from C to B are geodesics:
+    geodesicsReach(s, A.id, triangle->length[iB]);
+    geodesicsReach(s, B.id, triangle->length[iA]);
+    current_idx = triangle->neighbor[iC];
+    // ------ build triangle chain ------
+    while (true) {
+      if ((current_idx < 0) || s.inChain[current_idx]) {
+        if (s.stack.empty()) break;
+        // revert to the last stack item:
+        stackitem = s.stack.top();
+        A = stackitem.a;
+        B = stackitem.b;
+        C = stackitem.c;
+        min_angle = stackitem.mina;
+        max_angle = stackitem.maxa;
+        current_idx = stackitem.idx;
+        triangle = &triangles[current_idx];
+        // trim the chain back to the current triangle:
+        while ((s.chain.size() > 0) && (s.chain.back() != current_idx)) {
+          s.inChain[s.chain.back()] = 0;
+          s.chain.pop_back();
+        }
+        s.stack.pop();
+      }
+      else {
+        triangle = &triangles[current_idx];
+        s.chain.push_back(current_idx);
+        s.inChain[current_idx] = 1;
+        iA = getIndex((int *)triangle->vert, A.id);
+        iB = getIndex((int *)triangle->vert, B.id);
+        iD = idxlookup[iA + iB];
+        // planar position of the extended vertex D and its distance to the origin:
+        D = extendedPoint(A, B, triangle->length[iB], triangle->length[iA], triangle->length[iD]);
+        D.id = triangle->vert[iD];
+        current_angle = atan2(D.y, D.x);
+        distance = sqrt(D.x * D.x + D.y * D.y);
+        if (distance > maxdist) {
+          current_idx = -1;  // this forces the next triangle invalid
+          continue;
+        }
+        if (current_angle < min_angle) {
+          geodesicsReach(s, D.id, GEO_HIDDEN);
+          C = A;
+          A = D;
+        }
+        else if (current_angle > max_angle) {
+          geodesicsReach(s, D.id, GEO_HIDDEN);
+          C = B;
+          B = D;
+        }
+        else if ((current_angle <= max_angle) && (current_angle >= min_angle)) {
+          // visible within the fov, so the straight line is a geodesic:
+          geodesicsReach(s, D.id, distance);
+          stackitem.a = A;
+          stackitem.b = D;
+          stackitem.c = B;
+          stackitem.idx = current_idx;
+          stackitem.mina = min_angle;
+          stackitem.maxa = current_angle;
+          s.stack.push(stackitem);
+          C = A;
+          A = D;
+          min_angle = current_angle;
+        }
+        else {
+          // nan angle, only seen on broken surfaces
+          current_idx = -1;
+          continue;
+        }
+      }
+      iC = getIndex((int *)triangle->vert, C.id);
+      current_idx = triangle->neighbor[iC];
+    }
+  }
+  for (unsigned int c = 0; c < s.chain.size(); c++) s.inChain[s.chain[c]] = 0;
+  s.chain.clear();
+
+  std::sort(s.touched.begin(), s.touched.end());
+  nbrs.clear();
+  dists.clear();
+  for (unsigned int n = 0; n < s.touched.size(); n++) {
+    int vno = s.touched[n];
+    if (vno != vertexID) {
+      nbrs.push_back(vno);
+      dists.push_back(s.dist[vno]);
+    }
+    s.dist[vno] = GEO_UNREACHED;
+  }
+  s.touched.clear();
+}
+
+// line-of-sight distance from seed a to vertex b, GEO_HIDDEN if none
+static float geodesicsLookup(GeodesicsCSR const *los, int a, int b)
+{
+  int const *first = los->v + los->offset[a];
+  int const *last = los->v + los->offset[a + 1];
+  int const *p = std::lower_bound(first, last, b);
+  if (p == last || *p != b) return (GEO_HIDDEN);
+  return (los->dist[p - los->v]);
+}
+
+// step 1 distance between a and b, seen from either end
+static float geodesicsLOSDist(GeodesicsCSR const *los, int a, int b)
+{
+  float dab = geodesicsLookup(los, a, b);
+  float dba = geodesicsLookup(los, b, a);
+  if (dab < 0) return (dba);
+  if (dba < 0) return (dab);
+  return (std::min(dab, dba));
+}
+
+/*
+  Step 2 for a single seed k: vertices reached but not visible get the
+  shortest path through a visible neighbour vj, using the step 1 distance
+  from vj. Vertices adjacent to a resolved vertex that the chains missed are
+  added to the neighbourhood as they are found. Only step 1 results of other
+  seeds are read, so seeds are independent of each other.
+*/
+static void geodesicsShortestPaths(int k, MRIS *surf, GeodesicsCSR const *los, float maxdist, GeoScratch &s,
+                                   std::vector< int > &nbrs, std::vector< float > &dists)
+{
+  std::vector< int > &list = s.touched;
+
+  s.dist[k] = GEO_HIDDEN;
+  for (size_t n = los->offset[k]; n < los->offset[k + 1]; n++) {
+    int vno = los->v[n];
+    s.dist[vno] = geodesicsLOSDist(los, k, vno);
+    list.push_back(vno);
+  }
+
+  for (unsigned int i = 0; i < list.size(); i++) {
+    int vi = list[i];
+    if (s.dist[vi] >= 0) continue;
+    for (unsigned int j = 0; j < list.size(); j++) {
+      int vj = list[j];
+      if ((vi == vj) || (s.dist[vj] < 0)) continue;
+      float dji = geodesicsLOSDist(los, vj, vi);
+      if (dji < 0) continue;
+      float distance = s.dist[vj] + dji;
+      if (s.dist[vi] < 0) {
+        if (distance < maxdist) s.dist[vi] = distance;
+      }
+      else if (distance < s.dist[vi])
+        s.dist[vi] = distance;
+    }
+    // search for vertices that are within distance limits
+    // but weren't discovered by the triangle chain
+    if (s.dist[vi] >= 0 && s.dist[vi] + 0.5 < maxdist) {
+      VERTEX_TOPOLOGY const * const vt = &surf->vertices_topology[vi];
+      for (int side = 0; side < vt->vnum; side++) {
+        int vno = vt->v[side];
+        if (s.dist[vno] != GEO_UNREACHED || vno == k) continue;
+        s.dist[vno] = GEO_HIDDEN;
+        list.push_back(vno);
+      }
+    }
+  }
+
+  nbrs.clear();
+  dists.clear();
+  for (unsigned int n = 0; n < list.size(); n++) {
+    int vno = list[n];
+    if (s.dist[vno] >= 0) {
+      nbrs.push_back(vno);
+      dists.push_back(s.dist[vno]);
+    }
+    s.dist[vno] = GEO_UNREACHED;
+  }
+  s.dist[k] = GEO_UNREACHED;
+  list.clear();
+}
+
+// packs per-vertex lists into a CSR structure and frees the lists
+static GeodesicsCSR *geodesicsPackCSR(std::vector< std::vector< int > > &nbrs, std::vector< std::vector< float > > &dists)
+{
+  GeodesicsCSR *geo = (GeodesicsCSR *)calloc(1, sizeof(GeodesicsCSR));
+  geo->nvertices = nbrs.size();
+  geo->offset = (size_t *)calloc(geo->nvertices + 1, sizeof(size_t));
+  for (int vno = 0; vno < geo->nvertices; vno++) geo->offset[vno + 1] = geo->offset[vno] + nbrs[vno].size();
+  geo->v = (int *)calloc(geo->offset[geo->nvertices] + 1, sizeof(int));
+  geo->dist = (float *)calloc(geo->offset[geo->nvertices] + 1, sizeof(float));
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (int vno = 0; vno < geo->nvertices; vno++) {
+    ROMP_PFLB_begin
+    std::copy(nbrs[vno].begin(), nbrs[vno].end(), geo->v + geo->offset[vno]);
+    std::copy(dists[vno].begin(), dists[vno].end(), geo->dist + geo->offset[vno]);
+    std::vector< int >().swap(nbrs[vno]);
+    std::vector< float >().swap(dists[vno]);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (geo);
+}
+
+/*
+  Runs the seeds in parallel. Each thread keeps its own chain, stack and
+  per-vertex distance scratch, and the neighbourhoods are gathered into CSR
+  form, so memory is proportional to the number of neighbours rather than
+  nvertices*MAX_GEODESICS. The result does not depend on the number of
+  threads.
+*/
+GeodesicsCSR *computeGeodesicsCSR(MRIS *surf, float maxdist)
 {
   int msec;
   Timer mytimer;
-  printf("computeGeodesics(): maxdist = %g, nvertices = %d\n", maxdist, surf->nvertices);
+  printf("computeGeodesicsCSR(): maxdist = %g, nvertices = %d, nthreads = %d\n", maxdist, surf->nvertices,
+         omp_get_max_threads());
   fflush(stdout);
 
   // pre-compute and set-up required values to build triangle chain:
-  FACE *face;
-  Triangle *triangle;
   std::vector< Triangle > triangles(surf->nfaces);
-  int idx1, idx2;
   for (int nf = 0; nf < surf->nfaces; nf++) {
-    face = &surf->faces[nf];
-    triangle = &triangles[nf];
+    FACE *face = &surf->faces[nf];
+    Triangle *triangle = &triangles[nf];
     for (int ns = 0; ns < 3; ns++) {
-      idx1 = (ns + 1) % 3;
-      idx2 = (ns + 2) % 3;
+      int idx1 = (ns + 1) % 3;
+      int idx2 = (ns + 2) % 3;
       triangle->length[ns] = distanceBetween(face->v[idx1], face->v[idx2], surf);
       triangle->neighbor[ns] = findNeighbor(nf, face->v[idx1], face->v[idx2], surf);
       triangle->vert[ns] = face->v[ns];
@@ -77,267 +348,122 @@ Geodesics *computeGeodesics(MRIS *surf, float maxdist)
     }
     triangle->inChain = false;
   }
-
   msec = mytimer.milliseconds();
   printf("precompute t = %g min\n", msec / (1000.0 * 60));
   fflush(stdout);
 
-  std::cout << "computing geodesics within distance of " << maxdist << " mm\n";
-  fflush(stdout);
-  std::vector< std::vector< int > > nearestverts(surf->nvertices);
-  int idxlookup[] = {0, 2, 1, 0};  // fast lookup table to find remaining index
-                                   // can be removed... there's an easier way
-  std::map< std::pair< int, int >, float > pathmap;
-  // private vars:
-  std::vector< int > chain;
-  std::stack< StackItem > stack;
-  std::vector< bool > isnearest(surf->nvertices);
-  std::map< std::pair< int, int >, float >::iterator edge;
-  StackItem stackitem;
-  Vertex A, B, C, D;
-  int iA, iB, iC, iD;
-  int current_idx;
-  float min_angle, max_angle, current_angle, distance;
+  std::vector< GeoScratch > scratch(omp_get_max_threads());
+  for (unsigned int t = 0; t < scratch.size(); t++) {
+    scratch[t].inChain.assign(surf->nfaces, 0);
+    scratch[t].dist.assign(surf->nvertices, GEO_UNREACHED);
+  }
+  std::vector< std::vector< int > > nbrs(surf->nvertices);
+  std::vector< std::vector< float > > dists(surf->nvertices);
+  int ndone = 0;
 
   // ------ STEP 1 ------
-  // compute each geodesic using the LOS algorithm. each geodesics is added
-  // to the pathmap, but this will not account for every path.
+  // compute each geodesic using the LOS algorithm. this will not account
+  // for every path.
+  std::cout << "computing geodesics within distance of " << maxdist << " mm\n";
+  fflush(stdout);
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 64)
+#endif
   for (int vertexID = 0; vertexID < surf->nvertices; vertexID++) {
-    VERTEX_TOPOLOGY const * const basevertex = &surf->vertices_topology[vertexID];
-    // begin chain with each face that neighbors the current base vertex:
-    for (int i = 0; i < basevertex->num; i++) {
-      // clear triangle chain and surrounding vertices index:
-      for (unsigned int c = 0; c < chain.size(); c++) triangles[chain[c]].inChain = false;
-      chain.clear();
-      for (unsigned int c = 0; c < isnearest.size(); c++) isnearest[c] = false;
-      // set up initial triangle in plane:
-      current_idx = basevertex->f[i];
-      triangle = &triangles[current_idx];
-      // formally add to chain:
-      chain.push_back(current_idx);
-      triangle->inChain = true;
-      // get vertex indices in relation to their
-      // placement in the face's vertex array:
-      iC = getIndex(triangle->vert, vertexID);
-      iA = (iC + 1) % 3;
-      iB = (iC + 2) % 3;
-      // compute min and max fov angles:
-      min_angle = 0.0;
-      max_angle = triangle->angle[iC];
-      // compute vertex A along x axis:
-      A.x = triangle->length[iB];
-      A.y = 0.0;
-      A.id = triangle->vert[iA];
-      // compute vertex B in positive y (no need for this to be pre-computed):
-      B.x = triangle->length[iA] * cos(max_angle);
-      B.y = triangle->length[iA] * sin(max_angle);
-      B.id = triangle->vert[iB];
-      // reset vertex C (base vertex which represents the origin):
-      C.x = 0.0;
-      C.y = 0.0;
-      C.id = triangle->vert[iC];
-      // formally consider the distance from C to A as a geodesic:
-      nearestverts[vertexID].push_back(A.id);
-      isnearest[A.id] = true;
-      edge = pathmap.find(makeKey(vertexID, A.id));
-      if (edge != pathmap.end())
-        edge->second = triangle->length[iB];
-      else
-        pathmap.insert(make_pair(makeKey(vertexID, A.id), triangle->length[iB]));
-      // formally consider the distance from C to B as a geodesic:
-      nearestverts[vertexID].push_back(B.id);
-      isnearest[B.id] = true;
-      edge = pathmap.find(makeKey(vertexID, B.id));
-      if (edge != pathmap.end())
-        edge->second = triangle->length[iA];
-      else
-        pathmap.insert(make_pair(makeKey(vertexID, B.id), triangle->length[iA]));
-      // chain initialiaztion complete. get next triangle
-      // and begin building chain:
-      current_idx = triangle->neighbor[iC];
-      // ------ build triangle chain ------
-      while (true) {
-        // check if the current triangle is valid or if it
-        // already exists in the chain:
-        if ((current_idx < 0) || (triangles[current_idx].inChain)) {
-          // move on to next base triangle if the stack is empty:
-          if (stack.empty()) break;
-          // if not, just revert to the last stack item:
-          else {
-            stackitem = stack.top();
-            A = stackitem.a;
-            B = stackitem.b;
-            C = stackitem.c;
-            min_angle = stackitem.mina;
-            max_angle = stackitem.maxa;
-            current_idx = stackitem.idx;
-            triangle = &triangles[current_idx];
-            // trim the chain back to the current triangle:
-            while ((chain.back() != current_idx) && (chain.size() > 0)) {
-              triangles[chain.back()].inChain = false;
-              chain.pop_back();
-            }
-            stack.pop();
-          }
-        }
-        // triangle is valid, so add it to the chain:
-        else {
-          triangle = &triangles[current_idx];
-          chain.push_back(current_idx);
-          triangle->inChain = true;
-          // find appropriate vertex indices for new triangle:
-          iA = getIndex(triangle->vert, A.id);  // this can be optimized
-          iB = getIndex(triangle->vert, B.id);
-          iD = idxlookup[iA + iB];
-          // calculate the planar position of the extended vertex D:
-          D = extendedPoint(A, B, triangle->length[iB], triangle->length[iA], triangle->length[iD]);
-          D.id = triangle->vert[iD];
-          // calculate the angle that the vector D makes with x-axis:
-          current_angle = atan2(D.y, D.x);
-          // now calculate the distance to the origin:
-          distance = sqrt(D.x * D.x + D.y * D.y);
-          if (distance > maxdist) {
-            current_idx = -1;  // this forces the next triangle invalid
-            continue;
-          }
-          // potentially use the geodesics matrix here...
-          if (!isnearest[D.id]) {
-            nearestverts[vertexID].push_back(D.id);
-            isnearest[D.id] = true;
-          }
-          // check if angle is visible within the fov:
-          if ((current_angle < min_angle)) {
-            C = A;
-            A = D;
-          }
-          else if ((current_angle > max_angle)) {
-            C = B;
-            B = D;
-          }
-          else if (((current_angle <= max_angle) && (current_angle >= min_angle))) {
-            // add geodesic to path map if shorter than the previous distance:
-            edge = pathmap.find(makeKey(vertexID, D.id));
-            if (edge != pathmap.end()) {
-              if ((distance < edge->second) || (edge->second < 0.0)) edge->second = distance;
-            }
-            else {
-              pathmap.insert(make_pair(makeKey(vertexID, D.id), distance));
-            }
-            // push triangle to the stack:
-            stackitem.a = A;
-            stackitem.b = D;
-            stackitem.c = B;
-            stackitem.idx = current_idx;
-            stackitem.mina = min_angle;
-            stackitem.maxa = current_angle;
-            stack.push(stackitem);
-            C = A;
-            A = D;
-            min_angle = current_angle;
-          }
-          // this is used to find bugs within the surface (so far I've only
-          // seen problems in the fsaverage surface)
-          else {
-            // std::cout << "nan\n";
-            // fflush(stdout);
-            current_idx = -1;
-            continue;
-          }
-        }
-        // get the next triangle and repeat:
-        iC = getIndex(triangle->vert, C.id);
-        current_idx = triangle->neighbor[iC];
-      }
-    }
-    if (vertexID % 1000 == 0) progressBar((float)vertexID / surf->nvertices);
+    ROMP_PFLB_begin
+    geodesicsLineOfSight(vertexID, surf, triangles, maxdist, scratch[omp_get_thread_num()], nbrs[vertexID],
+                         dists[vertexID]);
+#ifdef HAVE_OPENMP
+    #pragma omp atomic
+#endif
+    ndone++;
+    if (omp_get_thread_num() == 0 && vertexID % 1000 == 0) progressBar((float)ndone / surf->nvertices);
+    ROMP_PFLB_end
   }
+  ROMP_PF_end
   progressBar(1.0);
   std::cout << std::endl;
+  GeodesicsCSR *los = geodesicsPackCSR(nbrs, dists);
   msec = mytimer.milliseconds();
-  printf("step 1 t = %g min\n", msec / (1000.0 * 60));
+  printf("step 1 t = %g min, %lu line-of-sight neighbours\n", msec / (1000.0 * 60),
+         (unsigned long)los->offset[los->nvertices]);
   fflush(stdout);
 
-  std::cout << "computing shortest paths and non-geodesics\n";
-  fflush(stdout);
-  Geodesics *geo = (Geodesics *)calloc(surf->nvertices, sizeof(Geodesics));
   // ------ STEP 2 ------
   // compute the shortest paths between each vertex (within given limit)
-  int vi, vj;
+  std::cout << "computing shortest paths and non-geodesics\n";
+  fflush(stdout);
+  ndone = 0;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 64)
+#endif
   for (int k = 0; k < surf->nvertices; k++) {
-    // set up nearest vertices reference:
-    for (unsigned int d = 0; d < nearestverts[k].size(); d++) {
-      isnearest[nearestverts[k][d]] == true;
-    }
-    for (unsigned int i = 0; i < nearestverts[k].size(); i++) {
-      vi = nearestverts[k][i];
-      edge = pathmap.find(makeKey(k, vi));
-      if ((vi == k) || (edge != pathmap.end())) continue;
-
-      for (unsigned int j = 0; j < nearestverts[k].size(); j++) {
-        vj = nearestverts[k][j];
-        if ((vi == vj) || (vj == k)) continue;
-        // retrieve distance from k to i:
-        edge = pathmap.find(makeKey(k, vj));
-        if (edge == pathmap.end()) continue;
-        distance = edge->second;
-        // retrieve distance from j to k:
-        edge = pathmap.find(makeKey(vj, vi));
-        if (edge == pathmap.end()) continue;
-        distance += edge->second;
-        // retrieve distance from i to j:
-        edge = pathmap.find(makeKey(k, vi));
-        if ((edge == pathmap.end()) && (distance < maxdist))
-          pathmap.insert(make_pair(makeKey(k, vi), distance));
-        else if (distance < edge->second)
-          edge->second = distance;
-      }
-      // search for vertices that are within distance limits
-      // but weren't discovered by the triangle chain
-      edge = pathmap.find(makeKey(k, vi));
-      if (edge != pathmap.end()) {
-        for (int side = 0; side < surf->vertices_topology[vi].vnum; side++) {
-          if (!isnearest[surf->vertices_topology[vi].v[side]]) {
-            distance = edge->second + 0.5;
-            if (distance < maxdist) {
-              isnearest[surf->vertices_topology[vi].v[side]] = true;
-              nearestverts[k].push_back(surf->vertices_topology[vi].v[side]);
-            }
-          }
-        }
-      }
-    }
-    geo[k].vnum = 0;
-    // geo[k].v = (int*) calloc(nearestverts[k].size(), sizeof(int));
-    // geo[k].dist = (float*) calloc(nearestverts[k].size(), sizeof(float));
-    for (unsigned int d = 0; d < nearestverts[k].size(); d++) {
-      edge = pathmap.find(makeKey(k, nearestverts[k][d]));
-      if (edge != pathmap.end()) {
-        geo[k].v[geo[k].vnum] = nearestverts[k][d];
-        geo[k].dist[geo[k].vnum] = edge->second;
-        geo[k].vnum += 1;
-        if (geo[k].vnum > MAX_GEODESICS) {
-          std::cerr << "error: too many neighbors, try a smaller max distance\n";
-          fflush(stdout);
-          exit(1);
-        }
-      }
-      isnearest[nearestverts[k][d]] == false;
-    }
-
-    if (k % 100 == 0) {
-      progressBar((float)k / surf->nvertices);
-    }
+    ROMP_PFLB_begin
+    geodesicsShortestPaths(k, surf, los, maxdist, scratch[omp_get_thread_num()], nbrs[k], dists[k]);
+#ifdef HAVE_OPENMP
+    #pragma omp atomic
+#endif
+    ndone++;
+    if (omp_get_thread_num() == 0 && k % 100 == 0) progressBar((float)ndone / surf->nvertices);
+    ROMP_PFLB_end
   }
+  ROMP_PF_end
   progressBar(1.0);
   std::cout << std::endl;
+  geodesicsFreeCSR(&los);
 
+  GeodesicsCSR *geo = geodesicsPackCSR(nbrs, dists);
   msec = mytimer.milliseconds();
-  printf("t = %g min\n", msec / (1000.0 * 60));
+  printf("t = %g min, %lu neighbours\n", msec / (1000.0 * 60), (unsigned long)geo->offset[geo->nvertices]);
   fflush(stdout);
 
   return geo;
 }
 
+Geodesics *computeGeodesics(MRIS *surf, float maxdist)
+{
+  GeodesicsCSR *csr = computeGeodesicsCSR(surf, maxdist);
+  Geodesics *geo = geodesicsFromCSR(csr);
+  geodesicsFreeCSR(&csr);
+  if (geo == NULL) {
+    std::cerr << "error: too many neighbors, try a smaller max distance\n";
+    exit(1);
+  }
+  return geo;
+}
+
+void geodesicsFreeCSR(GeodesicsCSR **pgeo)
+{
+  GeodesicsCSR *geo = *pgeo;
+  if (geo == NULL) return;
+  free(geo->offset);
+  free(geo->v);
+  free(geo->dist);
+  free(geo);
+  *pgeo = NULL;
+}
+
+// expands to the fixed-size layout, NULL if a vertex has more than MAX_GEODESICS neighbours
+Geodesics *geodesicsFromCSR(GeodesicsCSR *csr)
+{
+  for (int vtxno = 0; vtxno < csr->nvertices; vtxno++) {
+    if (csr->offset[vtxno + 1] - csr->offset[vtxno] > MAX_GEODESICS) {
+      printf("ERROR: geodesicsFromCSR(): vertex %d has %d neighbors, max is %d\n", vtxno,
+             (int)(csr->offset[vtxno + 1] - csr->offset[vtxno]), MAX_GEODESICS);
+      return (NULL);
+    }
+  }
+  Geodesics *geo = (Geodesics *)calloc(csr->nvertices, sizeof(Geodesics));
+  for (int vtxno = 0; vtxno < csr->nvertices; vtxno++) {
+    geo[vtxno].vnum = csr->offset[vtxno + 1] - csr->offset[vtxno];
+    memcpy(geo[vtxno].v, csr->v + csr->offset[vtxno], geo[vtxno].vnum * sizeof(int));
+    memcpy(geo[vtxno].dist, csr->dist + csr->offset[vtxno], geo[vtxno].vnum * sizeof(float));
+  }
+  return (geo);
+}
+
 void geodesicsWrite(Geodesics *geo, int nvertices, char *fname)
 {
   int vtxno;
@@ -505,14 +631,6 @@ static Vertex extendedPoint(Vertex A, Vertex B, float dA, float dB, float dAB)
   return D;
 }
 
-static std::pair< int, int > makeKey(int a, int b)
-{
-  if (a < b)
-    return std::pair< int, int >(a, b);
-  else
-    return std::pair< int, int >(b, a);
-}
-
 static void progressBar(float progress)
 {
   if (!isatty(fileno(stdout))) return;
@@ -737,6 +855,105 @@ Geodesics* geodesicsReadV2(char* fname, int *pnvertices)
   return(geo);
 }
 
+/*
+  Writes CSR geodesics in the V2 layout (neighbour counts, then the packed
+  vertex and distance arrays), which is what the CSR arrays already are, so
+  nothing is repacked. The file can be read with geodesicsReadV2() or
+  geodesicsReadCSR().
+*/
+int geodesicsWriteCSR(GeodesicsCSR *geo, char *fname)
+{
+  int vtxno, *vnum;
+  size_t nnbrstot = geo->offset[geo->nvertices];
+  FILE *fp;
+
+  if (nnbrstot > INT_MAX) {
+    printf("ERROR: geodesicsWriteCSR(): %lu neighbors do not fit in the V2 format\n", (unsigned long)nnbrstot);
+    return (1);
+  }
+  printf(" GeoCount %d\n", (int)nnbrstot);
+
+  fp = fopen(fname, "wb");
+  if (fp == NULL) {
+    printf("ERROR: geodesicsWriteCSR(): could not open %s\n", fname);
+    return (1);
+  }
+  fprintf(fp, "FreeSurferGeodesics-V2\n");
+  fprintf(fp, "%d\n", -1);
+  fprintf(fp, "%d\n", geo->nvertices);
+  fprintf(fp, "%d\n", (int)nnbrstot);
+
+  vnum = (int *)calloc(sizeof(int), geo->nvertices);
+  for (vtxno = 0; vtxno < geo->nvertices; vtxno++) vnum[vtxno] = geo->offset[vtxno + 1] - geo->offset[vtxno];
+  fwrite(vnum, sizeof(int), geo->nvertices, fp);
+  free(vnum);
+  fwrite(geo->v, sizeof(int), nnbrstot, fp);
+  fwrite(geo->dist, sizeof(float), nnbrstot, fp);
+
+  if (fclose(fp) != 0) {
+    printf("ERROR: geodesicsWriteCSR(): failed writing %s\n", fname);
+    return (1);
+  }
+  return (0);
+}
+
+// reads a V2 geodesics file without expanding it to MAX_GEODESICS per vertex
+GeodesicsCSR *geodesicsReadCSR(char *fname)
+{
+  int magic, nvertices, nnbrstot, vtxno, *vnum;
+  char tmpstr[1000];
+  FILE *fp;
+
+  fp = fopen(fname, "rb");
+  if (fp == NULL) {
+    printf("ERROR: could not open %s\n", fname);
+    return (NULL);
+  }
+  if (fscanf(fp, "%999s", tmpstr) != 1 || strcmp(tmpstr, "FreeSurferGeodesics-V2")) {
+    fclose(fp);
+    printf("ERROR: %s not a geodesics file\n", fname);
+    return (NULL);
+  }
+  if (fscanf(fp, "%d", &magic) != 1 || magic != -1) {
+    fclose(fp);
+    printf("ERROR: %s wrong endian\n", fname);
+    return (NULL);
+  }
+  if (fscanf(fp, "%d", &nvertices) != 1 || fscanf(fp, "%d", &nnbrstot) != 1 || nvertices < 0 || nnbrstot < 0) {
+    fclose(fp);
+    printf("ERROR: %s bad geodesics header\n", fname);
+    return (NULL);
+  }
+  fgetc(fp);  // swallow the new line
+  printf("    geodesicsReadCSR(): %s nvertices = %d, nnbrs = %d\n", fname, nvertices, nnbrstot);
+
+  GeodesicsCSR *geo = (GeodesicsCSR *)calloc(1, sizeof(GeodesicsCSR));
+  geo->nvertices = nvertices;
+  geo->offset = (size_t *)calloc(nvertices + 1, sizeof(size_t));
+  geo->v = (int *)calloc(nnbrstot + 1, sizeof(int));
+  geo->dist = (float *)calloc(nnbrstot + 1, sizeof(float));
+  vnum = (int *)calloc(nvertices + 1, sizeof(int));
+  if ((int)fread(vnum, sizeof(int), nvertices, fp) != nvertices ||
+      (int)fread(geo->v, sizeof(int), nnbrstot, fp) != nnbrstot ||
+      (int)fread(geo->dist, sizeof(float), nnbrstot, fp) != nnbrstot) {
+    printf("ERROR: %s truncated\n", fname);
+    free(vnum);
+    geodesicsFreeCSR(&geo);
+    fclose(fp);
+    return (NULL);
+  }
+  fclose(fp);
+
+  for (vtxno = 0; vtxno < nvertices; vtxno++) geo->offset[vtxno + 1] = geo->offset[vtxno] + vnum[vtxno];
+  free(vnum);
+  if (geo->offset[nvertices] != (size_t)nnbrstot) {
+    printf("ERROR: %s neighbor counts do not add up to %d\n", fname, nnbrstot);
+    geodesicsFreeCSR(&geo);
+    return (NULL);
+  }
+  return (geo);
+}
+
 // distance along the sphere between two  vertices
 double MRISsphereDist(MRIS *sphere, VERTEX *vtx1, VERTEX *vtx2)
 {
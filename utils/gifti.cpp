@@ -331,6 +331,32 @@ static void gifti_set_DA_value_2D(giiDataArray *da, int row, int col, double val
   return;
 }
 
+/*
+ * Returns the data of da as a row-major array of nrows x ncols elements of
+ * type T if it is stored with that datatype and layout, or NULL otherwise,
+ * in which case the caller falls back to gifti_get_DA_value_2D. This lets
+ * the common float/int32 arrays be copied in one typed pass instead of
+ * dispatching on the datatype for every scalar.
+ */
+template <class T>
+static T *gifti_get_DA_rows(giiDataArray *da, int datatype, long long nrows, int ncols)
+{
+  if (!da || !da->data || da->datatype != datatype) return NULL;
+
+  if (da->num_dim == 1) {
+    if (ncols != 1) return NULL;
+  }
+  else if (da->num_dim == 2) {
+    if (da->dims[1] != ncols) return NULL;
+    if (ncols != 1 && GIFTI_IND_ORD_ROW_MAJOR != da->ind_ord) return NULL;
+  }
+  else
+    return NULL;
+
+  if (da->dims[0] < nrows) return NULL;
+  return (T *)da->data;
+}
+
 
 /*
  *
@@ -705,8 +731,13 @@ MRIS *mrisReadGIFTIdanum(const char *fname, MRIS *mris, int daNum, std::vector<O
 
     /* Copy in the vertices. */
     int vertex_index;
+    const float *xyz = gifti_get_DA_rows<float>(coords, NIFTI_TYPE_FLOAT32, num_vertices, 3);
     for (vertex_index = 0; vertex_index < num_vertices; vertex_index++) {
       mris->vertices_topology[vertex_index].num = 0;
+      if (xyz) {
+        MRISsetXYZ(mris, vertex_index, xyz[3 * vertex_index], xyz[3 * vertex_index + 1], xyz[3 * vertex_index + 2]);
+        continue;
+      }
       float x = (float)gifti_get_DA_value_2D(coords, vertex_index, 0);
       float y = (float)gifti_get_DA_value_2D(coords, vertex_index, 1);
       float z = (float)gifti_get_DA_value_2D(coords, vertex_index, 2);
@@ -715,10 +746,14 @@ MRIS *mrisReadGIFTIdanum(const char *fname, MRIS *mris, int daNum, std::vector<O
     
     /* Copy in the faces. */
     int face_index;
+    const int *fv = gifti_get_DA_rows<int>(faces, NIFTI_TYPE_INT32, num_faces, VERTICES_PER_FACE);
     for (face_index = 0; face_index < num_faces; face_index++) {
       int face_vertex_index;
       for (face_vertex_index = 0; face_vertex_index < VERTICES_PER_FACE; face_vertex_index++) {
-        vertex_index = (int)gifti_get_DA_value_2D(faces, face_index, face_vertex_index);
+        if (fv)
+          vertex_index = fv[VERTICES_PER_FACE * face_index + face_vertex_index];
+        else
+          vertex_index = (int)gifti_get_DA_value_2D(faces, face_index, face_vertex_index);
         mris->faces[face_index].v[face_vertex_index] = vertex_index;
         mris->vertices_topology[vertex_index].num++;
       }
@@ -911,19 +946,22 @@ MRIS *mrisReadGIFTIdanum(const char *fname, MRIS *mris, int daNum, std::vector<O
 
         if (node_index)  // sparse data storage
         {
+          const int *nodes = gifti_get_DA_rows<int>(node_index, NIFTI_TYPE_INT32, num_index_nodes, 1);
+          const float *vals = gifti_get_DA_rows<float>(darray, NIFTI_TYPE_FLOAT32, num_index_nodes, 1);
           int nindex;
           for (nindex = 0; nindex < num_index_nodes; nindex++) {
-            int vno = gifti_get_DA_value_2D(node_index, nindex, 0);
-            mris->vertices[vno].curv = (float)gifti_get_DA_value_2D(darray, nindex, 0);
+            int vno = nodes ? nodes[nindex] : gifti_get_DA_value_2D(node_index, nindex, 0);
+            mris->vertices[vno].curv = vals ? vals[nindex] : (float)gifti_get_DA_value_2D(darray, nindex, 0);
             if (overlayMRI != NULL)
               MRIsetVoxVal(overlayMRI, vno, 0, 0, 0, mris->vertices[vno].curv);
           }
         }
         else  // regular indexing
         {
+          const float *vals = gifti_get_DA_rows<float>(darray, NIFTI_TYPE_FLOAT32, mris->nvertices, 1);
           int vno;
           for (vno = 0; vno < mris->nvertices; vno++) {
-            mris->vertices[vno].curv = (float)gifti_get_DA_value_2D(darray, vno, 0);
+            mris->vertices[vno].curv = vals ? vals[vno] : (float)gifti_get_DA_value_2D(darray, vno, 0);
             if (overlayMRI != NULL)
               MRIsetVoxVal(overlayMRI, vno, 0, 0, 0, mris->vertices[vno].curv);
           }
@@ -982,10 +1020,11 @@ MRIS *mrisReadGIFTIdanum(const char *fname, MRIS *mris, int daNum, std::vector<O
       int nindex = 0;    // index into node_index (if sparse data storage is used)
       int da_index = 0;  // index into the data array at hand
       int vno = 0;       // index into the mris struct (vertex number)
+      const int *nodes = gifti_get_DA_rows<int>(node_index, NIFTI_TYPE_INT32, num_index_nodes, 1);
       while (vno < mris->nvertices) {
         if (node_index)  // sparse data storage support
         {
-          vno = gifti_get_DA_value_2D(node_index, nindex, 0);
+          vno = nodes ? nodes[nindex] : gifti_get_DA_value_2D(node_index, nindex, 0);
           da_index = nindex;
         }
         else  // regular indexing
@@ -1054,8 +1093,15 @@ MRIS *mrisReadGIFTIdanum(const char *fname, MRIS *mris, int daNum, std::vector<O
     } // NIFTI_INTENT_LABEL
     else if (darray->intent == NIFTI_INTENT_VECTOR) {
       // 'vector' data goes in our 'dx,dy,dz' data element of mris
+      const float *dxyz = gifti_get_DA_rows<float>(darray, NIFTI_TYPE_FLOAT32, mris->nvertices, 3);
       int vno;
       for (vno = 0; vno < mris->nvertices; vno++) {
+        if (dxyz) {
+          mris->vertices[vno].dx = dxyz[3 * vno];
+          mris->vertices[vno].dy = dxyz[3 * vno + 1];
+          mris->vertices[vno].dz = dxyz[3 * vno + 2];
+          continue;
+        }
         mris->vertices[vno].dx = (float)gifti_get_DA_value_2D(darray, vno, 0);
         mris->vertices[vno].dy = (float)gifti_get_DA_value_2D(darray, vno, 1);
         mris->vertices[vno].dz = (float)gifti_get_DA_value_2D(darray, vno, 2);
@@ -1144,21 +1190,24 @@ MRIS *mrisReadGIFTIdanum(const char *fname, MRIS *mris, int daNum, std::vector<O
 
         if (node_index)  // sparse data storage
         {
+          const int *nodes = gifti_get_DA_rows<int>(node_index, NIFTI_TYPE_INT32, num_index_nodes, 1);
+          const float *vals = gifti_get_DA_rows<float>(darray, NIFTI_TYPE_FLOAT32, num_index_nodes, 1);
           int nindex;
           for (nindex = 0; nindex < num_index_nodes; nindex++) {
-            int vno = gifti_get_DA_value_2D(node_index, nindex, 0);
-            mris->vertices[vno].val = (float)gifti_get_DA_value_2D(darray, nindex, 0);
-            mris->vertices[vno].stat = (float)gifti_get_DA_value_2D(darray, nindex, 0);
+            int vno = nodes ? nodes[nindex] : gifti_get_DA_value_2D(node_index, nindex, 0);
+            mris->vertices[vno].val = vals ? vals[nindex] : (float)gifti_get_DA_value_2D(darray, nindex, 0);
+            mris->vertices[vno].stat = mris->vertices[vno].val;
             if (overlayMRI != NULL)
               MRIsetVoxVal(overlayMRI, vno, 0, 0, nStatIntentFrame, mris->vertices[vno].stat);
           }
         }
         else  // regular indexing
         {
+          const float *vals = gifti_get_DA_rows<float>(darray, NIFTI_TYPE_FLOAT32, mris->nvertices, 1);
           int vno;
           for (vno = 0; vno < mris->nvertices; vno++) {
-            mris->vertices[vno].val = (float)gifti_get_DA_value_2D(darray, vno, 0);
-            mris->vertices[vno].stat = (float)gifti_get_DA_value_2D(darray, vno, 0);
+            mris->vertices[vno].val = vals ? vals[vno] : (float)gifti_get_DA_value_2D(darray, vno, 0);
+            mris->vertices[vno].stat = mris->vertices[vno].val;
             if (overlayMRI != NULL)
               MRIsetVoxVal(overlayMRI, vno, 0, nStatIntentFrame, 0, mris->vertices[vno].stat);
           }
@@ -1381,6 +1430,24 @@ MRI *MRISreadGiftiAsMRI(const char *fname, int read_volume)
       continue;
     }
     int vno;
+    if (dtype == MRI_FLOAT) {
+      const float *vals = gifti_get_DA_rows<float>(scalars, NIFTI_TYPE_FLOAT32, num_vertices, 1);
+      if (vals) {
+        memcpy(&MRIFseq_vox(mri, 0, 0, 0, frame_count), vals, num_vertices * sizeof(float));
+        frame_count++;
+        continue;
+      }
+    }
+    else if (dtype == MRI_INT) {
+      const int *vals = gifti_get_DA_rows<int>(scalars, NIFTI_TYPE_INT32, num_vertices, 1);
+      if (vals) {
+        int *frame = &MRIIseq_vox(mri, 0, 0, 0, frame_count);
+        for (vno = 0; vno < num_vertices; vno++)
+          frame[vno] = (intent_code[intent_code_idx] == NIFTI_INTENT_LABEL && vals[vno] == -1) ? 0 : vals[vno];
+        frame_count++;
+        continue;
+      }
+    }
     for (vno = 0; vno < num_vertices; vno++) {
       float val = (float)gifti_get_DA_value_2D(scalars, vno, 0);
       /* make the annotation volume consistent with MRISannot2seg()/ReadAnnotAsMRISeg()
@@ -1566,10 +1633,13 @@ int mriWriteGifti(MRI *mri, const char *out_fname)
     }
 
     /* Copy in all our data. */
-    int scalar_index;
-    for (scalar_index = 0; scalar_index < mri->width; scalar_index++) {
-      float val = MRIgetVoxVal(mri, scalar_index, 0, 0, frame);
-      gifti_set_DA_value_2D(scalars, scalar_index, 0, val);
+    float *vals = (float *)scalars->data;
+    if (mri->type == MRI_FLOAT)
+      memcpy(vals, &MRIFseq_vox(mri, 0, 0, 0, frame), mri->width * sizeof(float));
+    else {
+      int scalar_index;
+      for (scalar_index = 0; scalar_index < mri->width; scalar_index++)
+        vals[scalar_index] = MRIgetVoxVal(mri, scalar_index, 0, 0, frame);
     }
 
     // next frame
@@ -2190,11 +2260,12 @@ int MRISwriteGIFTISurface(MRIS *mris, gifti_image *image, const char *out_fname)
     }
 
     /* Copy in all our data. */
+    float *xyz = (float *)coords->data;
     int vertex_index;
     for (vertex_index = 0; vertex_index < mris->nvertices; vertex_index++) {
-      gifti_set_DA_value_2D(coords, vertex_index, 0, mris->vertices[vertex_index].x);
-      gifti_set_DA_value_2D(coords, vertex_index, 1, mris->vertices[vertex_index].y);
-      gifti_set_DA_value_2D(coords, vertex_index, 2, mris->vertices[vertex_index].z);
+      xyz[3 * vertex_index] = mris->vertices[vertex_index].x;
+      xyz[3 * vertex_index + 1] = mris->vertices[vertex_index].y;
+      xyz[3 * vertex_index + 2] = mris->vertices[vertex_index].z;
     }
 
     /*
@@ -2239,11 +2310,12 @@ int MRISwriteGIFTISurface(MRIS *mris, gifti_image *image, const char *out_fname)
 
     /* Copy in all our face data (remembering to ignore faces which
        have a vertex with the ripflag set). */
+    int *fv = (int *)faces->data;
     int faceNum = 0;
     for (int face_index = 0; face_index < mris->nfaces; face_index++) {
-      gifti_set_DA_value_2D(faces, faceNum, 0, mris->faces[face_index].v[0]);
-      gifti_set_DA_value_2D(faces, faceNum, 1, mris->faces[face_index].v[1]);
-      gifti_set_DA_value_2D(faces, faceNum, 2, mris->faces[face_index].v[2]);
+      fv[3 * faceNum] = mris->faces[face_index].v[0];
+      fv[3 * faceNum + 1] = mris->faces[face_index].v[1];
+      fv[3 * faceNum + 2] = mris->faces[face_index].v[2];
       faceNum++;
     }
 
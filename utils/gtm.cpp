@@ -27,6 +27,9 @@
 #include <sys/utsname.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <vector>
+
 #include "cma.h"
 #include "cmdargs.h"
 #include "diag.h"
@@ -870,6 +873,8 @@ int GTMfree(GTM **pGTM)
   // MRIfree(&gtm->gtmseg);
   MRIfree(&gtm->mask);
   MatrixFree(&gtm->X);
+  GTMsparseXfree(&gtm->Xsp);
+  GTMsparseXfree(&gtm->X0sp);
   MatrixFree(&gtm->y);
   MatrixFree(&gtm->XtX);
   MatrixFree(&gtm->iXtX);
@@ -989,7 +994,7 @@ int GTMsolve(GTM *gtm)
   int n, f;
   double sum;
 
-  if (gtm->X == NULL) {
+  if (gtm->Xsp == NULL) {
     printf("ERROR: GTMsolve(): must build design matrix first\n");
     exit(1);
   }
@@ -997,7 +1002,7 @@ int GTMsolve(GTM *gtm)
   if (!gtm->Optimizing) printf("Computing  XtX ... ");
   fflush(stdout);
   Timer timer;
-  gtm->XtX = MatrixMtM(gtm->X, gtm->XtX);
+  gtm->XtX = GTMsparseAtB(gtm->Xsp, gtm->Xsp, gtm->XtX);
   if (!gtm->Optimizing) printf(" %4.1f sec\n", timer.seconds());
   fflush(stdout);
 
@@ -1008,15 +1013,15 @@ int GTMsolve(GTM *gtm)
     printf("ERROR: matrix cannot be inverted, cond=%g\n", gtm->XtXcond);
     return (1);
   }
-  gtm->Xty = MatrixAtB(gtm->X, gtm->y, gtm->Xty);
+  gtm->Xty = GTMsparseXty(gtm->Xsp, gtm->y, gtm->Xty);
   gtm->beta = MatrixMultiplyD(gtm->iXtX, gtm->Xty, gtm->beta);
   if (gtm->rescale) GTMrescale(gtm);
   GTMrefTAC(gtm);
   if (gtm->DoSteadyState) GTMsteadyState(gtm);
 
-  gtm->yhat = MatrixMultiplyD(gtm->X, gtm->beta, gtm->yhat);
+  gtm->yhat = GTMsparseXbeta(gtm->Xsp, gtm->beta, gtm->yhat);
   gtm->res = MatrixSubtract(gtm->y, gtm->yhat, gtm->res);
-  gtm->dof = gtm->X->rows - gtm->X->cols;
+  gtm->dof = gtm->Xsp->rows - gtm->Xsp->cols;
   if(gtm->rvar == NULL) gtm->rvar = MatrixAlloc(1, gtm->res->cols, MATRIX_REAL);
   if(gtm->rvarUnscaled == NULL) gtm->rvarUnscaled = MatrixAlloc(1, gtm->res->cols, MATRIX_REAL);
   if(gtm->rL1 == NULL) gtm->rL1 = MatrixAlloc(1, gtm->res->cols, MATRIX_REAL);
@@ -1543,9 +1548,9 @@ int GTMrbv0(GTM *gtm)
  */
 MRI *GTMmgxpvc(GTM *gtm, int Target)
 {
-  int nthseg, segid, r, f, tt;
+  int nthseg, segid, r, f, tt, n;
   MATRIX *betaNotTarg, *yNotTarg, *ydiff;
-  double sum;
+  double sum, *tsum;
   MRI *mgx=NULL;
   COLOR_TABLE_ENTRY *cte;
   //COLOR_TABLE *ttctab = gtm->ctGTMSeg->ctabTissueType;
@@ -1577,50 +1582,56 @@ MRI *GTMmgxpvc(GTM *gtm, int Target)
   }
 
   // Compute the estimate of the image without the target
-  yNotTarg = MatrixMultiplyD(gtm->X, betaNotTarg, NULL);
+  yNotTarg = GTMsparseXbeta(gtm->Xsp, betaNotTarg, NULL);
   // Subtract to resdiualize the PET wrt the non-target tissue
   ydiff = MatrixSubtract(gtm->y, yNotTarg, NULL);
 
-  // Scale by the fraction of target tissue type in voxel
-  for (r = 0; r < gtm->X->rows; r++) {
-    sum = 0;
-    for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
-      segid = gtm->segidlist[nthseg];
-      tt = gtm->ctGTMSeg->entries[segid]->TissueType;
-      cte = gtm->ctGTMSeg->ctabTissueType->entries[tt];
-      if(Target == 1){ // asking for cortex
-	if(strcmp("cortex",cte->name)!=0 &&
-	   strcmp("cortex-lh",cte->name)!=0 &&
-	   strcmp("cortex-rh",cte->name)!=0) continue; // but this is not cortex
-      }
-      if(Target == 2){ // asking for subcort
-	if(strcmp("subcort_gm",cte->name)!=0 && 
-	   strcmp("subcort_gm-lh",cte->name)!=0 &&
-	   strcmp("subcort_gm-rh",cte->name)!=0) continue; // but this is not subcort
-      }
-      if(Target == 3){ // asking for any GM
-	if(strcmp("cortex",cte->name)!=0 &&
-	   strcmp("cortex-lh",cte->name)!=0 &&
-	   strcmp("cortex-rh",cte->name)!=0 &&
-	   strcmp("subcort_gm",cte->name)!=0 &&
-	   strcmp("subcort_gm-lh",cte->name)!=0 &&
-	   strcmp("subcort_gm-rh",cte->name)!=0 &&
-	   strcmp("subcort_gm-mid",cte->name)!=0) continue; // but this is not GM
-      }
-      if(Target == 4 && strcmp("cortex-lh",cte->name)!=0) continue;
-      if(Target == 5 && strcmp("cortex-rh",cte->name)!=0) continue;
-      if(Target == 6 && strcmp("subcort_gm-lh",cte->name)!=0) continue;
-      if(Target == 7 && strcmp("subcort_gm-rh",cte->name)!=0) continue;
-      if(Target == 8 && strcmp("subcort_gm-mid",cte->name)!=0) continue;
+  // Fraction of target tissue type in each voxel, summed over the
+  // target columns in seg order
+  tsum = (double *)calloc(gtm->Xsp->rows, sizeof(double));
+  for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
+    segid = gtm->segidlist[nthseg];
+    tt = gtm->ctGTMSeg->entries[segid]->TissueType;
+    cte = gtm->ctGTMSeg->ctabTissueType->entries[tt];
+    if(Target == 1){ // asking for cortex
+      if(strcmp("cortex",cte->name)!=0 &&
+	 strcmp("cortex-lh",cte->name)!=0 &&
+	 strcmp("cortex-rh",cte->name)!=0) continue; // but this is not cortex
+    }
+    if(Target == 2){ // asking for subcort
+      if(strcmp("subcort_gm",cte->name)!=0 && 
+	 strcmp("subcort_gm-lh",cte->name)!=0 &&
+	 strcmp("subcort_gm-rh",cte->name)!=0) continue; // but this is not subcort
+    }
+    if(Target == 3){ // asking for any GM
+      if(strcmp("cortex",cte->name)!=0 &&
+	 strcmp("cortex-lh",cte->name)!=0 &&
+	 strcmp("cortex-rh",cte->name)!=0 &&
+	 strcmp("subcort_gm",cte->name)!=0 &&
+	 strcmp("subcort_gm-lh",cte->name)!=0 &&
+	 strcmp("subcort_gm-rh",cte->name)!=0 &&
+	 strcmp("subcort_gm-mid",cte->name)!=0) continue; // but this is not GM
+    }
+    if(Target == 4 && strcmp("cortex-lh",cte->name)!=0) continue;
+    if(Target == 5 && strcmp("cortex-rh",cte->name)!=0) continue;
+    if(Target == 6 && strcmp("subcort_gm-lh",cte->name)!=0) continue;
+    if(Target == 7 && strcmp("subcort_gm-rh",cte->name)!=0) continue;
+    if(Target == 8 && strcmp("subcort_gm-mid",cte->name)!=0) continue;
 
-      // otherwise
-      sum += gtm->X->rptr[r+1][nthseg+1];
-    }
+    // otherwise
+    for (n = 0; n < gtm->Xsp->nnz[nthseg]; n++)
+      tsum[gtm->Xsp->row[nthseg][n]] += gtm->Xsp->val[nthseg][n];
+  }
+
+  // Scale by the fraction of target tissue type in voxel
+  for (r = 0; r < gtm->Xsp->rows; r++) {
+    sum = tsum[r];
     if (sum < gtm->mgx_gmthresh)
       for (f = 0; f < gtm->nframes; f++) ydiff->rptr[r + 1][f + 1] = 0;
     else
       for (f = 0; f < gtm->nframes; f++) ydiff->rptr[r + 1][f + 1] /= sum;
   }
+  free(tsum);
 
   mgx = GTMmat2vol(gtm, ydiff, NULL);
 
@@ -1846,7 +1857,11 @@ int GTMsynth(GTM *gtm, int NoiseSeed, int nReps)
     MRIcopyHeader(gtm->yvol, gtm->ysynth);
     MRIcopyPulseParameters(gtm->yvol, gtm->ysynth);
   }
-  yhat = MatrixMultiply(gtm->X0, gtm->beta, NULL);
+  if (gtm->X0sp == NULL) {
+    printf("ERROR: GTMsynth(): X0 was not built\n");
+    return (1);
+  }
+  yhat = GTMsparseXbeta(gtm->X0sp, gtm->beta, NULL);
   GTMmat2vol(gtm, yhat, gtm->ysynth);
   MatrixFree(&yhat);
 
@@ -1921,6 +1936,261 @@ int GTMcheckX(MATRIX *X)
   return (count);
 }
 /*------------------------------------------------------------------------------*/
+/*
+  \fn GTM_SPARSE_X *GTMsparseXalloc(int rows, int cols)
+  \brief Allocates an empty sparse design matrix. Columns are filled
+  by the caller (see GTMbuildX()).
+ */
+GTM_SPARSE_X *GTMsparseXalloc(int rows, int cols)
+{
+  GTM_SPARSE_X *X;
+  X = (GTM_SPARSE_X *)calloc(1, sizeof(GTM_SPARSE_X));
+  X->rows = rows;
+  X->cols = cols;
+  X->nnz = (int *)calloc(cols, sizeof(int));
+  X->row = (int **)calloc(cols, sizeof(int *));
+  X->val = (float **)calloc(cols, sizeof(float *));
+  return (X);
+}
+/*------------------------------------------------------------------------------*/
+int GTMsparseXfree(GTM_SPARSE_X **pX)
+{
+  GTM_SPARSE_X *X = *pX;
+  int c;
+  if (X == NULL) return (0);
+  for (c = 0; c < X->cols; c++) {
+    if (X->row[c]) free(X->row[c]);
+    if (X->val[c]) free(X->val[c]);
+  }
+  free(X->nnz);
+  free(X->row);
+  free(X->val);
+  free(X);
+  *pX = NULL;
+  return (0);
+}
+// copies one column into X, each column is written by only one thread
+static void gtmSparseXsetColumn(GTM_SPARSE_X *X, int col, const std::vector<int> &row, const std::vector<float> &val)
+{
+  X->nnz[col] = row.size();
+  X->row[col] = (int *)malloc(MAX(row.size(), 1) * sizeof(int));
+  X->val[col] = (float *)malloc(MAX(val.size(), 1) * sizeof(float));
+  std::copy(row.begin(), row.end(), X->row[col]);
+  std::copy(val.begin(), val.end(), X->val[col]);
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn MATRIX *GTMsparseXtoDense(GTM_SPARSE_X *X, MATRIX *D)
+  \brief Expands a sparse design matrix into a dense nrows-by-ncols
+  matrix. Only needed when the full matrix is saved or inspected.
+ */
+MATRIX *GTMsparseXtoDense(GTM_SPARSE_X *X, MATRIX *D)
+{
+  int c, n;
+
+  if (D && (D->rows != X->rows || D->cols != X->cols)) MatrixFree(&D);
+  if (D == NULL) {
+    D = MatrixAlloc(X->rows, X->cols, MATRIX_REAL);
+    if (D == NULL) {
+      printf("ERROR: GTMsparseXtoDense(): could not alloc %d %d\n", X->rows, X->cols);
+      return (NULL);
+    }
+  }
+  else
+    MatrixClear(D);
+  for (c = 0; c < X->cols; c++)
+    for (n = 0; n < X->nnz[c]; n++) D->rptr[X->row[c][n] + 1][c + 1] = X->val[c][n];
+  return (D);
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn MATRIX *GTMsparseAtB(GTM_SPARSE_X *A, GTM_SPARSE_X *B, MATRIX *AtB)
+  \brief Computes A'*B from the overlap of the columns. Only pairs of
+  columns whose row ranges overlap are visited. Sums are accumulated
+  in double in row order, so the result is the same as MatrixMtM()
+  or MatrixAtB() on the dense matrices. If A==B only the upper
+  triangle is computed and then mirrored.
+ */
+MATRIX *GTMsparseAtB(GTM_SPARSE_X *A, GTM_SPARSE_X *B, MATRIX *AtB)
+{
+  int ca, cb, n, ntot, symmetric;
+  int *calist, *cblist;
+
+  if (A->rows != B->rows) {
+    printf("ERROR: GTMsparseAtB(): dim mismatch: %d %d\n", A->rows, B->rows);
+    return (NULL);
+  }
+  if (AtB == NULL) AtB = MatrixAlloc(A->cols, B->cols, MATRIX_REAL);
+  if (AtB->rows != A->cols || AtB->cols != B->cols) {
+    printf("ERROR: GTMsparseAtB(): output is %d x %d, expected %d x %d\n", AtB->rows, AtB->cols, A->cols, B->cols);
+    return (NULL);
+  }
+  MatrixClear(AtB);
+  symmetric = (A == B);
+
+  // List the column pairs with overlapping row ranges
+  ntot = 0;
+  calist = (int *)calloc((size_t)A->cols * B->cols, sizeof(int));
+  cblist = (int *)calloc((size_t)A->cols * B->cols, sizeof(int));
+  for (ca = 0; ca < A->cols; ca++) {
+    if (A->nnz[ca] == 0) continue;
+    for (cb = (symmetric ? ca : 0); cb < B->cols; cb++) {
+      if (B->nnz[cb] == 0) continue;
+      if (A->row[ca][A->nnz[ca] - 1] < B->row[cb][0]) continue;
+      if (B->row[cb][B->nnz[cb] - 1] < A->row[ca][0]) continue;
+      calist[ntot] = ca;
+      cblist[ntot] = cb;
+      ntot++;
+    }
+  }
+
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for schedule(dynamic, 16)
+#endif
+  for (n = 0; n < ntot; n++) {
+    int ca = calist[n], cb = cblist[n];
+    int na = A->nnz[ca], nb = B->nnz[cb], *ra = A->row[ca], *rb = B->row[cb];
+    float *va = A->val[ca], *vb = B->val[cb];
+    int ia = 0, ib = 0;
+    double v = 0;
+    while (ia < na && ib < nb) {
+      if (ra[ia] < rb[ib])
+        ia++;
+      else if (rb[ib] < ra[ia])
+        ib++;
+      else {
+        v += (double)va[ia] * vb[ib];
+        ia++;
+        ib++;
+      }
+    }
+    AtB->rptr[ca + 1][cb + 1] = v;
+    if (symmetric) AtB->rptr[cb + 1][ca + 1] = v;
+  }
+
+  free(calist);
+  free(cblist);
+  return (AtB);
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn MATRIX *GTMsparseXty(GTM_SPARSE_X *X, MATRIX *y, MATRIX *Xty)
+  \brief Computes X'*y where y is dense (nrows-by-nframes).
+ */
+MATRIX *GTMsparseXty(GTM_SPARSE_X *X, MATRIX *y, MATRIX *Xty)
+{
+  int c;
+
+  if (X->rows != y->rows) {
+    printf("ERROR: GTMsparseXty(): dim mismatch: %d %d\n", X->rows, y->rows);
+    return (NULL);
+  }
+  if (Xty == NULL) Xty = MatrixAlloc(X->cols, y->cols, MATRIX_REAL);
+
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for schedule(dynamic, 1)
+#endif
+  for (c = 0; c < X->cols; c++) {
+    int n, f;
+    double sum;
+    for (f = 0; f < y->cols; f++) {
+      sum = 0;
+      for (n = 0; n < X->nnz[c]; n++) sum += (double)X->val[c][n] * y->rptr[X->row[c][n] + 1][f + 1];
+      Xty->rptr[c + 1][f + 1] = sum;
+    }
+  }
+  return (Xty);
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn MATRIX *GTMsparseXbeta(GTM_SPARSE_X *X, MATRIX *beta, MATRIX *yhat)
+  \brief Computes X*beta. The rows are done in blocks; within a block
+  each row is summed in double over the columns in order, as in
+  MatrixMultiplyD().
+ */
+#define GTM_XBETA_BLOCK 4096
+MATRIX *GTMsparseXbeta(GTM_SPARSE_X *X, MATRIX *beta, MATRIX *yhat)
+{
+  int nblocks, b;
+
+  if (X->cols != beta->rows) {
+    printf("ERROR: GTMsparseXbeta(): dim mismatch: %d %d\n", X->cols, beta->rows);
+    return (NULL);
+  }
+  if (yhat == NULL) yhat = MatrixAlloc(X->rows, beta->cols, MATRIX_REAL);
+
+  nblocks = (X->rows + GTM_XBETA_BLOCK - 1) / GTM_XBETA_BLOCK;
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for schedule(dynamic, 1)
+#endif
+  for (b = 0; b < nblocks; b++) {
+    int r0 = b * GTM_XBETA_BLOCK, r1 = MIN(r0 + GTM_XBETA_BLOCK, X->rows);
+    int nf = beta->cols, c, n, f, r;
+    double *acc = (double *)calloc((size_t)(r1 - r0) * nf, sizeof(double));
+    for (c = 0; c < X->cols; c++) {
+      int *rows = X->row[c];
+      if (X->nnz[c] == 0 || rows[0] >= r1 || rows[X->nnz[c] - 1] < r0) continue;
+      // first entry of this column in the block
+      n = std::lower_bound(rows, rows + X->nnz[c], r0) - rows;
+      for (; n < X->nnz[c] && rows[n] < r1; n++) {
+        double *a = &acc[(size_t)(rows[n] - r0) * nf];
+        for (f = 0; f < nf; f++) a[f] += (double)X->val[c][n] * beta->rptr[c + 1][f + 1];
+      }
+    }
+    for (r = r0; r < r1; r++)
+      for (f = 0; f < nf; f++) yhat->rptr[r + 1][f + 1] = acc[(size_t)(r - r0) * nf + f];
+    free(acc);
+  }
+  return (yhat);
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn int GTMdenseX(GTM *gtm)
+  \brief Creates dense copies of X and X0 (gtm->X, gtm->X0) from the
+  sparse ones. GTMbuildX() no longer creates these, so this only needs
+  to be called when the full matrices are written out or analyzed.
+ */
+int GTMdenseX(GTM *gtm)
+{
+  if (gtm->Xsp) {
+    gtm->X = GTMsparseXtoDense(gtm->Xsp, gtm->X);
+    if (gtm->X == NULL) return (1);
+  }
+  if (gtm->X0sp) {
+    gtm->X0 = GTMsparseXtoDense(gtm->X0sp, gtm->X0);
+    if (gtm->X0 == NULL) return (1);
+  }
+  return (0);
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn int *GTMrowNthSeg(GTM *gtm)
+  \brief Returns an array with the nthseg of the voxel at each row of
+  X (ie, in the mask order of GTMvol2mat()), or -1 for voxels not in
+  any seg. Caller must free.
+ */
+int *GTMrowNthSeg(GTM *gtm)
+{
+  int c, r, s, k, segid, *rowseg;
+
+  rowseg = (int *)calloc(gtm->nmask, sizeof(int));
+  k = 0;
+  for (s = 0; s < gtm->yvol->depth; s++) {  // crs order is important here!
+    for (c = 0; c < gtm->yvol->width; c++) {
+      for (r = 0; r < gtm->yvol->height; r++) {
+        if (gtm->mask && MRIgetVoxVal(gtm->mask, c, r, s, 0) < 0.5) continue;
+        segid = MRIgetVoxVal(gtm->gtmseg, c, r, s, 0);
+        if (segid == 0)
+          rowseg[k] = -1;
+        else
+          rowseg[k] = GTMsegid2nthseg(gtm, segid);
+        k++;
+      }
+    }
+  }
+  return (rowseg);
+}
+/*------------------------------------------------------------------------------*/
 /*
   \fn int GTMbuildX(GTM *gtm)
   \brief Builds the GTM design matrix both with (X) and without (X0) PSF.  If
@@ -1928,26 +2198,38 @@ int GTMcheckX(MATRIX *X)
 */
 int GTMbuildX(GTM *gtm)
 {
-  int nthseg, err;
-
-  if (gtm->X == NULL || gtm->X->rows != gtm->nmask || gtm->X->cols != gtm->nsegs) {
-    // Alloc or realloc X
-    if (gtm->X) MatrixFree(&gtm->X);
-    gtm->X = MatrixAlloc(gtm->nmask, gtm->nsegs, MATRIX_REAL);
-    if (gtm->X == NULL) {
-      printf("ERROR: GTMbuildX(): could not alloc X %d %d\n", gtm->nmask, gtm->nsegs);
-      return (1);
-    }
-  }
-  if (gtm->X0 == NULL || gtm->X0->rows != gtm->nmask || gtm->X0->cols != gtm->nsegs) {
-    if (gtm->X0) MatrixFree(&gtm->X0);
-    gtm->X0 = MatrixAlloc(gtm->nmask, gtm->nsegs, MATRIX_REAL);
-    if (gtm->X0 == NULL) {
-      printf("ERROR: GTMbuildX(): could not alloc X0 %d %d\n", gtm->nmask, gtm->nsegs);
-      return (1);
+  int nthseg, err, c, r, s, k, *rowindex;
+  size_t nvox;
+
+  // The dense matrices are only made on request by GTMdenseX(), and
+  // any old ones would be stale after this
+  if (gtm->X) MatrixFree(&gtm->X);
+  if (gtm->X0) MatrixFree(&gtm->X0);
+  GTMsparseXfree(&gtm->Xsp);
+  GTMsparseXfree(&gtm->X0sp);
+  gtm->Xsp = GTMsparseXalloc(gtm->nmask, gtm->nsegs);
+  if (!gtm->Optimizing) gtm->X0sp = GTMsparseXalloc(gtm->nmask, gtm->nsegs);
+  gtm->dof = gtm->Xsp->rows - gtm->Xsp->cols;
+
+  // Row of X for each voxel (-1 if not in the mask). Creating X in this order
+  // makes it consistent with matlab. Note: y must be ordered in the same way.
+  // See GTMvol2mat()
+  nvox = (size_t)gtm->yvol->width * gtm->yvol->height * gtm->yvol->depth;
+  rowindex = (int *)calloc(nvox, sizeof(int));
+  k = 0;
+  for (s = 0; s < gtm->yvol->depth; s++) {
+    for (c = 0; c < gtm->yvol->width; c++) {
+      for (r = 0; r < gtm->yvol->height; r++) {
+        size_t ind = ((size_t)s * gtm->yvol->width + c) * gtm->yvol->height + r;
+        if (gtm->mask && MRIgetVoxVal(gtm->mask, c, r, s, 0) < 0.5) {
+          rowindex[ind] = -1;
+          continue;
+        }
+        rowindex[ind] = k;
+        k++;
+      }
     }
   }
-  gtm->dof = gtm->X->rows - gtm->X->cols;
 
   Timer timer;
 
@@ -2012,25 +2294,33 @@ int GTMbuildX(GTM *gtm)
       nthsegpvfbbsm = nthsegpvfbbsmmb;
       MB2Dfree(&mb);
     }
-    // Fill X, creating X in this order makes it consistent with matlab
-    // Note: y must be ordered in the same way. See GTMvol2mat()
-    k = 0;
-    for (s = 0; s < gtm->yvol->depth; s++) {
-      for (c = 0; c < gtm->yvol->width; c++) {
-        for (r = 0; r < gtm->yvol->height; r++) {
-          if (gtm->mask && MRIgetVoxVal(gtm->mask, c, r, s, 0) < 0.5) continue;
-          k++;  // have to incr here in case continue below
-          if (c < region->x || c >= region->x + region->dx) continue;
-          if (r < region->y || r >= region->y + region->dy) continue;
-          if (s < region->z || s >= region->z + region->dz) continue;
-          // do not use k+1 here because it has already been incr above
-          if (!gtm->Optimizing)
-            gtm->X0->rptr[k][nthseg + 1] = MRIgetVoxVal(nthsegpvfbb, c - region->x, r - region->y, s - region->z, 0);
-
-          gtm->X->rptr[k][nthseg + 1] = MRIgetVoxVal(nthsegpvfbbsm, c - region->x, r - region->y, s - region->z, 0);
+    // Fill the nthseg column of X and X0 with the nonzero voxels in the
+    // bounding box. Visiting the box in s,c,r order keeps the rows ascending.
+    std::vector<int> xrow, x0row;
+    std::vector<float> xval, x0val;
+    for (s = MAX(region->z, 0); s < MIN(region->z + region->dz, gtm->yvol->depth); s++) {
+      for (c = MAX(region->x, 0); c < MIN(region->x + region->dx, gtm->yvol->width); c++) {
+        for (r = MAX(region->y, 0); r < MIN(region->y + region->dy, gtm->yvol->height); r++) {
+          float v;
+          k = rowindex[((size_t)s * gtm->yvol->width + c) * gtm->yvol->height + r];
+          if (k < 0) continue;
+          if (!gtm->Optimizing) {
+            v = MRIgetVoxVal(nthsegpvfbb, c - region->x, r - region->y, s - region->z, 0);
+            if (v != 0) {
+              x0row.push_back(k);
+              x0val.push_back(v);
+            }
+          }
+          v = MRIgetVoxVal(nthsegpvfbbsm, c - region->x, r - region->y, s - region->z, 0);
+          if (v != 0) {
+            xrow.push_back(k);
+            xval.push_back(v);
+          }
         }
       }
     }
+    gtmSparseXsetColumn(gtm->Xsp, nthseg, xrow, xval);
+    if (!gtm->Optimizing) gtmSparseXsetColumn(gtm->X0sp, nthseg, x0row, x0val);
     MRIfree(&nthsegpvf);
     MRIfree(&nthsegpvfbb);
     MRIfree(&nthsegpvfbbsm);
@@ -2039,9 +2329,13 @@ int GTMbuildX(GTM *gtm)
   }
   //ROMP_PF_end
   
+  free(rowindex);
   if (!gtm->Optimizing) printf(" Build time %6.4f, err = %d\n", timer.seconds(), err);
   fflush(stdout);
-  if (err) gtm->X = NULL;
+  if (err) {
+    GTMsparseXfree(&gtm->Xsp);
+    GTMsparseXfree(&gtm->X0sp);
+  }
 
   return (0);
 }
@@ -2877,36 +3171,27 @@ MRI **GTMlocal(GTM *gtm, MRI **pvc)
 */
 int GTMttPercent(GTM *gtm)
 {
-  int nTT, k, s, c, r, segid, nthseg, mthseg, mthsegid, tt;
+  int nTT, n, k, nthseg, mthseg, mthsegid, tt, *rowseg;
   double sum;
 
   nTT = gtm->ttpvf->nframes;
   if (gtm->ttpct != NULL) MatrixFree(&gtm->ttpct);
   gtm->ttpct = MatrixAlloc(gtm->nsegs, nTT, MATRIX_REAL);
 
-  // Must be done in same order as GTMbuildX()
-  k = 0;
-  for (s = 0; s < gtm->yvol->depth; s++) {
-    for (c = 0; c < gtm->yvol->width; c++) {
-      for (r = 0; r < gtm->yvol->height; r++) {
-        if (gtm->mask && MRIgetVoxVal(gtm->mask, c, r, s, 0) < 0.5) continue;
-        segid = MRIgetVoxVal(gtm->gtmseg, c, r, s, 0);
-        k++;  // have to do this here
-        if (segid == 0) continue;
-        for (nthseg = 0; nthseg < gtm->nsegs; nthseg++)
-          if (segid == gtm->segidlist[nthseg]) break;
-        for (mthseg = 0; mthseg < gtm->nsegs; mthseg++) {
-          mthsegid = gtm->segidlist[mthseg];
-          tt = gtm->ctGTMSeg->entries[mthsegid]->TissueType;
-          // printf("k=%d, segid = %d, nthseg = %d, mthsegid = %d, mthseg = %d, tt=%d\n",
-          // k,segid,nthseg,mthsegid,mthseg,tt);
-          fflush(stdout);
-          gtm->ttpct->rptr[nthseg + 1][tt] +=  // not tt+1
-              (gtm->X->rptr[k][mthseg + 1] * gtm->beta->rptr[mthseg + 1][1]);
-        }
-      }
+  // Walk the columns of X, crediting each entry to the seg of its voxel
+  rowseg = GTMrowNthSeg(gtm);
+  for (mthseg = 0; mthseg < gtm->nsegs; mthseg++) {
+    mthsegid = gtm->segidlist[mthseg];
+    tt = gtm->ctGTMSeg->entries[mthsegid]->TissueType;
+    for (n = 0; n < gtm->Xsp->nnz[mthseg]; n++) {
+      k = gtm->Xsp->row[mthseg][n];
+      nthseg = rowseg[k];
+      if (nthseg < 0) continue;
+      gtm->ttpct->rptr[nthseg + 1][tt] +=  // not tt+1
+          (gtm->Xsp->val[mthseg][n] * gtm->beta->rptr[mthseg + 1][1]);
     }
   }
+  free(rowseg);
 
   for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
     sum = 0;
@@ -24,6 +24,7 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <vector>
 
 #include "mri.h"
 #include "mrisurf.h"
@@ -32,7 +33,9 @@
 #include "diag.h"
 #include "error.h"
 #include "fio.h"
+#include "machine.h"
 #include "macros.h"
+#include "mghendian.h"
 #include "minc.h"
 #include "proto.h"
 #include "utils.h"
@@ -49,12 +52,102 @@ static int update_vertex_indices(LABEL *area);
 static LABEL_VERTEX *labelFindVertexNumber(LABEL *area, int vno);
 static Transform *labelLoadTransform(const char *subject_name, const char *sdir, General_transform *transform);
 #define MAX_VERTICES 500000
+
+/*
+  Binary labels start with a "#!binary label ..." line that carries the same
+  information as the first line of an ASCII label, followed by big-endian
+  int version, int n_points, and then the vno, x, y, z and stat arrays of
+  n_points values each.
+*/
+#define LABEL_BINARY_TAG "#!binary label"
+#define LABEL_BINARY_VERSION 1
+
+// space and coords from the first line of a label file
+static void labelParseHeaderLine(LABEL *area, char *cp)
+{
+  char *str = strstr(cp, "vox2ras=");
+  if (str) {
+    if (*(cp + strlen(cp) - 1) == '\n') *(cp + strlen(cp) - 1) = 0;
+    sprintf(area->space, "%s", str + strlen("vox2ras="));
+  }
+
+  if (strstr(area->space, "voxel"))
+    area->coords = LABEL_COORDS_VOXEL;
+  else if (strstr(cp, "scanner"))
+    area->coords = LABEL_COORDS_SCANNER_RAS;
+  else
+    area->coords = LABEL_COORDS_TKREG_RAS;
+}
+
+static void labelAllocPoints(LABEL *area, int n_points)
+{
+  area->n_points = area->max_points = n_points;
+  area->lv = (LABEL_VERTEX *)calloc(n_points, sizeof(LABEL_VERTEX));
+  if (!area->lv)
+    ErrorExit(ERROR_NOMEMORY, "%s: LabelReadFrom could not allocate %d-sized vector", Progname, sizeof(LV) * n_points);
+}
+
+// fills area->lv from the arrays of a binary label, which need not be aligned
+static void labelDecodeBinaryArrays(LABEL *area, unsigned char const *data)
+{
+  long const n = area->n_points;
+
+  unsigned char const *vno = data, *x = vno + 4 * n, *y = x + 4 * n, *z = y + 4 * n, *stat = z + 4 * n;
+  for (long i = 0; i < n; i++) {
+    int ival;
+    float fval;
+    memcpy(&ival, vno + 4 * i, 4);
+    area->lv[i].vno = orderIntBytes(ival);
+    memcpy(&fval, x + 4 * i, 4);
+    area->lv[i].x = orderFloatBytes(fval);
+    memcpy(&fval, y + 4 * i, 4);
+    area->lv[i].y = orderFloatBytes(fval);
+    memcpy(&fval, z + 4 * i, 4);
+    area->lv[i].z = orderFloatBytes(fval);
+    memcpy(&fval, stat + 4 * i, 4);
+    area->lv[i].stat = orderFloatBytes(fval);
+  }
+}
+
+static int labelReadBinaryCount(unsigned char const *hdr, const char *fname)
+{
+  int version, n_points;
+
+  memcpy(&version, hdr, 4);
+  memcpy(&n_points, hdr + 4, 4);
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+  version = swapInt(version);
+  n_points = swapInt(n_points);
+#endif
+  if (version != LABEL_BINARY_VERSION)
+    ErrorReturn(-1, (ERROR_BADFILE, "%s: unknown binary label version %d in %s", Progname, version, fname));
+  if (n_points <= 0) ErrorReturn(-1, (ERROR_BADFILE, "%s: no data in label file %s", Progname, fname));
+  return (n_points);
+}
+
+// loads the talairach transform of the subject the label belongs to
+static void labelSetSubject(LABEL *area, const char *subject_name)
+{
+  char subjects_dir[STRLEN], *cp;
+
+  cp = getenv("SUBJECTS_DIR");
+  if (!cp)
+    ErrorExit(ERROR_BADPARM,
+              "%s: no subject's directory specified in environment "
+              "(SUBJECTS_DIR)",
+              Progname);
+  strncpy(subjects_dir, cp, STRLEN - 1);
+  strncpy(area->subject_name, subject_name, STRLEN - 1);
+  area->linear_transform = labelLoadTransform(subject_name, subjects_dir, &area->transform);
+  area->inverse_linear_transform = get_inverse_linear_transform_ptr(&area->transform);
+}
+
 /*-----------------------------------------------------
 ------------------------------------------------------*/
 LABEL *LabelReadFrom(const char *subject_name, FILE *fp)
 {
   LABEL *area;
-  char line[STRLEN], subjects_dir[STRLEN], *cp, *str;
+  char line[STRLEN], *cp;
   int vno, nlines;
   float x, y, z, stat;
 
@@ -64,30 +157,29 @@ LABEL *LabelReadFrom(const char *subject_name, FILE *fp)
   }
   cp = fgets(line, STRLEN, fp);  // read comment line
   if (cp == NULL) return (NULL);
-  str = strstr(cp, "vox2ras=");
-  if (str) {
-    if (*(cp + strlen(cp) - 1) == '\n') *(cp + strlen(cp) - 1) = 0;
-    sprintf(area->space, "%s", str + strlen("vox2ras="));
+  labelParseHeaderLine(area, cp);
+
+  if (!strncmp(line, LABEL_BINARY_TAG, strlen(LABEL_BINARY_TAG))) {
+    unsigned char hdr[8];
+    if (fread(hdr, 1, 8, fp) != 8) ErrorReturn(NULL, (ERROR_BADFILE, "%s: empty label", Progname));
+    int n_points = labelReadBinaryCount(hdr, "label");
+    if (n_points < 0) return (NULL);
+    labelAllocPoints(area, n_points);
+    std::vector<unsigned char> data(20L * n_points);
+    if (fread(&data[0], 1, data.size(), fp) != data.size())
+      ErrorReturn(NULL, (ERROR_BADFILE, "%s: truncated binary label", Progname));
+    labelDecodeBinaryArrays(area, &data[0]);
+    if (subject_name) labelSetSubject(area, subject_name);
+    return (area);
   }
 
-  if (strstr(area->space, "voxel"))
-    area->coords = LABEL_COORDS_VOXEL;
-  else if (strstr(cp, "scanner"))
-    area->coords = LABEL_COORDS_SCANNER_RAS;
-  else
-    area->coords = LABEL_COORDS_TKREG_RAS;
-
   cp = fgetl(line, STRLEN, fp);
   if (!cp) ErrorReturn(NULL, (ERROR_BADFILE, "%s: empty label", Progname));
   if (!sscanf(cp, "%d", &area->n_points)) {
     printf("\n%s\n", cp);
     ErrorReturn(NULL, (ERROR_BADFILE, "%s: could not scan # of lines from label file", Progname));
   }
-  area->max_points = area->n_points;
-  area->lv = (LABEL_VERTEX *)calloc(area->n_points, sizeof(LABEL_VERTEX));
-  if (!area->lv)
-    ErrorExit(
-          ERROR_NOMEMORY, "%s: LabelReadFrom could not allocate %d-sized vector", Progname, sizeof(LV) * area->n_points);
+  labelAllocPoints(area, area->n_points);
   nlines = 0;
   while ((cp = fgetl(line, STRLEN, fp)) != NULL) {
     if (sscanf(cp, "%d %f %f %f %f", &vno, &x, &y, &z, &stat) != 5)
@@ -102,18 +194,99 @@ LABEL *LabelReadFrom(const char *subject_name, FILE *fp)
   }
 
   if (!nlines) ErrorReturn(NULL, (ERROR_BADFILE, "%s: no data in label file", Progname));
-  if (subject_name) {
-    cp = getenv("SUBJECTS_DIR");
-    if (!cp)
-      ErrorExit(ERROR_BADPARM,
-                "%s: no subject's directory specified in environment "
-                "(SUBJECTS_DIR)",
-                Progname);
-    strncpy(subjects_dir, cp, STRLEN - 1);
-    strncpy(area->subject_name, subject_name, STRLEN - 1);
-    area->linear_transform = labelLoadTransform(subject_name, subjects_dir, &area->transform);
-    area->inverse_linear_transform = get_inverse_linear_transform_ptr(&area->transform);
+  if (subject_name) labelSetSubject(area, subject_name);
+  return (area);
+}
+
+/*
+  Same as LabelReadFrom() for a label file that has been read into buf
+  (nul-terminated). The ASCII points are parsed in place instead of line by
+  line through stdio.
+*/
+static LABEL *labelReadFromBuffer(const char *subject_name, char *buf, size_t len, const char *fname)
+{
+  LABEL *area;
+  char *cp, *end = buf + len, *eol;
+
+  area = (LABEL *)calloc(1, sizeof(LABEL));
+  if (!area) {
+    ErrorExit(ERROR_NOMEMORY, "%s: could not allocate LABEL struct.", Progname);
   }
+
+  // comment line, keeping its newline as fgets() would
+  eol = (char *)memchr(buf, '\n', len);
+  cp = eol ? eol + 1 : end;
+  {
+    char line[STRLEN];
+    size_t n = MIN((size_t)(cp - buf), (size_t)STRLEN - 1);
+    memcpy(line, buf, n);
+    line[n] = 0;
+    labelParseHeaderLine(area, line);
+  }
+
+  if (!strncmp(buf, LABEL_BINARY_TAG, strlen(LABEL_BINARY_TAG))) {
+    if ((size_t)(end - cp) < 8) ErrorReturn(NULL, (ERROR_BADFILE, "%s: empty label %s", Progname, fname));
+    int n_points = labelReadBinaryCount((unsigned char *)cp, fname);
+    if (n_points < 0) return (NULL);
+    if ((size_t)(end - cp - 8) < 20L * n_points)
+      ErrorReturn(NULL, (ERROR_BADFILE, "%s: truncated binary label %s", Progname, fname));
+    labelAllocPoints(area, n_points);
+    labelDecodeBinaryArrays(area, (unsigned char *)cp + 8);
+    if (subject_name) labelSetSubject(area, subject_name);
+    return (area);
+  }
+
+  // the remaining lines, skipping blank and comment lines as fgetl() does
+  int nlines = -1;
+  while (cp < end) {
+    eol = (char *)memchr(cp, '\n', end - cp);
+    if (!eol) eol = end;
+    while (cp < eol && isspace((unsigned char)*cp)) cp++;
+    if (cp == eol || *cp == '#') {
+      cp = eol + 1;
+      continue;
+    }
+    *eol = 0;  // a comment ends the line for the parse below
+    char *hash = strchr(cp, '#');
+    if (hash) *hash = 0;
+
+    if (nlines < 0) {
+      if (!sscanf(cp, "%d", &area->n_points)) {
+        printf("\n%s\n", cp);
+        ErrorReturn(NULL, (ERROR_BADFILE, "%s: could not scan # of lines from label file", Progname));
+      }
+      labelAllocPoints(area, area->n_points);
+      nlines = 0;
+    }
+    else {
+      LABEL_VERTEX *lv = &area->lv[nlines];
+      char *p = cp, *q;
+      int ok = 1;
+      lv->vno = strtol(p, &q, 10);
+      ok = ok && q != p;
+      p = q;
+      lv->x = strtof(p, &q);
+      ok = ok && q != p;
+      p = q;
+      lv->y = strtof(p, &q);
+      ok = ok && q != p;
+      p = q;
+      lv->z = strtof(p, &q);
+      ok = ok && q != p;
+      p = q;
+      lv->stat = strtof(p, &q);
+      ok = ok && q != p;
+      if (!ok)
+        ErrorReturn(NULL, (ERROR_BADFILE, "%s: could not parse %dth line '%s' in label file", Progname, nlines + 1, cp));
+      nlines++;
+      if (nlines == area->n_points) break;
+    }
+    cp = eol + 1;
+  }
+
+  if (nlines < 0) ErrorReturn(NULL, (ERROR_BADFILE, "%s: empty label", Progname));
+  if (!nlines) ErrorReturn(NULL, (ERROR_BADFILE, "%s: no data in label file", Progname));
+  if (subject_name) labelSetSubject(area, subject_name);
   return (area);
 }
 
@@ -182,11 +355,22 @@ LABEL *LabelRead(const char *subject_name, const char *label_name)
 
   if (!fp) ErrorReturn(NULL, (ERROR_NOFILE, "%s: could not open label file %s", Progname, fname.c_str()));
 
-  area = LabelReadFrom(subject_name, fp);
+  // read the whole file and parse it in memory, doubling the buffer as it fills
+  std::vector<char> buf;
+  size_t len = 0, nread;
+  do {
+    buf.resize(MAX((size_t)1 << 20, 2 * buf.size()));
+    nread = fread(&buf[len], 1, buf.size() - len, fp);
+    len += nread;
+  } while (nread > 0 && len == buf.size());
+  fclose(fp);
+  buf.resize(len + 1);
+  buf[len] = 0;
+
+  area = labelReadFromBuffer(subject_name, &buf[0], len, fname.c_str());
   if (area) {
     strncpy(area->name, fname.c_str(), STRLEN-1);
   }
-  fclose(fp);
   return (area);
 }
 /*-----------------------------------------------------
@@ -553,21 +737,73 @@ int LabelWriteInto(LABEL *area, FILE *fp)
     fclose(fp);
     return (1);
   }
-  for (n = 0; n < area->n_points; n++)
-    if (!area->lv[n].deleted) {
-      nbytes = fprintf(fp,
-                       "%d  %2.3f  %2.3f  %2.3f %10.10f\n",
-                       area->lv[n].vno,
-                       area->lv[n].x,
-                       area->lv[n].y,
-                       area->lv[n].z,
-                       area->lv[n].stat);
-      if (nbytes < 0) {
+
+  // format the points into a buffer and write it in large pieces
+  std::vector<char> buf(1 << 20);
+  size_t used = 0;
+  for (n = 0; n < area->n_points; n++) {
+    if (area->lv[n].deleted) continue;
+    if (buf.size() - used < 512) {
+      if (fwrite(&buf[0], 1, used, fp) != used) {
         printf("ERROR: writing to label file 3\n");
         fclose(fp);
         return (1);
       }
+      used = 0;
+    }
+    used += snprintf(&buf[used],
+                     buf.size() - used,
+                     "%d  %2.3f  %2.3f  %2.3f %10.10f\n",
+                     area->lv[n].vno,
+                     area->lv[n].x,
+                     area->lv[n].y,
+                     area->lv[n].z,
+                     area->lv[n].stat);
+  }
+  if (fwrite(&buf[0], 1, used, fp) != used) {
+    printf("ERROR: writing to label file 3\n");
+    fclose(fp);
+    return (1);
+  }
+  return (NO_ERROR);
+}
+
+int LabelWriteBinaryInto(LABEL *area, FILE *fp)
+{
+  int n, num, i;
+
+  for (num = n = 0; n < area->n_points; n++)
+    if (!area->lv[n].deleted) {
+      num++;
     }
+
+  if (fprintf(fp, "%s %s , from subject %s vox2ras=%s\n", LABEL_BINARY_TAG, area->name, area->subject_name, area->space) <
+      0) {
+    printf("ERROR: writing to label file 1\n");
+    return (1);
+  }
+
+  std::vector<int> data(2 + 5L * num);
+  int *vno = &data[2];
+  float *x = (float *)(vno + num), *y = x + num, *z = y + num, *stat = z + num;
+  data[0] = LABEL_BINARY_VERSION;
+  data[1] = num;
+  for (i = n = 0; n < area->n_points; n++) {
+    if (area->lv[n].deleted) continue;
+    vno[i] = area->lv[n].vno;
+    x[i] = area->lv[n].x;
+    y[i] = area->lv[n].y;
+    z[i] = area->lv[n].z;
+    stat[i] = area->lv[n].stat;
+    i++;
+  }
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+  ByteSwap4(&data[0], sizeof(int) * data.size());  // counts bytes, not items
+#endif
+  if (fwrite(&data[0], sizeof(int), data.size(), fp) != data.size()) {
+    printf("ERROR: writing to label file 2\n");
+    return (1);
+  }
   return (NO_ERROR);
 }
 /*-----------------------------------------------------
@@ -615,6 +851,11 @@ int LabelWrite(LABEL *area, const char *label_name)
   fp = fopen(fname.c_str(), "w");
   if (!fp) ErrorReturn(ERROR_NOFILE, (ERROR_NO_FILE, "%s: could not open label file %s", Progname, fname.c_str()));
 
+  if (getenv("FS_LABEL_BINARY")) {
+    ret = LabelWriteBinaryInto(area, fp);
+    fclose(fp);
+    return (ret);
+  }
   ret = LabelWriteInto(area, fp);
   fclose(fp);
   return (ret);
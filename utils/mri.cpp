@@ -22,6 +22,7 @@ extern const char *Progname;
 
 #include <ctype.h>
 #include <errno.h>
+#include <float.h>
 #include <math.h>
 #include <memory.h>
 #include <stdio.h>
@@ -41,6 +42,7 @@ extern const char *Progname;
 #include "macros.h"
 #include "matrix.h"
 #include "minc.h"
+#include "mrifloodfill.h"
 #include "mri2.h"
 #include "mriBSpline.h"
 #include "pdf.h"
@@ -8095,33 +8097,17 @@ MRI *MRIfill(MRI *mri_src, MRI *mri_dst, int seed_x, int seed_y, int seed_z, int
   ------------------------------------------------------*/
 MRI *MRIfillFG(MRI *mri_src, MRI *mri_dst, int seed_x, int seed_y, int seed_z, int threshold, int fill_val, int *npix)
 {
-  int width, height, depth, x, y, z, nfilled, xmin, xmax, ymin, ymax, zmin, zmax, on, x0, x1, y0, y1, z0, z1, total_pix;
-  BUFTYPE *psrc, *pdst, val;
+  int width, height, depth, x, y, z, nfilled;
+  BUFTYPE *pdst, val;
 
   width = mri_src->width;
   height = mri_src->height;
   depth = mri_src->depth;
   if (!mri_dst) mri_dst = MRIclone(mri_src, NULL);
 
-  if (seed_x < 0)
-    seed_x = 0;
-  else if (seed_x >= width)
-    seed_x = width - 1;
-  if (seed_y < 0)
-    seed_y = 0;
-  else if (seed_y >= height)
-    seed_y = width - 1;
-  if (seed_z < 0)
-    seed_z = 0;
-  else if (seed_z >= depth)
-    seed_z = width - 1;
-
-  xmin = MAX(seed_x - 1, 0);
-  xmax = MIN(seed_x + 1, width - 1);
-  ymin = MAX(seed_y - 1, 0);
-  ymax = MIN(seed_y + 1, height - 1);
-  zmin = MAX(seed_z - 1, 0);
-  zmax = MIN(seed_z + 1, depth - 1);
+  seed_x = MAX(0, MIN(seed_x, width - 1));
+  seed_y = MAX(0, MIN(seed_y, height - 1));
+  seed_z = MAX(0, MIN(seed_z, depth - 1));
 
   /* replace all occurrences of fill_val with fill_val-1 */
   for (z = 0; z < depth; z++) {
@@ -8134,55 +8120,10 @@ MRI *MRIfillFG(MRI *mri_src, MRI *mri_dst, int seed_x, int seed_y, int seed_z, i
     }
   }
 
-  MRIvox(mri_dst, seed_x, seed_y, seed_z) = fill_val;
-  total_pix = 1; /* include the seed point */
-  do {
-    z0 = zmin;
-    z1 = zmax;
-    y0 = ymin;
-    y1 = ymax;
-    x0 = xmin;
-    x1 = xmax;
-    nfilled = 0;
-    for (z = zmin; z <= zmax; z++) {
-      for (y = ymin; y <= ymax; y++) {
-        psrc = &MRIvox(mri_src, xmin, y, z);
-        pdst = &MRIvox(mri_dst, xmin, y, z);
-        for (x = xmin; x <= xmax; x++, psrc++, pdst++) {
-          val = *psrc;
-          if ((val < threshold) || (*pdst == fill_val)) continue;
+  nfilled = MRIfloodFillFromSeed(
+      mri_src, mri_dst, seed_x, seed_y, seed_z, FLOODFILL_CONNECT_6, threshold, FLT_MAX, fill_val);
 
-          on = 0;
-          if (x > 0) on = (MRIvox(mri_dst, x - 1, y, z) == fill_val);
-          if (!on && (x < width - 1)) on = (MRIvox(mri_dst, x + 1, y, z) == fill_val);
-          if (!on && (y > 0)) on = (MRIvox(mri_dst, x, y - 1, z) == fill_val);
-          if (!on && (y < height - 1)) on = (MRIvox(mri_dst, x, y + 1, z) == fill_val);
-          if (!on && (z > 0)) on = (MRIvox(mri_dst, x, y, z - 1) == fill_val);
-          if (!on && (z < depth - 1)) on = (MRIvox(mri_dst, x, y, z + 1) == fill_val);
-          if (on) {
-            if (x <= x0) x0 = MAX(x - 1, 0);
-            if (x >= x1) x1 = MIN(x + 1, width - 1);
-            if (y <= y0) y0 = MAX(y - 1, 0);
-            if (y >= y1) y1 = MIN(y + 1, height - 1);
-            if (z <= z0) z0 = MAX(z - 1, 0);
-            if (z >= z1) z1 = MIN(z + 1, depth - 1);
-            nfilled++;
-            *pdst = fill_val;
-          }
-        }
-      }
-    }
-    zmin = z0;
-    zmax = z1;
-    ymin = y0;
-    ymax = y1;
-    xmin = x0;
-    xmax = x1;
-    total_pix += nfilled;
-    /*    fprintf(stderr, "# filled = %d\n", nfilled) ;*/
-  } while (nfilled > 0);
-
-  if (npix) *npix = total_pix;
+  if (npix) *npix = nfilled + 1; /* include the seed point */
   return (mri_dst);
 }
 /*-----------------------------------------------------
@@ -8194,33 +8135,17 @@ MRI *MRIfillFG(MRI *mri_src, MRI *mri_dst, int seed_x, int seed_y, int seed_z, i
   ------------------------------------------------------*/
 MRI *MRIfillBG(MRI *mri_src, MRI *mri_dst, int seed_x, int seed_y, int seed_z, int threshold, int fill_val, int *npix)
 {
-  int width, height, depth, x, y, z, nfilled, xmin, xmax, ymin, ymax, zmin, zmax, on, x0, x1, y0, y1, z0, z1, total_pix;
-  BUFTYPE *psrc, *pdst, val;
+  int width, height, depth, x, y, z, nfilled;
+  BUFTYPE *pdst, val;
 
   width = mri_src->width;
   height = mri_src->height;
   depth = mri_src->depth;
   if (!mri_dst) mri_dst = MRIclone(mri_src, NULL);
 
-  if (seed_x < 0)
-    seed_x = 0;
-  else if (seed_x >= width)
-    seed_x = width - 1;
-  if (seed_y < 0)
-    seed_y = 0;
-  else if (seed_y >= height)
-    seed_y = width - 1;
-  if (seed_z < 0)
-    seed_z = 0;
-  else if (seed_z >= depth)
-    seed_z = width - 1;
-
-  xmin = MAX(seed_x - 1, 0);
-  xmax = MIN(seed_x + 1, width - 1);
-  ymin = MAX(seed_y - 1, 0);
-  ymax = MIN(seed_y + 1, height - 1);
-  zmin = MAX(seed_z - 1, 0);
-  zmax = MIN(seed_z + 1, depth - 1);
+  seed_x = MAX(0, MIN(seed_x, width - 1));
+  seed_y = MAX(0, MIN(seed_y, height - 1));
+  seed_z = MAX(0, MIN(seed_z, depth - 1));
 
   /* replace all occurrences of fill_val with fill_val-1 */
   for (z = 0; z < depth; z++) {
@@ -8233,57 +8158,10 @@ MRI *MRIfillBG(MRI *mri_src, MRI *mri_dst, int seed_x, int seed_y, int seed_z, i
     }
   }
 
-  MRIvox(mri_dst, seed_x, seed_y, seed_z) = fill_val;
-  total_pix = 0;
-  do {
-    z0 = zmin;
-    z1 = zmax;
-    y0 = ymin;
-    y1 = ymax;
-    x0 = xmin;
-    x1 = xmax;
-    nfilled = 0;
-    for (z = zmin; z <= zmax; z++) {
-      for (y = ymin; y <= ymax; y++) {
-        psrc = &MRIvox(mri_src, xmin, y, z);
-        pdst = &MRIvox(mri_dst, xmin, y, z);
-        for (x = xmin; x <= xmax; x++, psrc++, pdst++) {
-          if (z == 130 && (y == 145 || y == 146) && x == 142) DiagBreak();
-          val = *psrc;
-          if ((val > threshold) || (*pdst == fill_val)) continue;
-
-          on = 0;
-          if (x > 0) on = (MRIvox(mri_dst, x - 1, y, z) == fill_val);
-          if (!on && (x < width - 1)) on = (MRIvox(mri_dst, x + 1, y, z) == fill_val);
-          if (!on && (y > 0)) on = (MRIvox(mri_dst, x, y - 1, z) == fill_val);
-          if (!on && (y < height - 1)) on = (MRIvox(mri_dst, x, y + 1, z) == fill_val);
-          if (!on && (z > 0)) on = (MRIvox(mri_dst, x, y, z - 1) == fill_val);
-          if (!on && (z < depth - 1)) on = (MRIvox(mri_dst, x, y, z + 1) == fill_val);
-          if (on) {
-            if (z == 130 && (y == 145 || y == 146) && x == 142) DiagBreak();
-            if (x <= x0) x0 = MAX(x - 1, 0);
-            if (x >= x1) x1 = MIN(x + 1, width - 1);
-            if (y <= y0) y0 = MAX(y - 1, 0);
-            if (y >= y1) y1 = MIN(y + 1, height - 1);
-            if (z <= z0) z0 = MAX(z - 1, 0);
-            if (z >= z1) z1 = MIN(z + 1, depth - 1);
-            nfilled++;
-            *pdst = fill_val;
-          }
-        }
-      }
-    }
-    zmin = z0;
-    zmax = z1;
-    ymin = y0;
-    ymax = y1;
-    xmin = x0;
-    xmax = x1;
-    total_pix += nfilled;
-    /*    fprintf(stderr, "# filled = %d\n", nfilled) ;*/
-  } while (nfilled > 0);
+  nfilled = MRIfloodFillFromSeed(
+      mri_src, mri_dst, seed_x, seed_y, seed_z, FLOODFILL_CONNECT_6, -FLT_MAX, threshold, fill_val);
 
-  if (npix) *npix = total_pix;
+  if (npix) *npix = nfilled;
   return (mri_dst);
 }
 /*-----------------------------------------------------
@@ -20,9 +20,186 @@
  *
  */
 
+#include <vector>
+
+#include "romp_support.h"
+
 #include "fastmarching.h"
 
-MRI *MRIextractDistanceMap(MRI *mri_src, MRI *mri_dst, int label, float max_distance, int mode, MRI *mri_mask)
+#define EDT_INF 1e30f
+
+/*
+  1D squared distance transform of the sampled function f (lower envelope of
+  parabolas, Felzenszwalb and Huttenlocher 2012). s2 is the squared sample
+  spacing, v and zb are scratch arrays of length n and n+1.
+*/
+static void edt1D(const float *f, float *d, int n, double s2, int *v, double *zb)
+{
+  int k = -1;
+  for (int q = 0; q < n; q++) {
+    if (f[q] >= EDT_INF) continue;
+    double fq = f[q] + s2 * q * q, s = -HUGE_VAL;
+    while (k >= 0) {
+      s = (fq - (f[v[k]] + s2 * v[k] * v[k])) / (2 * s2 * (q - v[k]));
+      if (s > zb[k]) break;
+      k--;
+      s = -HUGE_VAL;
+    }
+    k++;
+    v[k] = q;
+    zb[k] = s;
+    zb[k + 1] = HUGE_VAL;
+  }
+
+  if (k < 0) {
+    for (int p = 0; p < n; p++) d[p] = EDT_INF;
+    return;
+  }
+  for (int p = 0, j = 0; p < n; p++) {
+    while (zb[j + 1] < p) j++;
+    d[p] = s2 * (p - v[j]) * (p - v[j]) + f[v[j]];
+  }
+}
+
+/*
+  Exact squared Euclidean distance to the nearest zero of d2 (which holds 0
+  at the sources and EDT_INF elsewhere), one axis at a time. Distances are
+  in units of the x voxel size, sy and sz are the y and z voxel sizes in the
+  same units. Each pass is parallel across its scanlines.
+*/
+static void edt3D(std::vector<float> &d2, int width, int height, int depth, double sy, double sz)
+{
+  int nmax = MAX(MAX(width, height), depth);
+  int nthreads = omp_get_max_threads();
+  std::vector<std::vector<float> > f(nthreads, std::vector<float>(nmax)), d(nthreads, std::vector<float>(nmax));
+  std::vector<std::vector<int> > v(nthreads, std::vector<int>(nmax));
+  std::vector<std::vector<double> > zb(nthreads, std::vector<double>(nmax + 1));
+
+  // x lines are contiguous
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (int l = 0; l < height * depth; l++) {
+    ROMP_PFLB_begin
+    int tid = omp_get_thread_num();
+    float *line = &d2[(size_t)l * width];
+    std::copy(line, line + width, f[tid].begin());
+    edt1D(&f[tid][0], line, width, 1.0, &v[tid][0], &zb[tid][0]);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (int l = 0; l < width * depth; l++) {
+    ROMP_PFLB_begin
+    int tid = omp_get_thread_num();
+    int x = l % width, z = l / width;
+    size_t base = (size_t)z * width * height + x;
+    for (int y = 0; y < height; y++) f[tid][y] = d2[base + (size_t)y * width];
+    edt1D(&f[tid][0], &d[tid][0], height, sy * sy, &v[tid][0], &zb[tid][0]);
+    for (int y = 0; y < height; y++) d2[base + (size_t)y * width] = d[tid][y];
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (int l = 0; l < width * height; l++) {
+    ROMP_PFLB_begin
+    int tid = omp_get_thread_num();
+    size_t slice = (size_t)width * height;
+    for (int z = 0; z < depth; z++) f[tid][z] = d2[l + z * slice];
+    edt1D(&f[tid][0], &d[tid][0], depth, sz * sz, &v[tid][0], &zb[tid][0]);
+    for (int z = 0; z < depth; z++) d2[l + z * slice] = d[tid][z];
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+/*
+  Same output as the FastMarching passes below: the boundary lies halfway
+  between a label voxel and its non-label neighbor, so a voxel gets its
+  distance to the nearest voxel on the other side minus 0.5, clamped to
+  max_distance. Masked-out voxels get the limit of the last pass, but they
+  do not block the (straight-line) distances.
+*/
+static void extractDistanceMapEDT(MRI *mri_src, MRI *mri_distance, int label, float max_distance, int mode, MRI *mri_mask)
+{
+  const int outside = 1;
+  const int inside = 2;
+  const int both = 3;
+  const int bothUnsigned = 4;
+
+  int width = mri_src->width, height = mri_src->height, depth = mri_src->depth;
+  size_t nvox = (size_t)width * height * depth;
+  double sy = mri_src->ysize / mri_src->xsize, sz = mri_src->zsize / mri_src->xsize;
+
+  std::vector<unsigned char> inlabel(nvox);
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (int z = 0; z < depth; z++) {
+    ROMP_PFLB_begin
+    for (int y = 0; y < height; y++)
+      for (int x = 0; x < width; x++)
+        inlabel[((size_t)z * height + y) * width + x] =
+            (static_cast< int >(round(MRIgetVoxVal(mri_src, x, y, z, 0))) == label);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  std::vector<float> d2(nvox);
+  for (int pass = 0; pass < 2; pass++) {
+    int sign = pass == 0 ? +1 : -1;
+    if (sign > 0 && mode != outside && mode != both && mode != bothUnsigned) continue;
+    if (sign < 0 && mode != inside && mode != both && mode != bothUnsigned) continue;
+
+    // the sources are the voxels on the other side of the boundary
+    unsigned char source = sign > 0 ? 1 : 0;
+    for (size_t i = 0; i < nvox; i++) d2[i] = (inlabel[i] == source) ? 0 : EDT_INF;
+    edt3D(d2, width, height, depth, sy, sz);
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+    for (int z = 0; z < depth; z++) {
+      ROMP_PFLB_begin
+      for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++) {
+          size_t i = ((size_t)z * height + y) * width + x;
+          if (inlabel[i] == source) continue;
+          float dist = d2[i] >= EDT_INF ? max_distance : sqrt(d2[i]) - 0.5f;
+          MRIFvox(mri_distance, x, y, z) = sign * MIN(dist, max_distance);
+        }
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+  }
+
+  if (mri_mask) {
+    float limit = (mode == outside || mode == bothUnsigned) ? max_distance : -max_distance;
+    for (int z = 0; z < depth; z++)
+      for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+          if ((int)MRIgetVoxVal(mri_mask, x, y, z, 0) == 0) MRIFvox(mri_distance, x, y, z) = limit;
+  }
+
+  if (mode == bothUnsigned) {
+    for (int z = 0; z < depth; z++)
+      for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++) MRIFvox(mri_distance, x, y, z) = fabs(MRIFvox(mri_distance, x, y, z));
+  }
+}
+
+static MRI *extractDistanceMap(MRI *mri_src, MRI *mri_dst, int label, float max_distance, int mode, MRI *mri_mask, bool edt)
 {
   MRI *mri_distance = NULL;
 
@@ -89,6 +266,11 @@ MRI *MRIextractDistanceMap(MRI *mri_src, MRI *mri_dst, int label, float max_dist
     // positive inside and positive outside
     const int bothUnsigned = 4;
 
+    if (edt) {
+      extractDistanceMapEDT(mri_src, mri_distance, label, max_distance, mode, mri_mask);
+      return mri_distance;
+    }
+
     if (mode == outside || mode == both || mode == bothUnsigned) {
       FastMarching< +1 > fastmarching_out(mri_distance, mri_mask);
       fastmarching_out.SetLimit(max_distance);
@@ -114,3 +296,15 @@ MRI *MRIextractDistanceMap(MRI *mri_src, MRI *mri_dst, int label, float max_dist
 
   return mri_distance;
 }
+
+MRI *MRIextractDistanceMap(MRI *mri_src, MRI *mri_dst, int label, float max_distance, int mode, MRI *mri_mask)
+{
+  static int use_edt = -1;
+  if (use_edt < 0) use_edt = (getenv("FS_DTRANS_EDT") != NULL);
+  return (extractDistanceMap(mri_src, mri_dst, label, max_distance, mode, mri_mask, use_edt));
+}
+
+MRI *MRIextractDistanceMapEDT(MRI *mri_src, MRI *mri_dst, int label, float max_distance, int mode, MRI *mri_mask)
+{
+  return (extractDistanceMap(mri_src, mri_dst, label, max_distance, mode, mri_mask, true));
+}
@@ -25,6 +25,7 @@
 #include "fsenv.h"
 #include "macros.h"
 #include "mri.h"
+#include "mrifloodfill.h"
 #include "mrisurf.h"
 #include "mrisurf_metricProperties.h"
 #include "region.h"
@@ -252,7 +253,7 @@ MRI *MRISshell(MRI *mri_src, MRI_SURFACE *mris, MRI *mri_dst, int clearflag)
 // mri_src is just a dummy
 MRI *MRISfloodoutside(MRI *mri_src, MRI *mri_dst)
 {
-  int newfilled, width, height, depth, i, j, k, v1, v2, v3;
+  int width, height, depth;
 
   mri_dst = MRIcopy(mri_src, mri_dst);
 
@@ -301,131 +302,8 @@ newfilled++;
   MRIsetVoxVal(mri_dst, 0, height - 1, depth - 1, 0, FILL_VAL);
   MRIsetVoxVal(mri_dst, width - 1, height - 1, depth - 1, 0, FILL_VAL);
 
-  newfilled = 1;
-  while (newfilled > 0) {
-    newfilled = 0;
-
-    /* corner: 0 0 0 */
-    for (i = 0; i < width; i++)
-      for (j = 0; j < height; j++)
-        for (k = 0; k < depth; k++) {
-          if ((int)MRIgetVoxVal(mri_dst, i, j, k, 0) == 0) {
-            v1 = (int)MRIgetVoxVal(mri_dst, i - 1 + ((i == 0) ? 1 : 0), j, k, 0);
-            v2 = (int)MRIgetVoxVal(mri_dst, i, j - 1 + ((j == 0) ? 1 : 0), k, 0);
-            v3 = (int)MRIgetVoxVal(mri_dst, i, j, k - 1 + ((k == 0) ? 1 : 0), 0);
-            if (v1 == FILL_VAL || v2 == FILL_VAL || v3 == FILL_VAL) {
-              if (i == Gx && j == Gy && k == Gz) DiagBreak();
-              MRIsetVoxVal(mri_dst, i, j, k, 0, FILL_VAL);
-              newfilled++;
-            }
-          }
-        }
-    /* corner: w 0 0 */
-    for (i = width - 1; i >= 0; i--)
-      for (j = 0; j < height; j++)
-        for (k = 0; k < depth; k++) {
-          if ((int)MRIgetVoxVal(mri_dst, i, j, k, 0) == 0) {
-            v1 = (int)MRIgetVoxVal(mri_dst, i + 1 - ((i == width - 1) ? 1 : 0), j, k, 0);
-            v2 = (int)MRIgetVoxVal(mri_dst, i, j - 1 + ((j == 0) ? 1 : 0), k, 0);
-            v3 = (int)MRIgetVoxVal(mri_dst, i, j, k - 1 + ((k == 0) ? 1 : 0), 0);
-            if (v1 == FILL_VAL || v2 == FILL_VAL || v3 == FILL_VAL) {
-              if (i == Gx && j == Gy && k == Gz) DiagBreak();
-              MRIsetVoxVal(mri_dst, i, j, k, 0, FILL_VAL);
-              newfilled++;
-            }
-          }
-        }
-    /* corner: 0 h 0 */
-    for (i = 0; i < width; i++)
-      for (j = height - 1; j >= 0; j--)
-        for (k = 0; k < depth; k++) {
-          if ((int)MRIgetVoxVal(mri_dst, i, j, k, 0) == 0) {
-            v1 = (int)MRIgetVoxVal(mri_dst, i - 1 + ((i == 0) ? 1 : 0), j, k, 0);
-            v2 = (int)MRIgetVoxVal(mri_dst, i, j + 1 - ((j == height - 1) ? 1 : 0), k, 0);
-            v3 = (int)MRIgetVoxVal(mri_dst, i, j, k - 1 + ((k == 0) ? 1 : 0), 0);
-            if (v1 == FILL_VAL || v2 == FILL_VAL || v3 == FILL_VAL) {
-              if (i == Gx && j == Gy && k == Gz) DiagBreak();
-              MRIsetVoxVal(mri_dst, i, j, k, 0, FILL_VAL);
-              newfilled++;
-            }
-          }
-        }
-    /* corner: 0 0 d */
-    for (i = 0; i < width; i++)
-      for (j = 0; j < height; j++)
-        for (k = depth - 1; k >= 0; k--) {
-          if ((int)MRIgetVoxVal(mri_dst, i, j, k, 0) == 0) {
-            v1 = (int)MRIgetVoxVal(mri_dst, i - 1 + ((i == 0) ? 1 : 0), j, k, 0);
-            v2 = (int)MRIgetVoxVal(mri_dst, i, j - 1 + ((j == 0) ? 1 : 0), k, 0);
-            v3 = (int)MRIgetVoxVal(mri_dst, i, j, k + 1 - ((k == depth - 1) ? 1 : 0), 0);
-            if (v1 == FILL_VAL || v2 == FILL_VAL || v3 == FILL_VAL) {
-              if (i == Gx && j == Gy && k == Gz) DiagBreak();
-              MRIsetVoxVal(mri_dst, i, j, k, 0, FILL_VAL);
-              newfilled++;
-            }
-          }
-        }
-    /* corner: w h 0 */
-    for (i = width - 1; i >= 0; i--)
-      for (j = height - 1; j >= 0; j--)
-        for (k = 0; k < depth; k++) {
-          if ((int)MRIgetVoxVal(mri_dst, i, j, k, 0) == 0) {
-            v1 = (int)MRIgetVoxVal(mri_dst, i + 1 - ((i == width - 1) ? 1 : 0), j, k, 0);
-            v2 = (int)MRIgetVoxVal(mri_dst, i, j + 1 - ((j == height - 1) ? 1 : 0), k, 0);
-            v3 = (int)MRIgetVoxVal(mri_dst, i, j, k - 1 + ((k == 0) ? 1 : 0), 0);
-            if (v1 == FILL_VAL || v2 == FILL_VAL || v3 == FILL_VAL) {
-              if (i == Gx && j == Gy && k == Gz) DiagBreak();
-              MRIsetVoxVal(mri_dst, i, j, k, 0, FILL_VAL);
-              newfilled++;
-            }
-          }
-        }
-    /* corner: w 0 d */
-    for (i = width - 1; i >= 0; i--)
-      for (j = 0; j < height; j++)
-        for (k = depth - 1; k >= 0; k--) {
-          if ((int)MRIgetVoxVal(mri_dst, i, j, k, 0) == 0) {
-            v1 = (int)MRIgetVoxVal(mri_dst, i + 1 - ((i == width - 1) ? 1 : 0), j, k, 0);
-            v2 = (int)MRIgetVoxVal(mri_dst, i, j - 1 + ((j == 0) ? 1 : 0), k, 0);
-            v3 = (int)MRIgetVoxVal(mri_dst, i, j, k + 1 - ((k == depth - 1) ? 1 : 0), 0);
-            if (v1 == FILL_VAL || v2 == FILL_VAL || v3 == FILL_VAL) {
-              if (i == Gx && j == Gy && k == Gz) DiagBreak();
-              MRIsetVoxVal(mri_dst, i, j, k, 0, FILL_VAL);
-              newfilled++;
-            }
-          }
-        }
-    /* corner: 0 h d */
-    for (i = 0; i < width; i++)
-      for (j = height - 1; j >= 0; j--)
-        for (k = depth - 1; k >= 0; k--) {
-          if ((int)MRIgetVoxVal(mri_dst, i, j, k, 0) == 0) {
-            v1 = (int)MRIgetVoxVal(mri_dst, i - 1 + ((i == 0) ? 1 : 0), j, k, 0);
-            v2 = (int)MRIgetVoxVal(mri_dst, i, j + 1 - ((j == height - 1) ? 1 : 0), k, 0);
-            v3 = (int)MRIgetVoxVal(mri_dst, i, j, k + 1 - ((k == depth - 1) ? 1 : 0), 0);
-            if (v1 == FILL_VAL || v2 == FILL_VAL || v3 == FILL_VAL) {
-              if (i == Gx && j == Gy && k == Gz) DiagBreak();
-              MRIsetVoxVal(mri_dst, i, j, k, 0, FILL_VAL);
-              newfilled++;
-            }
-          }
-        }
-    /* corner: w h d */
-    for (i = width - 1; i >= 0; i--)
-      for (j = height - 1; j >= 0; j--)
-        for (k = depth - 1; k >= 0; k--) {
-          if ((int)MRIgetVoxVal(mri_dst, i, j, k, 0) == 0) {
-            v1 = (int)MRIgetVoxVal(mri_dst, i + 1 - ((i == width - 1) ? 1 : 0), j, k, 0);
-            v2 = (int)MRIgetVoxVal(mri_dst, i, j + 1 - ((j == height - 1) ? 1 : 0), k, 0);
-            v3 = (int)MRIgetVoxVal(mri_dst, i, j, k + 1 - ((k == depth - 1) ? 1 : 0), 0);
-            if (v1 == FILL_VAL || v2 == FILL_VAL || v3 == FILL_VAL) {
-              if (i == Gx && j == Gy && k == Gz) DiagBreak();
-              MRIsetVoxVal(mri_dst, i, j, k, 0, FILL_VAL);
-              newfilled++;
-            }
-          }
-        }
-  }
+  /* grow the corners (and anything already filled) through the 0 voxels */
+  MRIfloodFill(mri_dst, mri_dst, FLOODFILL_CONNECT_6, 0, 0, FILL_VAL);
 
   return mri_dst;
 }
@@ -0,0 +1,298 @@
+/**
+ * @brief queue-based and parallel flood-fill primitives
+ *
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <algorithm>
+#include <functional>
+
+#include "diag.h"
+#include "error.h"
+#include "macros.h"
+#include "romp_support.h"
+
+#include "mrifloodfill.h"
+
+typedef struct
+{
+  int dx, dy, dz;
+} FLOOD_OFFSET;
+
+// neighbor offsets for the given connectivity, returns the number of them
+static int floodFillOffsets(int connectivity, FLOOD_OFFSET *offsets)
+{
+  int maxdist, n = 0;
+
+  switch (connectivity) {
+    case FLOODFILL_CONNECT_6:
+      maxdist = 1;
+      break;
+    case FLOODFILL_CONNECT_18:
+      maxdist = 2;
+      break;
+    case FLOODFILL_CONNECT_26:
+      maxdist = 3;
+      break;
+    default:
+      ErrorExit(ERROR_BADPARM, "flood fill: unsupported connectivity %d", connectivity);
+  }
+
+  for (int dz = -1; dz <= 1; dz++)
+    for (int dy = -1; dy <= 1; dy++)
+      for (int dx = -1; dx <= 1; dx++) {
+        int dist = abs(dx) + abs(dy) + abs(dz);
+        if (dist == 0 || dist > maxdist) continue;
+        offsets[n].dx = dx;
+        offsets[n].dy = dy;
+        offsets[n].dz = dz;
+        n++;
+      }
+  return (n);
+}
+
+/*
+  breadth-first fill from the voxels in 'queue', which must already be set
+  to fill_val in mri_dst. Each voxel is set as soon as it is queued, so it
+  is examined at most once per neighbor.
+*/
+static int floodFillQueue(MRI *mri_src, MRI *mri_dst, std::vector<size_t> &queue,
+                          int connectivity, float low, float high, float fill_val)
+{
+  FLOOD_OFFSET offsets[26];
+  int noffsets = floodFillOffsets(connectivity, offsets);
+  int width = mri_dst->width, height = mri_dst->height, depth = mri_dst->depth;
+  size_t nseeds = queue.size();
+
+  for (size_t head = 0; head < queue.size(); head++) {
+    size_t index = queue[head];
+    int x = index % width;
+    int y = (index / width) % height;
+    int z = index / ((size_t)width * height);
+
+    for (int n = 0; n < noffsets; n++) {
+      int xn = x + offsets[n].dx, yn = y + offsets[n].dy, zn = z + offsets[n].dz;
+      if (xn < 0 || xn >= width || yn < 0 || yn >= height || zn < 0 || zn >= depth) continue;
+      if (MRIgetVoxVal(mri_dst, xn, yn, zn, 0) == fill_val) continue;
+      float val = MRIgetVoxVal(mri_src, xn, yn, zn, 0);
+      if (val < low || val > high) continue;
+      if (xn == Gx && yn == Gy && zn == Gz) DiagBreak();
+      MRIsetVoxVal(mri_dst, xn, yn, zn, 0, fill_val);
+      queue.push_back(((size_t)zn * height + yn) * width + xn);
+    }
+  }
+
+  return (queue.size() - nseeds);
+}
+
+int MRIfloodFill(MRI *mri_src, MRI *mri_dst, int connectivity, float low, float high, float fill_val)
+{
+  std::vector<size_t> queue;
+
+  if (!MRIcheckSize(mri_src, mri_dst, 0, 0, 0))
+    ErrorReturn(0, (ERROR_BADPARM, "MRIfloodFill: volume dimensions do not match"));
+  for (int z = 0; z < mri_dst->depth; z++)
+    for (int y = 0; y < mri_dst->height; y++)
+      for (int x = 0; x < mri_dst->width; x++)
+        if (MRIgetVoxVal(mri_dst, x, y, z, 0) == fill_val)
+          queue.push_back(((size_t)z * mri_dst->height + y) * mri_dst->width + x);
+
+  return (floodFillQueue(mri_src, mri_dst, queue, connectivity, low, high, fill_val));
+}
+
+int MRIfloodFillFromSeed(MRI *mri_src, MRI *mri_dst, int x, int y, int z,
+                         int connectivity, float low, float high, float fill_val)
+{
+  std::vector<size_t> queue;
+
+  if (!MRIcheckSize(mri_src, mri_dst, 0, 0, 0))
+    ErrorReturn(0, (ERROR_BADPARM, "MRIfloodFillFromSeed: volume dimensions do not match"));
+  if (x < 0 || x >= mri_dst->width || y < 0 || y >= mri_dst->height || z < 0 || z >= mri_dst->depth)
+    ErrorReturn(0, (ERROR_BADPARM, "MRIfloodFillFromSeed: seed (%d, %d, %d) out of bounds", x, y, z));
+
+  MRIsetVoxVal(mri_dst, x, y, z, 0, fill_val);
+  queue.push_back(((size_t)z * mri_dst->height + y) * mri_dst->width + x);
+  return (floodFillQueue(mri_src, mri_dst, queue, connectivity, low, high, fill_val));
+}
+
+int MRIfloodFillLabels(MRI *mri_src, MRI *mri_labels, int connectivity, float low, float high)
+{
+  FLOOD_OFFSET offsets[26];
+  int noffsets = floodFillOffsets(connectivity, offsets);
+  int width = mri_labels->width, height = mri_labels->height, depth = mri_labels->depth;
+  std::vector<size_t> frontier, wave;
+  std::vector<float> wave_labels;
+  int nfilled = 0;
+
+  if (!MRIcheckSize(mri_src, mri_labels, 0, 0, 0))
+    ErrorReturn(0, (ERROR_BADPARM, "MRIfloodFillLabels: volume dimensions do not match"));
+
+  // only seeds on the border of their label can reach anything
+  for (int z = 0; z < depth; z++)
+    for (int y = 0; y < height; y++)
+      for (int x = 0; x < width; x++) {
+        if (MRIgetVoxVal(mri_labels, x, y, z, 0) == 0) continue;
+        for (int n = 0; n < noffsets; n++) {
+          int xn = x + offsets[n].dx, yn = y + offsets[n].dy, zn = z + offsets[n].dz;
+          if (xn < 0 || xn >= width || yn < 0 || yn >= height || zn < 0 || zn >= depth) continue;
+          if (MRIgetVoxVal(mri_labels, xn, yn, zn, 0) == 0) {
+            frontier.push_back(((size_t)z * height + y) * width + x);
+            break;
+          }
+        }
+      }
+
+  std::vector<std::vector<size_t> > found(omp_get_max_threads());
+  while (frontier.size() > 0) {
+    // collect the unlabeled in-range neighbors of the current wave
+    for (unsigned int t = 0; t < found.size(); t++) found[t].clear();
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+    for (long i = 0; i < (long)frontier.size(); i++) {
+      ROMP_PFLB_begin
+      std::vector<size_t> &mine = found[omp_get_thread_num()];
+      size_t index = frontier[i];
+      int x = index % width;
+      int y = (index / width) % height;
+      int z = index / ((size_t)width * height);
+      for (int n = 0; n < noffsets; n++) {
+        int xn = x + offsets[n].dx, yn = y + offsets[n].dy, zn = z + offsets[n].dz;
+        if (xn < 0 || xn >= width || yn < 0 || yn >= height || zn < 0 || zn >= depth) continue;
+        if (MRIgetVoxVal(mri_labels, xn, yn, zn, 0) != 0) continue;
+        float val = MRIgetVoxVal(mri_src, xn, yn, zn, 0);
+        if (val < low || val > high) continue;
+        mine.push_back(((size_t)zn * height + yn) * width + xn);
+      }
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    wave.clear();
+    for (unsigned int t = 0; t < found.size(); t++) wave.insert(wave.end(), found[t].begin(), found[t].end());
+    std::sort(wave.begin(), wave.end());
+    wave.erase(std::unique(wave.begin(), wave.end()), wave.end());
+
+    // every labeled neighbor was labeled in an earlier wave, so this is order independent
+    wave_labels.resize(wave.size());
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+    for (long i = 0; i < (long)wave.size(); i++) {
+      ROMP_PFLB_begin
+      size_t index = wave[i];
+      int x = index % width;
+      int y = (index / width) % height;
+      int z = index / ((size_t)width * height);
+      float label = 0;
+      for (int n = 0; n < noffsets; n++) {
+        int xn = x + offsets[n].dx, yn = y + offsets[n].dy, zn = z + offsets[n].dz;
+        if (xn < 0 || xn >= width || yn < 0 || yn >= height || zn < 0 || zn >= depth) continue;
+        float nlabel = MRIgetVoxVal(mri_labels, xn, yn, zn, 0);
+        if (nlabel != 0 && (label == 0 || nlabel > label)) label = nlabel;
+      }
+      wave_labels[i] = label;
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    for (size_t i = 0; i < wave.size(); i++) {
+      size_t index = wave[i];
+      MRIsetVoxVal(mri_labels, index % width, (index / width) % height, index / ((size_t)width * height), 0,
+                   wave_labels[i]);
+    }
+    nfilled += wave.size();
+    frontier.swap(wave);
+  }
+
+  return (nfilled);
+}
+
+MRIrasterWorklist::MRIrasterWorklist(const MRI *mri)
+    : width(mri->width), height(mri->height), depth(mri->depth), dir(1), cursor(0), started(false)
+{
+  queued.assign((size_t)width * height * depth, 0);
+}
+
+#define QUEUED_CURRENT 0x01
+#define QUEUED_NEXT    0x02
+
+void MRIrasterWorklist::begin(int sweep_dir)
+{
+  dir = sweep_dir;
+  started = false;
+  heap.clear();
+  for (size_t i = 0; i < deferred.size(); i++) {
+    size_t index = deferred[i];
+    queued[index] &= ~QUEUED_NEXT;
+    if (!(queued[index] & QUEUED_CURRENT)) {
+      queued[index] |= QUEUED_CURRENT;
+      heap.push_back(index);
+    }
+  }
+  deferred.clear();
+  if (dir > 0)
+    std::make_heap(heap.begin(), heap.end(), std::greater<size_t>());
+  else
+    std::make_heap(heap.begin(), heap.end(), std::less<size_t>());
+}
+
+bool MRIrasterWorklist::next(int *px, int *py, int *pz)
+{
+  if (heap.empty()) return (false);
+
+  if (dir > 0)
+    std::pop_heap(heap.begin(), heap.end(), std::greater<size_t>());
+  else
+    std::pop_heap(heap.begin(), heap.end(), std::less<size_t>());
+  cursor = heap.back();
+  heap.pop_back();
+  queued[cursor] &= ~QUEUED_CURRENT;
+  started = true;
+
+  *px = cursor % width;
+  *py = (cursor / width) % height;
+  *pz = cursor / ((size_t)width * height);
+  return (true);
+}
+
+void MRIrasterWorklist::schedule(int x, int y, int z)
+{
+  if (x < 0 || x >= width || y < 0 || y >= height || z < 0 || z >= depth) return;
+
+  size_t index = this->index(x, y, z);
+  if (started && !before(cursor, index)) {
+    defer(x, y, z);
+    return;
+  }
+  if (queued[index] & QUEUED_CURRENT) return;
+  queued[index] |= QUEUED_CURRENT;
+  heap.push_back(index);
+  if (dir > 0)
+    std::push_heap(heap.begin(), heap.end(), std::greater<size_t>());
+  else
+    std::push_heap(heap.begin(), heap.end(), std::less<size_t>());
+}
+
+void MRIrasterWorklist::defer(int x, int y, int z)
+{
+  if (x < 0 || x >= width || y < 0 || y >= height || z < 0 || z >= depth) return;
+
+  size_t index = this->index(x, y, z);
+  if (queued[index] & QUEUED_NEXT) return;
+  queued[index] |= QUEUED_NEXT;
+  deferred.push_back(index);
+}
@@ -24,6 +24,8 @@
 #include <sys/utsname.h>
 #include <unistd.h>
 
+#include <vector>
+
 #include "cmdargs.h"
 #include "diag.h"
 #include "error.h"
@@ -32,6 +34,7 @@
 #include "mris_compVolFrac.h"
 #include "mrisurf.h"
 #include "mrisurf_metricProperties.h"
+#include "romp_support.h"
 #include "utils.h"
 #include "version.h"
 
@@ -40,8 +43,7 @@ MRI *MRIcomputeVolumeFractionFromSurface(MRI_SURFACE *mris, double acc, MRI *mri
   const int width = mri_src->width;
   const int height = mri_src->height;
   const int depth = mri_src->depth;
-  int x, y, z, vno;
-  double xs, ys, zs, dist;
+  int x, y, z;
   MRIS_HASH_TABLE *mht;
 
   /* preparing the output */
@@ -55,44 +57,69 @@ MRI *MRIcomputeVolumeFractionFromSurface(MRI_SURFACE *mris, double acc, MRI *mri
   printf("computing the shell\n");
   mri_shell = MRIclone(mri_src, NULL);
   mri_shell = MRISshell(mri_src, mris, mri_shell, 1);
-  /* creating an interior image from the surface */
+  /* classifying the voxels off the shell by the parity of the surface crossings along each row */
   printf("computing an interior image\n");
   mri_interior = MRIclone(mri_src, NULL);
-  MRIclear(mri_interior);
-  mri_interior = MRISfillInterior(mris, 0.0, mri_interior);
-  /* creating the hash table related to the surface vertices */
+  MRISfillInteriorScanline(mris, mri_interior);
+  /* creating the hash table related to the surface vertices, lock-free so it can be shared by threads */
   printf("computing the hash table\n");
-  mht = MHTcreateVertexTable_Resolution(mris, CURRENT_VERTICES, 10);
-  /* looping over the nonzero elements of the shell */
+  mht = MHTcreateVertexTableGrid_Resolution(mris, CURRENT_VERTICES, 10);
+  /* only the voxels the surface crosses need the oct tree */
   printf("computing the fractions\n");
-  volFraction frac;
-  octTreeVoxel V;
-  double vox[3], vsize[3];
-  vsize[0] = mri_src->xsize;
-  vsize[1] = mri_src->ysize;
-  vsize[2] = mri_src->zsize;
-  for (x = 0; x < width; x++) {
+  std::vector<int> shell;
+  for (z = 0; z < depth; z++) {
     for (y = 0; y < height; y++) {
-      for (z = 0; z < depth; z++) {
-        if (MRIgetVoxVal(mri_shell, x, y, z, 0) > 125.0) {
-          /* change of coordinates from image to surface domain */
-          MRIvoxelToSurfaceRAS(mri_shell, x, y, z, &xs, &ys, &zs);
-          /* find the closest vertex to the point */
-          MHTfindClosestVertexGeneric(mht, xs, ys, zs, 10, 2, &vno, &dist);
-          /* creating the oct tree voxel structure */
-          vox[0] = xs - vsize[0] / 2.0;
-          vox[1] = ys - vsize[1] / 2.0;
-          vox[2] = zs - vsize[2] / 2.0;
-          V = octTreeVoxelCreate(vox, vsize);
-          /* compute the volume fraction of this voxel */
-          frac = MRIcomputeVoxelFractions(V, vno, acc, 1, mris);
-          MRIsetVoxVal(mri_fractions, x, y, z, 0, frac.frac);
-        }
+      for (x = 0; x < width; x++) {
+        if (MRIgetVoxVal(mri_shell, x, y, z, 0) > 125.0)
+          shell.push_back((z * height + y) * width + x);
         else if (MRIgetVoxVal(mri_interior, x, y, z, 0) > 0.0)
           MRIsetVoxVal(mri_fractions, x, y, z, 0, 1.0);
       }
     }
   }
+  /* resolve any deferred face normals now, so the threads only read them */
+  for (int fno = 0; fno < mris->nfaces; fno++) getFaceNorm(mris, fno);
+  MATRIX *m_vox2sras = surfaceRASFromVoxel_(mri_shell);
+  double vsize[3];
+  vsize[0] = mri_src->xsize;
+  vsize[1] = mri_src->ysize;
+  vsize[2] = mri_src->zsize;
+  /* the threads only read the grid table, so it is used outside MHT_maybeParallel and never locked */
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 16)
+#endif
+  for (int i = 0; i < (int)shell.size(); i++) {
+    ROMP_PFLB_begin
+    int const xv = shell[i] % width, yv = (shell[i] / width) % height, zv = shell[i] / (width * height);
+    /* change of coordinates from image to surface domain */
+    double const xs = *MATRIX_RELT(m_vox2sras, 1, 1) * xv + *MATRIX_RELT(m_vox2sras, 1, 2) * yv +
+                      *MATRIX_RELT(m_vox2sras, 1, 3) * zv + *MATRIX_RELT(m_vox2sras, 1, 4);
+    double const ys = *MATRIX_RELT(m_vox2sras, 2, 1) * xv + *MATRIX_RELT(m_vox2sras, 2, 2) * yv +
+                      *MATRIX_RELT(m_vox2sras, 2, 3) * zv + *MATRIX_RELT(m_vox2sras, 2, 4);
+    double const zs = *MATRIX_RELT(m_vox2sras, 3, 1) * xv + *MATRIX_RELT(m_vox2sras, 3, 2) * yv +
+                      *MATRIX_RELT(m_vox2sras, 3, 3) * zv + *MATRIX_RELT(m_vox2sras, 3, 4);
+    /* find the closest vertex to the point */
+    int vno;
+    double dist;
+    MHTfindClosestVertexGeneric(mht, xs, ys, zs, 10, 2, &vno, &dist);
+    /* creating the oct tree voxel structure */
+    double vox[3];
+    vox[0] = xs - vsize[0] / 2.0;
+    vox[1] = ys - vsize[1] / 2.0;
+    vox[2] = zs - vsize[2] / 2.0;
+    octTreeVoxel V = octTreeVoxelCreate(vox, vsize);
+    /* compute the volume fraction of this voxel */
+    volFraction frac = MRIcomputeVoxelFractions(V, vno, acc, 1, mris);
+    MRIsetVoxVal(mri_fractions, xv, yv, zv, 0, frac.frac);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  MatrixFree(&m_vox2sras);
+  MHTfree(&mht);
+  MRIfree(&mri_shell);
+  MRIfree(&mri_interior);
   return mri_fractions;
 }
 volFraction MRIcomputeVoxelFractions(octTreeVoxel V, int vno, double acc, int current_depth, MRI_SURFACE *mris)
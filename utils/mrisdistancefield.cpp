@@ -0,0 +1,346 @@
+/**
+ * @brief scanline-parity interior and narrow-band distance field of a surface
+ *
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "diag.h"
+#include "error.h"
+#include "macros.h"
+#include "romp_support.h"
+
+#include "MRISdistancefield.h"
+
+// edge length of the voxel bricks faces are binned into
+#define SDF_BRICK 8
+
+typedef struct
+{
+  int minc[3], maxc[3];  // inclusive voxel range, empty if minc > maxc
+} SDF_RANGE;
+
+// which side of the (y,z) projection of the edge va->vb the point is on,
+// evaluated in a fixed vertex order so both faces sharing the edge agree
+static int sdfEdgeSide(const float *vy, const float *vz, int va, int vb, double py, double pz)
+{
+  int sense = 1;
+  if (va > vb) {
+    std::swap(va, vb);
+    sense = -1;
+  }
+  double w = ((double)vy[vb] - vy[va]) * (pz - vz[va]) - ((double)vz[vb] - vz[va]) * (py - vy[va]);
+  return (w > 0 ? sense : -sense);
+}
+
+/*
+  Marks the voxel centers of a width x height x depth grid that are inside
+  the surface, given its vertex positions (vx,vy,vz) in voxel coordinates.
+  A voxel is inside if an odd number of surface crossings lie before it on
+  its x scanline, so the surface has to be closed. Each scanline only
+  visits the faces whose (y,z) projection covers it.
+*/
+static void sdfScanlineInterior(MRIS *mris, const float *vx, const float *vy, const float *vz,
+                                int width, int height, int depth, unsigned char *inside)
+{
+  // the scanlines each face's (y,z) projection covers
+  int const nrows = height * depth;
+  std::vector<SDF_RANGE> cover(mris->nfaces);
+  for (int fno = 0; fno < mris->nfaces; fno++) {
+    FACE const *face = &mris->faces[fno];
+    float const ylo = std::min(std::min(vy[face->v[0]], vy[face->v[1]]), vy[face->v[2]]);
+    float const yhi = std::max(std::max(vy[face->v[0]], vy[face->v[1]]), vy[face->v[2]]);
+    float const zlo = std::min(std::min(vz[face->v[0]], vz[face->v[1]]), vz[face->v[2]]);
+    float const zhi = std::max(std::max(vz[face->v[0]], vz[face->v[1]]), vz[face->v[2]]);
+    cover[fno].minc[1] = std::max(0, (int)ceil(ylo));
+    cover[fno].maxc[1] = std::min(height - 1, (int)floor(yhi));
+    cover[fno].minc[2] = std::max(0, (int)ceil(zlo));
+    cover[fno].maxc[2] = std::min(depth - 1, (int)floor(zhi));
+  }
+
+  // bin the faces by scanline, compressed by row
+  std::vector<int> row_start(nrows + 1, 0), row_faces;
+  for (int pass = 0; pass < 2; pass++) {
+    std::vector<int> fill;
+    if (pass == 1) {
+      for (int r = 0; r < nrows; r++) row_start[r + 1] += row_start[r];
+      row_faces.resize(row_start[nrows]);
+      fill.assign(row_start.begin(), row_start.end() - 1);
+    }
+    for (int fno = 0; fno < mris->nfaces; fno++) {
+      SDF_RANGE const &c = cover[fno];
+      for (int z = c.minc[2]; z <= c.maxc[2]; z++)
+        for (int y = c.minc[1]; y <= c.maxc[1]; y++) {
+          int r = z * height + y;
+          if (pass == 0)
+            row_start[r + 1]++;
+          else
+            row_faces[fill[r]++] = fno;
+        }
+    }
+  }
+
+  std::vector<std::vector<double> > crossings(omp_get_max_threads());
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 64)
+#endif
+  for (int r = 0; r < nrows; r++) {
+    ROMP_PFLB_begin
+    double const py = r % height, pz = r / height;
+    std::vector<double> &xs = crossings[omp_get_thread_num()];
+    xs.clear();
+    for (int n = row_start[r]; n < row_start[r + 1]; n++) {
+      FACE const *face = &mris->faces[row_faces[n]];
+      int const a = face->v[0], b = face->v[1], c = face->v[2];
+      int s0 = sdfEdgeSide(vy, vz, a, b, py, pz);
+      int s1 = sdfEdgeSide(vy, vz, b, c, py, pz);
+      int s2 = sdfEdgeSide(vy, vz, c, a, py, pz);
+      if (s0 != s1 || s1 != s2) continue;
+
+      double const by = (double)vy[b] - vy[a], bz = (double)vz[b] - vz[a];
+      double const cy = (double)vy[c] - vy[a], cz = (double)vz[c] - vz[a];
+      double const det = by * cz - bz * cy;
+      if (det == 0) continue;
+      double const u = ((py - vy[a]) * cz - (pz - vz[a]) * cy) / det;
+      double const v = (by * (pz - vz[a]) - bz * (py - vy[a])) / det;
+      xs.push_back(vx[a] + u * ((double)vx[b] - vx[a]) + v * ((double)vx[c] - vx[a]));
+    }
+    std::sort(xs.begin(), xs.end());
+
+    unsigned int ncross = 0;
+    unsigned char *row = inside + (size_t)r * width;
+    for (int x = 0; x < width; x++) {
+      while (ncross < xs.size() && xs[ncross] < x) ncross++;
+      row[x] = ncross & 1;
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+/*
+  Distance from every voxel of mri_dist (which must be MRI_FLOAT) to the
+  surface, whose vertices must already be in the voxel coordinates of
+  mri_dist (see Math::ConvertSurfaceRASToVoxel). Only voxels within
+  max_distance of a face get an exact point-to-triangle distance, all others
+  are set to max_distance. If signedfield is nonzero, voxels inside the
+  surface are positive and voxels outside are negative, as decided by the
+  parity of the surface crossings along each x scanline, so the surface has
+  to be closed.
+
+  Faces are binned into SDF_BRICK^3 voxel bricks by their bounding box
+  grown by max_distance, and the bricks are processed in parallel. Each
+  voxel is written by exactly one brick and one scanline, so the result
+  does not depend on the number of threads.
+*/
+MRI *MRISdistancefield(MRIS *mris, MRI *mri_dist, double max_distance, int signedfield)
+{
+  if (mri_dist->type != MRI_FLOAT)
+    ErrorReturn(NULL, (ERROR_UNSUPPORTED, "MRISdistancefield: output volume must be MRI_FLOAT"));
+
+  int const width = mri_dist->width, height = mri_dist->height, depth = mri_dist->depth;
+  int const dims[3] = {width, height, depth};
+  int const nbricks[3] = {(width + SDF_BRICK - 1) / SDF_BRICK,
+                          (height + SDF_BRICK - 1) / SDF_BRICK,
+                          (depth + SDF_BRICK - 1) / SDF_BRICK};
+
+  // voxels each face can reach
+  std::vector<SDF_RANGE> reach(mris->nfaces);
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (int fno = 0; fno < mris->nfaces; fno++) {
+    ROMP_PFLB_begin
+    FACE const *face = &mris->faces[fno];
+    double minc[3], maxc[3];
+    for (int d = 0; d < 3; d++) {
+      minc[d] = 1e30;
+      maxc[d] = -1e30;
+    }
+    for (int n = 0; n < 3; n++) {
+      VERTEX const *v = &mris->vertices[face->v[n]];
+      double const c[3] = {v->x, v->y, v->z};
+      for (int d = 0; d < 3; d++) {
+        minc[d] = std::min(minc[d], c[d]);
+        maxc[d] = std::max(maxc[d], c[d]);
+      }
+    }
+    for (int d = 0; d < 3; d++) {
+      reach[fno].minc[d] = std::max(0, (int)ceil(minc[d] - max_distance));
+      reach[fno].maxc[d] = std::min(dims[d] - 1, (int)floor(maxc[d] + max_distance));
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  // bin the faces into bricks, compressed by brick
+  int const nbrick = nbricks[0] * nbricks[1] * nbricks[2];
+  std::vector<int> brick_start(nbrick + 1, 0), brick_faces;
+  for (int pass = 0; pass < 2; pass++) {
+    std::vector<int> fill;
+    if (pass == 1) {
+      for (int b = 0; b < nbrick; b++) brick_start[b + 1] += brick_start[b];
+      brick_faces.resize(brick_start[nbrick]);
+      fill.assign(brick_start.begin(), brick_start.end() - 1);
+    }
+    for (int fno = 0; fno < mris->nfaces; fno++) {
+      SDF_RANGE const &r = reach[fno];
+      if (r.minc[0] > r.maxc[0] || r.minc[1] > r.maxc[1] || r.minc[2] > r.maxc[2]) continue;
+      for (int bz = r.minc[2] / SDF_BRICK; bz <= r.maxc[2] / SDF_BRICK; bz++)
+        for (int by = r.minc[1] / SDF_BRICK; by <= r.maxc[1] / SDF_BRICK; by++)
+          for (int bx = r.minc[0] / SDF_BRICK; bx <= r.maxc[0] / SDF_BRICK; bx++) {
+            int b = (bz * nbricks[1] + by) * nbricks[0] + bx;
+            if (pass == 0)
+              brick_start[b + 1]++;
+            else
+              brick_faces[fill[b]++] = fno;
+          }
+    }
+  }
+
+  std::vector<int> bricks;
+  for (int b = 0; b < nbrick; b++)
+    if (brick_start[b + 1] > brick_start[b]) bricks.push_back(b);
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (int z = 0; z < depth; z++) {
+    ROMP_PFLB_begin
+    for (int y = 0; y < height; y++)
+      for (int x = 0; x < width; x++) MRIFvox(mri_dist, x, y, z) = (float)max_distance;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 1)
+#endif
+  for (int i = 0; i < (int)bricks.size(); i++) {
+    ROMP_PFLB_begin
+    int const b = bricks[i];
+    int const b0[3] = {(b % nbricks[0]) * SDF_BRICK,
+                       ((b / nbricks[0]) % nbricks[1]) * SDF_BRICK,
+                       (b / (nbricks[0] * nbricks[1])) * SDF_BRICK};
+    float dist[SDF_BRICK][SDF_BRICK][SDF_BRICK];
+    for (int k = 0; k < SDF_BRICK; k++)
+      for (int j = 0; j < SDF_BRICK; j++)
+        for (int l = 0; l < SDF_BRICK; l++) dist[k][j][l] = (float)max_distance;
+
+    for (int n = brick_start[b]; n < brick_start[b + 1]; n++) {
+      int const fno = brick_faces[n];
+      FACE const *face = &mris->faces[fno];
+      VERTEX *v0 = &mris->vertices[face->v[0]];
+      VERTEX *v1 = &mris->vertices[face->v[1]];
+      VERTEX *v2 = &mris->vertices[face->v[2]];
+      int lo[3], hi[3];
+      for (int d = 0; d < 3; d++) {
+        lo[d] = std::max(reach[fno].minc[d], b0[d]);
+        hi[d] = std::min(reach[fno].maxc[d], b0[d] + SDF_BRICK - 1);
+      }
+      for (int z = lo[2]; z <= hi[2]; z++)
+        for (int y = lo[1]; y <= hi[1]; y++)
+          for (int x = lo[0]; x <= hi[0]; x++) {
+            double pt[3] = {(double)x, (double)y, (double)z};
+            double calcdist = Math::DistancePointToFace(v0, v1, v2, pt);
+            float &d = dist[z - b0[2]][y - b0[1]][x - b0[0]];
+            if (calcdist < d) d = (float)calcdist;
+          }
+    }
+
+    int const hi[3] = {std::min(b0[0] + SDF_BRICK, width),
+                       std::min(b0[1] + SDF_BRICK, height),
+                       std::min(b0[2] + SDF_BRICK, depth)};
+    for (int z = b0[2]; z < hi[2]; z++)
+      for (int y = b0[1]; y < hi[1]; y++)
+        for (int x = b0[0]; x < hi[0]; x++) MRIFvox(mri_dist, x, y, z) = dist[z - b0[2]][y - b0[1]][x - b0[0]];
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  if (!signedfield) return (mri_dist);
+
+  std::vector<float> vx(mris->nvertices), vy(mris->nvertices), vz(mris->nvertices);
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    vx[vno] = mris->vertices[vno].x;
+    vy[vno] = mris->vertices[vno].y;
+    vz[vno] = mris->vertices[vno].z;
+  }
+  std::vector<unsigned char> inside((size_t)width * height * depth);
+  sdfScanlineInterior(mris, vx.data(), vy.data(), vz.data(), width, height, depth, inside.data());
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (int z = 0; z < depth; z++) {
+    ROMP_PFLB_begin
+    for (int y = 0; y < height; y++)
+      for (int x = 0; x < width; x++)
+        if (!inside[((size_t)z * height + y) * width + x]) MRIFvox(mri_dist, x, y, z) = -MRIFvox(mri_dist, x, y, z);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (mri_dist);
+}
+
+/*
+  Sets the voxels of mri_interior whose centers are inside the surface to 1
+  and all others to 0, by the parity of the surface crossings along each x
+  scanline. The surface must be closed and in surface RAS coordinates; the
+  vertices themselves are not modified.
+*/
+MRI *MRISfillInteriorScanline(MRIS *mris, MRI *mri_interior)
+{
+  int const width = mri_interior->width, height = mri_interior->height, depth = mri_interior->depth;
+
+  MATRIX *m_sras2vox = voxelFromSurfaceRAS_(mri_interior);
+  std::vector<float> vx(mris->nvertices), vy(mris->nvertices), vz(mris->nvertices);
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX const *v = &mris->vertices[vno];
+    vx[vno] = *MATRIX_RELT(m_sras2vox, 1, 1) * v->x + *MATRIX_RELT(m_sras2vox, 1, 2) * v->y +
+              *MATRIX_RELT(m_sras2vox, 1, 3) * v->z + *MATRIX_RELT(m_sras2vox, 1, 4);
+    vy[vno] = *MATRIX_RELT(m_sras2vox, 2, 1) * v->x + *MATRIX_RELT(m_sras2vox, 2, 2) * v->y +
+              *MATRIX_RELT(m_sras2vox, 2, 3) * v->z + *MATRIX_RELT(m_sras2vox, 2, 4);
+    vz[vno] = *MATRIX_RELT(m_sras2vox, 3, 1) * v->x + *MATRIX_RELT(m_sras2vox, 3, 2) * v->y +
+              *MATRIX_RELT(m_sras2vox, 3, 3) * v->z + *MATRIX_RELT(m_sras2vox, 3, 4);
+  }
+  MatrixFree(&m_sras2vox);
+
+  std::vector<unsigned char> inside((size_t)width * height * depth);
+  sdfScanlineInterior(mris, vx.data(), vy.data(), vz.data(), width, height, depth, inside.data());
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (int z = 0; z < depth; z++) {
+    ROMP_PFLB_begin
+    for (int y = 0; y < height; y++)
+      for (int x = 0; x < width; x++)
+        MRIsetVoxVal(mri_interior, x, y, z, 0, inside[((size_t)z * height + y) * width + x]);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (mri_interior);
+}
@@ -49,6 +49,9 @@
 #include "face_barycentric_coords.h"
 #include "mrishash_internals.h"
 
+#include <map>
+#include <vector>
+
 //==================================================================
 // Local macros
 //==================================================================
@@ -419,13 +422,13 @@ static void mhtVoxelList_SampleTriangle(
 static void lockBucket(const MHBT *bucketc) {
 #ifdef HAVE_OPENMP
     MHBT *bucket = (MHBT *)bucketc;
-    if (parallelLevel) omp_set_lock(&bucket->bucket_lock); else checkThread0();
+    if (parallelLevel) omp_set_lock(&bucket->bucket_lock); else if (!bucket->gridded) checkThread0();
 #endif
 }
 static void unlockBucket(const MHBT *bucketc) {
 #ifdef HAVE_OPENMP
     MHBT *bucket = (MHBT *)bucketc;
-    if (parallelLevel) omp_unset_lock(&bucket->bucket_lock); else checkThread0();
+    if (parallelLevel) omp_unset_lock(&bucket->bucket_lock); else if (!bucket->gridded) checkThread0();
 #endif
 }
 
@@ -465,6 +468,10 @@ int FindBucketsChecked_Count;
 int FindBucketsPresent_Count;
 int VertexNumFoundByMHT; /* 2007-07-30 GW: Added to allow diagnostics even
                             with fallback-to-brute-force */
+// per thread, so that concurrent lookups do not race on the instrumentation
+#ifdef HAVE_OPENMP
+#pragma omp threadprivate(FindBucketsChecked_Count, FindBucketsPresent_Count, VertexNumFoundByMHT)
+#endif
 
 void MHTfindReportCounts(int *BucketsChecked, int *BucketsPresent, int *VtxNumByMHT)
 {
@@ -481,19 +488,41 @@ struct MRIS_HASH_TABLE_NoSurface : public MRIS_HASH_TABLE {
     omp_lock_t mutable buckets_lock;
 #endif
     int                 nbuckets ;                      // Total # of buckets
-    MRIS_HASH_BUCKET **buckets_mustUseAcqRel[TABLE_SIZE][TABLE_SIZE] ;
+    MRIS_HASH_BUCKET **(*buckets_mustUseAcqRel)[TABLE_SIZE] ;   // [TABLE_SIZE][TABLE_SIZE], NULL for grid tables
 
     int                nfaces;
     MHT_FACE*          f;
 
+    // Counting-sort grid storage, used instead of buckets_mustUseAcqRel when 'grid' is set.
+    // The voxels [glo, glo+gdim) have a cell -> bucket index, and the buckets built by gridPack
+    // point into one packed bin array, leaving a little slack for faces that are added later.
+    // Voxels outside the box that get a face while parallel go into goutside until the next repack.
+    //
+    bool               grid;
+    int                glo[3], gdim[3];
+    std::vector<int>   gcell;           // per voxel of the box, index into gbuckets or -1
+    std::vector<MHBT*> gbuckets;
+    MHBT*              gheaders;        // the buckets created by gridPack
+    std::vector<MHBT*> gextra;          // the buckets created later
+    std::vector<MHB>   gbins;
+    std::map<size_t,int> goutside;      // gridVoxelKey -> index into gbuckets
+    std::vector<int>   gitemStart;      // voxels of each face or vertex when last sorted, 3 ints each
+    std::vector<int>   gitemVox;
+    bool               gmutated;        // faces were added or removed since then
+
 
     virtual MRIS_HASH_TABLE_NoSurface       * toMRIS_HASH_TABLE_NoSurface_Wkr()       { return this; }
     virtual MRIS_HASH_TABLE_NoSurface const * toMRIS_HASH_TABLE_NoSurface_Wkr() const { return this; }
 
-    MRIS_HASH_TABLE_NoSurface(MHTFNO_t fno_usage, float vres, int which, int nfaces) 
-      : MRIS_HASH_TABLE(fno_usage, vres, which), nbuckets(0), nfaces(0), f(nullptr) 
+    MRIS_HASH_TABLE_NoSurface(MHTFNO_t fno_usage, float vres, int which, int nfaces, bool grid) 
+      : MRIS_HASH_TABLE(fno_usage, vres, which), nbuckets(0), buckets_mustUseAcqRel(nullptr), nfaces(0), f(nullptr),
+        grid(grid), gheaders(nullptr), gmutated(false)
     {  
-        bzero(&buckets_mustUseAcqRel, sizeof(buckets_mustUseAcqRel));
+        if (!grid) {
+            // calloc leaves the untouched pages of this 32MB directory unmapped
+            buckets_mustUseAcqRel = (MHBT **(*)[TABLE_SIZE])calloc(TABLE_SIZE, sizeof(*buckets_mustUseAcqRel));
+            if (!buckets_mustUseAcqRel) ErrorExit(ERROR_NO_MEMORY, "%s: could not allocate buckets.\n", __MYFUNCTION__);
+        }
 #ifdef HAVE_OPENMP
         omp_init_lock(&buckets_lock);
 #endif
@@ -540,6 +569,22 @@ struct MRIS_HASH_TABLE_NoSurface : public MRIS_HASH_TABLE {
     int mhtAddFaceOrVertexAtVoxIx    (int xv, int yv, int zv, int forvnum);
     int mhtRemoveFaceOrVertexAtVoxIx (int xv, int yv, int zv, int forvnum);
 
+    // grid storage
+    virtual int  gridItemCount() const = 0;
+    virtual void gridItemVoxels(int item, VOXEL_LISTgw *voxlist) const = 0;
+    long  gridCellIndex  (int xv, int yv, int zv) const;
+    MHBT* gridBucket     (int xv, int yv, int zv) const;
+    MHBT* gridNewBucket  ();
+    bool  gridPacked     (MHB const *bins) const;
+    void  gridFree       ();
+    void  gridItems      (std::vector<int> &start, std::vector<int> &vox) const;
+    void  gridPack       (std::vector<int> const &vox, std::vector<int> const &items, int const lo[3], int const hi[3]);
+    void  gridRegrow     (int xv, int yv, int zv);
+    void  gridAdd        (int xv, int yv, int zv, int forvnum);
+    void  gridRemove     (int xv, int yv, int zv, int forvnum);
+    void  gridBuild      ();
+    int   gridRefit      ();
+
     void mhtFaceCentroid2xyz_float   (int fno, float *x, float *y, float *z);
         // Centroids are computed once and stored in the MHT_FACE
         // They *should* be updated when the face is moved - but I suspect that they are not!
@@ -548,7 +593,8 @@ struct MRIS_HASH_TABLE_NoSurface : public MRIS_HASH_TABLE {
 
 MRIS_HASH_TABLE_NoSurface::~MRIS_HASH_TABLE_NoSurface() 
 {
-    for (int xv = 0; xv < TABLE_SIZE; xv++) {
+    gridFree();
+    for (int xv = 0; buckets_mustUseAcqRel && xv < TABLE_SIZE; xv++) {
         for (int yv = 0; yv < TABLE_SIZE; yv++) {
             if (!buckets_mustUseAcqRel[xv][yv]) continue;
             for (int zv = 0; zv < TABLE_SIZE; zv++) {
@@ -563,6 +609,7 @@ MRIS_HASH_TABLE_NoSurface::~MRIS_HASH_TABLE_NoSurface()
             ::free(buckets_mustUseAcqRel[xv][yv]);
         }
     }
+    ::free(buckets_mustUseAcqRel);
 
 #ifdef HAVE_OPENMP
     omp_destroy_lock(&buckets_lock);
@@ -600,12 +647,12 @@ void MHTfree(MRIS_HASH_TABLE **pmht)
 
 void MRIS_HASH_TABLE_NoSurface::lockBuckets() const {
 #ifdef HAVE_OPENMP
-    if (parallelLevel) omp_set_lock(&buckets_lock); else checkThread0();
+    if (parallelLevel) omp_set_lock(&buckets_lock); else if (!grid) checkThread0();
 #endif
 }
 void MRIS_HASH_TABLE_NoSurface::unlockBuckets() const {
 #ifdef HAVE_OPENMP
-    if (parallelLevel) omp_unset_lock(&buckets_lock); else checkThread0();
+    if (parallelLevel) omp_unset_lock(&buckets_lock); else if (!grid) checkThread0();
 #endif
 }
 
@@ -669,6 +716,15 @@ MHBT* MRIS_HASH_TABLE_NoSurface::acqBucket(int xv, int yv, int zv) const
 {
   if (xv >= TABLE_SIZE || yv >= TABLE_SIZE || zv >= TABLE_SIZE || xv < 0 || yv < 0 || zv < 0) return (NULL);
 
+  if (grid) {
+    // gbuckets and goutside only change under buckets_lock, which is only needed while parallel
+    lockBuckets();
+    MHBT* bucket = gridBucket(xv, yv, zv);
+    unlockBuckets();
+    if (bucket) lockBucket(bucket);
+    return bucket;
+  }
+
   lockBuckets();
 
   MHBT* bucket = NULL;
@@ -719,6 +775,12 @@ bool MRIS_HASH_TABLE_NoSurface::existsBuckets2(int xv, int yv) const
 {
     bool result = false;
     if (xv >= TABLE_SIZE || yv >= TABLE_SIZE || xv < 0 || yv < 0) goto Done;
+    if (grid) {
+      lockBuckets();
+      result = (xv >= glo[0] && xv < glo[0] + gdim[0] && yv >= glo[1] && yv < glo[1] + gdim[1]) || !goutside.empty();
+      unlockBuckets();
+      goto Done;
+    }
     if (!buckets_mustUseAcqRel[xv][yv]) goto Done;
     result = true;
 Done:
@@ -752,6 +814,11 @@ int MRIS_HASH_TABLE_NoSurface::mhtAddFaceOrVertexAtVoxIx(int xv, int yv, int zv,
   if (zv < 0) zv = 0;
   if (zv >= TABLE_SIZE) zv = TABLE_SIZE - 1;
 
+  if (grid) {
+    gridAdd(xv, yv, zv, forvnum);
+    return (NO_ERROR);
+  }
+
   {
     MHBT *bucket = makeAndAcqBucket(xv, yv, zv);
 
@@ -807,6 +874,11 @@ int MRIS_HASH_TABLE_NoSurface::mhtRemoveFaceOrVertexAtVoxIx(int xv, int yv, int
   if (yv >= TABLE_SIZE) yv = TABLE_SIZE - 1;
   if (zv >= TABLE_SIZE) zv = TABLE_SIZE - 1;
 
+  if (grid) {
+    gridRemove(xv, yv, zv, forvnum);
+    return (NO_ERROR);
+  }
+
   if (!existsBuckets2(xv,yv)) return (NO_ERROR);  // no bucket at such coordinates
   
   MHBT *bucket = acqBucket(xv,yv,zv);
@@ -834,14 +906,364 @@ int MRIS_HASH_TABLE_NoSurface::mhtRemoveFaceOrVertexAtVoxIx(int xv, int yv, int
 }
 
 
+//=============================================================================
+// Grid storage
+//
+// The faces or vertices are voxelized in parallel, then counting-sorted into
+// the voxels of their bounding box, so building is O(N) with no per-bucket
+// allocation. The buckets are only locked between MHT_maybeParallel_begin and _end,
+// when faces may be added and removed concurrently with the queries.
+//
+#define GRID_PAD   2    // voxels around the bounding box, so small motions stay inside
+
+static size_t gridVoxelKey(int xv, int yv, int zv)
+{
+  return ((size_t)zv * TABLE_SIZE + yv) * TABLE_SIZE + xv;
+}
+
+long MRIS_HASH_TABLE_NoSurface::gridCellIndex(int xv, int yv, int zv) const
+{
+  xv -= glo[0];
+  yv -= glo[1];
+  zv -= glo[2];
+  if (xv < 0 || yv < 0 || zv < 0 || xv >= gdim[0] || yv >= gdim[1] || zv >= gdim[2]) return -1;
+  return ((long)zv * gdim[1] + yv) * gdim[0] + xv;
+}
+
+// The caller holds buckets_lock if parallel
+//
+MHBT* MRIS_HASH_TABLE_NoSurface::gridBucket(int xv, int yv, int zv) const
+{
+  long const cell = gridCellIndex(xv, yv, zv);
+  if (cell >= 0) return gcell[cell] < 0 ? NULL : gbuckets[gcell[cell]];
+  if (goutside.empty()) return NULL;
+  auto it = goutside.find(gridVoxelKey(xv, yv, zv));
+  return it == goutside.end() ? NULL : gbuckets[it->second];
+}
+
+MHBT* MRIS_HASH_TABLE_NoSurface::gridNewBucket()
+{
+  MHBT *bucket = (MHBT *)calloc(1, sizeof(MHBT));
+  if (!bucket) ErrorExit(ERROR_NOMEMORY, "%s couldn't allocate bucket.\n", __MYFUNCTION__);
+#ifdef HAVE_OPENMP
+  omp_init_lock(&bucket->bucket_lock);
+#endif
+  bucket->gridded = true;
+  gextra.push_back(bucket);
+  gbuckets.push_back(bucket);
+  nbuckets++;
+  return bucket;
+}
+
+bool MRIS_HASH_TABLE_NoSurface::gridPacked(MHB const *bins) const
+{
+  return gbins.size() > 0 && bins >= &gbins[0] && bins < &gbins[0] + gbins.size();
+}
+
+void MRIS_HASH_TABLE_NoSurface::gridFree()
+{
+  for (size_t b = 0; b < gbuckets.size(); b++) {
+    if (!gridPacked(gbuckets[b]->bins)) ::free(gbuckets[b]->bins);
+#ifdef HAVE_OPENMP
+    omp_destroy_lock(&gbuckets[b]->bucket_lock);
+#endif
+  }
+  for (size_t b = 0; b < gextra.size(); b++) ::free(gextra[b]);
+  ::free(gheaders);
+  gheaders = nullptr;
+  gbuckets.clear();
+  gextra.clear();
+  gbins.clear();
+  gcell.clear();
+  goutside.clear();
+}
+
+// The voxels of every face or vertex, in item order, clamped as mhtAddFaceOrVertexAtVoxIx does
+//
+void MRIS_HASH_TABLE_NoSurface::gridItems(std::vector<int> &start, std::vector<int> &vox) const
+{
+  int const nitems  = gridItemCount();
+  int const nchunks = MAX(1, MIN(nitems, 8 * omp_get_max_threads()));
+  std::vector< std::vector<int> > chunkVox(nchunks);
+  std::vector<int> counts(nitems + 1, 0);
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 1)
+#endif
+  for (int c = 0; c < nchunks; c++) {
+    ROMP_PFLB_begin
+    VOXEL_LISTgw *voxlist = (VOXEL_LISTgw *)malloc(sizeof(VOXEL_LISTgw));
+    int const lo = (long)nitems * c / nchunks, hi = (long)nitems * (c + 1) / nchunks;
+    for (int item = lo; item < hi; item++) {
+      mhtVoxelList_Init(voxlist);
+      gridItemVoxels(item, voxlist);
+      counts[item + 1] = voxlist->nused;
+      for (int i = 0; i < voxlist->nused; i++)
+        for (int a = 0; a < 3; a++) chunkVox[c].push_back(MIN(MAX(voxlist->voxels[i][a], 0), TABLE_SIZE - 1));
+    }
+    ::free(voxlist);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  for (int item = 0; item < nitems; item++) counts[item + 1] += counts[item];
+  start.swap(counts);
+  vox.clear();
+  vox.reserve(3 * start[nitems]);
+  for (int c = 0; c < nchunks; c++) vox.insert(vox.end(), chunkVox[c].begin(), chunkVox[c].end());
+}
+
+// Counting sort of the (voxel, item) entries into the box [lo, hi].
+// Within a bucket the items keep the order of the entries.
+//
+void MRIS_HASH_TABLE_NoSurface::gridPack(
+    std::vector<int> const &vox, std::vector<int> const &items, int const lo[3], int const hi[3])
+{
+  gridFree();
+  for (int a = 0; a < 3; a++) {
+    glo[a]  = lo[a];
+    gdim[a] = hi[a] - lo[a] + 1;
+  }
+  gcell.assign((size_t)gdim[0] * gdim[1] * gdim[2], -1);
+
+  std::vector<int> counts;
+  for (size_t e = 0; e < items.size(); e++) {
+    long const cell = gridCellIndex(vox[3 * e], vox[3 * e + 1], vox[3 * e + 2]);
+    if (gcell[cell] < 0) {
+      gcell[cell] = counts.size();
+      counts.push_back(0);
+    }
+    counts[gcell[cell]]++;
+  }
+
+  int const nb = counts.size();
+  size_t nbins = 0;
+  for (int b = 0; b < nb; b++) nbins += counts[b] + counts[b] / 4 + 1;
+  gbins.assign(nbins, MHB());
+  gheaders = (MHBT *)calloc(MAX(nb, 1), sizeof(MHBT));
+  if (!gheaders) ErrorExit(ERROR_NO_MEMORY, "%s: could not allocate %d buckets.\n", __MYFUNCTION__, nb);
+  gbuckets.resize(nb);
+  nbins = 0;
+  for (int b = 0; b < nb; b++) {
+    MHBT *bucket = &gheaders[b];
+    *(MHB**)&bucket->bins     = &gbins[nbins];
+    *(int *)&bucket->max_bins = counts[b] + counts[b] / 4 + 1;
+#ifdef HAVE_OPENMP
+    omp_init_lock(&bucket->bucket_lock);
+#endif
+    bucket->gridded = true;
+    gbuckets[b] = bucket;
+    nbins += bucket->max_bins;
+  }
+
+  for (size_t e = 0; e < items.size(); e++) {
+    MHBT *bucket = gbuckets[gcell[gridCellIndex(vox[3 * e], vox[3 * e + 1], vox[3 * e + 2])]];
+    if (bucket->nused > 0 && bucket->bins[bucket->nused - 1].fno == items[e]) continue;
+    bucket->bins[bucket->nused++].fno = items[e];
+  }
+  nbuckets = nb;
+}
+
+// Repacks the current contents, including goutside, into a box that also contains (xv,yv,zv)
+//
+void MRIS_HASH_TABLE_NoSurface::gridRegrow(int xv, int yv, int zv)
+{
+  int lo[3] = {xv, yv, zv}, hi[3] = {xv, yv, zv};
+  std::vector<int> vox, items;
+
+  for (int a = 0; a < 3; a++) {
+    lo[a] = MIN(lo[a], glo[a]);
+    hi[a] = MAX(hi[a], glo[a] + gdim[a] - 1);
+  }
+  for (int z = 0; z < gdim[2]; z++)
+    for (int y = 0; y < gdim[1]; y++)
+      for (int x = 0; x < gdim[0]; x++) {
+        int const b = gcell[((long)z * gdim[1] + y) * gdim[0] + x];
+        if (b < 0) continue;
+        MHBT const *bucket = gbuckets[b];
+        for (int i = 0; i < bucket->nused; i++) {
+          vox.push_back(glo[0] + x);
+          vox.push_back(glo[1] + y);
+          vox.push_back(glo[2] + z);
+          items.push_back(bucket->bins[i].fno);
+        }
+      }
+  for (auto it = goutside.begin(); it != goutside.end(); it++) {
+    int const v[3] = { int(it->first % TABLE_SIZE), int(it->first / TABLE_SIZE % TABLE_SIZE), int(it->first / TABLE_SIZE / TABLE_SIZE) };
+    MHBT const *bucket = gbuckets[it->second];
+    for (int a = 0; a < 3; a++) {
+      lo[a] = MIN(lo[a], v[a]);
+      hi[a] = MAX(hi[a], v[a]);
+    }
+    for (int i = 0; i < bucket->nused; i++) {
+      vox.insert(vox.end(), v, v + 3);
+      items.push_back(bucket->bins[i].fno);
+    }
+  }
+  for (int a = 0; a < 3; a++) {
+    lo[a] = MAX(lo[a] - GRID_PAD, 0);
+    hi[a] = MIN(hi[a] + GRID_PAD, TABLE_SIZE - 1);
+  }
+  gridPack(vox, items, lo, hi);
+}
+
+// While parallel, the lookup and any new bucket are done under buckets_lock and the bins
+// are changed under the bucket's lock, just as for the ordinary buckets.  A voxel outside
+// the box then goes into goutside, because repacking would move buckets other threads hold.
+//
+void MRIS_HASH_TABLE_NoSurface::gridAdd(int xv, int yv, int zv, int forvnum)
+{
+  lockBuckets();
+  gmutated = true;
+  MHBT *bucket = gridBucket(xv, yv, zv);
+  if (!bucket) {
+    long cell = gridCellIndex(xv, yv, zv);
+#ifdef HAVE_OPENMP
+    if (cell < 0 && parallelLevel) {
+      bucket = gridNewBucket();
+      goutside[gridVoxelKey(xv, yv, zv)] = gbuckets.size() - 1;
+    }
+#endif
+    if (!bucket) {
+      if (cell < 0) {
+        gridRegrow(xv, yv, zv);
+        cell = gridCellIndex(xv, yv, zv);
+      }
+      if (gcell[cell] < 0) {
+        bucket = gridNewBucket();
+        gcell[cell] = gbuckets.size() - 1;
+      }
+      else
+        bucket = gbuckets[gcell[cell]];
+    }
+  }
+  unlockBuckets();
+
+  lockBucket(bucket);
+
+  int i;
+  for (i = 0; i < bucket->nused; i++)
+    if (bucket->bins[i].fno == forvnum) break;
+
+  if (i == bucket->nused) {
+    if (bucket->nused == bucket->max_bins) {
+      // outgrew its slack, so move it out of the packed bins
+      int const max_bins = MAX(4, 2 * bucket->max_bins);
+      MHB *bins = (MHB *)malloc(max_bins * sizeof(MHB));
+      if (!bins) ErrorExit(ERROR_NO_MEMORY, "%s: could not allocate %d bins.\n", __MYFUNCTION__, max_bins);
+      if (bucket->nused) memcpy(bins, bucket->bins, bucket->nused * sizeof(MHB));
+      if (!gridPacked(bucket->bins)) ::free(bucket->bins);
+      *(MHB**)&bucket->bins     = bins;
+      *(int *)&bucket->max_bins = max_bins;
+    }
+    bucket->bins[bucket->nused++].fno = forvnum;
+  }
+
+  unlockBucket(bucket);
+}
+
+void MRIS_HASH_TABLE_NoSurface::gridRemove(int xv, int yv, int zv, int forvnum)
+{
+  lockBuckets();
+  gmutated = true;
+  unlockBuckets();
+
+  MHBT *bucket = acqBucket(xv, yv, zv);
+  if (!bucket) return;
+
+  for (int i = 0; i < bucket->nused; i++) {
+    if (bucket->bins[i].fno != forvnum) continue;
+    bucket->nused--;
+    memmove(&bucket->bins[i], &bucket->bins[i + 1], (bucket->nused - i) * sizeof(MHB));
+    break;
+  }
+  relBucket(&bucket);
+}
+
+void MRIS_HASH_TABLE_NoSurface::gridBuild()
+{
+  gridItems(gitemStart, gitemVox);
+
+  int lo[3] = {TABLE_CENTER, TABLE_CENTER, TABLE_CENTER}, hi[3] = {TABLE_CENTER, TABLE_CENTER, TABLE_CENTER};
+  if (gitemVox.size() > 0)
+    for (int a = 0; a < 3; a++) lo[a] = hi[a] = gitemVox[a];
+  for (size_t i = 0; i < gitemVox.size(); i += 3)
+    for (int a = 0; a < 3; a++) {
+      lo[a] = MIN(lo[a], gitemVox[i + a]);
+      hi[a] = MAX(hi[a], gitemVox[i + a]);
+    }
+  for (int a = 0; a < 3; a++) {
+    lo[a] = MAX(lo[a] - GRID_PAD, 0);
+    hi[a] = MIN(hi[a] + GRID_PAD, TABLE_SIZE - 1);
+  }
+
+  std::vector<int> items(gitemVox.size() / 3);
+  for (int item = 0; item + 1 < (int)gitemStart.size(); item++)
+    for (int e = gitemStart[item]; e < gitemStart[item + 1]; e++) items[e] = item;
+  gridPack(gitemVox, items, lo, hi);
+  gmutated = false;
+}
+
+// Moves only the items whose voxels changed since the last sort, unless there are many of
+// them or the table was changed in between, in which case it is simply rebuilt.
+// Must not be called between MHT_maybeParallel_begin and _end, so it needs no locks,
+// and the repacks also empty goutside.
+//
+int MRIS_HASH_TABLE_NoSurface::gridRefit()
+{
+#ifdef HAVE_OPENMP
+  if (parallelLevel) ErrorExit(ERROR_UNSUPPORTED, "%s: grid hash tables can not be refit in parallel\n", __MYFUNCTION__);
+#endif
+  int const nitems = gridItemCount();
+  if (fno_usage() == MHTFNO_FACE && nitems != nfaces) return -1;   // the MHT_FACEs are for the old faces
+
+  init();
+
+  std::vector<int> start, vox;
+  gridItems(start, vox);
+
+  std::vector<int> changed;
+  if (!gmutated && goutside.empty() && (int)gitemStart.size() == nitems + 1) {
+    for (int item = 0; item < nitems; item++) {
+      int const n = start[item + 1] - start[item];
+      if (n != gitemStart[item + 1] - gitemStart[item] ||
+          memcmp(&vox[3 * start[item]], &gitemVox[3 * gitemStart[item]], 3 * n * sizeof(int)))
+        changed.push_back(item);
+    }
+  }
+  else {
+    gridBuild();
+    return nitems;
+  }
+
+  if ((int)changed.size() > nitems / 20) {
+    gridBuild();
+    return changed.size();
+  }
+
+  for (size_t c = 0; c < changed.size(); c++) {
+    int const item = changed[c];
+    for (int e = gitemStart[item]; e < gitemStart[item + 1]; e++)
+      gridRemove(gitemVox[3 * e], gitemVox[3 * e + 1], gitemVox[3 * e + 2], item);
+    for (int e = start[item]; e < start[item + 1]; e++)
+      gridAdd(vox[3 * e], vox[3 * e + 1], vox[3 * e + 2], item);
+  }
+  gitemStart.swap(start);
+  gitemVox.swap(vox);
+  gmutated = false;
+  return changed.size();
+}
+
+
 // Now the algorithms that depend on the surface representation
 //
 template <class Surface, class Face, class Vertex>
 struct MRIS_HASH_TABLE_IMPL : public MRIS_HASH_TABLE_NoSurface {
 
-    static MRIS_HASH_TABLE_IMPL* newMHT(MHTFNO_t fno_usage, float vres, int which, Surface surface) 
+    static MRIS_HASH_TABLE_IMPL* newMHT(MHTFNO_t fno_usage, float vres, int which, Surface surface, bool grid = false) 
     {
-        auto mht = new MRIS_HASH_TABLE_IMPL(fno_usage, vres, surface, which);
+        auto mht = new MRIS_HASH_TABLE_IMPL(fno_usage, vres, surface, which, grid);
         if (!mht) ErrorExit(ERROR_NO_MEMORY, "%s: could not allocate hash table.\n", __MYFUNCTION__);
         return mht;
     }
@@ -909,8 +1331,8 @@ struct MRIS_HASH_TABLE_IMPL : public MRIS_HASH_TABLE_NoSurface {
     
     Surface surface;
 
-    MRIS_HASH_TABLE_IMPL(MHTFNO_t fno_usage, float vres, Surface surface, int which) 
-      : MRIS_HASH_TABLE_NoSurface(fno_usage, vres, which, surface.nfaces()), surface(surface) 
+    MRIS_HASH_TABLE_IMPL(MHTFNO_t fno_usage, float vres, Surface surface, int which, bool grid) 
+      : MRIS_HASH_TABLE_NoSurface(fno_usage, vres, which, surface.nfaces(), grid), surface(surface) 
     {
         init();
     }
@@ -926,6 +1348,9 @@ struct MRIS_HASH_TABLE_IMPL : public MRIS_HASH_TABLE_NoSurface {
 
     void captureFaceData();
     void captureVertexData();
+
+    virtual int  gridItemCount() const;
+    virtual void gridItemVoxels(int item, VOXEL_LISTgw *voxlist) const;
     
     int mhtFaceToMHT                 (Face f, bool on);
     int mhtDoesTriangleVoxelListIntersect(
@@ -1103,6 +1528,35 @@ void MRIS_HASH_TABLE_IMPL<Surface,Face,Vertex>::captureVertexData()
 }
 
 
+// What captureFaceData and captureVertexData would add for one face or vertex
+//
+template <class Surface, class Face, class Vertex>
+int MRIS_HASH_TABLE_IMPL<Surface,Face,Vertex>::gridItemCount() const
+{
+    return (fno_usage() == MHTFNO_FACE) ? surface.nfaces() : surface.nvertices();
+}
+
+template <class Surface, class Face, class Vertex>
+void MRIS_HASH_TABLE_IMPL<Surface,Face,Vertex>::gridItemVoxels(int item, VOXEL_LISTgw *voxlist) const
+{
+    if (fno_usage() == MHTFNO_FACE) {
+        Face const face = surface.faces(item);
+        if (face.ripflag()) return;
+        Ptdbl_t vpt0, vpt1, vpt2;
+        mhtVertex2xyz(face.v(0), which(), &vpt0);
+        mhtVertex2xyz(face.v(1), which(), &vpt1);
+        mhtVertex2xyz(face.v(2), which(), &vpt2);
+        mhtVoxelList_SampleTriangle(vres(), &vpt0, &vpt1, &vpt2, voxlist);
+    } else {
+        Vertex const v = surface.vertices(item);
+        if (v.ripflag()) return;
+        float x, y, z;
+        mhtVertex2xyz(v, which(), &x, &y, &z);
+        mhtVoxelList_Add(voxlist, WORLD_TO_VOXEL(x), WORLD_TO_VOXEL(y), WORLD_TO_VOXEL(z));
+    }
+}
+
+
 //  Constructors for MRIS_HASH_TABLE that deal with faces are different to those for vertices
 //  They should have been a different type...
 //
@@ -2298,9 +2752,33 @@ using namespace Minimal_Surface_MRIS;
 //using namespace SurfaceFromMRISPV::XYZPositionConsequences;
 
 
+static bool mhtUseGrid()
+{
+    static int use = -1;
+    if (use < 0) use = (getenv("FS_MHT_GRID") != NULL);
+    return use;
+}
+
 #define CONSTRUCTORS(ARG,NS) \
+MRIS_HASH_TABLE* MHTcreateVertexTableGrid_Resolution(ARG mris, int which, float res)                                \
+{                                                                                                                   \
+    NS::Surface surface(mris);                                                                                      \
+    auto mht = MRIS_HASH_TABLE_IMPL<NS::Surface,NS::Face,NS::Vertex>::newMHT(MHTFNO_VERTEX, res, which, surface, true); \
+    mht->gridBuild();                                                                                               \
+    return (mht);                                                                                                   \
+}                                                                                                                   \
+                                                                                                                    \
+MRIS_HASH_TABLE* MHTcreateFaceTableGrid_Resolution(ARG mris, int which, float res)                                  \
+{                                                                                                                   \
+    NS::Surface surface(mris);                                                                                      \
+    auto mht = MRIS_HASH_TABLE_IMPL<NS::Surface,NS::Face,NS::Vertex>::newMHT(MHTFNO_FACE, res, which, surface, true); \
+    mht->gridBuild();                                                                                               \
+    return (mht);                                                                                                   \
+}                                                                                                                   \
+                                                                                                                    \
 MRIS_HASH_TABLE* MHTcreateVertexTable_Resolution(ARG mris, int which, float res)                                    \
 {                                                                                                                   \
+    if (mhtUseGrid()) return MHTcreateVertexTableGrid_Resolution(mris, which, res);                                 \
     NS::Surface surface(mris);                                                                                      \
     auto mht = MRIS_HASH_TABLE_IMPL<NS::Surface,NS::Face,NS::Vertex>::newMHT(MHTFNO_VERTEX, res, which, surface);   \
     mht->captureVertexData();                                                                                       \
@@ -2317,6 +2795,7 @@ MRIS_HASH_TABLE* MHTcreateFaceTable_Resolution(
     int         which,                                                                                              \
     float       res)                                                                                                \
 {                                                                                                                   \
+    if (mhtUseGrid()) return MHTcreateFaceTableGrid_Resolution(mris, which, res);                                   \
     NS::Surface surface(mris);                                                                                      \
     auto mht = MRIS_HASH_TABLE_IMPL<NS::Surface,NS::Face,NS::Vertex>::newMHT(MHTFNO_FACE, res, which, surface);     \
     mht->captureFaceData();                                                                                         \
@@ -2393,6 +2872,13 @@ int MHTtestIsMRISselfIntersecting(MRIS* mris,  float res)
 //
 int  MHTwhich(MRIS_HASH_TABLE const * mht) { return mht->which(); }
 
+int MHTrefit(MRIS_HASH_TABLE* mht)
+{
+    if (!mht) return -1;
+    auto mhtNS = mht->toMRIS_HASH_TABLE_NoSurface();
+    if (!mhtNS || !mhtNS->grid) return -1;
+    return mhtNS->gridRefit();
+}
 
 // Add/remove the faces of which vertex vno is a part
 //
@@ -5075,13 +5075,610 @@ int mrisComputePosterior2DTerm(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
 }
 
 
+/*-----------------------------------------------------
+  MRIS_MP versions of the gradient terms, see MRIScomputeGradientTerms_MP.
+  They follow the MRIS versions above step for step, reading the vectors
+  instead of the VERTEX and FACE, and without the diagnostic output.
+  ------------------------------------------------------*/
+int mrisComputeDistanceTerm(MRIS_MP *mris, INTEGRATION_PARMS *parms)
+{
+  float l_dist, scale, norm;
+  int vno, tno;
+  VECTOR *v_y[_MAX_FS_THREADS], *v_delta[_MAX_FS_THREADS], *v_n[_MAX_FS_THREADS];
+
+  if (!FZERO(parms->l_nldist)) {
+    mrisComputeNonlinearDistanceTerm(mris, parms);
+  }
+
+  l_dist = parms->l_dist;
+  if (DZERO(l_dist)) {
+    return (NO_ERROR);
+  }
+
+  norm = 1.0f / mris->underlyingMRIS->avg_nbrs;
+
+#if METRIC_SCALE
+  if (mris->underlyingMRIS->patch) {
+    scale = 1.0f;
+  }
+  else if (mris->status == MRIS_PARAMETERIZED_SPHERE || mris->status == MRIS_SPHERE) {
+    scale = sqrt(mris->orig_area / mris->total_area);
+  }
+  else
+    scale = mris->neg_area < mris->total_area ? sqrt(mris->orig_area / (mris->total_area - mris->neg_area))
+                                              : sqrt(mris->orig_area / mris->total_area);
+#else
+  scale = 1.0f;
+#endif
 
+  for (tno = 0; tno < _MAX_FS_THREADS; tno++) {
+    v_n[tno] = VectorAlloc(3, MATRIX_REAL);
+    v_y[tno] = VectorAlloc(3, MATRIX_REAL);
+    v_delta[tno] = VectorAlloc(3, MATRIX_REAL);
+  }
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(static, 1)
+#endif
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    ROMP_PFLB_begin
+    
+    int vnum, n;
+    float d0, dt, delta, nc;
 
+#ifdef HAVE_OPENMP
+    int tid = omp_get_thread_num();
+#else
+    int tid = 0;
+#endif
 
+    VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
+    vnum = vt->vtotal;
+    if (mris->v_ripflag[vno] || vnum <= 0) ROMP_PFLB_continue;
 
+    float const x = mris->v_x[vno], y = mris->v_y[vno], z = mris->v_z[vno];
+    float const * const dist      = mris->v_dist     [vno];
+    float const * const dist_orig = mris->v_dist_orig[vno];
 
+    V3_CLEAR(v_delta[tid]);
+    VECTOR_LOAD(v_n[tid], mris->v_nx[vno], mris->v_ny[vno], mris->v_nz[vno]);
 
+    for (n = 0; n < vnum; n++) {
+      int const vnno = vt->v[n];
+      if (mris->v_ripflag[vnno]) continue;
 
+      float const dist_orig_n = !dist_orig ? 0.0 : dist_orig[n];
 
+      d0 = dist_orig_n / scale;
+      dt = dist[n];
+      delta = dt - d0;
+      VECTOR_LOAD(v_y[tid], mris->v_x[vnno] - x, mris->v_y[vnno] - y, mris->v_z[vnno] - z);
+      if ((V3_LEN_IS_ZERO(v_y[tid]))) continue;
 
+      V3_NORMALIZE(v_y[tid], v_y[tid]); /* make it a unit vector */
+      V3_SCALAR_MUL(v_y[tid], delta, v_y[tid]);
+      V3_ADD(v_y[tid], v_delta[tid], v_delta[tid]);
+    }
+
+    V3_SCALAR_MUL(v_delta[tid], norm, v_delta[tid]);
+
+    /* take out normal component */
+    nc = V3_DOT(v_n[tid], v_delta[tid]);
+    V3_SCALAR_MUL(v_n[tid], -nc, v_n[tid]);
+    V3_ADD(v_delta[tid], v_n[tid], v_delta[tid]);
+
+    mris->v_dx[vno] += l_dist * V3_X(v_delta[tid]);
+    mris->v_dy[vno] += l_dist * V3_Y(v_delta[tid]);
+    mris->v_dz[vno] += l_dist * V3_Z(v_delta[tid]);
+
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+  
+  for (tno = 0; tno < _MAX_FS_THREADS; tno++) {
+    VectorFree(&v_n[tno]);
+    VectorFree(&v_y[tno]);
+    VectorFree(&v_delta[tno]);
+  }
+
+  return (NO_ERROR);
+}
+
+int mrisComputeNonlinearDistanceTerm(MRIS_MP *mris, INTEGRATION_PARMS *parms)
+{
+  VECTOR *v_y, *v_delta, *v_n;
+  float l_dist, d0, dt, delta, nc, scale, norm, ratio;
+  int vno, n, vnum;
+
+  l_dist = parms->l_nldist;
+  if (FZERO(l_dist)) {
+    return (NO_ERROR);
+  }
+
+  v_n = VectorAlloc(3, MATRIX_REAL);
+  v_y = VectorAlloc(3, MATRIX_REAL);
+  v_delta = VectorAlloc(3, MATRIX_REAL);
+  norm = 1.0f / mris->underlyingMRIS->avg_nbrs;
+
+#if METRIC_SCALE
+  if (mris->underlyingMRIS->patch) {
+    scale = 1.0f;
+  }
+  else if (mris->status == MRIS_PARAMETERIZED_SPHERE) {
+    scale = sqrt(mris->orig_area / mris->total_area);
+  }
+  else
+    scale = mris->neg_area < mris->total_area ? sqrt(mris->orig_area / (mris->total_area - mris->neg_area))
+                                              : sqrt(mris->orig_area / mris->total_area);
+#else
+  scale = 1.0f;
+#endif
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
+    vnum = vt->vtotal;
+    if (mris->v_ripflag[vno] || vnum <= 0) {
+      continue;
+    }
 
+    float const x = mris->v_x[vno], y = mris->v_y[vno], z = mris->v_z[vno];
+    float const * const dist      = mris->v_dist     [vno];
+    float const * const dist_orig = mris->v_dist_orig[vno];
+
+    V3_CLEAR(v_delta);
+    VECTOR_LOAD(v_n, mris->v_nx[vno], mris->v_ny[vno], mris->v_nz[vno]);
+
+    for (n = 0; n < vnum; n++) {
+      int const vnno = vt->v[n];
+      if (mris->v_ripflag[vnno]) {
+        continue;
+      }
+      d0 = dist_orig[n];
+      dt = scale * dist[n];
+      delta = dt - d0;
+      VECTOR_LOAD(v_y, mris->v_x[vnno] - x, mris->v_y[vnno] - y, mris->v_z[vnno] - z);
+      if ((V3_LEN_IS_ZERO(v_y))) {
+        continue;
+      }
+      V3_NORMALIZE(v_y, v_y); /* make it a unit vector */
+      if (!FZERO(d0)) {
+        ratio = dt / d0;
+        delta *= 1 / (1 + exp(-1 * ratio));
+      }
+      V3_SCALAR_MUL(v_y, delta, v_y);
+      V3_ADD(v_y, v_delta, v_delta);
+    }
+
+    V3_SCALAR_MUL(v_delta, norm, v_delta);
+
+    /* take out normal component */
+    nc = V3_DOT(v_n, v_delta);
+    V3_SCALAR_MUL(v_n, -nc, v_n);
+    V3_ADD(v_delta, v_n, v_delta);
+
+    mris->v_dx[vno] += l_dist * V3_X(v_delta);
+    mris->v_dy[vno] += l_dist * V3_Y(v_delta);
+    mris->v_dz[vno] += l_dist * V3_Z(v_delta);
+  }
+
+  VectorFree(&v_n);
+  VectorFree(&v_y);
+  VectorFree(&v_delta);
+
+  return (NO_ERROR);
+}
+
+int mrisComputeAngleAreaTerms(MRIS_MP *mris, INTEGRATION_PARMS *parms)
+{
+  int fno, ano, vo, va, vb;
+  VECTOR *v_a, *v_b, *v_a_x_n, *v_b_x_n, *v_n, *v_tmp, *v_sum;
+  float orig_area, area, l_parea, l_area, l_angle, delta, len, area_scale;
+
+#if METRIC_SCALE
+  if (mris->underlyingMRIS->patch || (mris->status != MRIS_SPHERE && mris->status != MRIS_PARAMETERIZED_SPHERE)) {
+    area_scale = 1.0f;
+  }
+  else {
+    area_scale = mris->orig_area / mris->total_area;
+  }
+#else
+  area_scale = 1.0f;
+#endif
+
+  l_angle = parms->l_angle;
+  l_area = parms->l_area;
+  l_parea = parms->l_parea;
+  if (!FZERO(parms->l_nlarea)) {
+    mrisComputeNonlinearAreaTerm(mris, parms);
+  }
+
+  if (FZERO(l_area) && FZERO(l_angle) && FZERO(l_parea) && FZERO(parms->l_pangle)) {
+    return (NO_ERROR);
+  }
+
+  v_a = VectorAlloc(3, MATRIX_REAL);
+  v_b = VectorAlloc(3, MATRIX_REAL);
+  v_n = VectorAlloc(3, MATRIX_REAL);
+
+  v_tmp = VectorAlloc(3, MATRIX_REAL);
+  v_sum = VectorAlloc(3, MATRIX_REAL);
+  v_a_x_n = VectorAlloc(3, MATRIX_REAL);
+  v_b_x_n = VectorAlloc(3, MATRIX_REAL);
+
+  #define MP_VERTEX_EDGE(vec, vno0, vno1) \
+    VECTOR_LOAD(vec, mris->v_x[vno1] - mris->v_x[vno0], mris->v_y[vno1] - mris->v_y[vno0], mris->v_z[vno1] - mris->v_z[vno0])
+  #define MP_VERTEX_ADD(vno, OP, vec) \
+    (mris->v_dx[vno] OP V3_X(vec), mris->v_dy[vno] OP V3_Y(vec), mris->v_dz[vno] OP V3_Z(vec))
+
+  /* calculcate movement of each vertex caused by each triangle */
+  for (fno = 0; fno < mris->nfaces; fno++) {
+    if (mris->f_ripflag[fno]) {
+      continue;
+    }
+    FACE_TOPOLOGY const * const ft = &mris->faces_topology[fno];
+    int const v0 = ft->v[0], v1 = ft->v[1], v2 = ft->v[2];
+
+    VECTOR_LOAD(v_n, mris->f_norm[fno].x, mris->f_norm[fno].y, mris->f_norm[fno].z);
+    MP_VERTEX_EDGE(v_a, v0, v1);
+    MP_VERTEX_EDGE(v_b, v0, v2);
+    orig_area = mris->f_norm_orig_area[fno];
+    area = area_scale * mris->f_area[fno];
+    delta = 0.0;
+    if (!FZERO(l_parea)) {
+      delta += l_parea * (area - orig_area);
+    }
+
+    if (!FZERO(l_area)) {
+      if (area <= 0.0f) {
+        delta += l_area * (area - orig_area);
+      }
+    }
+
+    V3_CROSS_PRODUCT(v_a, v_n, v_a_x_n);
+    V3_CROSS_PRODUCT(v_b, v_n, v_b_x_n);
+
+    /* calculate movement of vertices in order, 0-3 */
+
+    /* v0 */
+    V3_SCALAR_MUL(v_a_x_n, -1.0f, v_sum);
+    V3_ADD(v_sum, v_b_x_n, v_sum);
+    V3_SCALAR_MUL(v_sum, delta, v_sum);
+    MP_VERTEX_ADD(v0, +=, v_sum);
+
+    /* v1 */
+    V3_SCALAR_MUL(v_b_x_n, -delta, v_sum);
+    MP_VERTEX_ADD(v1, +=, v_sum);
+
+    /* v2 */
+    V3_SCALAR_MUL(v_a_x_n, delta, v_sum);
+    MP_VERTEX_ADD(v2, +=, v_sum);
+
+    /* now calculate the angle contributions */
+    if (!FZERO(l_angle) || !FZERO(parms->l_pangle)) {
+      angles_per_triangle_t const & angle      = mris->f_angle     [fno];
+      angles_per_triangle_t const & orig_angle = mris->f_orig_angle[fno];
+      for (ano = 0; ano < ANGLES_PER_TRIANGLE; ano++) {
+        switch (ano) {
+          default:
+          case 0:
+            vo = v0;
+            va = v2;
+            vb = v1;
+            break;
+          case 1:
+            vo = v1;
+            va = v0;
+            vb = v2;
+            break;
+          case 2:
+            vo = v2;
+            va = v1;
+            vb = v0;
+            break;
+        }
+        delta = deltaAngle(angle[ano], orig_angle[ano]);
+#if ONLY_NEG_AREA_TERM
+        if (angle[ano] >= 0.0f && ((mris->status == MRIS_PLANE) || (mris->status == MRIS_SPHERE) ||
+                                   (mris->status == MRIS_PARAMETERIZED_SPHERE))) {
+          delta = 0.0f;
+        }
+#endif
+
+        // for pangle term don't penalize angles that are wider, just narrower ones to avoid pinching
+        if (FZERO(parms->l_angle) && !FZERO(parms->l_pangle) && delta < 0) delta = 0.0;
+
+        delta *= parms->l_angle;
+        MP_VERTEX_EDGE(v_a, vo, va);
+        MP_VERTEX_EDGE(v_b, vo, vb);
+
+        /* this angle's contribution to va */
+        V3_CROSS_PRODUCT(v_a, v_n, v_tmp);
+        len = V3_DOT(v_a, v_a);
+        if (!FZERO(len)) {
+          V3_SCALAR_MUL(v_tmp, delta / len, v_tmp);
+        }
+        else {
+          V3_SCALAR_MUL(v_tmp, 0.0f, v_tmp);
+        }
+        MP_VERTEX_ADD(va, +=, v_tmp);
+
+        /* this angle's contribution to vb */
+        V3_CROSS_PRODUCT(v_n, v_b, v_sum);
+        len = V3_DOT(v_b, v_b);
+        if (!FZERO(len)) {
+          V3_SCALAR_MUL(v_sum, delta / len, v_sum);
+        }
+        else {
+          V3_SCALAR_MUL(v_sum, 0.0f, v_sum);
+        }
+        MP_VERTEX_ADD(vb, +=, v_sum);
+
+        /* this angle's contribution to vo */
+        V3_ADD(v_tmp, v_sum, v_sum);
+        MP_VERTEX_ADD(vo, -=, v_sum);
+      }
+    }
+  } /* done with all faces */
+
+  VectorFree(&v_a);
+  VectorFree(&v_b);
+  VectorFree(&v_tmp);
+  VectorFree(&v_sum);
+  VectorFree(&v_n);
+
+  VectorFree(&v_a_x_n);
+  VectorFree(&v_b_x_n);
+  return (NO_ERROR);
+}
+
+int mrisComputeNonlinearAreaTerm(MRIS_MP *mris, INTEGRATION_PARMS *parms)
+{
+  int fno;
+  VECTOR *v_a, *v_b, *v_a_x_n, *v_b_x_n, *v_n, *v_sum;
+  double orig_area, area, delta, area_scale, scale, l_nlarea, ratio;
+
+#if METRIC_SCALE
+  if (mris->underlyingMRIS->patch || (mris->status != MRIS_SPHERE && mris->status != MRIS_PARAMETERIZED_SPHERE)) {
+    area_scale = 1.0f;
+  }
+  else {
+    area_scale = mris->orig_area / mris->total_area;
+  }
+#else
+  area_scale = 1.0f;
+#endif
+
+  l_nlarea = parms->l_nlarea;
+
+  if (FZERO(l_nlarea)) {
+    return (NO_ERROR);
+  }
+
+  v_a = VectorAlloc(3, MATRIX_REAL);
+  v_b = VectorAlloc(3, MATRIX_REAL);
+  v_n = VectorAlloc(3, MATRIX_REAL);
+
+  v_sum = VectorAlloc(3, MATRIX_REAL);
+  v_a_x_n = VectorAlloc(3, MATRIX_REAL);
+  v_b_x_n = VectorAlloc(3, MATRIX_REAL);
+
+  /* calculcate movement of each vertex caused by each triangle */
+  for (fno = 0; fno < mris->nfaces; fno++) {
+    if (mris->f_ripflag[fno]) {
+      continue;
+    }
+    FACE_TOPOLOGY const * const ft = &mris->faces_topology[fno];
+    int const v0 = ft->v[0], v1 = ft->v[1], v2 = ft->v[2];
+
+    VECTOR_LOAD(v_n, mris->f_norm[fno].x, mris->f_norm[fno].y, mris->f_norm[fno].z);
+    MP_VERTEX_EDGE(v_a, v0, v1);
+    MP_VERTEX_EDGE(v_b, v0, v2);
+    orig_area = mris->f_norm_orig_area[fno];
+    area = area_scale * mris->f_area[fno];
+#if SCALE_NONLINEAR_AREA
+    if (!FZERO(orig_area)) {
+      ratio = area / orig_area;
+    }
+    else {
+      ratio = 0.0f;
+    }
+#else
+    ratio = area;
+#endif
+
+    if (ratio > MAX_NEG_RATIO) {
+      ratio = MAX_NEG_RATIO;
+    }
+    else if (ratio < -MAX_NEG_RATIO) {
+      ratio = -MAX_NEG_RATIO;
+    }
+    scale = l_nlarea / (1.0 + exp(NEG_AREA_K * ratio));
+    delta = scale * (area - orig_area);         // the MRIS version's nlscale is always 1
+
+    V3_CROSS_PRODUCT(v_a, v_n, v_a_x_n);
+    V3_CROSS_PRODUCT(v_b, v_n, v_b_x_n);
+
+    /* calculate movement of vertices in order, 0-3 */
+
+    /* v0 */
+    V3_SCALAR_MUL(v_a_x_n, -1.0f, v_sum);
+    V3_ADD(v_sum, v_b_x_n, v_sum);
+    V3_SCALAR_MUL(v_sum, delta, v_sum);
+    MP_VERTEX_ADD(v0, +=, v_sum);
+
+    /* v1 */
+    V3_SCALAR_MUL(v_b_x_n, -delta, v_sum);
+    MP_VERTEX_ADD(v1, +=, v_sum);
+
+    /* v2 */
+    V3_SCALAR_MUL(v_a_x_n, delta, v_sum);
+    MP_VERTEX_ADD(v2, +=, v_sum);
+  } /* done with all faces */
+
+  #undef MP_VERTEX_ADD
+  #undef MP_VERTEX_EDGE
+
+  VectorFree(&v_a);
+  VectorFree(&v_b);
+  VectorFree(&v_sum);
+  VectorFree(&v_n);
+
+  VectorFree(&v_a_x_n);
+  VectorFree(&v_b_x_n);
+  return (NO_ERROR);
+}
+
+int mrisComputeSpringTerm(MRIS_MP *mris, double l_spring)
+{
+  int vno, n, m;
+  float sx, sy, sz, x, y, z, dist_scale;
+
+  if (FZERO(l_spring)) {
+    return (NO_ERROR);
+  }
+
+#if METRIC_SCALE
+  if (mris->underlyingMRIS->patch) {
+    dist_scale = 1.0;
+  }
+  else {
+    dist_scale = sqrt(mris->orig_area / mris->total_area);
+  }
+#else
+  dist_scale = 1.0;
+#endif
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
+    if (mris->v_ripflag[vno]) {
+      continue;
+    }
+
+    // v_neg is only kept for planes
+    char const neg = mris->v_neg ? mris->v_neg[vno] : mris->underlyingMRIS->vertices[vno].neg;
+    if (mris->v_border[vno] && !neg) {
+      continue;
+    }
+
+    x = mris->v_x[vno];
+    y = mris->v_y[vno];
+    z = mris->v_z[vno];
+
+    sx = sy = sz = 0.0;
+    n = 0;
+    for (m = 0; m < vt->vnum; m++) {
+      int const vnno = vt->v[m];
+      if (!mris->v_ripflag[vnno]) {
+        sx += mris->v_x[vnno] - x;
+        sy += mris->v_y[vnno] - y;
+        sz += mris->v_z[vnno] - z;
+        n++;
+      }
+    }
+    if (n > 0) {
+      sx = dist_scale * sx / n;
+      sy = dist_scale * sy / n;
+      sz = dist_scale * sz / n;
+    }
+
+    sx *= l_spring;
+    sy *= l_spring;
+    sz *= l_spring;
+    mris->v_dx[vno] += sx;
+    mris->v_dy[vno] += sy;
+    mris->v_dz[vno] += sz;
+  }
+
+  return (NO_ERROR);
+}
+
+
+MRIScomputeGradientTerms_MP::MRIScomputeGradientTerms_MP(MRIS* mris)
+  : mris(mris), dx(nullptr), dy(nullptr), dz(nullptr), state(0)
+{
+  MRISMP_ctr(&mp);
+}
+
+MRIScomputeGradientTerms_MP::~MRIScomputeGradientTerms_MP()
+{
+  mp.v_dx = mp.v_dy = mp.v_dz = nullptr;
+  MRISMP_dtr(&mp);
+  freeAndNULL(dx); freeAndNULL(dy); freeAndNULL(dz);
+}
+
+MRIS_MP* MRIScomputeGradientTerms_MP::begin()
+{
+  if (state == 0) {
+    static int use = -1;
+    if (use < 0) use = (getenv("FREESURFER_OLD_mrisComputeGradientTerms") == NULL);
+
+    // The MRIS versions cope with missing distances, these only read them
+    //
+    if (!use || (mris->dist_alloced_flags & 3) != 3) {
+      state = -1;
+    } else {
+      MRISMP_load(&mp, mris, true);                   // the outputs include the distances, normals and areas
+      MRISmemalignNFloats(mris->nvertices, &dx, &dy, &dz);
+      mp.v_dx = dx; mp.v_dy = dy; mp.v_dz = dz;
+      state = 1;
+    }
+  }
+  if (state < 0) return nullptr;
+
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX const * const v = &mris->vertices[vno];
+    dx[vno] = v->dx;
+    dy[vno] = v->dy;
+    dz[vno] = v->dz;
+  }
+  return &mp;
+}
+
+void MRIScomputeGradientTerms_MP::end()
+{
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX * const v = &mris->vertices[vno];
+    v->dx = dx[vno];
+    v->dy = dy[vno];
+    v->dz = dz[vno];
+  }
+}
+
+void MRIScomputeGradientTerms_MP::angleAreaTerms(INTEGRATION_PARMS *parms)
+{
+  if (FZERO(parms->l_nlarea) && FZERO(parms->l_area) && FZERO(parms->l_angle) && FZERO(parms->l_parea) && FZERO(parms->l_pangle)) {
+    return;
+  }
+  MRIS_MP* const mp = begin();
+  if (!mp) {
+    mrisComputeAngleAreaTerms(mris, parms);
+    return;
+  }
+  mrisComputeAngleAreaTerms(mp, parms);
+  end();
+}
+
+void MRIScomputeGradientTerms_MP::distanceTerm(INTEGRATION_PARMS *parms)
+{
+  // The MRIS version also makes any missing distances, so use it when there is nothing else to do
+  //
+  MRIS_MP* const mp = (FZERO(parms->l_nldist) && DZERO(parms->l_dist)) ? nullptr : begin();
+  if (!mp) {
+    mrisComputeDistanceTerm(mris, parms);
+    return;
+  }
+  mrisComputeDistanceTerm(mp, parms);
+  end();
+}
+
+void MRIScomputeGradientTerms_MP::springTerm(double l_spring)
+{
+  if (FZERO(l_spring)) {
+    return;
+  }
+  MRIS_MP* const mp = begin();
+  if (!mp) {
+    mrisComputeSpringTerm(mris, l_spring);
+    return;
+  }
+  mrisComputeSpringTerm(mp, l_spring);
+  end();
+}
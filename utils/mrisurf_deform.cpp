@@ -307,7 +307,8 @@ public:
   
   bool canDo(int mris_status) { 
     switch (mris_status) {
-    //case MRIS_PARAMETERIZED_SPHERE: return true;
+    case MRIS_SURFACE:              return true;        // nothing to project onto
+    case MRIS_PARAMETERIZED_SPHERE: return true;
     case MRIS_SPHERE:               return true;
     default:;
     }
@@ -322,10 +323,15 @@ public:
   
   void project(MRIS_MP* mris_mp) {
     switch (mris_mp->status) {
-      case MRIS_SPHERE:   MRISprojectOntoSphere(mris_mp, mris_mp->radius);  break;
-      default: break;
+      case MRIS_SURFACE:
+        break;
+      case MRIS_PARAMETERIZED_SPHERE:
+      case MRIS_SPHERE:
+        MRISprojectOntoSphere(mris_mp, mris_mp->radius);
+        break;
+      default:
+        cheapAssert(!"mrisSurfaceProjector<MRIS_MP>::canDo should have returned false");
     }
-    cheapAssert(false);
   }
   
 };
@@ -961,6 +967,11 @@ struct MRIScomputeSSE_asThoughGradientApplied_ctx::Impl {
   Impl() : inited(false), dx(nullptr), dy(nullptr), dz(nullptr) {}
   ~Impl() 
   {
+    if (inited) {
+      MRISMP_dtr(&curr);                                    // curr shares the inputs of orig, so goes first
+      orig.v_dx = orig.v_dy = orig.v_dz = nullptr;
+      MRISMP_dtr(&orig);
+    }
     freeAndNULL(dx); freeAndNULL(dy); freeAndNULL(dz);
   }
   
@@ -976,6 +987,7 @@ struct MRIScomputeSSE_asThoughGradientApplied_ctx::Impl {
 
     MRISmemalignNFloats(mris->nvertices, &dx, &dy, &dz);
     MRISMP_load(&orig, mris, true, dx,dy,dz);               // needs to load the outputs because those are inputs to ProjectSurface
+    orig.v_dx = dx; orig.v_dy = dy; orig.v_dz = dz;         // the step direction, read by MRIStranslate_along_vertex_dxdydz
       
     inited = true;
   }
@@ -1003,8 +1015,6 @@ double MRIScomputeSSE_asThoughGradientApplied(
   bool useOldBehaviour = !!getenv("FREESURFER_OLD_MRIScomputeSSE_asThoughGradientApplied");
   bool useNewBehaviour = !!getenv("FREESURFER_NEW_MRIScomputeSSE_asThoughGradientApplied") || !useOldBehaviour;
 
-  useNewBehaviour = false;
-  
   if (!canUseNewBehaviour) {
     useNewBehaviour = false;
     useOldBehaviour = true;
@@ -1018,16 +1028,18 @@ double MRIScomputeSSE_asThoughGradientApplied(
     
     MRISMP_copy(&ctxImpl.curr, &ctxImpl.orig, 
       false,  // needs to copy the outputs because those are inputs to ProjectSurface
-      true);  // no need to copy v_x[*] etc. because they are obtained by the translate_along_vertex_dxdydxz below
+      false); // the translate_along_vertex_dxdydxz below does not write the ripped vertices
 
-    MRIStranslate_along_vertex_dxdydz(&ctxImpl.orig, &ctxImpl.curr, delta_t);
+    MRIStranslate_along_vertex_dxdydz(&ctxImpl.curr, &ctxImpl.orig, delta_t);
     mrisProjectSurface(&ctxImpl.curr);
     MRIScomputeMetricProperties(&ctxImpl.curr);
     new_result = MRIScomputeSSE(&ctxImpl.curr, parms);
   }
 
   double old_result = 0.0;
-  if (useOldBehaviour) {
+  if (useOldBehaviour && delta_t == 0.0) {
+    old_result = MRIScomputeSSE(mris, parms);     // the line searches' starting sse, as it was before they asked for it here
+  } else if (useOldBehaviour) {
     MRISapplyGradient(mris, delta_t);
     mrisProjectSurface(mris);
     MRIScomputeMetricProperties(mris);
@@ -561,7 +561,8 @@ int MRISintegrate(MRI_SURFACE *mris, INTEGRATION_PARMS *parms, int n_averages)
 
     MRISclearGradient(mris); /* clear old deltas */
     mrisComputeVariableSmoothnessCoefficients(mris, parms);
-    mrisComputeDistanceTerm(mris, parms);
+    MRIScomputeGradientTerms_MP gradientTerms_MP(mris);
+    gradientTerms_MP.distanceTerm(parms);
     if (Gdiag & DIAG_WRITE && parms->write_iterations > 0 && DIAG_VERBOSE_ON) {
       MRI *mri;
       char fname[STRLEN];
@@ -576,7 +577,7 @@ int MRISintegrate(MRI_SURFACE *mris, INTEGRATION_PARMS *parms, int n_averages)
       MRIwrite(mri, fname);
       MRIfree(&mri);
     }
-    mrisComputeAngleAreaTerms(mris, parms);
+    gradientTerms_MP.angleAreaTerms(parms);
     mrisComputeCorrelationTerm(mris, parms);
     mrisComputePolarCorrelationTerm(mris, parms);
     /*    mrisComputeSpringTerm(mris, parms->l_spring) ;*/
@@ -590,7 +591,7 @@ int MRISintegrate(MRI_SURFACE *mris, INTEGRATION_PARMS *parms, int n_averages)
 
     mrisComputeLaplacianTerm(mris, parms->l_lap);
     MRISaverageGradients(mris, n_averages);
-    mrisComputeSpringTerm(mris, parms->l_spring);
+    gradientTerms_MP.springTerm(parms->l_spring);
     mrisComputeThicknessMinimizationTerm(mris, parms->l_thick_min, parms);
     mrisComputeThicknessParallelTerm(mris, parms->l_thick_parallel, parms);
     mrisComputeThicknessNormalTerm(mris, parms->l_thick_normal, parms);
@@ -1749,7 +1750,9 @@ static double mrisLineMinimize(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
   {
     MRIScomputeSSE_asThoughGradientApplied_ctx sseCtx;
 
-    double const starting_sse = MRIScomputeSSE(mris, parms);
+    // Computed the same way as the probes below, so that it is only compared with sses from the same code
+    //
+    double const starting_sse = MRIScomputeSSE_asThoughGradientApplied(mris, 0.0, parms, sseCtx);
 
     /* write out some data on supposed quadratic form */
     if (Gdiag & DIAG_WRITE && DIAG_VERBOSE_ON) {
@@ -2029,18 +2032,19 @@ static double mrisLineMinimizeSearch(MRI_SURFACE *mris, INTEGRATION_PARMS *parms
   }
   double const min_dt = MIN_MM / mean_delta;
 
+  MRIScomputeSSE_asThoughGradientApplied_ctx sseCtx;
+
+  // The probes are compared with a starting sse computed the same way they are,
+  // the search along the gradient below applies it to the MRIS and compares with the MRIS sse
+  //
   double const starting_sse = MRIScomputeSSE(mris, parms);
-  double min_sse = starting_sse;
+  double min_sse = MRIScomputeSSE_asThoughGradientApplied(mris, 0.0, parms, sseCtx);
 
   /* pick starting step size */
   double min_delta = 0.0f; /* to get rid of compiler warning */
   for (double delta_t = min_dt; delta_t < max_dt; delta_t *= 10.0) {
 
-    MRISapplyGradient(mris, delta_t);
-    mrisProjectSurface(mris);
-    MRIScomputeMetricProperties(mris);
-    double sse = MRIScomputeSSE(mris, parms);
-    MRISrestoreOldPositions(mris);
+    double sse = MRIScomputeSSE_asThoughGradientApplied(mris, delta_t, parms, sseCtx);
 
     if (sse <= min_sse) /* new minimum found */
     {
@@ -2053,11 +2057,7 @@ static double mrisLineMinimizeSearch(MRI_SURFACE *mris, INTEGRATION_PARMS *parms
   {
     min_delta = min_dt / 10.0; /* start at smallest step */
 
-    MRISapplyGradient(mris, min_delta);
-    mrisProjectSurface(mris);
-    MRIScomputeMetricProperties(mris);
-    double sse = MRIScomputeSSE(mris, parms);
-    MRISrestoreOldPositions(mris);
+    double sse = MRIScomputeSSE_asThoughGradientApplied(mris, min_delta, parms, sseCtx);
 
     min_sse = sse; 
   }
@@ -2849,7 +2849,8 @@ int MRISinflateBrain(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
       }
   
       MRISclearGradient(mris);
-      mrisComputeDistanceTerm(mris, parms);
+      MRIScomputeGradientTerms_MP gradientTerms_MP(mris);
+      gradientTerms_MP.distanceTerm(parms);
       mrisComputeSphereTerm(mris, parms->l_sphere, parms->a, parms->explode_flag);
       mrisComputeExpansionTerm(mris, parms->l_expand);
 
@@ -2859,7 +2860,7 @@ int MRISinflateBrain(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
       mrisComputeTangentialSpringTerm(mris, parms->l_tspring);
       mrisComputeNonlinearTangentialSpringTerm(mris, parms->l_nltspring, parms->min_dist);
       mrisComputeQuadraticCurvatureTerm(mris, parms->l_curv);
-      mrisComputeSpringTerm(mris, parms->l_spring);
+      gradientTerms_MP.springTerm(parms->l_spring);
       mrisComputeLaplacianTerm(mris, parms->l_lap);
       mrisComputeNormalizedSpringTerm(mris, parms->l_spring_norm);
       
@@ -3028,7 +3029,8 @@ int MRISinflateToSphere(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
         mht_v_current = MHTcreateVertexTable_Resolution(mris, CURRENT_VERTICES, 3.0f);
       }
       MRISclearGradient(mris);
-      mrisComputeDistanceTerm(mris, parms);
+      MRIScomputeGradientTerms_MP gradientTerms_MP(mris);
+      gradientTerms_MP.distanceTerm(parms);
       mrisComputeSphereTerm(mris, parms->l_sphere, parms->a, parms->explode_flag);
       mrisComputeExpansionTerm(mris, parms->l_expand);
       mrisComputeRepulsiveRatioTerm(mris, parms->l_repulse_ratio, mht_v_current);
@@ -3039,7 +3041,7 @@ int MRISinflateToSphere(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
       mrisComputeTangentialSpringTerm(mris, parms->l_tspring);
       mrisComputeNonlinearTangentialSpringTerm(mris, parms->l_nltspring, parms->min_dist);
       MRISaverageGradients(mris, n_averages);
-      mrisComputeSpringTerm(mris, parms->l_spring);
+      gradientTerms_MP.springTerm(parms->l_spring);
       mrisComputeNormalizedSpringTerm(mris, parms->l_spring_norm);
       switch (parms->integration_type) {
         case INTEGRATE_LM_SEARCH:
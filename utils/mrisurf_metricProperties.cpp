@@ -14,6 +14,8 @@
  * Reporting: freesurfer@nmr.mgh.harvard.edu
  *
  */
+#include <vector>
+
 #include "mrisurf_metricProperties.h"
 
 #include "mrisurf_MRIS.h"
@@ -6871,6 +6873,148 @@ int MRIShistoThresholdCurvature(MRIS *mris, float thresh_pct)
 }
 
 
+/*
+  Per-thread state for the nbhd_size-ring searches below. The ring levels
+  are kept in 'marks' instead of v->marked so that several vertices can be
+  searched at once; only the visited entries are cleared afterwards.
+*/
+typedef struct
+{
+  std::vector<int> marks;
+  std::vector<int> vlist;
+} NBHD_SEARCH;
+
+// which positions the ring search compares
+#define NBHD_SEARCH_PIAL_FROM_ORIG     0  // vn->[xyz] to v->orig[xyz], normals v->n[xyz]
+#define NBHD_SEARCH_ORIG_FROM_PIAL     1  // v->[xyz] to vn->orig[xyz], normals v->n[xyz]
+#define NBHD_SEARCH_PIAL_FROM_WHITE    2  // vn->pial[xyz] to v->white[xyz], normals v->wn[xyz]
+
+/*
+  Searches the nbhd_size-ring of vno for the closest vertex on the opposing
+  surface that lies outwards from it and has a consistently oriented normal.
+  The traversal is identical to the serial v->marked version it replaces, so
+  the results do not depend on the number of threads. *pmin_dist holds the
+  starting (vertex-to-itself) distance on entry. Returns the ring the
+  closest vertex was found in, 0 if none was closer.
+*/
+static int mrisNbhdSearchClosest(
+    MRIS *mris, int vno, int nbhd_size, int which, NBHD_SEARCH *search, float *pmin_dist, int *pmin_vno)
+{
+  VERTEX const * const v = &mris->vertices[vno];
+  std::vector<int> &marks = search->marks;
+  std::vector<int> &vlist = search->vlist;
+  float nx, ny, nz, dx, dy, dz, dot, dist, min_dist = *pmin_dist;
+  int ns, i, n, vtotal, vnum, min_n = 0, min_vno = vno;
+
+  if (which == NBHD_SEARCH_PIAL_FROM_WHITE) {
+    nx = v->wnx;
+    ny = v->wny;
+    nz = v->wnz;
+  }
+  else {
+    nx = v->nx;
+    ny = v->ny;
+    nz = v->nz;
+  }
+
+  if (marks.size() != (size_t)mris->nvertices) marks.assign(mris->nvertices, 0);
+  vlist.clear();
+  marks[vno] = 1;
+  vlist.push_back(vno);
+  vtotal = 1;
+  for (ns = 1; ns <= nbhd_size; ns++) {
+    vnum = 0; /* will be # of new neighbors added to list */
+    for (i = 0; i < vtotal; i++) {
+      VERTEX_TOPOLOGY const * const vnt = &mris->vertices_topology[vlist[i]];
+      if (mris->vertices[vlist[i]].ripflag) {
+        continue;
+      }
+      if (marks[vlist[i]] && marks[vlist[i]] < ns - 1) {
+        continue;
+      }
+      for (n = 0; n < vnt->vnum; n++) {
+        VERTEX const * const vn2 = &mris->vertices[vnt->v[n]];
+        if (vn2->ripflag || marks[vnt->v[n]]) /* already processed */
+        {
+          continue;
+        }
+        vlist.push_back(vnt->v[n]);
+        vnum++;
+        marks[vnt->v[n]] = ns;
+        switch (which) {
+          case NBHD_SEARCH_PIAL_FROM_ORIG:
+            dx = vn2->x - v->origx;
+            dy = vn2->y - v->origy;
+            dz = vn2->z - v->origz;
+            break;
+          case NBHD_SEARCH_ORIG_FROM_PIAL:
+            dx = v->x - vn2->origx;
+            dy = v->y - vn2->origy;
+            dz = v->z - vn2->origz;
+            break;
+          default:
+            dx = vn2->pialx - v->whitex;
+            dy = vn2->pialy - v->whitey;
+            dz = vn2->pialz - v->whitez;
+            break;
+        }
+        dot = dx * nx + dy * ny + dz * nz;
+        if (dot < 0) /* must be outwards from surface */
+        {
+          continue;
+        }
+        if (which == NBHD_SEARCH_PIAL_FROM_WHITE) {
+          dot = vn2->wnx * nx + vn2->wny * ny + vn2->wnz * nz;
+        }
+        else {
+          dot = vn2->nx * nx + vn2->ny * ny + vn2->nz * nz;
+        }
+        if (dot < 0) /* must be outwards from surface */
+        {
+          continue;
+        }
+        dist = sqrt(dx * dx + dy * dy + dz * dz);
+        if (Gdiag_no == vno && which != NBHD_SEARCH_PIAL_FROM_WHITE) {
+          printf("vno=%d %c %3d %6d %g %g\n", vno, which == NBHD_SEARCH_PIAL_FROM_ORIG ? 'A' : 'B', n, vnt->v[n],
+                 dist, min_dist);
+        }
+        if (dist < min_dist) {
+          min_n = ns;
+          min_dist = dist;
+          if (min_n == nbhd_size && DIAG_VERBOSE_ON) fprintf(stdout, "%d --> %d = %2.3f\n", vno, vnt->v[n], dist);
+          min_vno = vnt->v[n];
+        }
+      }
+    }
+    vtotal += vnum;
+  }
+
+  for (i = 0; i < vtotal; i++) {
+    marks[vlist[i]] = 0;
+  }
+  *pmin_dist = min_dist;
+  if (pmin_vno) {
+    *pmin_vno = min_vno;
+  }
+  return (min_n);
+}
+
+// histogram of the rings the closest vertices were found in
+static void mrisPrintNbhdCounts(std::vector<int> const &min_ns, int nbhd_size)
+{
+  std::vector<int> nbr_count(nbhd_size + 1, 0);
+
+  for (size_t vno = 0; vno < min_ns.size(); vno++) {
+    if (min_ns[vno] >= 0) {
+      nbr_count[min_ns[vno]]++;
+    }
+  }
+  for (int n = 0; n <= nbhd_size; n++) {
+    fprintf(stdout, "%d vertices at %d distance\n", nbr_count[n], n);
+  }
+}
+
+
 /*-----------------------------------------------------
   Parameters:
 
@@ -6887,90 +7031,36 @@ int MRIShistoThresholdCurvature(MRIS *mris, float thresh_pct)
 
 int MRISfindClosestOrigVertices(MRIS *mris, int nbhd_size)
 {
-  int vno, n, vlist[100000], vtotal, ns, i, vnum, nbr_count[100], min_n, min_vno;
-  float dx, dy, dz, dist, min_dist, nx, ny, nz, dot;
-
-  memset(nbr_count, 0, 100 * sizeof(int));
+  std::vector<int> min_ns(mris->nvertices, -1);
+  std::vector<NBHD_SEARCH> searches(omp_get_max_threads());
 
   /* current vertex positions are gray matter, orig are white matter */
-  for (vno = 0; vno < mris->nvertices; vno++) {
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    ROMP_PFLB_begin
     VERTEX * const v = &mris->vertices[vno];
     if (v->ripflag) {
-      continue;
+      ROMP_PFLB_continue;
     }
-    nx = v->nx;
-    ny = v->ny;
-    nz = v->nz;
     if (vno == Gdiag_no) {
       DiagBreak();
     }
-    dx = v->x - v->origx;
-    dy = v->y - v->origy;
-    dz = v->z - v->origz;
-    min_dist = sqrt(dx * dx + dy * dy + dz * dz);
-    v->marked = 1;
-    vtotal = 1;
-    vlist[0] = vno;
-    min_n = 0;
-    min_vno = vno;
-    for (ns = 1; ns <= nbhd_size; ns++) {
-      vnum = 0; /* will be # of new neighbors added to list */
-      for (i = 0; i < vtotal; i++) {
-        VERTEX_TOPOLOGY const * const vnt = &mris->vertices_topology[vlist[i]];
-        VERTEX          const * const vn  = &mris->vertices         [vlist[i]];
-        if (vn->ripflag) {
-          continue;
-        }
-        if (vn->marked && vn->marked < ns - 1) {
-          continue;
-        }
-        for (n = 0; n < vnt->vnum; n++) {
-          VERTEX * const vn2 = &mris->vertices[vnt->v[n]];
-          if (vn2->ripflag || vn2->marked) /* already processed */
-          {
-            continue;
-          }
-          vlist[vtotal + vnum++] = vnt->v[n];
-          vn2->marked = ns;
-          dx = vn2->x - v->origx;
-          dy = vn2->y - v->origy;
-          dz = vn2->z - v->origz;
-          dot = dx * nx + dy * ny + dz * nz;
-          if (dot < 0) /* must be outwards from surface */
-          {
-            continue;
-          }
-          dot = vn2->nx * nx + vn2->ny * ny + vn2->nz * nz;
-          if (dot < 0) /* must be outwards from surface */
-          {
-            continue;
-          }
-          dist = sqrt(dx * dx + dy * dy + dz * dz);
-          if (dist < min_dist) {
-            min_n = ns;
-            min_dist = dist;
-            if (min_n == nbhd_size && DIAG_VERBOSE_ON) fprintf(stdout, "%d --> %d = %2.3f\n", vno, vnt->v[n], dist);
-            min_vno = vnt->v[n];
-          }
-        }
-      }
-      vtotal += vnum;
-    }
-
-    nbr_count[min_n]++;
-    for (n = 0; n < vtotal; n++) {
-      VERTEX * const vn = &mris->vertices[vlist[n]];
-      if (vn->ripflag) {
-        continue;
-      }
-      vn->marked = 0;
-    }
+    float dx = v->x - v->origx;
+    float dy = v->y - v->origy;
+    float dz = v->z - v->origz;
+    float min_dist = sqrt(dx * dx + dy * dy + dz * dz);
+    int min_vno;
+    min_ns[vno] = mrisNbhdSearchClosest(
+        mris, vno, nbhd_size, NBHD_SEARCH_PIAL_FROM_ORIG, &searches[omp_get_thread_num()], &min_dist, &min_vno);
     v->curv = min_vno;  // BLETCH
+    ROMP_PFLB_end
   }
+  ROMP_PF_end
 
-  for (n = 0; n <= nbhd_size; n++) {
-    fprintf(stdout, "%d vertices at %d distance\n", nbr_count[n], n);
-  }
+  mrisPrintNbhdCounts(min_ns, nbhd_size);
   return (NO_ERROR);
 }
 /*
@@ -6979,185 +7069,71 @@ int MRISfindClosestOrigVertices(MRIS *mris, int nbhd_size)
 */
 int MRISfindClosestPialVerticesCanonicalCoords(MRIS *mris, int nbhd_size)
 {
-  int vno, n, vlist[100000], vtotal, ns, i, vnum, nbr_count[100], min_n, min_vno;
-  float dx, dy, dz, dist, min_dist, nx, ny, nz, dot;
+  std::vector<int> min_ns(mris->nvertices, -1);
+  std::vector<NBHD_SEARCH> searches(omp_get_max_threads());
 
-  memset(nbr_count, 0, 100 * sizeof(int));
-
-  for (vno = 0; vno < mris->nvertices; vno++) {
-    VERTEX * const v  = &mris->vertices         [vno];
+  // only v->pial[xyz] and v->c[xyz] of the neighbors are read, so v->[xyz] can be written in the loop
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    ROMP_PFLB_begin
+    VERTEX * const v = &mris->vertices[vno];
     if (v->ripflag) {
-      continue;
+      ROMP_PFLB_continue;
     }
-    nx = v->wnx;
-    ny = v->wny;
-    nz = v->wnz;
     if (vno == Gdiag_no) {
       DiagBreak();
     }
-    dx = v->pialx - v->whitex;
-    dy = v->pialy - v->whitey;
-    dz = v->pialz - v->whitez;
-    min_dist = sqrt(dx * dx + dy * dy + dz * dz);
-    v->marked = 1;
-    vtotal = 1;
-    vlist[0] = vno;
-    min_n = 0;
-    min_vno = vno;
-    for (ns = 1; ns <= nbhd_size; ns++) {
-      vnum = 0; /* will be # of new neighbors added to list */
-      for (i = 0; i < vtotal; i++) {
-        VERTEX_TOPOLOGY const * const vnt = &mris->vertices_topology[vlist[i]];
-        VERTEX          const * const vn  = &mris->vertices         [vlist[i]];
-        if (vn->ripflag) {
-          continue;
-        }
-        if (vn->marked && vn->marked < ns - 1) {
-          continue;
-        }
-        for (n = 0; n < vnt->vnum; n++) {
-          VERTEX * const vn2 = &mris->vertices[vnt->v[n]];
-          if (vn2->ripflag || vn2->marked) /* already processed */
-          {
-            continue;
-          }
-          vlist[vtotal + vnum++] = vnt->v[n];
-          vn2->marked = ns;
-          dx = vn2->pialx - v->whitex;
-          dy = vn2->pialy - v->whitey;
-          dz = vn2->pialz - v->whitez;
-          dot = dx * nx + dy * ny + dz * nz;
-          if (dot < 0) /* must be outwards from surface */
-          {
-            continue;
-          }
-          dot = vn2->wnx * nx + vn2->wny * ny + vn2->wnz * nz;
-          if (dot < 0) /* must be outwards from surface */
-          {
-            continue;
-          }
-          dist = sqrt(dx * dx + dy * dy + dz * dz);
-          if (dist < min_dist) {
-            min_n = ns;
-            min_dist = dist;
-            if (min_n == nbhd_size && DIAG_VERBOSE_ON) fprintf(stdout, "%d --> %d = %2.3f\n", vno, vnt->v[n], dist);
-            min_vno = vnt->v[n];
-          }
-        }
-      }
-      vtotal += vnum;
-    }
-
-    nbr_count[min_n]++;
-    for (n = 0; n < vtotal; n++) {
-      VERTEX * const vn = &mris->vertices[vlist[n]];
-      if (vn->ripflag) {
-        continue;
-      }
-      vn->marked = 0;
-    }
+    float dx = v->pialx - v->whitex;
+    float dy = v->pialy - v->whitey;
+    float dz = v->pialz - v->whitez;
+    float min_dist = sqrt(dx * dx + dy * dy + dz * dz);
+    int min_vno;
+    min_ns[vno] = mrisNbhdSearchClosest(
+        mris, vno, nbhd_size, NBHD_SEARCH_PIAL_FROM_WHITE, &searches[omp_get_thread_num()], &min_dist, &min_vno);
     v->curv = min_vno;                  // BLETCH
     v->x = mris->vertices[min_vno].cx;
     v->y = mris->vertices[min_vno].cy;
     v->z = mris->vertices[min_vno].cz;
+    ROMP_PFLB_end
   }
+  ROMP_PF_end
 
-  for (n = 0; n <= nbhd_size; n++) {
-    fprintf(stdout, "%d vertices at %d distance\n", nbr_count[n], n);
-  }
+  mrisPrintNbhdCounts(min_ns, nbhd_size);
   return (NO_ERROR);
 }
 
 
 int MRISmeasureCorticalThickness(MRIS *mris, int nbhd_size, float max_thick)
 {
-  int vno, n, vlist[100000], vtotal, ns, i, vnum, nbr_count[100], min_n, nwg_bad, ngw_bad;
-  float dx, dy, dz, dist, min_dist, nx, ny, nz, dot;
-
-  memset(nbr_count, 0, 100 * sizeof(int));
-  nwg_bad = ngw_bad = 0;
+  int nwg_bad = 0, ngw_bad = 0;
+  std::vector<int> min_ns(2 * mris->nvertices, -1);  // rings of both passes
+  std::vector<NBHD_SEARCH> searches(omp_get_max_threads());
 
   /* current vertex positions are gray matter, orig are white matter */
-  for (vno = 0; vno < mris->nvertices; vno++) {
-    if (!(vno % 25000)) {
-      fprintf(stdout, "%d of %d vertices processed\n", vno, mris->nvertices);
-    }
+  fprintf(stdout, "measuring white->gray distances at %d vertices\n", mris->nvertices);
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) reduction(+ : nwg_bad)
+#endif
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    ROMP_PFLB_begin
     VERTEX * const v = &mris->vertices[vno];
     if (v->ripflag) {
       v->curv = 0;
-      continue;
-    }
-    if (vno == Gdiag_no) {
-      DiagBreak();
+      ROMP_PFLB_continue;
     }
-    nx = v->nx;
-    ny = v->ny;
-    nz = v->nz;
     if (vno == Gdiag_no) {
       DiagBreak();
     }
-    dx = v->x - v->origx;
-    dy = v->y - v->origy;
-    dz = v->z - v->origz;
-    min_dist = sqrt(dx * dx + dy * dy + dz * dz);
-    v->marked = 1;
-    vtotal = 1;
-    vlist[0] = vno;
-    min_n = 0;
-    for (ns = 1; ns <= nbhd_size; ns++) {
-      vnum = 0; /* will be # of new neighbors added to list */
-      for (i = 0; i < vtotal; i++) {
-        VERTEX_TOPOLOGY const * const vnt = &mris->vertices_topology[vlist[i]];
-        VERTEX          const * const vn  = &mris->vertices         [vlist[i]];
-        if (vn->ripflag) {
-          continue;
-        }
-        if (vn->marked && vn->marked < ns - 1) {
-          continue;
-        }
-        for (n = 0; n < vnt->vnum; n++) {
-          VERTEX * const vn2 = &mris->vertices[vnt->v[n]];
-          if (vn2->ripflag || vn2->marked) /* already processed */
-          {
-            continue;
-          }
-          vlist[vtotal + vnum++] = vnt->v[n];
-          vn2->marked = ns;
-          dx = vn2->x - v->origx;
-          dy = vn2->y - v->origy;
-          dz = vn2->z - v->origz;
-          dot = dx * nx + dy * ny + dz * nz;
-          if (dot < 0) /* must be outwards from surface */
-          {
-            continue;
-          }
-          dot = vn2->nx * nx + vn2->ny * ny + vn2->nz * nz;
-          if (dot < 0) /* must be outwards from surface */
-          {
-            continue;
-          }
-          dist = sqrt(dx * dx + dy * dy + dz * dz);
-	  if(Gdiag_no == vno) {
-	    printf("vno=%d A %3d %6d (%g,%g,%g) (%g,%g,%g) %g %g\n",vno,n,vnt->v[n],v->origx,v->origy,v->origz,v->x,v->y,v->z,dist,min_dist);
-	  }
-          if (dist < min_dist) {
-            min_n = ns;
-            min_dist = dist;
-            if (min_n == nbhd_size && DIAG_VERBOSE_ON) fprintf(stdout, "%d --> %d = %2.3f\n", vno, vnt->v[n], dist);
-          }
-        }
-      }
-      vtotal += vnum;
-    }
-
-    nbr_count[min_n]++;
-    for (n = 0; n < vtotal; n++) {
-      VERTEX * const vn = &mris->vertices[vlist[n]];
-      if (vn->ripflag) {
-        continue;
-      }
-      vn->marked = 0;
-    }
+    float dx = v->x - v->origx;
+    float dy = v->y - v->origy;
+    float dz = v->z - v->origz;
+    float min_dist = sqrt(dx * dx + dy * dy + dz * dz);
+    min_ns[vno] = mrisNbhdSearchClosest(
+        mris, vno, nbhd_size, NBHD_SEARCH_PIAL_FROM_ORIG, &searches[omp_get_thread_num()], &min_dist, NULL);
     if (min_dist > max_thick) {
       nwg_bad++;
       min_dist = max_thick;
@@ -7166,87 +7142,31 @@ int MRISmeasureCorticalThickness(MRIS *mris, int nbhd_size, float max_thick)
       DiagBreak();
     }
     v->curv = min_dist;
+    ROMP_PFLB_end
   }
+  ROMP_PF_end
 
-  for (vno = 0; vno < mris->nvertices; vno++) {
-    if (!(vno % 25000)) {
-      fprintf(stdout, "%d of %d vertices processed\n", vno, mris->nvertices);
-    }
+  // each vertex only reads its own white->gray distance, so the passes can't interfere
+  fprintf(stdout, "measuring gray->white distances at %d vertices\n", mris->nvertices);
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) reduction(+ : ngw_bad)
+#endif
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    ROMP_PFLB_begin
     VERTEX * const v = &mris->vertices[vno];
     if (vno == Gdiag_no) {
       DiagBreak();
     }
     if (v->ripflag) {
-      continue;
-    }
-    nx = v->nx;
-    ny = v->ny;
-    nz = v->nz;
-    if (vno == Gdiag_no) {
-      DiagBreak();
-    }
-    dx = v->x - v->origx;
-    dy = v->y - v->origy;
-    dz = v->z - v->origz;
-    min_dist = sqrt(dx * dx + dy * dy + dz * dz);
-    v->marked = 1;
-    vtotal = 1;
-    vlist[0] = vno;
-    min_n = 0;
-    for (ns = 1; ns <= nbhd_size; ns++) {
-      vnum = 0; /* will be # of new neighbors added to list */
-      for (i = 0; i < vtotal; i++) {
-        VERTEX_TOPOLOGY const * const vnt = &mris->vertices_topology[vlist[i]];
-        VERTEX          const * const vn  = &mris->vertices         [vlist[i]];
-        if (vn->ripflag) {
-          continue;
-        }
-        if (vn->marked && vn->marked < ns - 1) {
-          continue;
-        }
-        for (n = 0; n < vnt->vnum; n++) {
-          VERTEX * const vn2 = &mris->vertices[vnt->v[n]];
-          if (vn2->ripflag || vn2->marked) /* already processed */
-          {
-            continue;
-          }
-          vlist[vtotal + vnum++] = vnt->v[n];
-          vn2->marked = ns;
-          dx = v->x - vn2->origx;
-          dy = v->y - vn2->origy;
-          dz = v->z - vn2->origz;
-          dot = dx * nx + dy * ny + dz * nz;
-          if (dot < 0) /* must be outwards from surface */
-          {
-            continue;
-          }
-          dot = vn2->nx * nx + vn2->ny * ny + vn2->nz * nz;
-          if (dot < 0) /* must be outwards from surface */
-          {
-            continue;
-          }
-          dist = sqrt(dx * dx + dy * dy + dz * dz);
-	  if(Gdiag_no == vno) {
-	    printf("vno=%d B %3d %6d (%g,%g,%g) (%g,%g,%g) %g %g\n",vno,n,vnt->v[n],vn2->origx,vn2->origy,vn2->origz,v->x,v->y,v->z,dist,min_dist);
-	  }
-          if (dist < min_dist) {
-            min_n = ns;
-            min_dist = dist;
-            if (min_n == nbhd_size && DIAG_VERBOSE_ON) fprintf(stdout, "%d --> %d = %2.3f\n", vno, vnt->v[n], dist);
-          }
-        }
-      }
-      vtotal += vnum;
-    }
-
-    nbr_count[min_n]++;
-    for (n = 0; n < vtotal; n++) {
-      VERTEX * const vn = &mris->vertices[vlist[n]];
-      if (vn->ripflag) {
-        continue;
-      }
-      vn->marked = 0;
-    }
+      ROMP_PFLB_continue;
+    }
+    float dx = v->x - v->origx;
+    float dy = v->y - v->origy;
+    float dz = v->z - v->origz;
+    float min_dist = sqrt(dx * dx + dy * dy + dz * dz);
+    min_ns[mris->nvertices + vno] = mrisNbhdSearchClosest(
+        mris, vno, nbhd_size, NBHD_SEARCH_ORIG_FROM_PIAL, &searches[omp_get_thread_num()], &min_dist, NULL);
     if (DIAG_VERBOSE_ON && fabs(v->curv - min_dist) > 4.0)
       fprintf(stdout, "v %d, white->gray=%2.2f, gray->white=%2.2f\n", vno, v->curv, min_dist);
     if (min_dist > max_thick) {
@@ -7262,12 +7182,12 @@ int MRISmeasureCorticalThickness(MRIS *mris, int nbhd_size, float max_thick)
     }
     if(Gdiag_no == vno) 
       printf("vno = %d, final measurment %g\n",vno,v->curv);
+    ROMP_PFLB_end
   }
+  ROMP_PF_end
 
   fprintf(stdout, "thickness calculation complete, %d:%d truncations.\n", nwg_bad, ngw_bad);
-  for (n = 0; n <= nbhd_size; n++) {
-    fprintf(stdout, "%d vertices at %d distance\n", nbr_count[n], n);
-  }
+  mrisPrintNbhdCounts(min_ns, nbhd_size);
   return (NO_ERROR);
 }
 
@@ -8561,9 +8481,7 @@ int MRISwhiteVertexToVoxel(MRIS *mris, VERTEX *v, MRI *mri, double *pxv, double
 */
 int MRISmeasureThicknessFromCorrespondence(MRIS *mris, MHT *mht, float max_thick)
 {
-  int vno, alloced;
-  VERTEX *v;
-  float xw, yw, zw, dx, dy, dz, xp, yp, zp;
+  int alloced;
 
   if (mht == NULL) {
     mht = MHTcreateFaceTable_Resolution(mris, CANONICAL_VERTICES, 1.0);  // to lookup closest face
@@ -8572,11 +8490,19 @@ int MRISmeasureThicknessFromCorrespondence(MRIS *mris, MHT *mht, float max_thick
   else
     alloced = 0;
 
-  for (vno = 0; vno < mris->nvertices; vno++) {
-    v = &mris->vertices[vno];
+  // the face lookups only read the table, and each vertex writes only its own curv
+  MHT_maybeParallel_begin();
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    ROMP_PFLB_begin
+    VERTEX * const v = &mris->vertices[vno];
+    float xw, yw, zw, dx, dy, dz, xp, yp, zp;
     if (v->ripflag) {
       v->curv = 0;
-      continue;
+      ROMP_PFLB_continue;
     }
     if (vno == Gdiag_no) DiagBreak();
     MRISvertexCoord2XYZ_float(v, WHITE_VERTICES, &xw, &yw, &zw);
@@ -8585,7 +8511,10 @@ int MRISmeasureThicknessFromCorrespondence(MRIS *mris, MHT *mht, float max_thick
     dy = yp - yw;
     dz = zp - zw;
     v->curv = MIN(max_thick, sqrt(dx * dx + dy * dy + dz * dz));
+    ROMP_PFLB_end
   }
+  ROMP_PF_end
+  MHT_maybeParallel_end();
 
   if (alloced) MHTfree(&mht);
 
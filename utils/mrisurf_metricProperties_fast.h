@@ -17,6 +17,26 @@ void MRISMP_ctr(MRIS_MP* mp) {
 }
 
 void MRISMP_dtr(MRIS_MP* mp) {
+  cheapAssert(mp->in_ref_count == 0);
+
+  // The inputs of a copy belong to its in_src, see MRISMP_copy
+  //
+  if (mp->in_src) {
+#define SEP
+#define ELTX(C,T,N) ELT(C,T,N)
+#define ELT(C,T,N) mp->f_##N = NULL;
+    MRIS_MP__LIST_F_IN
+#undef ELT
+#define ELT(C,T,N) mp->v_##N = NULL;
+    MRIS_MP__LIST_V_IN
+#undef ELT
+#undef ELTX
+#undef SEP
+    *(FACE_TOPOLOGY**)(&mp->faces_topology) = NULL;
+    mp->in_src->in_ref_count--;
+    mp->in_src = NULL;
+  }
+
   // Faces
   //
 #define SEP
@@ -132,6 +152,11 @@ void MRISMP_copy(MRIS_MP* dst, MRIS_MP* src,
 
   if (dst->status != MRIS_PLANE) { freeAndNULL(dst->v_neg); v_neg = NULL; }
 
+  // v_dist_capacity describes dst's own v_dist_buffer, so it is only meaningful once that exists.
+  // Until then the realloc above has left it uninitialized
+  //
+  if (!dst->v_dist_buffer) bzero(v_dist_capacity, dst->nvertices*sizeof(*v_dist_capacity));
+
   int vno;
   for (vno = 0; vno < src->nvertices; vno++) {
 #define SEP
@@ -257,8 +282,10 @@ void MRISMP_load(MRIS_MP* mp, MRIS* mris,
     if (loadOutputs) {
       if (v_neg) v_neg[vno] = v->neg;
       MRIS_MP__LIST_V_OUT
-      MRISMP_makeDist2(mp, vno, v->dist_capacity);
-      memcpy(v_dist [vno], v->dist,  v_VSize[vno]*sizeof(*v_dist[vno]));
+      if (v->dist) {
+        MRISMP_makeDist2(mp, vno, v->dist_capacity);
+        memcpy(v_dist [vno], v->dist,  v_VSize[vno]*sizeof(*v_dist[vno]));
+      }
     }
 #undef ELT
 #undef ELTX
@@ -298,18 +325,9 @@ void MRISMP_load(MRIS_MP* mp, MRIS* mris,
     f_normSet[fno] = false;
     if (loadOutputs) {
       MRIS_MP__LIST_F_OUT
-      DMATRIX* d = f->norm;
-      if (!d) {
-        f_norm[fno].x = 0.0;
-        f_norm[fno].y = 0.0;
-        f_norm[fno].z = 0.0;
-      } else {
-        cheapAssert(d->rows == 3);
-        cheapAssert(d->cols == 1);
-        f_norm[fno].x = d->rptr[0][0];
-        f_norm[fno].y = d->rptr[1][0];
-        f_norm[fno].z = d->rptr[2][0];
-      }
+      f_norm[fno].x = fNorm->nx;             // the face norms are kept in the cache, not in f->norm
+      f_norm[fno].y = fNorm->ny;
+      f_norm[fno].z = fNorm->nz;
       copyAnglesPerTriangle(f_angle[fno],f->angle);
     }
 #undef ELT
@@ -18,6 +18,8 @@
  * Reporting: freesurfer@nmr.mgh.harvard.edu
  *
  */
+#include <vector>
+
 #include "mrisurf_mri.h"
 
 #include "mrisurf_timeStep.h"
@@ -590,13 +592,20 @@ int MRISpositionSurface(MRI_SURFACE *mris, MRI *mri_brain, MRI *mri_smooth, INTE
   for (n = parms->start_t; n < parms->start_t + niterations; n++) {
 
     parms->t = n;
+    // A grid table (see FS_MHT_GRID) is refit in place, only moving what moved, the others are rebuilt
     if (!FZERO(parms->l_repulse)) {
-      MHTfree(&mht_v_current);
-      mht_v_current = MHTcreateVertexTable(mris, CURRENT_VERTICES);
-      MHTfree(&mht_f_current); mht_f_current = MHTcreateFaceTable(mris);
+      if (MHTrefit(mht_v_current) < 0) {
+        MHTfree(&mht_v_current);
+        mht_v_current = MHTcreateVertexTable(mris, CURRENT_VERTICES);
+      }
+      if (MHTrefit(mht_f_current) < 0) {
+        MHTfree(&mht_f_current); mht_f_current = MHTcreateFaceTable(mris);
+      }
     }
     if (!(parms->flags & IPFLAG_NO_SELF_INT_TEST)) {
-      MHTfree(&mht); mht = MHTcreateFaceTable(mris);
+      if (MHTrefit(mht) < 0) {
+        MHTfree(&mht); mht = MHTcreateFaceTable(mris);
+      }
     }
     MRISclearGradient(mris);
 
@@ -5399,6 +5408,76 @@ MRI *MRISsmoothMRI(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *BinMask, MRI *Ta
   MRIScrsLUTFree(crslut);
   return (Targ);
 }
+/*-------------------------------------------------------------------
+  Helpers for MRISsmoothMRIFast() and MRISsmoothMRIFastD(). The
+  nearest-neighbor averaging operator is built once in CSR form: row vno
+  lists vno itself followed by its unripped, in-mask neighbors, and the
+  rows of out-of-mask vertices are empty. The values are then smoothed
+  in blocks of frames stored vertex-major, so every step reads each
+  neighbor list once for all frames of the block. The sums are formed in
+  the same order as the frame-by-frame code, so the results are identical.
+  -------------------------------------------------------------------*/
+#define SMOOTH_FRAME_BLOCK 32
+
+static void mrisSmoothOperatorCSR(MRIS *Surf, MRI *IncMask, std::vector<int> &rowstart, std::vector<int> &cols)
+{
+  rowstart.resize(Surf->nvertices + 1);
+  cols.clear();
+  for (int vno = 0; vno < Surf->nvertices; vno++) {
+    rowstart[vno] = cols.size();
+    // Mask is inclusive, so look for out of mask
+    // should exclude rips here too? Original does not.
+    if (IncMask && MRIgetVoxVal(IncMask, vno, 0, 0, 0) < 0.5) continue;
+    cols.push_back(vno);
+    VERTEX_TOPOLOGY const * const vt = &Surf->vertices_topology[vno];
+    for (int nthnbr = 0; nthnbr < vt->vnum; nthnbr++) {
+      int nbrvno = vt->v[nthnbr];
+      if (Surf->vertices[nbrvno].ripflag) continue;
+      if (IncMask && MRIgetVoxVal(IncMask, nbrvno, 0, 0, 0) < 0.5) continue;
+      cols.push_back(nbrvno);
+    }
+  }
+  rowstart[Surf->nvertices] = cols.size();
+}
+
+// vals holds nframes (<= SMOOTH_FRAME_BLOCK) values per vertex, tmp is scratch of the same size
+template <class T>
+static void mrisSmoothFramesCSR(std::vector<int> const &rowstart, std::vector<int> const &cols,
+                                int nframes, std::vector<T> &vals, std::vector<T> &tmp, int nSmoothSteps)
+{
+  int const nvertices = rowstart.size() - 1;
+
+  for (int nthstep = 0; nthstep < nSmoothSteps; nthstep++) {
+    T const * const src = &vals[0];
+    T * const dst = &tmp[0];
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+    for (int vno = 0; vno < nvertices; vno++) {
+      ROMP_PFLB_begin
+      int const k0 = rowstart[vno], k1 = rowstart[vno + 1];
+      T * const out = dst + (size_t)vno * nframes;
+      if (k0 == k1) {  // out of mask, stays as it is
+        for (int f = 0; f < nframes; f++) out[f] = src[(size_t)vno * nframes + f];
+        ROMP_PFLB_continue;
+      }
+      T sum[SMOOTH_FRAME_BLOCK];
+      T const *in = src + (size_t)cols[k0] * nframes;
+      for (int f = 0; f < nframes; f++) sum[f] = in[f];
+      for (int k = k0 + 1; k < k1; k++) {
+        in = src + (size_t)cols[k] * nframes;
+        for (int f = 0; f < nframes; f++) sum[f] += in[f];
+      }
+      int const num = k1 - k0;  // takes into account all rips/masks
+      for (int f = 0; f < nframes; f++) out[f] = sum[f] / num;
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+    vals.swap(tmp);
+  }
+}
+
 /*-------------------------------------------------------------------
   MRISsmoothMRIFast() - faster version of MRISsmoothMRI(). Smooths
   values on the surface when the surface values are stored in an
@@ -5415,12 +5494,11 @@ MRI *MRISsmoothMRI(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *BinMask, MRI *Ta
   -------------------------------------------------------------------*/
 MRI *MRISsmoothMRIFast(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask, MRI *Targ)
 {
-  int nnbrs, nthstep, frame, vno, nthnbr, num, nvox, nbrvno, reshape;
+  int frame, vno, nvox, reshape, f0, nf;
   MRI *SrcTmp, *mritmp, *IncMaskTmp = NULL;
   int msecTime;
-  int *nNbrs, *nNbrs0, *rip, *rip0, nNbrsMax;
-  float **pF, **pF0, *tF, *tF0, sumF;
-  VERTEX *v, *vn;
+  std::vector<int> rowstart, cols;
+  std::vector<float> vals, tmp;
 
   if (Gdiag_no > 0) printf("MRISsmoothMRIFast()\n");
 
@@ -5460,86 +5538,25 @@ MRI *MRISsmoothMRIFast(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask, MRI
     }
   }
 
-  // Alloc arrays. If there are ripped vertices, then only rip
-  // needs nvertices elements
-  nNbrsMax = 12;  // Should measure this, but overalloc does not hurt
-  pF = (float **)calloc(Surf->nvertices * nNbrsMax, sizeof(float *));
-  tF = (float *)calloc(Surf->nvertices, sizeof(float));
-  nNbrs = (int *)calloc(Surf->nvertices, sizeof(int));
-  rip = (int *)calloc(Surf->nvertices, sizeof(int));
-
-  pF0 = pF;
-  tF0 = tF;
-  rip0 = rip;
-  nNbrs0 = nNbrs;
-
   Timer mytimer;
 
-  // Loop through frames
-  for (frame = 0; frame < Src->nframes; frame++) {
-    // Set up pointers for this frame
-    pF = pF0;
-    rip = rip0;
-    nNbrs = nNbrs0;
-    for (vno = 0; vno < Surf->nvertices; vno++) {
-      v = &Surf->vertices[vno];
-      if (IncMaskTmp && MRIgetVoxVal(IncMaskTmp, vno, 0, 0, 0) < 0.5) {
-        // Mask is inclusive, so look for out of mask
-        // should exclude rips here too? Original does not.
-        rip[vno] = 1;
-        MRIFseq_vox(SrcTmp, vno, 0, 0, frame) = 0;
-        continue;
-      }
-      rip[vno] = 0;
-      *pF++ = (float *)(&(MRIFseq_vox(SrcTmp, vno, 0, 0, frame)));
-      nnbrs = Surf->vertices_topology[vno].vnum;
-      num = 1;
-      for (nthnbr = 0; nthnbr < nnbrs; nthnbr++) {
-        nbrvno = Surf->vertices_topology[vno].v[nthnbr];
-        vn = &Surf->vertices[nbrvno];
-        if (vn->ripflag) {
-          continue;
-        }
-        if (IncMaskTmp && MRIgetVoxVal(IncMaskTmp, nbrvno, 0, 0, 0) < 0.5) {
-          continue;
-        }
-        *pF++ = (float *)(&(MRIFseq_vox(SrcTmp, nbrvno, 0, 0, frame)));
-        num++;
-      }
-      *nNbrs++ = num;  // num takes into account all rips/masks
-    }
+  mrisSmoothOperatorCSR(Surf, IncMaskTmp, rowstart, cols);
 
-    // Step through the iterations
-    for (nthstep = 0; nthstep < nSmoothSteps; nthstep++) {
-      // Init pointers for this iteration
-      pF = pF0;
-      rip = rip0;
-      tF = tF0;
-      nNbrs = nNbrs0;
-      // Loop through vertices, average nearest neighbors
-      for (vno = 0; vno < Surf->nvertices; vno++) {
-        if (*rip++) {
-          continue;
-        }
-        sumF = *(*pF++);
-        for (nthnbr = 0; nthnbr < (*nNbrs) - 1; nthnbr++) {
-          sumF += *(*pF++);
-        }
-        *tF++ = sumF / (*nNbrs);
-        nNbrs++;
-      }
-      // Load up for the next step
-      rip = rip0;
-      tF = tF0;
-      for (vno = 0; vno < Surf->nvertices; vno++) {
-        if (*rip++) {
-          continue;
-        }
-        MRIsetVoxVal(SrcTmp, vno, 0, 0, frame, *tF++);
+  // Loop through blocks of frames
+  for (f0 = 0; f0 < Src->nframes; f0 += SMOOTH_FRAME_BLOCK) {
+    nf = MIN(SMOOTH_FRAME_BLOCK, Src->nframes - f0);
+    vals.resize((size_t)nvox * nf);
+    tmp.resize((size_t)nvox * nf);
+    for (frame = 0; frame < nf; frame++) {
+      for (vno = 0; vno < nvox; vno++) {
+        if (rowstart[vno] == rowstart[vno + 1]) MRIFseq_vox(SrcTmp, vno, 0, 0, f0 + frame) = 0;
+        vals[(size_t)vno * nf + frame] = MRIFseq_vox(SrcTmp, vno, 0, 0, f0 + frame);
       }
     }
-
-  } /* end loop over frame */
+    mrisSmoothFramesCSR(rowstart, cols, nf, vals, tmp, nSmoothSteps);
+    for (frame = 0; frame < nf; frame++)
+      for (vno = 0; vno < nvox; vno++) MRIFseq_vox(SrcTmp, vno, 0, 0, f0 + frame) = vals[(size_t)vno * nf + frame];
+  }
 
   // Copy to the output
   if (reshape) {
@@ -5559,10 +5576,6 @@ MRI *MRISsmoothMRIFast(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask, MRI
 
   MRIfree(&SrcTmp);
   if (IncMaskTmp) MRIfree(&IncMaskTmp);
-  free(pF0);
-  free(tF0);
-  free(rip0);
-  free(nNbrs0);
 
   return (Targ);
 }
@@ -5576,13 +5589,11 @@ MRI *MRISsmoothMRIFast(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask, MRI
   -------------------------------------------------------------------*/
 MRI *MRISsmoothMRIFastD(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask, MRI *Targ)
 {
-  int nnbrs, nthstep, frame, vno, nthnbr, num, nvox, nbrvno, c, r, s;
+  int frame, vno, nvox, f0, nf;
   MRI *IncMaskTmp = NULL;
   int msecTime;
-  int *nNbrs, *nNbrs0, *rip, *rip0, nNbrsMax;
-  double **pF, **pF0, *tF, *tF0, sumF;
-  double *pD, *pD0;
-  VERTEX *v, *vn;
+  std::vector<int> rowstart, cols;
+  std::vector<double> vals, tmp;
 
   if (Gdiag_no > 0) printf("MRISsmoothMRIFastD()\n");
 
@@ -5618,91 +5629,29 @@ MRI *MRISsmoothMRIFastD(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask, MR
     return (NULL);
   }
 
-  // Alloc arrays. If there are ripped vertices, then only rip
-  // needs nvertices elements
-  nNbrsMax = 12;  // Should measure this, but overalloc does not hurt
-  pF = (double **)calloc(Surf->nvertices * nNbrsMax, sizeof(double *));
-  tF = (double *)calloc(Surf->nvertices, sizeof(double));
-  nNbrs = (int *)calloc(Surf->nvertices, sizeof(int));
-  rip = (int *)calloc(Surf->nvertices, sizeof(int));
-  pD = (double *)calloc(Surf->nvertices, sizeof(double));
-
-  pF0 = pF;
-  tF0 = tF;
-  rip0 = rip;
-  nNbrs0 = nNbrs;
-  pD0 = pD;
-
   Timer mytimer;
 
-  // Loop through frames
-  for (frame = 0; frame < Src->nframes; frame++) {
-    // Set up pointers for this frame
-    pD = pD0;
-    pF = pF0;
-    rip = rip0;
-    nNbrs = nNbrs0;
-    for (vno = 0; vno < Surf->nvertices; vno++) {
-      v = &Surf->vertices[vno];
-      if (IncMaskTmp && MRIgetVoxVal(IncMaskTmp, vno, 0, 0, 0) < 0.5) {
-        // Mask is inclusive, so look for out of mask
-        // should exclude rips here too? Original does not.
-        rip[vno] = 1;
-        *pD++ = 0;
-        continue;
-      }
-      *pD++ = MRIgetVoxVal(Src, vno, 0, 0, frame);
-      *pF++ = (double *)(&(pD0[vno]));
-      rip[vno] = 0;
-      nnbrs = Surf->vertices_topology[vno].vnum;
-      num = 1;
-      for (nthnbr = 0; nthnbr < nnbrs; nthnbr++) {
-        nbrvno = Surf->vertices_topology[vno].v[nthnbr];
-        vn = &Surf->vertices[nbrvno];
-        if (vn->ripflag) continue;
-        if (IncMaskTmp && MRIgetVoxVal(IncMaskTmp, nbrvno, 0, 0, 0) < 0.5) continue;
-        *pF++ = (double *)(&(pD0[nbrvno]));
-        num++;
-      }
-      *nNbrs++ = num;  // num takes into account all rips/masks
-    }
-
-    // Step through the iterations
-    for (nthstep = 0; nthstep < nSmoothSteps; nthstep++) {
-      // Init pointers for this iteration
-      pF = pF0;
-      rip = rip0;
-      tF = tF0;
-      nNbrs = nNbrs0;
-      // Loop through vertices, average nearest neighbors
-      for (vno = 0; vno < Surf->nvertices; vno++) {
-        if (*rip++) continue;
-        sumF = *(*pF++);
-        for (nthnbr = 0; nthnbr < (*nNbrs) - 1; nthnbr++) sumF += *(*pF++);
-        *tF++ = sumF / (*nNbrs);
-        nNbrs++;
-      }
-      // Load up for the next step
-      rip = rip0;
-      tF = tF0;
-      for (vno = 0; vno < Surf->nvertices; vno++) {
-        if (*rip++) continue;
-        pD0[vno] = *tF++;
-      }
-    }  // end iteration steps
-
-    // Pack output back into MRI structure (float)
-    pD = pD0;
-    for (c = 0; c < Targ->width; c++) {
-      for (r = 0; r < Targ->height; r++) {
-        for (s = 0; s < Targ->depth; s++) {
-          MRIsetVoxVal(Targ, c, r, s, frame, (*pD));
-          pD++;
-        }
+  mrisSmoothOperatorCSR(Surf, IncMaskTmp, rowstart, cols);
+
+  // Loop through blocks of frames
+  for (f0 = 0; f0 < Src->nframes; f0 += SMOOTH_FRAME_BLOCK) {
+    nf = MIN(SMOOTH_FRAME_BLOCK, Src->nframes - f0);
+    vals.resize((size_t)nvox * nf);
+    tmp.resize((size_t)nvox * nf);
+    for (frame = 0; frame < nf; frame++) {
+      for (vno = 0; vno < nvox; vno++) {
+        if (rowstart[vno] == rowstart[vno + 1])
+          vals[(size_t)vno * nf + frame] = 0;
+        else
+          vals[(size_t)vno * nf + frame] = MRIgetVoxVal(Src, vno, 0, 0, f0 + frame);
       }
     }
+    mrisSmoothFramesCSR(rowstart, cols, nf, vals, tmp, nSmoothSteps);
 
-  } /* end loop over frame */
+    // Pack output back into MRI structure (float)
+    for (frame = 0; frame < nf; frame++)
+      for (vno = 0; vno < nvox; vno++) MRIsetVoxVal(Targ, vno, 0, 0, f0 + frame, vals[(size_t)vno * nf + frame]);
+  }
 
   msecTime = mytimer.milliseconds();
   if (Gdiag_no > 0) {
@@ -5711,11 +5660,6 @@ MRI *MRISsmoothMRIFastD(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask, MR
   }
 
   if (IncMaskTmp) MRIfree(&IncMaskTmp);
-  free(pF0);
-  free(tF0);
-  free(rip0);
-  free(nNbrs0);
-  free(pD0);
 
   return (Targ);
 }
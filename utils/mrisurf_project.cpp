@@ -19,6 +19,7 @@
  */
 #include "mrisurf_project.h"
 #include "mrisurf_base.h"
+#include "mrisurf_MRIS_MP.h"
 
 /* project onto the sphere of radius DEFAULT_RADIUS */
 void mrisSphericalProjectXYZ(float xs, float ys, float zs, float *xd, float *yd, float *zd)
@@ -155,7 +156,31 @@ MRIS* MRISprojectOntoSphere(MRIS* mris, double r)
 
 MRIS_MP* MRISprojectOntoSphere(MRIS_MP* mris, double r)
 {
-  cheapAssert(false);
+  // Only the already spherical surfaces, so there is no MRIScenter.
+  // The dists and the ellipsoid orientation are redone by MRIScomputeMetricProperties.
+  //
+  cheapAssert((mris->status == MRIS_SPHERE) || (mris->status == MRIS_PARAMETERIZED_SPHERE));
+
+  if (FZERO(r)) {
+    r = DEFAULT_RADIUS;
+  }
+  mris->radius = r;
+
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    if (mris->v_ripflag[vno]) continue;
+
+    double const x = mris->v_x[vno];
+    double const y = mris->v_y[vno];
+    double const z = mris->v_z[vno];
+
+    double const dist = sqrt(x*x + y*y + z*z);
+    double const d = FZERO(dist) ? 0 : (1 - r / dist);
+
+    mris->v_x[vno] = x - d * x;
+    mris->v_y[vno] = y - d * y;
+    mris->v_z[vno] = z - d * z;
+  }
+
   return mris;
 }
 
@@ -311,14 +311,53 @@ struct SseTerms_MRIS_MP : public SseTerms_Template_for_SurfaceFromMRIS_MP {
     MRIS_MP* const mris;
     SseTerms_MRIS_MP(MRIS_MP* const mris, int selector) : SseTerms_Template_for_SurfaceFromMRIS_MP(Surface(mris),selector), mris(mris) {}
     
+    // Each term is either inherited from SseTerms_DistortedSurfaces, implemented below on the MRIS_MP vectors, or not implemented.
+    // SurfaceFromMRIS_MP::Distort does not supply the neighbours, so the terms that visit them are implemented here.
+    // MRIScomputeSSE_canDo(MRIS_MP*,...) must agree with this, so the not implemented ones are never called.
+    //
+    #define SSE_MRIS_MP_Template(NAME, SIGNATURE)
+    #define SSE_MRIS_MP_Implemented(NAME, SIGNATURE)   double NAME SIGNATURE;
+    #define SSE_MRIS_MP_NYI(NAME, SIGNATURE)           double NAME SIGNATURE { fs::fatal() << #NAME << "() has not been implemented for SseTerms_MRIS_MP"; return 0; }
+
+    #define SSE_MRIS_MP_RepulsiveRatioEnergy            SSE_MRIS_MP_Implemented
+    #define SSE_MRIS_MP_SpringEnergy                    SSE_MRIS_MP_Implemented
+    #define SSE_MRIS_MP_TangentialSpringEnergy          SSE_MRIS_MP_Implemented
+    #define SSE_MRIS_MP_NonlinearDistanceSSE            SSE_MRIS_MP_Implemented
+    #define SSE_MRIS_MP_NonlinearAreaSSE                SSE_MRIS_MP_Template
+    #define SSE_MRIS_MP_DistanceError                   SSE_MRIS_MP_Implemented
+    #define SSE_MRIS_MP_CorrelationError                SSE_MRIS_MP_Implemented
+    #define SSE_MRIS_MP_AshburnerTriangleEnergy         SSE_MRIS_MP_NYI
+    #define SSE_MRIS_MP_LaplacianEnergy                 SSE_MRIS_MP_NYI         // needs the TMP2 vertices
+    #define SSE_MRIS_MP_NonlinearSpringEnergy           SSE_MRIS_MP_NYI
+    #define SSE_MRIS_MP_RepulsiveEnergy                 SSE_MRIS_MP_NYI
+    #define SSE_MRIS_MP_SurfaceRepulsionEnergy          SSE_MRIS_MP_NYI
+    #define SSE_MRIS_MP_ThicknessMinimizationEnergy     SSE_MRIS_MP_NYI
+    #define SSE_MRIS_MP_ThicknessNormalEnergy           SSE_MRIS_MP_NYI
+    #define SSE_MRIS_MP_ThicknessSpringEnergy           SSE_MRIS_MP_NYI
+    #define SSE_MRIS_MP_ThicknessParallelEnergy         SSE_MRIS_MP_NYI
+    #define SSE_MRIS_MP_ThicknessSmoothnessEnergy       SSE_MRIS_MP_NYI
+    #define SSE_MRIS_MP_QuadraticCurvatureSSE           SSE_MRIS_MP_NYI         // needs the tangent planes
+    #define SSE_MRIS_MP_HistoNegativeLikelihood         SSE_MRIS_MP_NYI
+    #define SSE_MRIS_MP_NegativeLogPosterior            SSE_MRIS_MP_NYI
+    #define SSE_MRIS_MP_NegativeLogPosterior2D          SSE_MRIS_MP_NYI
+    #define SSE_MRIS_MP_DuraError                       SSE_MRIS_MP_NYI
+    #define SSE_MRIS_MP_IntensityError                  SSE_MRIS_MP_NYI         // needs val
+    #define SSE_MRIS_MP_TargetLocationError             SSE_MRIS_MP_NYI
+    #define SSE_MRIS_MP_TargetPointSetError             SSE_MRIS_MP_NYI
+    #define SSE_MRIS_MP_IntensityGradientError          SSE_MRIS_MP_NYI
+    #define SSE_MRIS_MP_VectorCorrelationError          SSE_MRIS_MP_NYI
+    #define SSE_MRIS_MP_ExpandwrapError                 SSE_MRIS_MP_NYI
+    #define SSE_MRIS_MP_ShrinkwrapError                 SSE_MRIS_MP_NYI
+    #define SSE_MRIS_MP_SphereError                     SSE_MRIS_MP_NYI
+    #define SSE_MRIS_MP_RmsDistanceError                SSE_MRIS_MP_NYI
+    #define SSE_MRIS_MP_Error                           SSE_MRIS_MP_NYI
+
     #define MRIS_PARAMETER          
     #define MRIS_PARAMETER_COMMA
     #define NOCOMMA_SELECTOR
     #define COMMA_SELECTOR
     #define SEP 
-    // #define ELT(NAME, SIGNATURE, CALL) double NAME SIGNATURE;
-    // andrew temporarily adding these definitions since they don't get defined anywhere else
-    #define ELT(NAME, SIGNATURE, CALL) inline double NAME SIGNATURE { fs::fatal() << #NAME << "() has not been implemented for SseTerms_MRIS_MP"; return 0; };
+    #define ELT(NAME, SIGNATURE, CALL) SSE_MRIS_MP_##NAME(NAME, SIGNATURE)
     LIST_OF_SSETERMS
     #undef ELT
     #undef SEP
@@ -362,7 +401,7 @@ double SseTerms_MRIS::TangentialSpringEnergy()
 //
 double SseTerms_MRIS::NonlinearDistanceSSE()
 {
-    return SseTerms_Template_for_SurfaceFromMRIS::TangentialSpringEnergy();
+    return SseTerms_Template_for_SurfaceFromMRIS::NonlinearDistanceSSE();
 }
 
 double SseTerms_MRIS::NonlinearAreaSSE()
@@ -373,6 +412,115 @@ double SseTerms_MRIS::NonlinearAreaSSE()
 
 
 
+//=============
+// MRIS_MP terms
+//
+// These match the SseTerms_DistortedSurfaces versions, but get the neighbours from the vertices_topology
+//
+double SseTerms_MRIS_MP::RepulsiveRatioEnergy(double l_repulse)
+{
+    if (FZERO(l_repulse))
+        return (0.0);
+
+    double sse_repulse = 0.0;
+    for (int vno = vnoBegin; vno < vnoEnd; vno++) {
+        if (mris->v_ripflag[vno]) continue;
+        VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
+
+        double const x  = mris->v_x [vno], y  = mris->v_y [vno], z  = mris->v_z [vno];
+        double const cx = mris->v_cx[vno], cy = mris->v_cy[vno], cz = mris->v_cz[vno];
+
+        double v_sse = 0.0;
+        for (int n = 0; n < vt->vnum; n++) {
+            int const vnno = vt->v[n];
+            if (mris->v_ripflag[vnno]) continue;
+
+            double const  dx =  x - mris->v_x [vnno],  dy =  y - mris->v_y [vnno],  dz =  z - mris->v_z [vnno];
+            double const cdx = cx - mris->v_cx[vnno], cdy = cy - mris->v_cy[vnno], cdz = cz - mris->v_cz[vnno];
+
+            double const dist       = sqrt(dx*dx   + dy*dy   + dz*dz);
+            double const canon_dist = sqrt(cdx*cdx + cdy*cdy + cdz*cdz) + REPULSE_E;
+
+            double const adjusted_dist = dist/canon_dist + REPULSE_E;
+            v_sse += REPULSE_K / (adjusted_dist * adjusted_dist);
+        }
+        sse_repulse += v_sse;
+    }
+
+    return l_repulse*sse_repulse;
+}
+
+double SseTerms_MRIS_MP::SpringEnergy()
+{
+    double sse_spring = 0.0;
+    for (int vno = vnoBegin; vno < vnoEnd; vno++) {
+        if (mris->v_ripflag[vno]) continue;
+        int          const vnum = mris->vertices_topology[vno].vnum;
+        float const* const dist = mris->v_dist[vno];
+        double v_sse = 0.0;
+        for (int n = 0; n < vnum; n++) {
+            v_sse += square(dist[n]);
+        }
+        sse_spring += area_scale * v_sse;
+    }
+    return sse_spring;
+}
+
+double SseTerms_MRIS_MP::TangentialSpringEnergy()
+{
+    double sse_spring = 0.0;
+    for (int vno = vnoBegin; vno < vnoEnd; vno++) {
+        if (mris->v_ripflag[vno]) continue;
+        VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
+
+        float const x = mris->v_x[vno], v_nx = mris->v_nx[vno];
+        float const y = mris->v_y[vno], v_ny = mris->v_ny[vno];
+        float const z = mris->v_z[vno], v_nz = mris->v_nz[vno];
+
+        double v_sse = 0.0;
+        for (int n = 0; n < vt->vnum; n++) {
+            int const vnno = vt->v[n];
+
+            float dx = mris->v_x[vnno] - x;
+            float dy = mris->v_y[vnno] - y;
+            float dz = mris->v_z[vnno] - z;
+
+            float const nc = dx * v_nx + dy * v_ny + dz * v_nz;
+            dx -= nc * v_nx;
+            dy -= nc * v_ny;
+            dz -= nc * v_nz;
+
+            v_sse += square(dx) + square(dy) + square(dz);
+        }
+        sse_spring += area_scale * v_sse;
+    }
+    return sse_spring;
+}
+
+double SseTerms_MRIS_MP::NonlinearDistanceSSE()
+{
+    double sse_dist = 0.0;
+    for (int vno = vnoBegin; vno < vnoEnd; vno++) {
+        if (mris->v_ripflag[vno]) continue;
+        int          const vtotal    = mris->vertices_topology[vno].vtotal;
+        float const* const dist      = mris->v_dist     [vno];
+        float const* const dist_orig = mris->v_dist_orig[vno];
+
+        double v_sse = 0.0;
+        for (int n = 0; n < vtotal; n++) {
+            if (FZERO(dist_orig[n])) continue;
+
+            double const ratio = dist_scale * dist[n] / dist_orig[n];
+            v_sse += log(1 + exp(ratio));
+        }
+        sse_dist += v_sse;
+    }
+    return sse_dist;
+}
+
+
+
+
 //========================================
 // Ones that have not been tidied up yet
 
@@ -1747,6 +1895,78 @@ double SseTerms_MRIS::DistanceError( INTEGRATION_PARMS *parms)
 }
 
 
+// Same as SseTerms_MRIS::DistanceError, but reading the MRIS_MP vectors, 
+// which already hold the ripflags densely and need no dist_alloced_flags checks
+//
+double SseTerms_MRIS_MP::DistanceError( INTEGRATION_PARMS *parms)
+{
+  volatile int count_dist_orig_zeros = 0;
+  int err_cnt = 0, max_errs = 100;
+
+  int const acceptableNumberOfZeros = 
+    ( mris->status == MRIS_PARAMETERIZED_SPHERE
+    ||mris->status == MRIS_SPHERE)
+    ? mris->nvertices * mris->underlyingMRIS->avg_nbrs * 0.01
+    : mris->nvertices * mris->underlyingMRIS->avg_nbrs * 0.001;
+
+  const char* const vertexRipflags = mris->v_ripflag;
+
+  double sse_dist = 0.0;
+  
+  // The line search compares these sums against each other, so they must not depend on the thread count
+  //
+  #define ROMP_VARIABLE       vno
+  #define ROMP_LO             vnoBegin
+  #define ROMP_HI             vnoEnd
+    
+  #define ROMP_SUMREDUCTION0  sse_dist
+    
+  #define ROMP_FOR_LEVEL      ROMP_level_assume_reproducible
+    
+#ifdef ROMP_SUPPORT_ENABLED
+  const int romp_for_line = __LINE__;
+#endif
+  #include "romp_for_begin.h"
+  ROMP_for_begin
+    
+    #define sse_dist  ROMP_PARTIALSUM(0)
+
+    if (vertexRipflags[vno]) ROMP_PF_continue;
+
+    VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
+    float const * const dist      = mris->v_dist[vno];
+    float const * const dist_orig = mris->v_dist_orig[vno];
+
+    double v_sse = 0.0;
+    for (int n = 0; n < vt->vtotal; n++) {
+      if (vertexRipflags[vt->v[n]]) continue;
+      
+      float const dist_orig_n = !dist_orig ? 0.0 : dist_orig[n];
+      if (dist_orig_n >= UNFOUND_DIST) continue;
+
+      if (DZERO(dist_orig_n) && (count_dist_orig_zeros++ > acceptableNumberOfZeros)) {
+        fprintf(stderr, "v[%d]->dist_orig[%d] = %f!!!!, count_dist_orig_zeros:%d\n", vno, n, dist_orig_n, count_dist_orig_zeros);
+        if (++err_cnt > max_errs) ErrorExit(ERROR_BADLOOP, "mrisComputeDistanceError: Too many errors!\n");
+      }
+
+      double delta = dist_scale * dist[n] - dist_orig_n;
+      if (parms->vsmoothness)
+        v_sse += (1.0 - parms->vsmoothness[vno]) * (delta * delta);
+      else
+        v_sse += delta * delta;
+    }
+
+    if (parms->dist_error) parms->dist_error[vno] = v_sse;
+
+    sse_dist += v_sse;
+    
+    #undef sse_dist
+  #include "romp_for_end.h"
+
+  return (sse_dist);
+}
+
+
 double MRIScomputeCorrelationError(MRI_SURFACE *mris, MRI_SP *mrisp_template, int fno)
 {
   INTEGRATION_PARMS parms;
@@ -1870,6 +2090,63 @@ double SseTerms_MRIS::CorrelationError( INTEGRATION_PARMS *parms, int use_stds)
 }
 
 
+double SseTerms_MRIS_MP::CorrelationError( INTEGRATION_PARMS *parms, int use_stds)
+{
+  float const l_corr = parms->l_corr + parms->l_pcorr; /* only one will be nonzero */
+  if (FZERO(l_corr)) {
+    return (0.0);
+  }
+
+  double sse = 0.0;
+  
+  #define ROMP_VARIABLE       vno
+  #define ROMP_LO             vnoBegin
+  #define ROMP_HI             vnoEnd
+    
+  #define ROMP_SUMREDUCTION0  sse
+    
+  #define ROMP_FOR_LEVEL      ROMP_level_assume_reproducible
+    
+#ifdef ROMP_SUPPORT_ENABLED
+  const int romp_for_line = __LINE__;
+#endif
+  #include "romp_for_begin.h"
+  ROMP_for_begin
+    
+    #define sse  ROMP_PARTIALSUM(0)
+
+    if (mris->v_ripflag[vno]) ROMP_PF_continue;
+
+    float const x = mris->v_x[vno], y = mris->v_y[vno], z = mris->v_z[vno];
+
+    double const src    = mris->v_curv[vno];
+    double const target = MRISPfunctionValTraceable(parms->mrisp_template, mris->radius, x, y, z, parms->frame_no, false);
+
+    double std = 1.0f;
+#if !DISABLE_STDS
+    if (use_stds) {
+      std = sqrt(MRISPfunctionValTraceable(parms->mrisp_template, mris->radius, x, y, z, parms->frame_no + 1, false));
+      if (FZERO(std)) std = DEFAULT_STD /*FSMALL*/;
+    }
+#endif
+    double const delta = (src - target) / std;
+    if (parms->geometry_error) {
+      parms->geometry_error[vno] = (delta * delta);
+    }
+    if (parms->abs_norm) {
+      sse += fabs(delta);
+    }
+    else {
+      sse += delta * delta;
+    }
+
+    #undef sse
+  #include "romp_for_end.h"
+
+  return (sse);
+}
+
+
 /*!
   \fn double SseTerms_MRIS::IntensityError( INTEGRATION_PARMS *parms)
   \brief Computes the sum of the squares of the value at a vertex minus the v->val.
@@ -2762,33 +3039,34 @@ double vlst_loglikelihood2D(MRIS *mris, MRI *mri, int vno, double displacement,
 // These are in the order the original code computed them, so that side effects are not reordered
 // In older code the ashburner_triangle is computed but not used , here it is not computed at all
 
-// The ELTS terms have a working overloading of mrisCompute### that can take a SurfaceFromMRIS_MP::XYZPositionConsequences::Surface as their first parameter
-//      They are implemented below in template <class _Surface> struct SseTerms_DistortedSurfaces {...}
+// The ELTS terms have a working overloading of mrisCompute### that can take a MRIS_MP* as their first parameter
+//      Most are implemented above in template <class _Surface> struct SseTerms_DistortedSurfaces {...}
+//      the rest in SseTerms_MRIS_MP
 //
 // The ELTM terms have a working overloading of mrisCompute### that can take a MRIS* as their first parameter
 //      They also have an asserting overloading that can take a SurfaceFromMRIS_MP::XYZPositionConsequences::Surface as their first parameter
 //      which will not be called because MRIScomputeSSE_canDo(MRIS_MP* usedOnlyForOverloadingResolution, INTEGRATION_PARMS *parms) returns false for these
 //
 #define SSE_TERMS \
-      ELTM(sse_area                  , parms->l_parea,                            true,    computed_area                                                                   ) \
-      ELTM(sse_neg_area              , parms->l_area,                             true,    computed_neg_area                                                               ) \
+      ELTS(sse_area                  , parms->l_parea,                            true,    computed_area                                                                   ) \
+      ELTS(sse_neg_area              , parms->l_area,                             true,    computed_neg_area                                                               ) \
       ELTM(sse_repulse               , 1.0,                     (parms->l_repulse > 0),    mrisComputeRepulsiveEnergy(mris, parms->l_repulse, mht_v_current, mht_f_current)) \
-      ELTM(sse_repulsive_ratio       , 1.0,                                       true,    mrisComputeRepulsiveRatioEnergy(mris, parms->l_repulse_ratio)                   ) \
-      ELTM(sse_tsmooth               , 1.0,                                       true,    mrisComputeThicknessSmoothnessEnergy(mris, parms->l_tsmooth, parms)             ) \
-      ELTM(sse_thick_min             , parms->l_thick_min,                        true,    mrisComputeThicknessMinimizationEnergy(mris, parms->l_thick_min, parms)         ) \
+      ELTS(sse_repulsive_ratio       , 1.0,                                       true,    mrisComputeRepulsiveRatioEnergy(mris, parms->l_repulse_ratio)                   ) \
+      ELTM(sse_tsmooth               , 1.0,                   !FZERO(parms->l_tsmooth),    mrisComputeThicknessSmoothnessEnergy(mris, parms->l_tsmooth, parms)             ) \
+      ELTM(sse_thick_min             , parms->l_thick_min,  !FZERO(parms->l_thick_min),    mrisComputeThicknessMinimizationEnergy(mris, parms->l_thick_min, parms)         ) \
       ELTM(sse_ashburner_triangle    , parms->l_ashburner_triangle,               false,   mrisComputeAshburnerTriangleEnergy(mris, parms->l_ashburner_triangle, parms)    ) \
-      ELTM(sse_thick_parallel        , parms->l_thick_parallel,                   true,    mrisComputeThicknessParallelEnergy(mris, parms->l_thick_parallel, parms)        ) \
-      ELTM(sse_thick_normal          , parms->l_thick_normal,                     true,    mrisComputeThicknessNormalEnergy(mris, parms->l_thick_normal, parms)            ) \
-      ELTM(sse_thick_spring          , parms->l_thick_spring,                     true,    mrisComputeThicknessSpringEnergy(mris, parms->l_thick_spring, parms)            ) \
-      ELTM(sse_nl_area               , parms->l_nlarea,        !FZERO(parms->l_nlarea),    mrisComputeNonlinearAreaSSE(mris)                                               ) \
-      ELTM(sse_nl_dist               , parms->l_nldist,        !DZERO(parms->l_nldist),    mrisComputeNonlinearDistanceSSE(mris)                                           ) \
-      ELTM(sse_dist                  , parms->l_dist,          !DZERO(parms->l_dist),      mrisComputeDistanceError(mris, parms)                                           ) \
-      ELTM(sse_spring                , parms->l_spring,        !DZERO(parms->l_spring),    mrisComputeSpringEnergy(mris)                                                   ) \
+      ELTM(sse_thick_parallel        , parms->l_thick_parallel, !FZERO(parms->l_thick_parallel),    mrisComputeThicknessParallelEnergy(mris, parms->l_thick_parallel, parms)        ) \
+      ELTM(sse_thick_normal          , parms->l_thick_normal, !FZERO(parms->l_thick_normal),    mrisComputeThicknessNormalEnergy(mris, parms->l_thick_normal, parms)            ) \
+      ELTM(sse_thick_spring          , parms->l_thick_spring, !FZERO(parms->l_thick_spring),    mrisComputeThicknessSpringEnergy(mris, parms->l_thick_spring, parms)            ) \
+      ELTS(sse_nl_area               , parms->l_nlarea,        !FZERO(parms->l_nlarea),    mrisComputeNonlinearAreaSSE(mris)                                               ) \
+      ELTS(sse_nl_dist               , parms->l_nldist,        !DZERO(parms->l_nldist),    mrisComputeNonlinearDistanceSSE(mris)                                           ) \
+      ELTS(sse_dist                  , parms->l_dist,          !DZERO(parms->l_dist),      mrisComputeDistanceError(mris, parms)                                           ) \
+      ELTS(sse_spring                , parms->l_spring,        !DZERO(parms->l_spring),    mrisComputeSpringEnergy(mris)                                                   ) \
       ELTM(sse_lap                   , parms->l_lap,           !DZERO(parms->l_lap),       mrisComputeLaplacianEnergy(mris)                                                ) \
-      ELTM(sse_tspring               , parms->l_tspring,       !DZERO(parms->l_tspring),   mrisComputeTangentialSpringEnergy(mris)                                         ) \
+      ELTS(sse_tspring               , parms->l_tspring,       !DZERO(parms->l_tspring),   mrisComputeTangentialSpringEnergy(mris)                                         ) \
       ELTM(sse_nlspring              , parms->l_nlspring,      !DZERO(parms->l_nlspring),  mrisComputeNonlinearSpringEnergy(mris, parms)                                   ) \
       ELTM(sse_curv                  , l_curv_scaled,          !DZERO(parms->l_curv),      mrisComputeQuadraticCurvatureSSE(mris, parms->l_curv)                           ) \
-      ELTM(sse_corr                  , l_corr,                 !DZERO(l_corr),             mrisComputeCorrelationError(mris, parms, 1)                                     ) \
+      ELTS(sse_corr                  , l_corr,                 !DZERO(l_corr),             mrisComputeCorrelationError(mris, parms, 1)                                     ) \
       ELTM(sse_val                   , parms->l_intensity,     !DZERO(parms->l_intensity), mrisComputeIntensityError(mris, parms)                                          ) \
       ELTM(sse_loc                   , parms->l_location,      !DZERO(parms->l_location),  mrisComputeTargetLocationError(mris, parms)                                     ) \
       ELTM(sse_tps                   , parms->l_targetpointset,!DZERO(parms->l_targetpointset),  parms->TargetPointSet->CostAndGrad(parms->l_targetpointset, 0)            ) \
@@ -2803,6 +3081,62 @@ double vlst_loglikelihood2D(MRIS *mris, MRI *mri, int vno, double displacement,
       ELTM(sse_vectorCorrelationError, 1.0,                    use_multiframes,            mrisComputeVectorCorrelationError(mris, parms, 1)                               ) \
       // end of list
 
+// The parts of MRIScomputeSSE_template that only the MRIS supports.
+// MRIScomputeSSE_canDo(MRIS_MP*,...) returns false when they would be needed.
+//
+static void sseCreateRepulsionTables(MRIS* mris, MHT** mht_v_current, MHT** mht_f_current)
+{
+  double vmean, vsigma;
+  vmean = MRIScomputeTotalVertexSpacingStats     (mris, &vsigma, NULL, NULL, NULL, NULL);
+  *mht_v_current = MHTcreateVertexTable_Resolution(mris, CURRENT_VERTICES, vmean);
+  *mht_f_current = MHTcreateFaceTable_Resolution  (mris, CURRENT_VERTICES, vmean);
+}
+
+static void sseCreateRepulsionTables(MRIS_MP* mris, MHT** mht_v_current, MHT** mht_f_current)
+{
+  cheapAssert(!"sseCreateRepulsionTables(MRIS_MP*) NYI");
+}
+
+static double sseExternal(MRIS* mris, INTEGRATION_PARMS *parms)
+{
+  return (*gMRISexternalSSE)(mris, parms);
+}
+
+static double sseExternal(MRIS_MP* mris, INTEGRATION_PARMS *parms)
+{
+  cheapAssert(!"sseExternal(MRIS_MP*) NYI");
+  return 0.0;
+}
+
+static void sseLogDist(MRIS* mris)
+{
+  bool dist_avail = !!(mris->dist_alloced_flags & 1);
+  fprintf(stdout, " dist_avail:%f\n", (float)dist_avail);
+  if (dist_avail) {
+    VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[0];
+    VERTEX          const * const v  = &mris->vertices         [0];
+    int n;
+    for (n = 0; n < vt->vtotal; n++) {
+      fprintf(stdout, " dist_n:%f\n",      !v->dist      ? 0.0f : v->dist     [n]);
+      fprintf(stdout, " dist_orig_n:%f\n", !v->dist_orig ? 0.0f : v->dist_orig[n]);
+    }
+  }
+}
+
+static void sseLogDist(MRIS_MP* mris)
+{
+  bool dist_avail = !!mris->v_dist[0];
+  fprintf(stdout, " dist_avail:%f\n", (float)dist_avail);
+  if (dist_avail) {
+    VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[0];
+    int n;
+    for (n = 0; n < vt->vtotal; n++) {
+      fprintf(stdout, " dist_n:%f\n",      mris->v_dist[0][n]);
+      fprintf(stdout, " dist_orig_n:%f\n", !mris->v_dist_orig[0] ? 0.0f : mris->v_dist_orig[0][n]);
+    }
+  }
+}
+
 template <class Surface, class Some_MRIS>
 double MRIScomputeSSE_template(Surface surface, Some_MRIS* mris, INTEGRATION_PARMS *parms)
 {
@@ -2943,10 +3277,7 @@ double MRIScomputeSSE_template(Surface surface, Some_MRIS* mris, INTEGRATION_PAR
   MHT* mht_v_current = NULL;
   MHT* mht_f_current = NULL;
   if (!FZERO(parms->l_repulse)) {
-    double vmean, vsigma;
-    vmean = MRIScomputeTotalVertexSpacingStats     (mris, &vsigma, NULL, NULL, NULL, NULL);
-    mht_v_current = MHTcreateVertexTable_Resolution(mris, CURRENT_VERTICES, vmean);
-    mht_f_current = MHTcreateFaceTable_Resolution  (mris, CURRENT_VERTICES, vmean);
+    sseCreateRepulsionTables(mris, &mht_v_current, &mht_f_current);
   }
 
 
@@ -2968,7 +3299,7 @@ double MRIScomputeSSE_template(Surface surface, Some_MRIS* mris, INTEGRATION_PAR
   double sse_init = 0;
 
   if (gMRISexternalSSE) {
-    sse_init = (*gMRISexternalSSE)(mris, parms);
+    sse_init = sseExternal(mris, parms);
   }
   
   double sse = sse_init
@@ -3000,30 +3331,13 @@ double MRIScomputeSSE_template(Surface surface, Some_MRIS* mris, INTEGRATION_PAR
     fprintf(stdout, "logSSE:%d \n", logSSECount);
     
     if (parms->l_dist) {
-      bool dist_avail  = 
-#ifdef COMPILING_MRIS_MP
-        !!mris->v_dist[0];
-#else
-        !!(mris->dist_alloced_flags & 1);
-#endif
       #define ELT(X) fprintf(stdout, " %s:%f\n", #X, (float)(X));
-      ELT(dist_avail)
-      if (dist_avail) {
-        VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[0];
-        VERTEX          const * const v  = &mris->vertices         [0];
-        int n;
-        for (n = 0; n < vt->vtotal; n++) {
-          float const dist_n      = !v->dist      ? 0.0 : v->dist     [n];
-          float const dist_orig_n = !v->dist_orig ? 0.0 : v->dist_orig[n];
-          ELT(dist_n);
-          ELT(dist_orig_n);
-        }
-      }
-      ELT(mris->patch)
-      ELT(mris->status)
-      ELT(mris->orig_area)
-      ELT(mris->total_area)
-      ELT(mris->neg_area)
+      sseLogDist(mris);
+      ELT(surface.patch())
+      ELT(surface.status())
+      ELT(surface.orig_area())
+      ELT(surface.total_area())
+      ELT(surface.neg_area())
 #undef ELT
     }
 
@@ -3066,17 +3380,13 @@ double MRIScomputeSSE(MRIS* mris, INTEGRATION_PARMS *parms)
 
 bool MRIScomputeSSE_canDo(MRIS_MP* usedOnlyForOverloadingResolution, INTEGRATION_PARMS *parms)
 {
-#if 1
-  return false;
-#else
   bool   const use_multiframes  = !!(parms->flags & IP_USE_MULTIFRAMES);
-  double const l_corr           = (double)(parms->l_corr + parms->l_pcorr);
 
   bool result = true;
 #define ELTS(NAME, MULTIPLIER, COND, EXPR)
 #define ELTM(NAME, MULTIPLIER, COND, EXPR) \
   if (COND) { static bool reported = false; \
-    if (!reported) { reported = true; fprintf(stdout, "%s:%d can't do %s %s\n", __FILE__,__LINE__,#NAME,#EXPR); } \
+    if (!reported && DIAG_VERBOSE_ON) { reported = true; fprintf(stdout, "%s:%d can't do %s %s\n", __FILE__,__LINE__,#NAME,#EXPR); } \
     result = false; \
   }
   SSE_TERMS
@@ -3085,18 +3395,13 @@ bool MRIScomputeSSE_canDo(MRIS_MP* usedOnlyForOverloadingResolution, INTEGRATION
 #undef ELTS
 
   return result;
-#endif
 }
 
 
 double MRIScomputeSSE(MRIS_MP* mris_mp, INTEGRATION_PARMS *parms)
 {
-#if 1
-  return 0.0;
-#else
   SurfaceFromMRIS_MP::XYZPositionConsequences::Surface surface(mris_mp);
-  return MRIScomputeSSE_template(surface,mris_mp,parms);    
-#endif
+  return MRIScomputeSSE_template(surface,mris_mp,parms);
 }
 
 #undef SSE_TERMS
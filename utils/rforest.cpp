@@ -37,6 +37,7 @@
 static double entropy(int *class_counts, int nclasses, int *Nc);
 static double rfFeatureInfoGain(
     RANDOM_FOREST *rf, TREE *tree, NODE *parent, NODE *left, NODE *right, int fno, int *ptotal_count);
+static int rfFreeCompiled(RANDOM_FOREST *rf);
 
 RANDOM_FOREST *RFalloc(int ntrees, int nfeatures, int nclasses, int max_depth, char **class_names, int nsteps)
 {
@@ -490,6 +491,19 @@ int RFtrain(RANDOM_FOREST *rf,
     }
   }
 
+  // check the classes before the trees share them
+  for (ii = 0; ii < ntraining; ii++) {
+    if (training_classes[ii] < 0 || training_classes[ii] >= rf->nclasses) {
+      ErrorPrintf(ERROR_BADPARM,
+                  "RFtrain: class at index %d = %d: out of bounds (%d)",
+                  ii,
+                  training_classes[ii],
+                  rf->nclasses);
+      training_classes[ii] = 0;
+    }
+  }
+
+  rfFreeCompiled(rf);
   nfeatures_per_tree = nint((double)rf->nfeatures * feature_fraction);
   ntraining_per_tree = nint((double)rf->ntraining * training_fraction);
   feature_permutation = compute_permutation(rf->nfeatures, NULL);
@@ -503,8 +517,9 @@ int RFtrain(RANDOM_FOREST *rf,
   index = 0;
   n = 0;
   ii = 0;
-  #pragma omp parallel for if_ROMP(experimental) firstprivate(tree, start_no, end_no, ii, index) \
-    shared(rf, nfeatures_per_tree, Gdiag, training_classes, training_data) schedule(static, 1)
+  // each tree only reads the shared training data, and the trees can take very different times
+  #pragma omp parallel for if_ROMP(assume_reproducible) firstprivate(tree, start_no, end_no, ii, index) \
+    shared(rf, nfeatures_per_tree, Gdiag, training_classes, training_data) schedule(dynamic, 1)
 #endif
   for (n = 0; n < rf->ntrees; n++)  // train each tree
   {
@@ -539,14 +554,6 @@ int RFtrain(RANDOM_FOREST *rf,
     end_no = MIN(rf->ntraining - 1, start_no + ntraining_per_tree - 1);
     for (ii = start_no; ii <= end_no; ii++) {
       index = training_permutation[ii];
-      if (training_classes[index] < 0 || training_classes[index] >= rf->nclasses) {
-        ErrorPrintf(ERROR_BADPARM,
-                    "RFtrain: class at index %d = %d: out of bounds (%d)",
-                    index,
-                    training_classes[index],
-                    rf->nclasses);
-        training_classes[index] = 0;
-      }
       tree->root.class_counts[training_classes[index]]++;
       tree->root.training_set[tree->root.total_counts] = index;
       tree->root.total_counts++;
@@ -592,6 +599,7 @@ int RFtrainTree(RANDOM_FOREST *rf, int tno, int *training_classes, double **trai
     }
   }
 
+  rfFreeCompiled(rf);
   tree = &rf->trees[tno];
 
   tree->feature_list = (int *)calloc(rf->nfeatures, sizeof(tree->feature_list[0]));
@@ -917,6 +925,16 @@ int RFcomputeOutOfBagCorrect(RANDOM_FOREST *rf, int *training_classes, double **
   return (correct);
 }
 
+// trees that only had one training class just bias labeling, so they are pruned from classification
+static int rfTreeUsedForClassification(RANDOM_FOREST *rf, TREE *tree)
+{
+  int c;
+
+  for (c = 0; c < rf->nclasses; c++)
+    if (tree->root.class_counts[c] == tree->root.total_counts) return (0);
+  return (1);
+}
+
 int RFclassify(RANDOM_FOREST *rf, double *feature, double *p_pval, int true_class)
 {
   int max_class = -1, n, c;
@@ -928,11 +946,7 @@ int RFclassify(RANDOM_FOREST *rf, double *feature, double *p_pval, int true_clas
   for (n = 0; n < rf->ntrees; n++) {
     tree = &rf->trees[n];
 
-    // now prune trees that only had one training class as they just bias labeling
-    for (c = 0; c < rf->nclasses; c++)
-      if (tree->root.class_counts[c] == tree->root.total_counts) break;
-    if (c < rf->nclasses)  // one class has all counts - prune this tree
-      continue;            // don't use this tree in classification
+    if (!rfTreeUsedForClassification(rf, tree)) continue;
     node = rfFindLeaf(rf, &tree->root, feature);
     for (c = 0; c < rf->nclasses; c++) class_counts[c] += node->class_counts[c];
 
@@ -991,6 +1005,176 @@ int RFclassify(RANDOM_FOREST *rf, double *feature, double *p_pval, int true_clas
   return (max_class);
 }
 
+static int rfCountNodes(NODE *node, int *pnleaves)
+{
+  if (node->left == NULL) {
+    (*pnleaves)++;
+    return (1);
+  }
+  return (1 + rfCountNodes(node->left, pnleaves) + rfCountNodes(node->right, pnleaves));
+}
+
+static int rfFreeCompiled(RANDOM_FOREST *rf)
+{
+  RF_COMPILED *crf = rf->compiled;
+
+  if (crf == NULL) return (NO_ERROR);
+  rf->compiled = NULL;
+  free(crf->tree_root);
+  free(crf->feature);
+  free(crf->thresh);
+  free(crf->child);
+  free(crf->leaf_counts);
+  free(crf);
+  return (NO_ERROR);
+}
+
+/*
+  build rf->compiled from the trees. The trees that RFclassify() skips are
+  left out, and every node keeps the double threshold so the compiled
+  form reaches the same leaves as rfFindLeaf().
+*/
+int RFcompile(RANDOM_FOREST *rf)
+{
+  RF_COMPILED *crf;
+  NODE **queue;
+  TREE *tree;
+  int n, head, tail, index, leaf, nnodes, max_nodes, nleaves;
+
+  rfFreeCompiled(rf);
+  crf = (RF_COMPILED *)calloc(1, sizeof(RF_COMPILED));
+  if (crf == NULL) ErrorExit(ERROR_NOMEMORY, "RFcompile: could not allocate compiled forest");
+  crf->ntrees = rf->ntrees;
+  crf->nclasses = rf->nclasses;
+  crf->tree_root = (int *)calloc(rf->ntrees, sizeof(crf->tree_root[0]));
+  if (crf->tree_root == NULL) ErrorExit(ERROR_NOMEMORY, "RFcompile: could not allocate %d tree roots", rf->ntrees);
+
+  for (max_nodes = n = 0; n < rf->ntrees; n++) {
+    tree = &rf->trees[n];
+    if (!rfTreeUsedForClassification(rf, tree)) continue;
+    nleaves = 0;
+    nnodes = rfCountNodes(&tree->root, &nleaves);
+    crf->nnodes += nnodes;
+    crf->nleaves += nleaves;
+    if (nnodes > max_nodes) max_nodes = nnodes;
+  }
+
+  crf->feature = (int *)calloc(crf->nnodes + 1, sizeof(crf->feature[0]));
+  crf->thresh = (double *)calloc(crf->nnodes + 1, sizeof(crf->thresh[0]));
+  crf->child = (int *)calloc(crf->nnodes + 1, sizeof(crf->child[0]));
+  crf->leaf_counts = (int *)calloc((size_t)(crf->nleaves + 1) * rf->nclasses, sizeof(crf->leaf_counts[0]));
+  queue = (NODE **)calloc(max_nodes + 1, sizeof(queue[0]));
+  if (crf->feature == NULL || crf->thresh == NULL || crf->child == NULL || crf->leaf_counts == NULL || queue == NULL)
+    ErrorExit(ERROR_NOMEMORY, "RFcompile: could not allocate %d nodes", crf->nnodes);
+
+  for (index = leaf = n = 0; n < rf->ntrees; n++) {
+    tree = &rf->trees[n];
+    if (!rfTreeUsedForClassification(rf, tree)) {
+      crf->tree_root[n] = -1;
+      continue;
+    }
+
+    // breadth first, so queue[head] is stored at index+head and children are appended in pairs
+    crf->tree_root[n] = index;
+    queue[0] = &tree->root;
+    for (tail = 1, head = 0; head < tail; head++) {
+      NODE *node = queue[head];
+      int i = index + head;
+
+      if (node->left == NULL) {
+        crf->feature[i] = -1;
+        crf->child[i] = leaf;
+        memmove(crf->leaf_counts + (size_t)leaf * rf->nclasses,
+                node->class_counts,
+                rf->nclasses * sizeof(crf->leaf_counts[0]));
+        leaf++;
+      }
+      else {
+        crf->feature[i] = node->feature;
+        crf->thresh[i] = node->thresh;
+        crf->child[i] = index + tail;
+        queue[tail++] = node->left;
+        queue[tail++] = node->right;
+      }
+    }
+    index += tail;
+  }
+
+  free(queue);
+  rf->compiled = crf;
+  return (NO_ERROR);
+}
+
+/*
+  classify nvectors feature vectors at once. classes[i] and pvals[i] (if
+  pvals is not NULL) get what RFclassify() returns and puts in *p_pval for
+  features[i], but rf->pvals is not touched. The vectors are processed in
+  blocks that walk one tree at a time so its nodes stay in cache, and the
+  blocks run in parallel.
+*/
+#define RF_BATCH_SIZE 64
+int RFclassifyBatch(RANDOM_FOREST *rf, double **features, int nvectors, int *classes, double *pvals)
+{
+  RF_COMPILED *crf;
+  int nblocks;
+
+  if (rf->nclasses > MAX_CLASSES)
+    ErrorReturn(ERROR_BADPARM,
+                (ERROR_BADPARM, "RFclassifyBatch: too many classes %d (max %d)", rf->nclasses, MAX_CLASSES));
+  if (rf->compiled == NULL || rf->compiled->nclasses != rf->nclasses) RFcompile(rf);
+  crf = rf->compiled;
+
+  nblocks = (nvectors + RF_BATCH_SIZE - 1) / RF_BATCH_SIZE;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 1)
+#endif
+  for (int b = 0; b < nblocks; b++) {
+    ROMP_PFLB_begin
+    double class_counts[RF_BATCH_SIZE][MAX_CLASSES];
+    int i, c, n, i0 = b * RF_BATCH_SIZE, i1 = MIN(nvectors, i0 + RF_BATCH_SIZE);
+
+    memset(class_counts, 0, sizeof(class_counts));
+    for (n = 0; n < crf->ntrees; n++) {
+      int const root = crf->tree_root[n];
+      if (root < 0) continue;
+      for (i = i0; i < i1; i++) {
+        double const *feature = features[i];
+        int node = root;
+        while (crf->feature[node] >= 0)
+          node = crf->child[node] + (feature[crf->feature[node]] < crf->thresh[node] ? 0 : 1);
+        int const *counts = crf->leaf_counts + (size_t)crf->child[node] * crf->nclasses;
+        for (c = 0; c < crf->nclasses; c++) class_counts[i - i0][c] += counts[c];
+      }
+    }
+
+    for (i = i0; i < i1; i++) {
+      double const *counts = class_counts[i - i0];
+      double total_count, max_count;
+      int max_class = -1;
+
+      for (total_count = c = 0; c < crf->nclasses; c++) total_count += counts[c];
+      if (pvals) pvals[i] = 0;
+      if (FZERO(total_count)) {
+        classes[i] = 0;
+        continue;
+      }
+      for (max_count = c = 0; c < crf->nclasses; c++) {
+        if (counts[c] > max_count) {
+          max_count = counts[c];
+          max_class = c;
+          if (pvals) pvals[i] = counts[c] / total_count;
+        }
+      }
+      classes[i] = max_class;
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (NO_ERROR);
+}
+
 RANDOM_FOREST *RFread(char *fname)
 {
   FILE *fp;
@@ -1057,6 +1241,7 @@ int RFsetNumberOfClasses(RANDOM_FOREST *rf, int nclasses)
   int *old_class_counts;
   TREE *tree;
 
+  rfFreeCompiled(rf);
   if (nclasses > rf->nclasses) {
     old_class_names = rf->class_names;
     rf->class_names = (char **)calloc(nclasses, sizeof(rf->class_names[0]));
@@ -1156,6 +1341,7 @@ int RFfree(RANDOM_FOREST **prf)
 
   *prf = NULL;
 
+  rfFreeCompiled(rf);
   for (t = 0; t < rf->ntrees; t++) {
     tree = &rf->trees[t];
     rfFreeNodes(tree->root.left);
@@ -1193,6 +1379,7 @@ int RFpruneTree(RANDOM_FOREST *rf, int min_training_samples)
   int t;
   TREE *tree;
 
+  rfFreeCompiled(rf);
   for (t = 0; t < rf->ntrees; t++) {
     tree = &rf->trees[t];
     rfPruneTree(&tree->root, min_training_samples);
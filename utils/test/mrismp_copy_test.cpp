@@ -0,0 +1,88 @@
+/**
+ * @brief checks that MRISMP_copy carries the vertex distances into a fresh and a reused copy
+ *
+ */
+/*
+ * Copyright © 2021 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mrisurf.h"
+#include "mrisurf_MRIS_MP.h"
+#include "icosahedron.h"
+
+const char *Progname = "mrismp_copy_test";
+
+
+static int checkDist(MRIS *mris, MRIS_MP *mp, const char *what)
+{
+  int fails = 0;
+  for (int vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX const * const v = &mris->vertices[vno];
+    if (v->ripflag || !v->dist) continue;
+    if (!mp->v_dist[vno]) {
+      fprintf(stderr, "%s: v_dist[%d] is NULL\n", what, vno);
+      fails++;
+      continue;
+    }
+    if (mp->v_dist_capacity[vno] < mp->v_VSize[vno]) {
+      fprintf(stderr, "%s: v_dist_capacity[%d] = %d < %d\n", what, vno, mp->v_dist_capacity[vno], mp->v_VSize[vno]);
+      fails++;
+    }
+    for (int n = 0; n < mp->v_VSize[vno]; n++) {
+      if (mp->v_dist[vno][n] != v->dist[n]) {
+        fprintf(stderr, "%s: v_dist[%d][%d] = %g, expected %g\n", what, vno, n, mp->v_dist[vno][n], v->dist[n]);
+        fails++;
+        break;
+      }
+    }
+  }
+  return fails;
+}
+
+
+int main(int argc, char *argv[])
+{
+  MRIS *mris = ic642_make_surface(0, 0);
+  if (!mris) {
+    fprintf(stderr, "could not make the icosahedron\n");
+    exit(1);
+  }
+  MRISsetNeighborhoodSizeAndDist(mris, 2);
+  MRIScomputeMetricProperties(mris);
+
+  MRIS_MP src, dst;
+  MRISMP_ctr(&src);
+  MRISMP_ctr(&dst);
+
+  MRISMP_load(&src, mris, true);
+
+  int fails = checkDist(mris, &src, "load");
+
+  MRISMP_copy(&dst, &src, false, false);        // dst has no dist storage yet
+  fails += checkDist(mris, &dst, "first copy");
+
+  MRISMP_copy(&dst, &src, false, false);        // dst reuses what the first copy made
+  fails += checkDist(mris, &dst, "second copy");
+
+  MRISMP_dtr(&dst);
+  MRISMP_dtr(&src);
+  MRISfree(&mris);
+
+  if (fails) {
+    fprintf(stderr, "%d failures\n", fails);
+    exit(1);
+  }
+  exit(0);
+}
@@ -12,3 +12,4 @@ test_command topology_test
 test_command tiff_write_image
 test_command sc_test
 test_command sse_mathfun_test
+test_command mrismp_copy_test